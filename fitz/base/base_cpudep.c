@@ -25,6 +25,8 @@ void fz_cpudetect(void)
 #ifndef WIN32
 #include <signal.h> /* signal/sigaction */
 #include <setjmp.h> /* sigsetjmp/siglongjmp */
+#else
+#include <excpt.h> /* EXCEPTION_EXECUTE_HANDLER */
 #endif
 
 /*
@@ -64,6 +66,14 @@ static void sse2(void)
 static void sse3(void)
 { __asm__ ("haddps %%xmm0, %%xmm0\n\t" : : : "%xmm0"); }
 */
+
+static void sse41(void)
+{ __asm__ ("pminud %xmm0, %xmm0\n\t"); }
+
+/* traps as well when the os does not save the ymm registers */
+static void avx2(void)
+{ __asm__ ("vpminud %ymm0, %ymm0, %ymm0\n\tvzeroupper\n\t"); }
+#define HAVE_AVX2TEST
 #else
 static void mmx(void)
 { __asm pand mm0, mm0; }
@@ -79,6 +89,22 @@ static void sse(void)
 
 static void sse2(void)
 { __asm andpd xmm0, xmm0; }
+
+/* the inline assembler of older compilers predates these */
+#if _MSC_VER >= 1700
+#include <immintrin.h>
+#define HAVE_AVX2TEST
+#else
+#include <smmintrin.h>
+#endif
+
+static void sse41(void)
+{ volatile __m128i x = _mm_setzero_si128(); x = _mm_min_epu32(x, x); }
+
+#ifdef HAVE_AVX2TEST
+static void avx2(void)
+{ volatile __m256i x = _mm256_setzero_si256(); x = _mm256_min_epu32(x, x); _mm256_zeroupper(); }
+#endif
 #endif
 
 
@@ -99,6 +125,10 @@ static const featuretest features[] = {
 	{ sse, HAVE_SSE, "sse" },
 	{ sse2, HAVE_SSE2, "sse2" },
 /*	{ sse3, HAVE_SSE3, "sse3" }, */
+	{ sse41, HAVE_SSE41, "sse41" },
+#ifdef HAVE_AVX2TEST
+	{ avx2, HAVE_AVX2, "avx2" },
+#endif
 #ifdef ARCH_X86_64
 	{ amd64, HAVE_AMD64, "amd64" }
 #endif
@@ -163,6 +193,7 @@ enabled(char *env, const char *ext)
 	return 0;
 }
 
+#ifdef DEBUG
 static void
 dumpflags(void)
 {
@@ -184,6 +215,7 @@ dumpflags(void)
 		fputs(" none", stdout);
 	fputc('\n', stdout);
 }
+#endif
 
 #ifndef WIN32
 
@@ -260,7 +292,9 @@ void fz_cpudetect(void)
 	__asm__ __volatile__ ("emms\n\t");
 #endif
 
+#ifdef DEBUG
 	dumpflags();
+#endif
 }
 
 /*
@@ -316,7 +350,9 @@ void fz_cpudetect(void)
 
 	fz_cpuflags = flags;
 
+#ifdef DEBUG
 	dumpflags();
+#endif
 }
 
 
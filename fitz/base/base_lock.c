@@ -0,0 +1,34 @@
+#include "fitz-base.h"
+
+static void nolock(fz_lockcontext *ctx, int lock)
+{
+}
+
+static fz_lockcontext deflock = { nolock, nolock };
+static fz_lockcontext *curlock = &deflock;
+
+fz_lockcontext *
+fz_currentlockcontext()
+{
+	return curlock;
+}
+
+void
+fz_setlockcontext(fz_lockcontext *ctx)
+{
+	curlock = ctx ? ctx : &deflock;
+}
+
+void
+fz_lock(int lock)
+{
+	assert(lock >= 0 && lock < FZ_LOCK_MAX);
+	curlock->lock(curlock, lock);
+}
+
+void
+fz_unlock(int lock)
+{
+	assert(lock >= 0 && lock < FZ_LOCK_MAX);
+	curlock->unlock(curlock, lock);
+}
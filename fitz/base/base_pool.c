@@ -0,0 +1,177 @@
+#include "fitz-base.h"
+
+/*
+ * Size class pools for small blocks whose size the caller knows when
+ * it frees them, like the dynamic objects. Blocks are carved from
+ * slabs allocated with fz_malloc, so a memory context still sees all
+ * the memory, but freed blocks are kept on free lists for reuse and
+ * slabs are never given back.
+ *
+ * Each thread keeps a short free list per class and trades blocks
+ * with the shared lists in batches, so the lock is rarely taken.
+ */
+
+#define POOLQUANTUM 16
+#define POOLCLASSES (FZ_POOLMAX / POOLQUANTUM)
+#define POOLSLAB (64 * 1024)
+#define POOLBATCH 64
+
+typedef struct fz_poolblock_s fz_poolblock;
+
+struct fz_poolblock_s
+{
+	fz_poolblock *next;
+};
+
+struct fz_poolcache_s
+{
+	fz_poolblock *head[POOLCLASSES];
+	int count[POOLCLASSES];
+};
+
+static FZ_THREADLOCAL struct fz_poolcache_s poolcache;
+
+static fz_poolblock *sharedhead[POOLCLASSES];
+static int sharedcount[POOLCLASSES];
+
+static inline int poolclass(int n)
+{
+	return (n + POOLQUANTUM - 1) / POOLQUANTUM - 1;
+}
+
+/* move up to count blocks from the shared list to this thread */
+static void
+takeshared(int c, int count)
+{
+	fz_poolblock *b;
+
+	fz_lock(FZ_LOCK_POOL);
+	while (count-- && sharedhead[c])
+	{
+		b = sharedhead[c];
+		sharedhead[c] = b->next;
+		sharedcount[c] --;
+		b->next = poolcache.head[c];
+		poolcache.head[c] = b;
+		poolcache.count[c] ++;
+	}
+	fz_unlock(FZ_LOCK_POOL);
+}
+
+/* move up to count blocks from this thread to the shared list */
+static void
+giveshared(int c, int count)
+{
+	fz_poolblock *b;
+
+	fz_lock(FZ_LOCK_POOL);
+	while (count-- && poolcache.head[c])
+	{
+		b = poolcache.head[c];
+		poolcache.head[c] = b->next;
+		poolcache.count[c] --;
+		b->next = sharedhead[c];
+		sharedhead[c] = b;
+		sharedcount[c] ++;
+	}
+	fz_unlock(FZ_LOCK_POOL);
+}
+
+static void
+newslab(int c)
+{
+	int size = (c + 1) * POOLQUANTUM;
+	char *slab;
+	int i;
+
+	slab = fz_malloc(POOLSLAB);
+	if (!slab)
+		return;
+
+	for (i = POOLSLAB / size - 1; i >= 0; i--)
+	{
+		fz_poolblock *b = (fz_poolblock *)(slab + i * size);
+		b->next = poolcache.head[c];
+		poolcache.head[c] = b;
+		poolcache.count[c] ++;
+	}
+}
+
+void *
+fz_poolalloc(int n)
+{
+	fz_poolblock *b;
+	int c;
+
+	if (n > FZ_POOLMAX)
+		return fz_malloc(n);
+
+	c = poolclass(n);
+
+	if (!poolcache.head[c])
+	{
+		if (sharedhead[c])
+			takeshared(c, POOLBATCH);
+		if (!poolcache.head[c])
+			newslab(c);
+		if (!poolcache.head[c])
+			return nil;
+	}
+
+	b = poolcache.head[c];
+	poolcache.head[c] = b->next;
+	poolcache.count[c] --;
+	return b;
+}
+
+void
+fz_poolfree(void *p, int n)
+{
+	fz_poolblock *b = p;
+	int c;
+
+	if (n > FZ_POOLMAX)
+	{
+		fz_free(p);
+		return;
+	}
+
+	c = poolclass(n);
+
+	b->next = poolcache.head[c];
+	poolcache.head[c] = b;
+	poolcache.count[c] ++;
+
+	if (poolcache.count[c] > 4 * POOLBATCH)
+		giveshared(c, 2 * POOLBATCH);
+}
+
+void *
+fz_poolrealloc(void *p, int oldn, int newn)
+{
+	void *np;
+
+	if (oldn > FZ_POOLMAX && newn > FZ_POOLMAX)
+		return fz_realloc(p, newn);
+
+	np = fz_poolalloc(newn);
+	if (!np)
+		return nil;
+	memcpy(np, p, MIN(oldn, newn));
+	fz_poolfree(p, oldn);
+	return np;
+}
+
+/*
+ * Give the blocks this thread holds to the shared lists.
+ * Call this before a thread that used dynamic objects exits.
+ */
+void
+fz_flushpool(void)
+{
+	int c;
+
+	for (c = 0; c < POOLCLASSES; c++)
+		if (poolcache.head[c])
+			giveshared(c, poolcache.count[c]);
+}
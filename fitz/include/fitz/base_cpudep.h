@@ -7,6 +7,8 @@
 #  define HAVE_SSE3       (1<<4)
 #  define HAVE_3DNOW      (1<<5)
 #  define HAVE_AMD64      (1<<6)
+#  define HAVE_SSE41      (1<<9)
+#  define HAVE_AVX2       (1<<10)
 
 #elif defined (ARCH_PPC)
 #  define HAVE_CPUDEP
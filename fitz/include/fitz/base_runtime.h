@@ -95,3 +95,44 @@ void fz_free(void *p);
 
 char *fz_strdup(char *s);
 
+/* pooled small blocks, see base_pool.c */
+#define FZ_POOLMAX 256
+
+void *fz_poolalloc(int n);
+void *fz_poolrealloc(void *p, int oldn, int newn);
+void fz_poolfree(void *p, int n);
+void fz_flushpool(void);
+
+/*
+ * Locking hooks for sharing process-wide state between threads.
+ * Fitz does no locking of its own; an application that runs several
+ * documents on several threads installs a lock context before it
+ * starts them. The default context does nothing.
+ */
+
+typedef struct fz_lockcontext_s fz_lockcontext;
+
+#define FZ_GLYPHSHARDS 8
+
+enum
+{
+	FZ_LOCK_FREETYPE,	/* the FT_Library and face creation/destruction */
+	FZ_LOCK_ATOMS,	/* setting up the well-known name table */
+	FZ_LOCK_POOL,	/* the shared free lists of the block pools */
+	FZ_LOCK_GLYPHCACHE,	/* glyph cache references and font serial numbers */
+	FZ_LOCK_GLYPHSHARD,	/* first of FZ_GLYPHSHARDS, one per glyph cache shard */
+	FZ_LOCK_MAX = FZ_LOCK_GLYPHSHARD + FZ_GLYPHSHARDS
+};
+
+struct fz_lockcontext_s
+{
+	void (*lock)(fz_lockcontext *, int lock);
+	void (*unlock)(fz_lockcontext *, int lock);
+};
+
+fz_lockcontext *fz_currentlockcontext(void);
+void fz_setlockcontext(fz_lockcontext *lockcontext);
+
+void fz_lock(int lock);
+void fz_unlock(int lock);
+
@@ -58,6 +58,7 @@ extern char *optarg;
 extern int gettimeofday(struct timeval *tv, struct timezone *tz);
 
 #define FZ_FLEX 1
+#define FZ_THREADLOCAL __declspec(thread)
 #define restrict
 
 #ifdef _MSC_VER
@@ -90,6 +91,7 @@ extern int gettimeofday(struct timeval *tv, struct timezone *tz);
 
 #include <unistd.h>
 #define FZ_FLEX
+#define FZ_THREADLOCAL __thread
 
 #endif
 
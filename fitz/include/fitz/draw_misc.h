@@ -17,25 +17,33 @@ extern void (*fz_duff_non)(FZ_BYTE*,int,int,FZ_BYTE*,int,int,int);
 extern void (*fz_duff_nimcn)(FZ_BYTE*,int,int,FZ_BYTE*,int,int,FZ_BYTE*,int,int,int);
 extern void (*fz_duff_nimon)(FZ_BYTE*,int,int,FZ_BYTE*,int,int,FZ_BYTE*,int,int,int);
 extern void (*fz_duff_1o1)(FZ_BYTE*,int,FZ_BYTE*,int,int,int);
+extern void (*fz_duff_2o2)(FZ_BYTE*,int,FZ_BYTE*,int,int,int);
 extern void (*fz_duff_4o4)(FZ_BYTE*,int,FZ_BYTE*,int,int,int);
 extern void (*fz_duff_1i1c1)(FZ_BYTE*,int,FZ_BYTE*,int,FZ_BYTE*,int,int,int);
+extern void (*fz_duff_2i1c2)(FZ_BYTE*,int,FZ_BYTE*,int,FZ_BYTE*,int,int,int);
 extern void (*fz_duff_4i1c4)(FZ_BYTE*,int,FZ_BYTE*,int,FZ_BYTE*,int,int,int);
 extern void (*fz_duff_1i1o1)(FZ_BYTE*,int,FZ_BYTE*,int,FZ_BYTE*,int,int,int);
+extern void (*fz_duff_2i1o2)(FZ_BYTE*,int,FZ_BYTE*,int,FZ_BYTE*,int,int,int);
 extern void (*fz_duff_4i1o4)(FZ_BYTE*,int,FZ_BYTE*,int,FZ_BYTE*,int,int,int);
 
 extern void (*fz_path_1c1)(FZ_BYTE*,unsigned char,int,FZ_BYTE*);
 extern void (*fz_path_1o1)(FZ_BYTE*,unsigned char,int,FZ_BYTE*);
+extern void (*fz_path_w2i1o2)(FZ_BYTE*,FZ_BYTE*,unsigned char,int,FZ_BYTE*);
 extern void (*fz_path_w4i1o4)(FZ_BYTE*,FZ_BYTE*,unsigned char,int,FZ_BYTE*);
 
 extern void (*fz_text_1c1)(FZ_BYTE*,int,FZ_BYTE*,int,int,int);
 extern void (*fz_text_1o1)(FZ_BYTE*,int,FZ_BYTE*,int,int,int);
+extern void (*fz_text_w2i1o2)(FZ_BYTE*,FZ_BYTE*,int,FZ_BYTE*,int,int,int);
 extern void (*fz_text_w4i1o4)(FZ_BYTE*,FZ_BYTE*,int,FZ_BYTE*,int,int,int);
 
 extern void (*fz_img_ncn)(FZ_PSRC, int sn, FZ_PDST, FZ_PCTM);
 extern void (*fz_img_1c1)(FZ_PSRC, FZ_PDST, FZ_PCTM);
+extern void (*fz_img_2c2)(FZ_PSRC, FZ_PDST, FZ_PCTM);
 extern void (*fz_img_4c4)(FZ_PSRC, FZ_PDST, FZ_PCTM);
 extern void (*fz_img_1o1)(FZ_PSRC, FZ_PDST, FZ_PCTM);
+extern void (*fz_img_2o2)(FZ_PSRC, FZ_PDST, FZ_PCTM);
 extern void (*fz_img_4o4)(FZ_PSRC, FZ_PDST, FZ_PCTM);
+extern void (*fz_img_w2i1o2)(FZ_BYTE*,FZ_PSRC,FZ_PDST,FZ_PCTM);
 extern void (*fz_img_w4i1o4)(FZ_BYTE*,FZ_PSRC,FZ_PDST,FZ_PCTM);
 
 extern void (*fz_decodetile)(fz_pixmap *pix, int skip, float *decode);
@@ -69,13 +77,14 @@ struct fz_renderer_s
 	fz_irect clip;
 	fz_pixmap *dest;
 	fz_pixmap *over;
-	unsigned char argb[7]; /* alpha, a*r, a*g, a*b, r, g, b */
+	unsigned char argb[7]; /* alpha, a*r, a*g, a*b, r, g, b; or alpha, a*k, -, -, k */
 	int flag;
 };
 
 extern void fz_accelerate();
 
 fz_error *fz_newrenderer(fz_renderer **gcp, fz_colorspace *pcm, int maskonly, int gcmem);
+fz_error *fz_newrendererwithcache(fz_renderer **gcp, fz_colorspace *pcm, int maskonly, fz_glyphcache *cache);
 void fz_droprenderer(fz_renderer *gc);
 fz_error *fz_rendertree(fz_pixmap **out, fz_renderer *gc, fz_tree *tree, fz_matrix ctm, fz_irect bbox, int white);
 fz_error *fz_rendertreeover(fz_renderer *gc, fz_pixmap *dest, fz_tree *tree, fz_matrix ctm);
@@ -4,10 +4,11 @@ typedef struct fz_ael_s fz_ael;
 
 struct fz_edge_s
 {
-	int x, e, h, y;
-	int adjup, adjdown;
-	int xmove;
-	int xdir, ydir;     /* -1 or +1 */
+	int x0, y0, x1, y1; /* 24.8 fixed point, top to bottom */
+	int dir;            /* -1 or +1 */
+	double dxdy;
+	int x;              /* where the edge enters the current row */
+	int lo, hi;         /* cells it touches in the current row */
 };
 
 struct fz_gel_s
@@ -13,6 +13,9 @@
  *
  * A buffer owns the memory it has allocated, unless ownsdata is false,
  * in which case the creator of the buffer owns it.
+ *
+ * A buffer that borrows the memory of a mapped file stream holds a
+ * reference to that stream in pin, so the mapping outlives the buffer.
  */
 
 typedef struct fz_buffer_s fz_buffer;
@@ -28,6 +31,7 @@ struct fz_buffer_s
 	unsigned char *wp;
 	unsigned char *ep;
 	int eof;
+	struct fz_stream_s *pin;
 };
 
 fz_error *fz_newbuffer(fz_buffer **bufp, int size);
@@ -40,7 +40,10 @@ struct fz_obj_s
 			unsigned short len;
 			char buf[1];
 		} s;
-		char n[1];
+		struct {
+			char *s;	/* buf, or a well-known atom */
+			char buf[1];
+		} n;
 		struct {
 			int len;
 			int cap;
@@ -105,6 +108,7 @@ int fz_togen(fz_obj *obj);
 void *fz_topointer(fz_obj *obj);
 
 fz_error *fz_newnamefromstring(fz_obj **op, fz_obj *str);
+char *fz_findatom(char *s);
 
 int fz_arraylen(fz_obj *array);
 fz_obj *fz_arrayget(fz_obj *array, int i);
@@ -5,7 +5,7 @@
 
 typedef struct fz_stream_s fz_stream;
 
-enum { FZ_SFILE, FZ_SBUFFER, FZ_SFILTER };
+enum { FZ_SFILE, FZ_SBUFFER, FZ_SFILTER, FZ_SMMAP };
 enum { FZ_SREAD, FZ_SWRITE };
 
 struct fz_stream_s
@@ -19,6 +19,7 @@ struct fz_stream_s
 	fz_stream *chain;
 	fz_error *error; /* delayed error from readbyte and peekbyte */
 	int file;
+	void *mapping; /* platform handle of an FZ_SMMAP view */
 };
 
 /*
@@ -30,9 +31,14 @@ fz_error *fz_openrfile(fz_stream **stmp, char *filename);
 fz_error *fz_openwfile(fz_stream **stmp, char *filename);
 fz_error *fz_openafile(fz_stream **stmp, char *filename);
 
+/* map the whole file and read straight out of the mapping; falls
+   back to an ordinary file stream if the file cannot be mapped */
+fz_error *fz_openrfilemmap(fz_stream **stmp, char *filename);
+
 #ifdef WIN32_UNICODE_HACK
 #include <wchar.h>
 fz_error * fz_openrfilew(fz_stream **stmp, const wchar_t *path);
+fz_error * fz_openrfilemmapw(fz_stream **stmp, const wchar_t *path);
 #endif
 
 /* write to memory buffers! */
@@ -65,6 +71,7 @@ fz_error * fz_readimp(fz_stream *stm);
 fz_error * fz_read(int *np, fz_stream *stm, unsigned char *buf, int len);
 fz_error * fz_readall(fz_buffer **bufp, fz_stream *stm, int sizehint);
 fz_error * fz_readline(fz_stream *stm, char *buf, int max);
+fz_error * fz_readslice(fz_buffer **bufp, fz_stream *stm, int len);
 
 /*
  * Error handling when reading with readbyte/peekbyte is non-standard.
@@ -3,6 +3,7 @@ typedef struct fz_hmtx_s fz_hmtx;
 typedef struct fz_vmtx_s fz_vmtx;
 typedef struct fz_glyph_s fz_glyph;
 typedef struct fz_glyphcache_s fz_glyphcache;
+typedef struct fz_glyphcachestats_s fz_glyphcachestats;
 
 struct fz_hmtx_s
 {
@@ -25,6 +26,10 @@ struct fz_font_s
 	int refs;
 	char name[32];
 
+	/* identifies the glyph shapes to the glyph cache: a serial
+	   number unless the loader sets a digest of the font program */
+	unsigned char id[16];
+
 	fz_error* (*render)(fz_glyph*, fz_font*, int, fz_matrix);
 	void (*drop)(fz_font *);
 
@@ -44,6 +49,7 @@ struct fz_glyph_s
 {
 	int x, y, w, h;
 	unsigned char *samples;
+	void *pin;	/* cache entry held until fz_releaseglyph */
 };
 
 void fz_initfont(fz_font *font, char *name);
@@ -61,8 +67,28 @@ fz_error *fz_endvmtx(fz_font *font);
 fz_hmtx fz_gethmtx(fz_font *font, int cid);
 fz_vmtx fz_getvmtx(fz_font *font, int cid);
 
+struct fz_glyphcachestats_s
+{
+	int hits, misses, evictions;
+	int count;	/* glyphs in the cache */
+	int used, size;	/* bytes of samples and the limit */
+};
+
+/*
+ * A glyph cache can be shared by renderers on several threads. It is
+ * split into FZ_GLYPHSHARDS shards with a lock each, and size is the
+ * limit in bytes for the samples of the cached glyphs of all shards.
+ * Glyphs up to a sixth of size are cached; one larger than the share of
+ * its shard has the shard to itself, which can take the total up to a
+ * third over size.
+ * The samples of a glyph from fz_renderglyph stay valid until it is
+ * passed to fz_releaseglyph.
+ */
 fz_error *fz_newglyphcache(fz_glyphcache **arenap, int slots, int size);
+fz_glyphcache *fz_keepglyphcache(fz_glyphcache *);
 fz_error *fz_renderglyph(fz_glyphcache*, fz_glyph*, fz_font*, int, fz_matrix);
+void fz_releaseglyph(fz_glyphcache *, fz_glyph *);
+void fz_getglyphcachestats(fz_glyphcache *, fz_glyphcachestats *);
 void fz_debugglyphcache(fz_glyphcache *);
 void fz_dropglyphcache(fz_glyphcache *);
 
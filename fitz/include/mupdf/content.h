@@ -5,6 +5,10 @@
 typedef struct pdf_material_s pdf_material;
 typedef struct pdf_gstate_s pdf_gstate;
 typedef struct pdf_csi_s pdf_csi;
+typedef struct pdf_measure_s pdf_measure;
+typedef struct pdf_measureitem_s pdf_measureitem;
+typedef struct pdf_measureop_s pdf_measureop;
+typedef struct pdf_imageuse_s pdf_imageuse;
 
 enum
 {
@@ -61,6 +65,69 @@ struct pdf_gstate_s
 
 	/* tree construction state */
 	fz_node *head;
+
+	/* measure state, the tree holds these otherwise */
+	fz_matrix ctm;
+	fz_rect clip;
+};
+
+/*
+ * In measure mode the interpreter builds no display tree.
+ * It only tracks the transform and clip of the graphics state
+ * and records the bounding box of every path, text run, image
+ * and shading it would have drawn, in page space.
+ */
+
+struct pdf_measureitem_s
+{
+	fz_nodekind kind;		/* FZ_NPATH, FZ_NTEXT, FZ_NIMAGE or FZ_NSHADE */
+	fz_rect bbox;
+};
+
+/*
+ * With recordops set the painting operators of the page contents
+ * are recorded too, with the byte range they take up in the contents
+ * so that they can be cut out again. Path painting ranges start at
+ * the first path construction operator. Operators run by forms have
+ * no range, only their xobject name.
+ */
+
+struct pdf_measureop_s
+{
+	int start, end;			/* byte range in the contents, -1 if not top level */
+	fz_rect bbox;			/* everything visible, clipped */
+	fz_obj *name;			/* xobject name for Do */
+};
+
+/*
+ * Every image xobject drawn on the page, with the transform that
+ * maps its unit square onto the page.
+ */
+
+struct pdf_imageuse_s
+{
+	fz_obj *ref;
+	fz_matrix ctm;
+	fz_rect bbox;
+};
+
+struct pdf_measure_s
+{
+	fz_rect mediabox;
+	int rotate;
+	fz_rect bbox;			/* everything visible, clipped */
+	int len;
+	int cap;
+	pdf_measureitem *items;
+
+	int recordops;
+	int oplen;
+	int opcap;
+	pdf_measureop *ops;
+
+	int imagelen;
+	int imagecap;
+	pdf_imageuse *images;
 };
 
 struct pdf_csi_s
@@ -83,8 +150,18 @@ struct pdf_csi_s
 	fz_matrix tlm;
 	fz_matrix tm;
 	int textmode;
+	fz_rect textbbox;
+	fz_rect textclipbbox;
 
 	fz_tree *tree;
+	pdf_measure *measure;
+
+	/* painting operator recording */
+	int depth;
+	int opstart;
+	int pathstart;
+	int pathclip;
+	fz_rect opbbox;
 };
 
 /* build.c */
@@ -106,8 +183,15 @@ fz_error *pdf_showtext(pdf_csi*, fz_obj *text);
 fz_error *pdf_flushtext(pdf_csi*);
 fz_error *pdf_showimage(pdf_csi*, pdf_image *img);
 
+fz_error *pdf_newmeasure(pdf_measure **measurep);
+void pdf_dropmeasure(pdf_measure *measure);
+fz_error *pdf_measureshape(pdf_csi *csi, fz_nodekind kind, fz_rect bbox, int visible);
+fz_error *pdf_recordimage(pdf_csi *csi, fz_obj *ref, fz_rect bbox);
+fz_error *pdf_recordop(pdf_csi *csi, int start, int end, fz_obj *name);
+
 /* interpret.c */
 fz_error *pdf_newcsi(pdf_csi **csip, int maskonly);
+fz_error *pdf_newmeasurecsi(pdf_csi **csip, pdf_measure *measure);
 fz_error *pdf_runcsi(pdf_csi *, pdf_xref *xref, fz_obj *rdb, fz_stream *);
 void pdf_dropcsi(pdf_csi *csi);
 
@@ -13,6 +13,10 @@ struct pdf_pagetree_s
 	int cursor;
 	fz_obj **pref;
 	fz_obj **pobj;
+	pdf_xref *xref;		/* set while pages are loaded on demand */
+	fz_obj *root;
+	fz_obj *rootref;
+	fz_hashtable *nodes;	/* kid counts of the nodes looked through */
 };
 
 struct pdf_page_s
@@ -40,6 +44,7 @@ struct pdf_textline_s
 
 /* pagetree.c */
 fz_error *pdf_loadpagetree(pdf_pagetree **pp, pdf_xref *xref);
+fz_error *pdf_loadpagetreelazy(pdf_pagetree **pp, pdf_xref *xref);
 int pdf_getpagecount(pdf_pagetree *pages);
 fz_obj *pdf_getpageobject(pdf_pagetree *pages, int p);
 void pdf_debugpagetree(pdf_pagetree *pages);
@@ -47,6 +52,10 @@ void pdf_droppagetree(pdf_pagetree *pages);
 
 /* page.c */
 fz_error *pdf_loadpage(pdf_page **pagep, pdf_xref *xref, fz_obj *ref);
+fz_error *pdf_measurepage(pdf_measure **measurep, pdf_xref *xref, fz_obj *ref);
+fz_error *pdf_measurepageops(pdf_measure **measurep, fz_buffer **contentsp, pdf_xref *xref, fz_obj *ref);
+fz_error *pdf_prunecontents(fz_buffer **bufp, fz_buffer *contents, pdf_measure *measure, fz_rect rect);
+fz_error *pdf_pruneresources(fz_obj **rdbp, pdf_xref *xref, fz_obj *rdb, pdf_measure *measure, fz_rect rect);
 void pdf_droppage(pdf_page *page);
 
 /* unicode.c */
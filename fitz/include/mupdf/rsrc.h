@@ -25,6 +25,7 @@ void *pdf_finditem(pdf_store *store, pdf_itemkind tag, fz_obj *key);
 fz_error *pdf_removeitem(pdf_store *store, pdf_itemkind tag, fz_obj *key);
 
 fz_error *pdf_loadresources(fz_obj **rdb, pdf_xref *xref, fz_obj *orig);
+fz_error *pdf_loadmeasureresources(fz_obj **rdb, pdf_xref *xref, fz_obj *orig);
 
 /*
  * Functions
@@ -141,6 +142,8 @@ struct pdf_image_s
 fz_error *pdf_loadinlineimage(pdf_image **imgp, pdf_xref *xref, fz_obj *rdb, fz_obj *dict, fz_stream *file);
 fz_error *pdf_loadimage(pdf_image **imgp, pdf_xref *xref, fz_obj *obj, fz_obj *ref);
 fz_error *pdf_loadtile(fz_image *image, fz_pixmap *tile);
+fz_error *pdf_downsampleimage(fz_buffer **bufp, int *wp, int *hp, pdf_image *img, int xdenom, int ydenom, int dct);
+fz_error *pdf_replaceimage(pdf_xref *xref, int oid, int gen, fz_buffer *buf, int w, int h, int dct);
 
 /*
  * CMap
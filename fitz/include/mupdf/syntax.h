@@ -18,6 +18,8 @@ typedef enum pdf_token_e
 
 /* lex.c */
 fz_error *pdf_lex(pdf_token_e *tok, fz_stream *f, char *buf, int n, int *len);
+int pdf_atoi(char *s);
+float pdf_atof(char *s);
 
 /* parse.c */
 fz_error *pdf_parsearray(fz_obj **op, fz_stream *f, char *buf, int cap);
@@ -4,6 +4,45 @@
 
 typedef struct pdf_xrefentry_s pdf_xrefentry;
 typedef struct pdf_xref_s pdf_xref;
+typedef struct pdf_objcache_s pdf_objcache;
+typedef struct pdf_objstm_s pdf_objstm;
+
+/*
+ * Objects parsed from the file stay in xref->table until they are
+ * flushed. With a limit set, pdf_trimcache drops clean objects that
+ * nobody else holds, oldest use first (CLOCK), until the estimated
+ * size fits. Changed objects, objects with streams in memory and
+ * pinned objects are kept.
+ */
+struct pdf_objcache_s
+{
+	int limit;		/* bytes of clean objects to keep, 0 for no limit */
+	int size;		/* estimated bytes held by counted objects */
+	int hand;		/* clock hand */
+	int cap;
+	unsigned char *flags;	/* per object: used since last sweep, pinned */
+	int *bytes;		/* per object: estimated size, 0 if not counted */
+	int hits;
+	int misses;
+	int evictions;
+};
+
+/*
+ * Decoded object streams, most recently used first. An object that
+ * lives in an /ObjStm is parsed straight from the decoded buffer at
+ * its recorded offset, so loading (or reloading after eviction) one
+ * object does not inflate and re-lex the whole stream.
+ */
+#define PDF_OBJSTMCACHE 4
+
+struct pdf_objstm_s
+{
+	int oid;
+	int count;
+	int *oids;		/* object number of each entry */
+	int *ofs;		/* offset of each entry in buf */
+	fz_buffer *buf;		/* decoded stream data */
+};
 
 struct pdf_xref_s
 {
@@ -24,6 +63,9 @@ struct pdf_xref_s
 	struct pdf_store_s *store;
 	struct pdf_pagetree_s *pages;
 	struct pdf_outline_s *outlines;
+
+	pdf_objcache cache;
+	pdf_objstm *objstms[PDF_OBJSTMCACHE];
 };
 
 struct pdf_xrefentry_s
@@ -34,6 +76,8 @@ struct pdf_xrefentry_s
 	char mark;				/* for garbage collection etc */
 	fz_buffer *stmbuf;		/* in-memory stream */
 	int stmofs;				/* on-disk stream */
+	pdf_xref *stmxref;		/* stream linked from another xref */
+	int stmoid, stmgen;		/* object of the linked stream */
 	fz_obj *obj;			/* stored/cached object */
 };
 
@@ -51,6 +95,17 @@ fz_error *pdf_openpdf(pdf_xref **, char *filename);
 fz_error *pdf_updatexref(pdf_xref *, char *filename);
 fz_error *pdf_savexref(pdf_xref *, char *filename, pdf_crypt *encrypt);
 
+typedef struct pdf_writer_s pdf_writer;
+
+fz_error *pdf_openwriter(pdf_writer **writerp, pdf_xref *xref, char *filename, pdf_crypt *encrypt, int compress);
+fz_error *pdf_writeobject(pdf_writer *writer, int oid, int gen);
+fz_error *pdf_closewriter(pdf_writer *writer);
+
+int pdf_isrecompressible(pdf_xref *xref, int oid, int gen);
+fz_error *pdf_encodebuffer(fz_buffer **bufp, fz_filter *filter, unsigned char *data, int len);
+fz_error *pdf_deflatebuffer(fz_buffer **bufp, unsigned char *data, int len);
+fz_error *pdf_replacestream(pdf_xref *xref, int oid, int gen, fz_buffer *buf);
+
 void pdf_debugxref(pdf_xref *);
 void pdf_flushxref(pdf_xref *, int force);
 void pdf_closexref(pdf_xref *);
@@ -59,8 +114,12 @@ fz_error *pdf_allocobject(pdf_xref *, int *oidp, int *genp);
 fz_error *pdf_deleteobject(pdf_xref *, int oid, int gen);
 fz_error *pdf_updateobject(pdf_xref *, int oid, int gen, fz_obj *obj);
 fz_error *pdf_updatestream(pdf_xref *, int oid, int gen, fz_buffer *stm);
+fz_error *pdf_linkstream(pdf_xref *, int oid, int gen, pdf_xref *src, int srcoid, int srcgen);
 
 fz_error *pdf_cacheobject(pdf_xref *, int oid, int gen);
+void pdf_setcachelimit(pdf_xref *, int bytes);
+void pdf_pinobject(pdf_xref *, int oid);
+void pdf_trimcache(pdf_xref *);
 fz_error *pdf_loadobject(fz_obj **objp, pdf_xref *, int oid, int gen);
 fz_error *pdf_loadindirect(fz_obj **objp, pdf_xref *, fz_obj *ref);
 fz_error *pdf_resolve(fz_obj **reforobj, pdf_xref *);
@@ -75,7 +134,15 @@ fz_error *pdf_openstream(fz_stream **stmp, pdf_xref *, int oid, int gen);
 fz_error *pdf_garbagecollect(pdf_xref *xref);
 fz_error *pdf_transplant(pdf_xref *dst, pdf_xref *src, fz_obj **newp, fz_obj *old);
 
+typedef struct pdf_remap_s pdf_remap;
+
+fz_error *pdf_newremap(pdf_remap **mapp, int linkstreams);
+void pdf_dropremap(pdf_remap *map);
+fz_error *pdf_transplantmap(pdf_xref *dst, pdf_xref *src, pdf_remap *map, fz_obj **newp, fz_obj *old);
+
 /* private */
-fz_error *pdf_loadobjstm(pdf_xref *xref, int oid, int gen, char *buf, int cap);
+fz_error *pdf_loadobjstm(pdf_xref *xref, int oid, char *buf, int cap);
+void pdf_dropobjstms(pdf_xref *xref);
+void pdf_countobject(pdf_xref *xref, int oid);
 fz_error *pdf_decryptxref(pdf_xref *xref);
 
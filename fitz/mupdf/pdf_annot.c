@@ -37,22 +37,45 @@ pdf_droplink(pdf_link *link)
 	fz_free(link);
 }
 
+/*
+ * The name trees are only read the first time a named
+ * destination is looked up.
+ */
+static fz_obj *
+lookupdest(pdf_xref *xref, fz_obj *name)
+{
+	fz_error *error;
+	fz_obj *dest;
+
+	if (!xref->dests)
+	{
+		error = pdf_loadnametrees(xref);
+		if (error)
+		{
+			fz_printerror(error);
+			fz_droperror(error);
+			return nil;
+		}
+	}
+
+	dest = fz_dictget(xref->dests, name);
+	if (dest)
+		pdf_resolve(&dest, xref); /* XXX */
+	return dest;
+}
+
 fz_obj *
 resolvedest(pdf_xref *xref, fz_obj *dest)
 {
 	if (fz_isname(dest))
 	{
-		dest = fz_dictget(xref->dests, dest);
-		if (dest)
-			pdf_resolve(&dest, xref); /* XXX */
+		dest = lookupdest(xref, dest);
 		return resolvedest(xref, dest);
 	}
 
 	else if (fz_isstring(dest))
 	{
-		dest = fz_dictget(xref->dests, dest);
-		if (dest)
-			pdf_resolve(&dest, xref); /* XXX */
+		dest = lookupdest(xref, dest);
 		return resolvedest(xref, dest);
 	}
 
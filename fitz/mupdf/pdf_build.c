@@ -40,6 +40,153 @@ pdf_initgstate(pdf_gstate *gs)
 	gs->rise = 0;
 
 	gs->head = nil;
+
+	gs->ctm = fz_identity();
+	gs->clip = fz_infiniterect;
+}
+
+/*
+ * Measure mode
+ */
+
+fz_error *
+pdf_newmeasure(pdf_measure **measurep)
+{
+	pdf_measure *measure;
+
+	measure = *measurep = fz_malloc(sizeof(pdf_measure));
+	if (!measure)
+		return fz_throw("outofmem: measure struct");
+
+	measure->mediabox = fz_emptyrect;
+	measure->rotate = 0;
+	measure->bbox = fz_emptyrect;
+	measure->len = 0;
+	measure->cap = 0;
+	measure->items = nil;
+
+	measure->recordops = 0;
+	measure->oplen = 0;
+	measure->opcap = 0;
+	measure->ops = nil;
+
+	measure->imagelen = 0;
+	measure->imagecap = 0;
+	measure->images = nil;
+
+	return fz_okay;
+}
+
+void
+pdf_dropmeasure(pdf_measure *measure)
+{
+	int i;
+	for (i = 0; i < measure->oplen; i++)
+		if (measure->ops[i].name)
+			fz_dropobj(measure->ops[i].name);
+	fz_free(measure->ops);
+	for (i = 0; i < measure->imagelen; i++)
+		fz_dropobj(measure->images[i].ref);
+	fz_free(measure->images);
+	fz_free(measure->items);
+	fz_free(measure);
+}
+
+/*
+ * Record a shape the way its leaf node would have been bound in the tree.
+ * The item keeps the unclipped box, the page box only gets the clipped
+ * part. Clip shapes and invisible text are recorded but are not visible.
+ */
+fz_error *
+pdf_measureshape(pdf_csi *csi, fz_nodekind kind, fz_rect bbox, int visible)
+{
+	pdf_gstate *gs = csi->gstate + csi->gtop;
+	pdf_measure *measure = csi->measure;
+	pdf_measureitem *newitems;
+	int newcap;
+
+	if (fz_isemptyrect(bbox))
+		return fz_okay;
+
+	if (measure->len + 1 > measure->cap)
+	{
+		newcap = measure->cap + 256;
+		newitems = fz_realloc(measure->items, sizeof(pdf_measureitem) * newcap);
+		if (!newitems)
+			return fz_throw("outofmem: measure items");
+		measure->cap = newcap;
+		measure->items = newitems;
+	}
+
+	measure->items[measure->len].kind = kind;
+	measure->items[measure->len].bbox = bbox;
+	measure->len ++;
+
+	if (visible)
+	{
+		bbox = fz_intersectrects(bbox, gs->clip);
+		measure->bbox = fz_mergerects(measure->bbox, bbox);
+		csi->opbbox = fz_mergerects(csi->opbbox, bbox);
+	}
+
+	return fz_okay;
+}
+
+/*
+ * Record where an image xobject was drawn.
+ */
+fz_error *
+pdf_recordimage(pdf_csi *csi, fz_obj *ref, fz_rect bbox)
+{
+	pdf_measure *measure = csi->measure;
+	pdf_imageuse *newimages;
+	int newcap;
+
+	if (measure->imagelen + 1 > measure->imagecap)
+	{
+		newcap = measure->imagecap + 32;
+		newimages = fz_realloc(measure->images, sizeof(pdf_imageuse) * newcap);
+		if (!newimages)
+			return fz_throw("outofmem: measure images");
+		measure->imagecap = newcap;
+		measure->images = newimages;
+	}
+
+	measure->images[measure->imagelen].ref = fz_keepobj(ref);
+	measure->images[measure->imagelen].ctm = csi->gstate[csi->gtop].ctm;
+	measure->images[measure->imagelen].bbox = bbox;
+	measure->imagelen ++;
+
+	return fz_okay;
+}
+
+/*
+ * Record a painting operator with what it painted since the last one.
+ */
+fz_error *
+pdf_recordop(pdf_csi *csi, int start, int end, fz_obj *name)
+{
+	pdf_measure *measure = csi->measure;
+	pdf_measureop *newops;
+	int newcap;
+
+	if (measure->oplen + 1 > measure->opcap)
+	{
+		newcap = measure->opcap + 256;
+		newops = fz_realloc(measure->ops, sizeof(pdf_measureop) * newcap);
+		if (!newops)
+			return fz_throw("outofmem: measure ops");
+		measure->opcap = newcap;
+		measure->ops = newops;
+	}
+
+	measure->ops[measure->oplen].start = start;
+	measure->ops[measure->oplen].end = end;
+	measure->ops[measure->oplen].bbox = csi->opbbox;
+	measure->ops[measure->oplen].name = name ? fz_keepobj(name) : nil;
+	measure->oplen ++;
+
+	return fz_okay;
 }
 
 fz_error *
@@ -612,6 +759,20 @@ pdf_showimage(pdf_csi *csi, pdf_image *img)
 	fz_node *color;
 	fz_node *shape;
 
+	if (csi->measure)
+	{
+		fz_rect bbox;
+		bbox.x0 = 0;
+		bbox.y0 = 0;
+		bbox.x1 = 1;
+		bbox.y1 = 1;
+		bbox = fz_transformaabb(csi->gstate[csi->gtop].ctm, bbox);
+		error = pdf_measureshape(csi, FZ_NIMAGE, bbox, 1);
+		if (error)
+			return fz_rethrow(error, "cannot measure image");
+		return fz_okay;
+	}
+
 	error = fz_newimagenode(&color, (fz_image*)img);
 	if (error)
 		return fz_rethrow(error, "cannot create image node");
@@ -656,6 +817,54 @@ pdf_showimage(pdf_csi *csi, pdf_image *img)
 	return fz_okay;
 }
 
+/*
+ * In measure mode the one path node of the interpreter is bound
+ * and then emptied for the next path, nothing goes into a tree.
+ */
+static fz_error *
+measurepath(pdf_csi *csi, int dofill, int dostroke)
+{
+	pdf_gstate *gstate = csi->gstate + csi->gtop;
+	fz_pathnode *path = csi->path;
+	fz_error *error;
+	fz_rect bbox;
+
+	if (dofill)
+	{
+		path->paint = FZ_FILL;
+		bbox = fz_boundpathnode(path, gstate->ctm);
+		error = pdf_measureshape(csi, FZ_NPATH, bbox, 1);
+		if (error)
+			return fz_rethrow(error, "cannot measure filled path");
+	}
+
+	if (dostroke)
+	{
+		path->paint = FZ_STROKE;
+		path->linewidth = gstate->linewidth;
+		path->miterlimit = gstate->miterlimit;
+		bbox = fz_boundpathnode(path, gstate->ctm);
+		error = pdf_measureshape(csi, FZ_NPATH, bbox, 1);
+		if (error)
+			return fz_rethrow(error, "cannot measure stroked path");
+	}
+
+	if (csi->clip)
+	{
+		path->paint = FZ_FILL;
+		bbox = fz_boundpathnode(path, gstate->ctm);
+		error = pdf_measureshape(csi, FZ_NPATH, bbox, 0);
+		if (error)
+			return fz_rethrow(error, "cannot measure clip path");
+		gstate->clip = fz_intersectrects(gstate->clip, bbox);
+		csi->clip = 0;
+	}
+
+	path->len = 0;
+
+	return fz_okay;
+}
+
 fz_error *
 pdf_showpath(pdf_csi *csi,
 		int doclose, int dofill, int dostroke, int evenodd)
@@ -676,6 +885,9 @@ pdf_showpath(pdf_csi *csi,
 			return fz_rethrow(error, "cannot create path node");
 	}
 
+	if (csi->measure)
+		return measurepath(csi, dofill, dostroke);
+
 	/*
 	 * Prepare the various copies of the path node.
 	 */
@@ -785,12 +997,37 @@ cleanupclip:
  * Text
  */
 
+static fz_error *
+measuretext(pdf_csi *csi)
+{
+	fz_error *error;
+
+	if (fz_isemptyrect(csi->textbbox))
+		return fz_okay;
+
+	/* same split of render modes as the text nodes below */
+	error = pdf_measureshape(csi, FZ_NTEXT, csi->textbbox,
+			csi->textmode != 3 && csi->textmode != 7);
+	if (error)
+		return fz_rethrow(error, "cannot measure text");
+
+	if (csi->textmode >= 4)
+		csi->textclipbbox = fz_mergerects(csi->textclipbbox, csi->textbbox);
+
+	csi->textbbox = fz_emptyrect;
+
+	return fz_okay;
+}
+
 fz_error *
 pdf_flushtext(pdf_csi *csi)
 {
 	pdf_gstate *gstate = csi->gstate + csi->gtop;
 	fz_error *error;
 
+	if (csi->measure)
+		return measuretext(csi);
+
 	if (csi->text)
 	{
 		switch (csi->textmode)
@@ -874,6 +1111,44 @@ showglyph(pdf_csi *csi, int cid)
 
 	trm = fz_concat(tsm, csi->tm);
 
+	if (csi->measure)
+	{
+		/* glyph origin expanded by the font bbox, see fz_boundtextnode */
+		fz_point p;
+		fz_matrix frm;
+		fz_rect fbox;
+
+		if (gstate->render != csi->textmode)
+		{
+			error = pdf_flushtext(csi);
+			if (error)
+				return fz_rethrow(error, "cannot finish text (rendermode change)");
+			csi->textmode = gstate->render;
+		}
+
+		p.x = trm.e;
+		p.y = trm.f;
+		p = fz_transformpoint(gstate->ctm, p);
+
+		frm = fz_concat(trm, gstate->ctm);
+		frm.e = 0;
+		frm.f = 0;
+
+		fbox.x0 = font->super.bbox.x0 * 0.001;
+		fbox.y0 = font->super.bbox.y0 * 0.001;
+		fbox.x1 = font->super.bbox.x1 * 0.001;
+		fbox.y1 = font->super.bbox.y1 * 0.001;
+		fbox = fz_transformaabb(frm, fbox);
+
+		fbox.x0 += p.x;
+		fbox.y0 += p.y;
+		fbox.x1 += p.x;
+		fbox.y1 += p.y;
+
+		csi->textbbox = fz_mergerects(csi->textbbox, fbox);
+		goto advance;
+	}
+
 	/* flush buffered text if face or matrix or rendermode has changed */
 	if (!csi->text ||
 			((fz_font*)font) != csi->text->font ||
@@ -902,6 +1177,7 @@ showglyph(pdf_csi *csi, int cid)
 	if (error)
 		return fz_rethrow(error, "cannot add glyph to text node");
 
+advance:
 	if (font->super.wmode == 0)
 	{
 		h = fz_gethmtx((fz_font*)font, cid);
@@ -655,7 +655,7 @@ static fz_error *parsewmode(pdf_cmap *cmap, fz_stream *file)
 
 	if (tok == PDF_TINT)
 	{
-		pdf_setwmode(cmap, atoi(buf));
+		pdf_setwmode(cmap, pdf_atoi(buf));
 		return fz_okay;
 	}
 
@@ -737,7 +737,7 @@ static fz_error *parsecidrange(pdf_cmap *cmap, fz_stream *file)
 		if (tok != PDF_TINT)
 			return fz_throw("expected integer");
 
-		dst = atoi(buf);
+		dst = pdf_atoi(buf);
 
 		error = pdf_maprangetorange(cmap, lo, hi, dst);
 		if (error)
@@ -773,7 +773,7 @@ static fz_error *parsecidchar(pdf_cmap *cmap, fz_stream *file)
 		if (tok != PDF_TINT)
 			return fz_throw("expected integer");
 
-		dst = atoi(buf);
+		dst = pdf_atoi(buf);
 
 		error = pdf_maprangetorange(cmap, src, src, dst);
 		if (error)
@@ -116,14 +116,81 @@ pdf_garbagecollect(pdf_xref *xref)
  * Transplant (copy) objects and streams from one file to another
  */
 
+/*
+ * The remap table is indexed by source object number, so looking up
+ * a reference is constant time. It lives across calls to
+ * pdf_transplantmap, so objects shared between several transplants
+ * (fonts, resources) are only copied the first time they are seen.
+ */
+
 struct pair
 {
-	int soid, sgen;
+	int sgen;
 	int doid, dgen;
 };
 
+struct pdf_remap_s
+{
+	int linkstreams;
+	int len;
+	struct pair *table;
+};
+
+/*
+ * With linkstreams the copied streams are not loaded into memory,
+ * they are read from the source xref when the destination is saved.
+ */
+fz_error *
+pdf_newremap(pdf_remap **mapp, int linkstreams)
+{
+	pdf_remap *map;
+
+	map = *mapp = fz_malloc(sizeof(pdf_remap));
+	if (!map)
+		return fz_throw("outofmem: remap struct");
+
+	map->linkstreams = linkstreams;
+	map->len = 0;
+	map->table = nil;
+
+	return fz_okay;
+}
+
+void
+pdf_dropremap(pdf_remap *map)
+{
+	fz_free(map->table);
+	fz_free(map);
+}
+
+static fz_error *
+growremap(pdf_remap *map, int len)
+{
+	struct pair *newtable;
+	int i;
+
+	if (len <= map->len)
+		return fz_okay;
+
+	newtable = fz_realloc(map->table, sizeof(struct pair) * len);
+	if (!newtable)
+		return fz_throw("outofmem: remapping table");
+
+	for (i = map->len; i < len; i++)
+	{
+		newtable[i].sgen = 0;
+		newtable[i].doid = 0;
+		newtable[i].dgen = 0;
+	}
+
+	map->len = len;
+	map->table = newtable;
+
+	return fz_okay;
+}
+
 static fz_error *
-remaprefs(fz_obj **newp, fz_obj *old, struct pair *map, int n)
+remaprefs(fz_obj **newp, fz_obj *old, pdf_remap *map)
 {
 	fz_error *error;
 	int i, o, g;
@@ -133,13 +200,19 @@ remaprefs(fz_obj **newp, fz_obj *old, struct pair *map, int n)
 	{
 		o = fz_tonum(old);
 		g = fz_togen(old);
-		for (i = 0; i < n; i++)
-			if (map[i].soid == o && map[i].sgen == g)
-			{
-				error = fz_newindirect(newp, map[i].doid, map[i].dgen);
-				if (error)
-					return fz_rethrow(error, "cannot remap indirect reference");
-			}
+		if (o > 0 && o < map->len && map->table[o].doid && map->table[o].sgen == g)
+		{
+			error = fz_newindirect(newp, map->table[o].doid, map->table[o].dgen);
+			if (error)
+				return fz_rethrow(error, "cannot remap indirect reference");
+		}
+		else
+		{
+			/* dangling reference, treat it like a missing object */
+			error = fz_newnull(newp);
+			if (error)
+				return fz_rethrow(error, "cannot remap dangling reference");
+		}
 	}
 
 	else if (fz_isarray(old))
@@ -150,7 +223,7 @@ remaprefs(fz_obj **newp, fz_obj *old, struct pair *map, int n)
 		for (i = 0; i < fz_arraylen(old); i++)
 		{
 			tmp = fz_arrayget(old, i);
-			error = remaprefs(&tmp, tmp, map, n);
+			error = remaprefs(&tmp, tmp, map);
 			if (error)
 				goto cleanup;
 			error = fz_arraypush(*newp, tmp);
@@ -169,7 +242,7 @@ remaprefs(fz_obj **newp, fz_obj *old, struct pair *map, int n)
 		{
 			key = fz_dictgetkey(old, i);
 			tmp = fz_dictgetval(old, i);
-			error = remaprefs(&tmp, tmp, map, n);
+			error = remaprefs(&tmp, tmp, map);
 			if (error)
 				goto cleanup;
 			error = fz_dictput(*newp, key, tmp);
@@ -195,91 +268,124 @@ cleanup:
  * Recursively copy objects from src to dst xref.
  * Start with root object in src xref.
  * Put the dst copy of root into newp.
+ * Objects already in the map are not copied again.
  */
 fz_error *
-pdf_transplant(pdf_xref *dst, pdf_xref *src, fz_obj **newp, fz_obj *root)
+pdf_transplantmap(pdf_xref *dst, pdf_xref *src, pdf_remap *map, fz_obj **newp, fz_obj *root)
 {
 	fz_error *error;
-	struct pair *map;
 	fz_obj *old, *new;
 	fz_buffer *stm;
-	int i, n;
+	int *list;
+	int i, n, g;
 
 	pdf_logxref("transplant {\n");
 
+	error = growremap(map, src->len);
+	if (error)
+		return fz_rethrow(error, "cannot grow remapping table");
+
+	/* objects copied by an earlier call stop the sweep */
 	for (i = 0; i < src->len; i++)
-		src->table[i].mark = 0;
+		src->table[i].mark = map->table[i].doid != 0;
 
 	error = sweepobj(src, root);
 	if (error)
 		return fz_rethrow(error, "cannot mark used objects");
 
-	for (n = 0, i = 0; i < src->len; i++)	
-		if (src->table[i].mark)
+	for (n = 0, i = 0; i < src->len; i++)
+		if (src->table[i].mark && !map->table[i].doid)
 			n++;
 
 	pdf_logxref("marked %d\n", n);
 
-	map = fz_malloc(sizeof(struct pair) * n);
-	if (!map)
-		return fz_throw("outofmem: remapping table");
+	list = fz_malloc(sizeof(int) * MAX(n, 1));
+	if (!list)
+		return fz_throw("outofmem: transplant list");
 
-	for (n = 0, i = 0; i < src->len; i++)	
+	for (n = 0, i = 0; i < src->len; i++)
 	{
-		if (src->table[i].mark)
+		if (src->table[i].mark && !map->table[i].doid)
 		{
-			map[n].soid = i;
-			map[n].sgen = src->table[i].gen;
+			g = src->table[i].gen;
 			if (src->table[i].type == 'o')
-				map[n].sgen = 0;
-			error = pdf_allocobject(dst, &map[n].doid, &map[n].dgen);
+				g = 0;
+			error = pdf_allocobject(dst, &map->table[i].doid, &map->table[i].dgen);
 			if (error)
 				goto cleanup;
-			n++;
+			map->table[i].sgen = g;
+			list[n++] = i;
 		}
 	}
 
-	error = remaprefs(newp, root, map, n);
+	error = remaprefs(newp, root, map);
 	if (error)
 		goto cleanup;
 
-	for (i = 0; i < n; i++)	
+	for (i = 0; i < n; i++)
 	{
+		struct pair *p = map->table + list[i];
+
 		pdf_logxref("copyfrom %d %d to %d %d\n",
-				map[i].soid, map[i].sgen,
-				map[i].doid, map[i].dgen);
+				list[i], p->sgen, p->doid, p->dgen);
 
-		error = pdf_loadobject(&old, src, map[i].soid, map[i].sgen);
+		error = pdf_loadobject(&old, src, list[i], p->sgen);
 		if (error)
-			goto cleanup;
+			goto cleanupnew;
 
-		if (pdf_isstream(src, map[i].soid, map[i].sgen))
+		if (map->linkstreams && pdf_isstream(src, list[i], p->sgen))
+		{
+			pdf_linkstream(dst, p->doid, p->dgen, src, list[i], p->sgen);
+		}
+		else if (pdf_isstream(src, list[i], p->sgen))
 		{
-			error = pdf_loadrawstream(&stm, src, map[i].soid, map[i].sgen);
+			error = pdf_loadrawstream(&stm, src, list[i], p->sgen);
 			if (error)
-				goto cleanup;
-			pdf_updatestream(dst, map[i].doid, map[i].dgen, stm);
+			{
+				fz_dropobj(old);
+				goto cleanupnew;
+			}
+			pdf_updatestream(dst, p->doid, p->dgen, stm);
 			fz_dropbuffer(stm);
 		}
 
-		error = remaprefs(&new, old, map, n);
+		error = remaprefs(&new, old, map);
 		fz_dropobj(old);
 		if (error)
-			goto cleanup;
+			goto cleanupnew;
 
-		error = pdf_updateobject(dst, map[i].doid, map[i].dgen, new);
+		error = pdf_updateobject(dst, p->doid, p->dgen, new);
 		fz_dropobj(new);
 		if (error)
-			goto cleanup;
+			goto cleanupnew;
 	}
 
 	pdf_logxref("}\n");
 
-	fz_free(map);
+	fz_free(list);
 	return fz_okay;
 
+cleanupnew:
+	fz_dropobj(*newp);
 cleanup:
-	fz_free(map);
+	fz_free(list);
 	return fz_rethrow(error, "cannot transplant objects");
 }
 
+fz_error *
+pdf_transplant(pdf_xref *dst, pdf_xref *src, fz_obj **newp, fz_obj *root)
+{
+	fz_error *error;
+	pdf_remap *map;
+
+	error = pdf_newremap(&map, 0);
+	if (error)
+		return fz_rethrow(error, "cannot create remapping table");
+
+	error = pdf_transplantmap(dst, src, map, newp, root);
+	pdf_dropremap(map);
+	if (error)
+		return fz_rethrow(error, "cannot transplant objects");
+
+	return fz_okay;
+}
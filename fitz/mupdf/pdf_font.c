@@ -263,7 +263,11 @@ static void ftdropfont(fz_font *font)
 	fz_free(pfont->cidtogid);
 	fz_free(pfont->cidtoucs);
 	if (pfont->ftface)
+	{
+		fz_lock(FZ_LOCK_FREETYPE);
 		FT_Done_Face((FT_Face)pfont->ftface);
+		fz_unlock(FZ_LOCK_FREETYPE);
+	}
 	if (pfont->fontdata)
 		fz_dropbuffer(pfont->fontdata);
 }
@@ -1101,6 +1105,23 @@ cleanup:
 	return fz_rethrow(error, "cannot load font descriptor");
 }
 
+/*
+ * Fonts that render the same glyphs for the same cids get the same id,
+ * so that documents embedding the same font share cached glyphs.
+ */
+static void
+fingerprintfont(pdf_font *font)
+{
+	fz_md5 md5;
+	unsigned char hint = font->hint;
+
+	fz_md5init(&md5);
+	fz_md5update(&md5, font->fontdata->rp, font->fontdata->wp - font->fontdata->rp);
+	fz_md5update(&md5, (unsigned char*)font->cidtogid, font->ncidtogid * sizeof(unsigned short));
+	fz_md5update(&md5, &hint, 1);
+	fz_md5final(&md5, font->super.id);
+}
+
 fz_error *
 pdf_loadfont(pdf_font **fontp, pdf_xref *xref, fz_obj *dict, fz_obj *ref)
 {
@@ -1128,6 +1149,11 @@ pdf_loadfont(pdf_font **fontp, pdf_xref *xref, fz_obj *dict, fz_obj *ref)
 	if (error)
 		return fz_rethrow(error, "cannot load font");
 
+	/* substitutes are stretched to the widths, and cids that go through
+	   a cmap depend on the charmap of the face, so those keep their serial */
+	if ((*fontp)->fontdata && !(*fontp)->substitute && !(*fontp)->tottfcmap)
+		fingerprintfont(*fontp);
+
 	error = pdf_storeitem(xref->store, PDF_KFONT, ref, *fontp);
 	if (error)
 		return fz_rethrow(error, "cannot store font resource");
@@ -110,7 +110,7 @@ static const struct subent fontsubs[] =
 	{ Korea, GOTHIC, "dotum.ttc" },
 };
 
-static fz_error *initfontlibs(void)
+static fz_error *initfontlibsimp(void)
 {
 	int fterr;
 	int maj, min, pat;
@@ -129,6 +129,15 @@ static fz_error *initfontlibs(void)
 	return fz_okay;
 }
 
+static fz_error *initfontlibs(void)
+{
+	fz_error *err;
+	fz_lock(FZ_LOCK_FREETYPE);
+	err = initfontlibsimp();
+	fz_unlock(FZ_LOCK_FREETYPE);
+	return err;
+}
+
 fz_error *
 pdf_loadbuiltinfont(pdf_font *font, char *fontname)
 {
@@ -154,7 +163,9 @@ found:
 	data = (unsigned char *) basefonts[i].cff;
 	len = *basefonts[i].len;
 
+	fz_lock(FZ_LOCK_FREETYPE);
 	fterr = FT_New_Memory_Face(ftlib, data, len, 0, (FT_Face*)&font->ftface);
+	fz_unlock(FZ_LOCK_FREETYPE);
 	if (fterr)
 		return fz_throw("freetype: cannot load font: %s", ft_errstr(fterr));
 
@@ -242,7 +253,9 @@ loadcidfont(pdf_font *font, int csi, int kind)
 			if (findcidfont(fontsubs[i].name, path, sizeof path))
 			{
 				pdf_logfont("load system font '%s'\n", fontsubs[i].name);
+				fz_lock(FZ_LOCK_FREETYPE);
 				fterr = FT_New_Face(ftlib, path, 0, (FT_Face*)&font->ftface);
+				fz_unlock(FZ_LOCK_FREETYPE);
 				if (fterr)
 					return fz_throw("freetype: cannot load font: %s", ft_errstr(fterr));
 				return fz_okay;
@@ -379,7 +392,9 @@ pdf_loadembeddedfont(pdf_font *font, pdf_xref *xref, fz_obj *stmref)
 	if (error)
 		return fz_rethrow(error, "cannot load font stream");
 
+	fz_lock(FZ_LOCK_FREETYPE);
 	fterr = FT_New_Memory_Face(ftlib, buf->rp, buf->wp - buf->rp, 0, &face);
+	fz_unlock(FZ_LOCK_FREETYPE);
 	if (fterr)
 	{
 		fz_dropbuffer(buf);
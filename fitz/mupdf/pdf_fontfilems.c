@@ -763,7 +763,7 @@ pdf_lookupfontMS2(char *fontname, char **fontpath, int *index, int *didfind)
 
 static FT_Library ftlib = nil;
 
-static fz_error *initfontlibs(void)
+static fz_error *initfontlibsimp(void)
 {
 	int fterr;
 	int maj, min, pat;
@@ -787,6 +787,16 @@ static fz_error *initfontlibs(void)
 	return fz_okay;
 }
 
+/* the font list is built once and only read afterwards */
+static fz_error *initfontlibs(void)
+{
+	fz_error *err;
+	fz_lock(FZ_LOCK_FREETYPE);
+	err = initfontlibsimp();
+	fz_unlock(FZ_LOCK_FREETYPE);
+	return err;
+}
+
 static fz_error *
 pdf_lookupfontMS(pdf_font *font, char *fontname, char *collection, char **fontpath, int *index)
 {
@@ -945,7 +955,9 @@ pdf_loadbuiltinfont(pdf_font *font, char *basefont)
 		data = (unsigned char *) basefonts[i].cff;
 		len = *basefonts[i].len;
 
+		fz_lock(FZ_LOCK_FREETYPE);
 		fterr = FT_New_Memory_Face(ftlib, data, len, 0, (FT_Face*)&font->ftface);
+		fz_unlock(FZ_LOCK_FREETYPE);
 		/* TODO: fails on "Helvetica" */
 #if 0
 		if (fterr)
@@ -963,7 +975,9 @@ pdf_loadbuiltinfont(pdf_font *font, char *basefont)
 	if (error)
 		return error;
 
+	fz_lock(FZ_LOCK_FREETYPE);
 	fterr = FT_New_Face(ftlib, file, index, &face);
+	fz_unlock(FZ_LOCK_FREETYPE);
 	if (fterr)
 		return fz_throw("freetype could not load font file '%s': %s", file, ft_errstr(fterr));
 
@@ -985,7 +999,9 @@ pdf_loadsystemfont(pdf_font *font, char *basefont, char *collection)
 	if (error)
 		goto cleanup;
 
+	fz_lock(FZ_LOCK_FREETYPE);
 	fterr = FT_New_Face(ftlib, file, index, &face);
+	fz_unlock(FZ_LOCK_FREETYPE);
 	if (fterr) {
 		return fz_throw("freetype could not load font file '%s': %s", file, ft_errstr(fterr));
 	}
@@ -1014,7 +1030,9 @@ pdf_loadembeddedfont(pdf_font *font, pdf_xref *xref, fz_obj *stmref)
 	if (error)
 		return error;
 
+	fz_lock(FZ_LOCK_FREETYPE);
 	fterr = FT_New_Memory_Face(ftlib, buf->rp, buf->wp - buf->rp, 0, &face);
+	fz_unlock(FZ_LOCK_FREETYPE);
 
 	if (fterr) {
 		fz_free(buf);
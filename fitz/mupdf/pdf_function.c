@@ -351,7 +351,7 @@ parsecode(pdf_function *func, fz_stream *stream, int *codeptr)
 			if (error)
 				return fz_rethrow(error, "resize calculator function code");
 			func->u.p.code[*codeptr].type = PSINT;
-			func->u.p.code[*codeptr].u.i = atoi(buf);
+			func->u.p.code[*codeptr].u.i = pdf_atoi(buf);
 			++*codeptr;
 			break;
 
@@ -360,7 +360,7 @@ parsecode(pdf_function *func, fz_stream *stream, int *codeptr)
 			if (error)
 				return fz_rethrow(error, "resize calculator function code");
 			func->u.p.code[*codeptr].type = PSREAL;
-			func->u.p.code[*codeptr].u.f = atof(buf);
+			func->u.p.code[*codeptr].u.f = pdf_atof(buf);
 			++*codeptr;
 			break;
 
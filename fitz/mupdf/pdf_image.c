@@ -596,3 +596,149 @@ pdf_loadtile(fz_image *img, fz_pixmap *tile)
 	return fz_okay;
 }
 
+
+/*
+ * Shrink an image by whole factors and turn it into 8 bit gray, for
+ * output devices that cannot show more. The new samples come back
+ * DCT encoded if dct is set and flate encoded otherwise. Only the
+ * loaded image is used, so this can run on any thread.
+ */
+fz_error *
+pdf_downsampleimage(fz_buffer **bufp, int *wp, int *hp, pdf_image *img,
+	int xdenom, int ydenom, int dct)
+{
+	fz_error *error;
+	fz_image *image = &img->super;
+	fz_pixmap *tile;
+	fz_pixmap *temp;
+	fz_filter *filter;
+	fz_obj *params;
+	unsigned char *gray;
+	int i, n;
+
+	if (!image->cs || image->a)
+		return fz_throw("cannot downsample image masks");
+
+	error = fz_newpixmap(&tile, 0, 0, image->w, image->h, image->n + 1);
+	if (error)
+		return fz_rethrow(error, "cannot create image tile");
+
+	error = image->loadtile(image, tile);
+	if (error)
+	{
+		fz_droppixmap(tile);
+		return fz_rethrow(error, "cannot load image tile");
+	}
+
+	if (xdenom > 1 || ydenom > 1)
+	{
+		error = fz_scalepixmap(&temp, tile, xdenom, ydenom);
+		fz_droppixmap(tile);
+		if (error)
+			return fz_rethrow(error, "cannot scale image");
+		tile = temp;
+	}
+
+	if (image->cs != pdf_devicegray)
+	{
+		error = fz_newpixmap(&temp, tile->x, tile->y, tile->w, tile->h, 2);
+		if (error)
+		{
+			fz_droppixmap(tile);
+			return fz_rethrow(error, "cannot create gray tile");
+		}
+		fz_convertpixmap(image->cs, tile, pdf_devicegray, temp);
+		fz_droppixmap(tile);
+		tile = temp;
+	}
+
+	/* drop the alpha, the samples are opaque */
+	n = tile->w * tile->h;
+	gray = tile->samples;
+	for (i = 0; i < n; i++)
+		gray[i] = tile->samples[i * 2 + 1];
+
+	if (dct)
+	{
+		error = fz_packobj(&params, "<< /Columns %i /Rows %i /Colors 1 >>",
+			tile->w, tile->h);
+		if (error)
+		{
+			fz_droppixmap(tile);
+			return fz_rethrow(error, "cannot create dct parameters");
+		}
+		error = fz_newdcte(&filter, params);
+		fz_dropobj(params);
+	}
+	else
+		error = fz_newflatee(&filter, nil);
+	if (error)
+	{
+		fz_droppixmap(tile);
+		return fz_rethrow(error, "cannot create image encoder");
+	}
+
+	error = pdf_encodebuffer(bufp, filter, gray, n);
+	fz_dropfilter(filter);
+	if (error)
+	{
+		fz_droppixmap(tile);
+		return fz_rethrow(error, "cannot encode image");
+	}
+
+	*wp = tile->w;
+	*hp = tile->h;
+	fz_droppixmap(tile);
+	return fz_okay;
+}
+
+/*
+ * Store the samples made by pdf_downsampleimage for an image object
+ * and describe them in its dictionary.
+ */
+fz_error *
+pdf_replaceimage(pdf_xref *xref, int oid, int gen, fz_buffer *buf, int w, int h, int dct)
+{
+	fz_error *error;
+	fz_obj *dict;
+	fz_obj *obj;
+
+	error = pdf_cacheobject(xref, oid, gen);
+	if (error)
+		return fz_rethrow(error, "cannot load image object (%d)", oid);
+
+	dict = xref->table[oid].obj;
+
+	error = fz_packobj(&obj, "<< /Width %i /Height %i /ColorSpace /DeviceGray "
+		"/BitsPerComponent 8 /Filter %n /Length %i >>",
+		w, h, dct ? "DCTDecode" : "FlateDecode", (int)(buf->wp - buf->rp));
+	if (error)
+		return fz_rethrow(error, "cannot create image entries");
+
+	error = fz_dictputs(dict, "Width", fz_dictgets(obj, "Width"));
+	if (!error)
+		error = fz_dictputs(dict, "Height", fz_dictgets(obj, "Height"));
+	if (!error)
+		error = fz_dictputs(dict, "ColorSpace", fz_dictgets(obj, "ColorSpace"));
+	if (!error)
+		error = fz_dictputs(dict, "BitsPerComponent", fz_dictgets(obj, "BitsPerComponent"));
+	if (!error)
+		error = fz_dictputs(dict, "Filter", fz_dictgets(obj, "Filter"));
+	if (!error)
+		error = fz_dictputs(dict, "Length", fz_dictgets(obj, "Length"));
+	fz_dropobj(obj);
+	if (error)
+		return fz_rethrow(error, "cannot update image dictionary");
+
+	fz_dictdels(dict, "DecodeParms");
+	fz_dictdels(dict, "DP");
+	fz_dictdels(dict, "Decode");
+
+	pdf_pinobject(xref, oid);
+
+	error = pdf_updatestream(xref, oid, gen, buf);
+	if (error)
+		return fz_rethrow(error, "cannot update image data");
+
+	return fz_okay;
+}
@@ -1,8 +1,8 @@
 #include "fitz.h"
 #include "mupdf.h"
 
-fz_error *
-pdf_newcsi(pdf_csi **csip, int maskonly)
+static fz_error *
+newcsi(pdf_csi **csip, int maskonly, pdf_measure *measure)
 {
 	fz_error *error;
 	pdf_csi *csi;
@@ -25,16 +25,22 @@ pdf_newcsi(pdf_csi **csip, int maskonly)
 		return fz_rethrow(error, "cannot create path node");
 	}
 
-	error = fz_newtree(&csi->tree);
-	if (error) {
-		fz_dropnode((fz_node*)csi->path);
-		fz_free(csi);
-		return fz_rethrow(error, "cannot create tree");
-	}
+	csi->tree = nil;
+	csi->measure = measure;
 
-	error = fz_newovernode(&node);
-	csi->tree->root = node;
-	csi->gstate[0].head = node;
+	if (!measure)
+	{
+		error = fz_newtree(&csi->tree);
+		if (error) {
+			fz_dropnode((fz_node*)csi->path);
+			fz_free(csi);
+			return fz_rethrow(error, "cannot create tree");
+		}
+
+		error = fz_newovernode(&node);
+		csi->tree->root = node;
+		csi->gstate[0].head = node;
+	}
 
 	if (maskonly)
 	{
@@ -50,11 +56,31 @@ pdf_newcsi(pdf_csi **csip, int maskonly)
 	csi->text = nil;
 	csi->tm = fz_identity();
 	csi->tlm = fz_identity();
+	csi->textbbox = fz_emptyrect;
+	csi->textclipbbox = fz_emptyrect;
+
+	csi->depth = 0;
+	csi->opstart = 0;
+	csi->pathstart = -1;
+	csi->pathclip = 0;
+	csi->opbbox = fz_emptyrect;
 
 	*csip = csi;
 	return fz_okay;
 }
 
+fz_error *
+pdf_newcsi(pdf_csi **csip, int maskonly)
+{
+	return newcsi(csip, maskonly, nil);
+}
+
+fz_error *
+pdf_newmeasurecsi(pdf_csi **csip, pdf_measure *measure)
+{
+	return newcsi(csip, 0, measure);
+}
+
 static void
 clearstack(pdf_csi *csi)
 {
@@ -221,6 +247,133 @@ runxobject(pdf_csi *csi, pdf_xref *xref, pdf_xobject *xobj, int istransparency)
 	return fz_okay;
 }
 
+/*
+ * Measure mode has no preloaded xobjects. Images are only a transform
+ * of the unit square and forms are interpreted straight from the file
+ * with the resources they need for measuring, clipped to their bbox.
+ * Nothing stops a form from drawing itself, so the nesting is bounded.
+ */
+
+enum { MAXFORMDEPTH = 32 };
+
+static fz_error *
+measurexobject(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, fz_obj *ref)
+{
+	fz_error *error;
+	fz_obj *dict = ref;
+	fz_obj *obj;
+	fz_obj *xrdb;
+	fz_stream *file;
+	pdf_gstate *gstate;
+	fz_rect bbox;
+
+	error = pdf_resolve(&dict, xref);
+	if (error)
+		return fz_rethrow(error, "cannot resolve xobject %d", fz_tonum(ref));
+
+	obj = fz_dictgets(dict, "Subtype");
+
+	if (!strcmp(fz_toname(obj), "Image"))
+	{
+		fz_dropobj(dict);
+		bbox.x0 = 0;
+		bbox.y0 = 0;
+		bbox.x1 = 1;
+		bbox.y1 = 1;
+		bbox = fz_transformaabb(csi->gstate[csi->gtop].ctm, bbox);
+		error = pdf_measureshape(csi, FZ_NIMAGE, bbox, 1);
+		if (error)
+			return fz_rethrow(error, "cannot measure image");
+		if (fz_isindirect(ref))
+		{
+			error = pdf_recordimage(csi, ref, bbox);
+			if (error)
+				return fz_rethrow(error, "cannot record image");
+		}
+		return fz_okay;
+	}
+
+	if (strcmp(fz_toname(obj), "Form") || !fz_isindirect(ref))
+	{
+		fz_dropobj(dict);
+		return fz_throw("unknown xobject resource type");
+	}
+
+	if (csi->depth >= MAXFORMDEPTH)
+	{
+		fz_dropobj(dict);
+		return fz_throw("xobject nesting too deep: %d", fz_tonum(ref));
+	}
+
+	error = gsave(csi);
+	if (error)
+	{
+		fz_dropobj(dict);
+		return fz_rethrow(error, "cannot push graphics state");
+	}
+
+	gstate = csi->gstate + csi->gtop;
+
+	obj = fz_dictgets(dict, "Matrix");
+	if (obj)
+		gstate->ctm = fz_concat(pdf_tomatrix(obj), gstate->ctm);
+
+	obj = fz_dictgets(dict, "BBox");
+	if (fz_isarray(obj))
+	{
+		bbox = fz_transformaabb(gstate->ctm, pdf_torect(obj));
+		gstate->clip = fz_intersectrects(gstate->clip, bbox);
+	}
+
+	obj = fz_dictgets(dict, "Resources");
+	if (obj)
+	{
+		error = pdf_resolve(&obj, xref);
+		if (error)
+		{
+			fz_dropobj(dict);
+			return fz_rethrow(error, "cannot resolve xobject resources");
+		}
+		error = pdf_loadmeasureresources(&xrdb, xref, obj);
+		fz_dropobj(obj);
+		if (error)
+		{
+			fz_dropobj(dict);
+			return fz_rethrow(error, "cannot load xobject resources");
+		}
+	}
+	else
+	{
+		/* Inherit parent resources */
+		xrdb = fz_keepobj(rdb);
+	}
+
+	fz_dropobj(dict);
+
+	error = pdf_openstream(&file, xref, fz_tonum(ref), fz_togen(ref));
+	if (error)
+	{
+		fz_dropobj(xrdb);
+		return fz_rethrow(error, "cannot open XObject stream");
+	}
+
+	csi->depth ++;
+	error = pdf_runcsi(csi, xref, xrdb, file);
+	csi->depth --;
+
+	fz_dropstream(file);
+	fz_dropobj(xrdb);
+
+	if (error)
+		return fz_rethrow(error, "cannot interpret XObject stream");
+
+	error = grestore(csi);
+	if (error)
+		return fz_rethrow(error, "cannot pop graphics state");
+
+	return fz_okay;
+}
+
 /*
  * Decode inline image and insert into page.
  */
@@ -267,7 +420,7 @@ runinlineimage(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, fz_stream *file, fz_ob
  */
 
 static fz_error *
-runextgstate(pdf_gstate *gstate, pdf_xref *xref, fz_obj *extgstate)
+runextgstate(pdf_csi *csi, pdf_gstate *gstate, pdf_xref *xref, fz_obj *extgstate)
 {
 	int i, k;
 
@@ -351,6 +504,8 @@ runextgstate(pdf_gstate *gstate, pdf_xref *xref, fz_obj *extgstate)
 			}
 
 			/*puts("we encountered a blend mode");*/
+			if (csi->measure)
+				continue;
 			if (gstate->blendmode == FZ_BNORMAL)
 			    error = fz_newovernode(&blend);
 			else
@@ -383,12 +538,36 @@ runextgstate(pdf_gstate *gstate, pdf_xref *xref, fz_obj *extgstate)
 	return fz_okay;
 }
 
+/*
+ * Content stream operators are at most three characters long, so the
+ * characters packed into an int are a perfect hash of the operator:
+ * each one gets a distinct code that is a constant expression and can
+ * label a case. One character operators keep their character as code.
+ * Anything longer maps to 0, which is no operator.
+ */
+
+#define OP2(a,b) ((a) | (b) << 8)
+#define OP3(a,b,c) ((a) | (b) << 8 | (c) << 16)
+
+static int
+opcode(char *buf, int len)
+{
+	unsigned char *s = (unsigned char *)buf;
+	switch (len)
+	{
+	case 1: return s[0];
+	case 2: return OP2(s[0], s[1]);
+	case 3: return OP3(s[0], s[1], s[2]);
+	}
+	return 0;
+}
+
 /*
  * The meat of the interpreter...
  */
 
 static fz_error *
-runkeyword(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, char *buf)
+runkeyword(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, int op, char *buf)
 {
 	pdf_gstate *gstate = csi->gstate + csi->gtop;
 	fz_error *error;
@@ -399,53 +578,47 @@ runkeyword(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, char *buf)
 	int what;
 	int i;
 
-	if (strlen(buf) > 1)
+	switch (op)
 	{
-		if (!strcmp(buf, "BX"))
-		{
-			if (csi->top != 0)
-				goto syntaxerror;
-			csi->xbalance ++;
-		}
 
-		else if (!strcmp(buf, "EX"))
-		{
-			if (csi->top != 0)
-				goto syntaxerror;
-			csi->xbalance --;
-		}
+	case OP2('B','X'):
+		if (csi->top != 0)
+			goto syntaxerror;
+		csi->xbalance ++;
+		break;
 
-		else if (!strcmp(buf, "MP"))
-		{
-			if (csi->top != 1)
-				goto syntaxerror;
-		}
+	case OP2('E','X'):
+		if (csi->top != 0)
+			goto syntaxerror;
+		csi->xbalance --;
+		break;
 
-		else if (!strcmp(buf, "DP"))
-		{
-			if (csi->top != 2)
-				goto syntaxerror;
-		}
+	case OP2('M','P'):
+		if (csi->top != 1)
+			goto syntaxerror;
+		break;
 
-		else if (!strcmp(buf, "BMC"))
-		{
-			if (csi->top != 1)
-				goto syntaxerror;
-		}
+	case OP2('D','P'):
+		if (csi->top != 2)
+			goto syntaxerror;
+		break;
 
-		else if (!strcmp(buf, "BDC"))
-		{
-			if (csi->top != 2)
-				goto syntaxerror;
-		}
+	case OP3('B','M','C'):
+		if (csi->top != 1)
+			goto syntaxerror;
+		break;
 
-		else if (!strcmp(buf, "EMC"))
-		{
-			if (csi->top != 0)
-				goto syntaxerror;
-		}
+	case OP3('B','D','C'):
+		if (csi->top != 2)
+			goto syntaxerror;
+		break;
 
-		else if (!strcmp(buf, "cm"))
+	case OP3('E','M','C'):
+		if (csi->top != 0)
+			goto syntaxerror;
+		break;
+
+	case OP2('c','m'):
 		{
 			fz_matrix m;
 			fz_node *transform;
@@ -460,6 +633,12 @@ runkeyword(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, char *buf)
 			m.e = fz_toreal(csi->stack[4]);
 			m.f = fz_toreal(csi->stack[5]);
 
+			if (csi->measure)
+			{
+				gstate->ctm = fz_concat(m, gstate->ctm);
+				return fz_okay;
+			}
+
 			error = fz_newtransformnode(&transform, m);
 			if (error)
 				return fz_rethrow(error, "cannot concatenate matrix");
@@ -468,14 +647,14 @@ runkeyword(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, char *buf)
 			if (error)
 				return fz_rethrow(error, "cannot concatenate matrix");
 		}
+		break;
 
-		else if (!strcmp(buf, "ri"))
-		{
-			if (csi->top != 1)
-				goto syntaxerror;
-		}
+	case OP2('r','i'):
+		if (csi->top != 1)
+			goto syntaxerror;
+		break;
 
-		else if (!strcmp(buf, "gs"))
+	case OP2('g','s'):
 		{
 			fz_obj *dict;
 			fz_obj *obj;
@@ -491,72 +670,66 @@ runkeyword(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, char *buf)
 			if (!obj)
 				return fz_throw("cannot find extgstate resource /%s", fz_toname(csi->stack[0]));
 
-			error = runextgstate(gstate, xref, obj);
+			error = runextgstate(csi, gstate, xref, obj);
 			if (error)
 				return fz_rethrow(error, "cannot set ExtGState");
 		}
+		break;
 
-		else if (!strcmp(buf, "re"))
-		{
-			if (csi->top != 4)
-				goto syntaxerror;
+	case OP2('r','e'):
+		if (csi->top != 4)
+			goto syntaxerror;
 
-			x = fz_toreal(csi->stack[0]);
-			y = fz_toreal(csi->stack[1]);
-			w = fz_toreal(csi->stack[2]);
-			h = fz_toreal(csi->stack[3]);
-
-			error = fz_moveto(csi->path, x, y);
-			if (error) return fz_rethrow(error, "cannot draw rectangle");
-			error = fz_lineto(csi->path, x + w, y);
-			if (error) return fz_rethrow(error, "cannot draw rectangle");
-			error = fz_lineto(csi->path, x + w, y + h);
-			if (error) return fz_rethrow(error, "cannot draw rectangle");
-			error = fz_lineto(csi->path, x, y + h);
-			if (error) return fz_rethrow(error, "cannot draw rectangle");
-			error = fz_closepath(csi->path);
-			if (error) return fz_rethrow(error, "cannot draw rectangle");
-		}
+		x = fz_toreal(csi->stack[0]);
+		y = fz_toreal(csi->stack[1]);
+		w = fz_toreal(csi->stack[2]);
+		h = fz_toreal(csi->stack[3]);
+
+		error = fz_moveto(csi->path, x, y);
+		if (error) return fz_rethrow(error, "cannot draw rectangle");
+		error = fz_lineto(csi->path, x + w, y);
+		if (error) return fz_rethrow(error, "cannot draw rectangle");
+		error = fz_lineto(csi->path, x + w, y + h);
+		if (error) return fz_rethrow(error, "cannot draw rectangle");
+		error = fz_lineto(csi->path, x, y + h);
+		if (error) return fz_rethrow(error, "cannot draw rectangle");
+		error = fz_closepath(csi->path);
+		if (error) return fz_rethrow(error, "cannot draw rectangle");
+		break;
 
-		else if (!strcmp(buf, "f*"))
-		{
-			if (csi->top != 0)
-				goto syntaxerror;
-			error = pdf_showpath(csi, 0, 1, 0, 1);
-			if (error) return fz_rethrow(error, "cannot draw path");
-		}
+	case OP2('f','*'):
+		if (csi->top != 0)
+			goto syntaxerror;
+		error = pdf_showpath(csi, 0, 1, 0, 1);
+		if (error) return fz_rethrow(error, "cannot draw path");
+		break;
 
-		else if (!strcmp(buf, "B*"))
-		{
-			if (csi->top != 0)
-				goto syntaxerror;
-			error = pdf_showpath(csi, 0, 1, 1, 1);
-			if (error) return fz_rethrow(error, "cannot draw path");
-		}
+	case OP2('B','*'):
+		if (csi->top != 0)
+			goto syntaxerror;
+		error = pdf_showpath(csi, 0, 1, 1, 1);
+		if (error) return fz_rethrow(error, "cannot draw path");
+		break;
 
-		else if (!strcmp(buf, "b*"))
-		{
-			if (csi->top != 0)
-				goto syntaxerror;
-			error = pdf_showpath(csi, 1, 1, 1, 1);
-			if (error) return fz_rethrow(error, "cannot draw path");
-		}
+	case OP2('b','*'):
+		if (csi->top != 0)
+			goto syntaxerror;
+		error = pdf_showpath(csi, 1, 1, 1, 1);
+		if (error) return fz_rethrow(error, "cannot draw path");
+		break;
 
-		else if (!strcmp(buf, "W*"))
-		{
-			if (csi->top != 0)
-				goto syntaxerror;
-			csi->clip = 1;
-			csi->clipevenodd = 1;
-		}
+	case OP2('W','*'):
+		if (csi->top != 0)
+			goto syntaxerror;
+		csi->clip = 1;
+		csi->clipevenodd = 1;
+		break;
 
-		else if (!strcmp(buf, "cs"))
-		{
-			what = PDF_MFILL;
-			goto Lsetcolorspace;
-		}
+	case OP2('c','s'):
+		what = PDF_MFILL;
+		goto Lsetcolorspace;
 
-		else if (!strcmp(buf, "CS"))
+	case OP2('C','S'):
 		{
 			fz_colorspace *cs;
 			fz_obj *obj;
@@ -601,14 +774,15 @@ Lsetcolorspace:
 				if (error) return fz_rethrow(error, "cannot set colorspace");
 			}
 		}
+		break;
 
-		else if (!strcmp(buf, "sc") || !strcmp(buf, "scn"))
-		{
-			what = PDF_MFILL;
-			goto Lsetcolor;
-		}
+	case OP2('s','c'):
+	case OP3('s','c','n'):
+		what = PDF_MFILL;
+		goto Lsetcolor;
 
-		else if (!strcmp(buf, "SC") || !strcmp(buf, "SCN"))
+	case OP2('S','C'):
+	case OP3('S','C','N'):
 		{
 			pdf_material *mat;
 			pdf_pattern *pat;
@@ -653,6 +827,14 @@ Lsetcolor:
 				for (i = 0; i < csi->top - 1; i++)
 					v[i] = fz_toreal(csi->stack[i]);
 
+				/* patterns are not loaded for measuring, the shape is enough */
+				if (csi->measure)
+				{
+					error = pdf_setpattern(csi, what, nil, nil);
+					if (error) return fz_rethrow(error, "cannot set pattern");
+					break;
+				}
+
 				dict = fz_dictgets(rdb, "Pattern");
 				if (!dict)
 					return fz_throw("cannot find Pattern dictionary");
@@ -685,96 +867,95 @@ Lsetcolor:
 				return fz_throw("cannot set color in shade objects");
 			}
 		}
+		break;
 
-		else if (!strcmp(buf, "rg"))
-		{
-			if (csi->top != 3)
-				goto syntaxerror;
-
-			v[0] = fz_toreal(csi->stack[0]);
-			v[1] = fz_toreal(csi->stack[1]);
-			v[2] = fz_toreal(csi->stack[2]);
+	case OP2('r','g'):
+		if (csi->top != 3)
+			goto syntaxerror;
 
-			error = pdf_setcolorspace(csi, PDF_MFILL, pdf_devicergb);
-			if (error) return fz_rethrow(error, "cannot set rgb colorspace");
-			error = pdf_setcolor(csi, PDF_MFILL, v);
-			if (error) return fz_rethrow(error, "cannot set rgb color");
-		}
+		v[0] = fz_toreal(csi->stack[0]);
+		v[1] = fz_toreal(csi->stack[1]);
+		v[2] = fz_toreal(csi->stack[2]);
 
-		else if (!strcmp(buf, "RG"))
-		{
-			if (csi->top != 3)
-				goto syntaxerror;
+		error = pdf_setcolorspace(csi, PDF_MFILL, pdf_devicergb);
+		if (error) return fz_rethrow(error, "cannot set rgb colorspace");
+		error = pdf_setcolor(csi, PDF_MFILL, v);
+		if (error) return fz_rethrow(error, "cannot set rgb color");
+		break;
 
-			v[0] = fz_toreal(csi->stack[0]);
-			v[1] = fz_toreal(csi->stack[1]);
-			v[2] = fz_toreal(csi->stack[2]);
+	case OP2('R','G'):
+		if (csi->top != 3)
+			goto syntaxerror;
 
-			error = pdf_setcolorspace(csi, PDF_MSTROKE, pdf_devicergb);
-			if (error) return fz_rethrow(error, "cannot set rgb colorspace");
-			error = pdf_setcolor(csi, PDF_MSTROKE, v);
-			if (error) return fz_rethrow(error, "cannot set rgb color");
-		}
+		v[0] = fz_toreal(csi->stack[0]);
+		v[1] = fz_toreal(csi->stack[1]);
+		v[2] = fz_toreal(csi->stack[2]);
 
-		else if (!strcmp(buf, "BT"))
-		{
-			if (csi->top != 0)
-				goto syntaxerror;
-			csi->tm = fz_identity();
-			csi->tlm = fz_identity();
-		}
+		error = pdf_setcolorspace(csi, PDF_MSTROKE, pdf_devicergb);
+		if (error) return fz_rethrow(error, "cannot set rgb colorspace");
+		error = pdf_setcolor(csi, PDF_MSTROKE, v);
+		if (error) return fz_rethrow(error, "cannot set rgb color");
+		break;
 
-		else if (!strcmp(buf, "ET"))
-		{
-			if (csi->top != 0)
-				goto syntaxerror;
+	case OP2('B','T'):
+		if (csi->top != 0)
+			goto syntaxerror;
+		csi->tm = fz_identity();
+		csi->tlm = fz_identity();
+		break;
 
-			error = pdf_flushtext(csi);
-			if (error)
-				return fz_rethrow(error, "cannot finish text object (ET)");
+	case OP2('E','T'):
+		if (csi->top != 0)
+			goto syntaxerror;
 
-			if (csi->textclip)
-			{
-				error = pdf_addclipmask(gstate, csi->textclip);
-				if (error) return fz_rethrow(error, "cannot add text clip mask");
-				csi->textclip = nil;
-			}
-		}
+		error = pdf_flushtext(csi);
+		if (error)
+			return fz_rethrow(error, "cannot finish text object (ET)");
 
-		else if (!strcmp(buf, "Tc"))
+		if (csi->measure && !fz_isemptyrect(csi->textclipbbox))
 		{
-			if (csi->top != 1)
-				goto syntaxerror;
-			gstate->charspace = fz_toreal(csi->stack[0]);
+			gstate->clip = fz_intersectrects(gstate->clip, csi->textclipbbox);
+			csi->textclipbbox = fz_emptyrect;
 		}
 
-		else if (!strcmp(buf, "Tw"))
+		if (csi->textclip)
 		{
-			if (csi->top != 1)
-				goto syntaxerror;
-			gstate->wordspace = fz_toreal(csi->stack[0]);
+			error = pdf_addclipmask(gstate, csi->textclip);
+			if (error) return fz_rethrow(error, "cannot add text clip mask");
+			csi->textclip = nil;
 		}
+		break;
 
-		else if (!strcmp(buf, "Tz"))
-		{
-			if (csi->top != 1)
-				goto syntaxerror;
+	case OP2('T','c'):
+		if (csi->top != 1)
+			goto syntaxerror;
+		gstate->charspace = fz_toreal(csi->stack[0]);
+		break;
 
-			error = pdf_flushtext(csi);
-			if (error)
-				return fz_rethrow(error, "cannot finish text object (state change)");
+	case OP2('T','w'):
+		if (csi->top != 1)
+			goto syntaxerror;
+		gstate->wordspace = fz_toreal(csi->stack[0]);
+		break;
 
-			gstate->scale = fz_toreal(csi->stack[0]) / 100.0;
-		}
+	case OP2('T','z'):
+		if (csi->top != 1)
+			goto syntaxerror;
 
-		else if (!strcmp(buf, "TL"))
-		{
-			if (csi->top != 1)
-				goto syntaxerror;
-			gstate->leading = fz_toreal(csi->stack[0]);
-		}
+		error = pdf_flushtext(csi);
+		if (error)
+			return fz_rethrow(error, "cannot finish text object (state change)");
+
+		gstate->scale = fz_toreal(csi->stack[0]) / 100.0;
+		break;
+
+	case OP2('T','L'):
+		if (csi->top != 1)
+			goto syntaxerror;
+		gstate->leading = fz_toreal(csi->stack[0]);
+		break;
 
-		else if (!strcmp(buf, "Tf"))
+	case OP2('T','f'):
 		{
 			fz_obj *dict;
 			fz_obj *obj;
@@ -796,84 +977,77 @@ Lsetcolor:
 
 			gstate->size = fz_toreal(csi->stack[1]);
 		}
+		break;
 
-		else if (!strcmp(buf, "Tr"))
-		{
-			if (csi->top != 1)
-				goto syntaxerror;
-			gstate->render = fz_toint(csi->stack[0]);
-		}
+	case OP2('T','r'):
+		if (csi->top != 1)
+			goto syntaxerror;
+		gstate->render = fz_toint(csi->stack[0]);
+		break;
 
-		else if (!strcmp(buf, "Ts"))
-		{
-			if (csi->top != 1)
-				goto syntaxerror;
-			gstate->rise = fz_toreal(csi->stack[0]);
-		}
+	case OP2('T','s'):
+		if (csi->top != 1)
+			goto syntaxerror;
+		gstate->rise = fz_toreal(csi->stack[0]);
+		break;
 
-		else if (!strcmp(buf, "Td"))
-		{
-			if (csi->top != 2)
-				goto syntaxerror;
-			m = fz_translate(fz_toreal(csi->stack[0]), fz_toreal(csi->stack[1]));
-			csi->tlm = fz_concat(m, csi->tlm);
-			csi->tm = csi->tlm;
-		}
+	case OP2('T','d'):
+		if (csi->top != 2)
+			goto syntaxerror;
+		m = fz_translate(fz_toreal(csi->stack[0]), fz_toreal(csi->stack[1]));
+		csi->tlm = fz_concat(m, csi->tlm);
+		csi->tm = csi->tlm;
+		break;
 
-		else if (!strcmp(buf, "TD"))
-		{
-			if (csi->top != 2)
-				goto syntaxerror;
-			gstate->leading = -fz_toreal(csi->stack[1]);
-			m = fz_translate(fz_toreal(csi->stack[0]), fz_toreal(csi->stack[1]));
-			csi->tlm = fz_concat(m, csi->tlm);
-			csi->tm = csi->tlm;
-		}
+	case OP2('T','D'):
+		if (csi->top != 2)
+			goto syntaxerror;
+		gstate->leading = -fz_toreal(csi->stack[1]);
+		m = fz_translate(fz_toreal(csi->stack[0]), fz_toreal(csi->stack[1]));
+		csi->tlm = fz_concat(m, csi->tlm);
+		csi->tm = csi->tlm;
+		break;
 
-		else if (!strcmp(buf, "Tm"))
-		{
-			if (csi->top != 6)
-				goto syntaxerror;
+	case OP2('T','m'):
+		if (csi->top != 6)
+			goto syntaxerror;
 
-			error = pdf_flushtext(csi);
-			if (error)
-				return fz_rethrow(error, "cannot finish text object (state change)");
-
-			csi->tm.a = fz_toreal(csi->stack[0]);
-			csi->tm.b = fz_toreal(csi->stack[1]);
-			csi->tm.c = fz_toreal(csi->stack[2]);
-			csi->tm.d = fz_toreal(csi->stack[3]);
-			csi->tm.e = fz_toreal(csi->stack[4]);
-			csi->tm.f = fz_toreal(csi->stack[5]);
-			csi->tlm = csi->tm;
-		}
+		error = pdf_flushtext(csi);
+		if (error)
+			return fz_rethrow(error, "cannot finish text object (state change)");
+
+		csi->tm.a = fz_toreal(csi->stack[0]);
+		csi->tm.b = fz_toreal(csi->stack[1]);
+		csi->tm.c = fz_toreal(csi->stack[2]);
+		csi->tm.d = fz_toreal(csi->stack[3]);
+		csi->tm.e = fz_toreal(csi->stack[4]);
+		csi->tm.f = fz_toreal(csi->stack[5]);
+		csi->tlm = csi->tm;
+		break;
 
-		else if (!strcmp(buf, "T*"))
-		{
-			if (csi->top != 0)
-				goto syntaxerror;
-			m = fz_translate(0, -gstate->leading);
-			csi->tlm = fz_concat(m, csi->tlm);
-			csi->tm = csi->tlm;
-		}
+	case OP2('T','*'):
+		if (csi->top != 0)
+			goto syntaxerror;
+		m = fz_translate(0, -gstate->leading);
+		csi->tlm = fz_concat(m, csi->tlm);
+		csi->tm = csi->tlm;
+		break;
 
-		else if (!strcmp(buf, "Tj"))
-		{
-			if (csi->top != 1)
-				goto syntaxerror;
-			error = pdf_showtext(csi, csi->stack[0]);
-			if (error) return fz_rethrow(error, "cannot draw text");
-		}
+	case OP2('T','j'):
+		if (csi->top != 1)
+			goto syntaxerror;
+		error = pdf_showtext(csi, csi->stack[0]);
+		if (error) return fz_rethrow(error, "cannot draw text");
+		break;
 
-		else if (!strcmp(buf, "TJ"))
-		{
-			if (csi->top != 1)
-				goto syntaxerror;
-			error = pdf_showtext(csi, csi->stack[0]);
-			if (error) return fz_rethrow(error, "cannot draw text");
-		}
+	case OP2('T','J'):
+		if (csi->top != 1)
+			goto syntaxerror;
+		error = pdf_showtext(csi, csi->stack[0]);
+		if (error) return fz_rethrow(error, "cannot draw text");
+		break;
 
-		else if (!strcmp(buf, "Do"))
+	case OP2('D','o'):
 		{
 			fz_obj *dict;
 			fz_obj *obj;
@@ -891,6 +1065,15 @@ Lsetcolor:
 			if (!obj)
 				return fz_throw("cannot find xobject resource: %s", fz_toname(csi->stack[0]));
 
+			if (csi->measure)
+			{
+				clearstack(csi);
+				error = measurexobject(csi, xref, rdb, obj);
+				if (error)
+					return fz_rethrow(error, "cannot measure xobject");
+				return fz_okay;
+			}
+
 			img = pdf_finditem(xref->store, PDF_KIMAGE, obj);
 			xobj = pdf_finditem(xref->store, PDF_KXOBJECT, obj);
 
@@ -927,8 +1110,9 @@ Lsetcolor:
 					return fz_rethrow(error, "cannot draw xobject");
 			}
 		}
+		break;
 
-		else if (!strcmp(buf, "sh"))
+	case OP2('s','h'):
 		{
 			fz_obj *dict;
 			fz_obj *obj;
@@ -949,29 +1133,24 @@ Lsetcolor:
 			if (!shd)
 				return fz_throw("cannot find shade in store");
 
+			if (csi->measure)
+			{
+				error = pdf_measureshape(csi, FZ_NSHADE, fz_boundshade(shd, gstate->ctm), 1);
+				if (error) return fz_rethrow(error, "cannot measure shade");
+				return fz_okay;
+			}
+
 			error = pdf_addshade(gstate, shd);
 			if (error) return fz_rethrow(error, "cannot draw shade");
 		}
+		break;
 
-		else if (!strcmp(buf, "d0"))
-		{
-			fz_warn("unimplemented: d0 charprocs");
-		}
-
-		else if (!strcmp(buf, "d1"))
-		{
-		}
-
-		else
-		{
-			/* don't fail on unknown keywords if braced by BX/EX */
-			if (!csi->xbalance)
-				fz_warn("unknown keyword: %s", buf);
-		}
-	}
+	case OP2('d','0'):
+		fz_warn("unimplemented: d0 charprocs");
+		break;
 
-	else switch (buf[0])
-	{
+	case OP2('d','1'):
+		break;
 
 	case 'q':
 		if (csi->top != 0)
@@ -1235,6 +1414,79 @@ syntaxerror:
 	return fz_throw("syntaxerror near '%s'", buf);
 }
 
+/*
+ * Sort the keyword that just ran into path construction, clipping and
+ * painting for the operator recording of measure mode. The painting
+ * operators of the page itself get the byte range that produced them
+ * and can be cut out; everything else only moves the start along.
+ * Xobject names are recorded at every depth since forms without
+ * resources of their own use the names of the page.
+ */
+
+static fz_error *
+recordop(pdf_csi *csi, fz_stream *file, int op, fz_obj *name)
+{
+	fz_error *error;
+	int pos;
+
+	if (csi->depth > 0)
+	{
+		if (name)
+		{
+			error = pdf_recordop(csi, -1, -1, name);
+			if (error)
+				return fz_rethrow(error, "cannot record operator");
+		}
+		return fz_okay;
+	}
+
+	pos = fz_tell(file);
+
+	switch (op)
+	{
+	case 'm': case 'l': case 'c': case 'v': case 'y': case 'h':
+	case OP2('r','e'):
+		if (csi->pathstart < 0)
+			csi->pathstart = csi->opstart;
+		break;
+
+	case 'W': case OP2('W','*'):
+		csi->pathclip = 1;
+		break;
+
+	case 'S': case 's': case 'f': case 'F': case OP2('f','*'):
+	case 'B': case OP2('B','*'): case 'b': case OP2('b','*'):
+		/* a clip outlives its path so it has to stay */
+		if (!csi->pathclip)
+		{
+			error = pdf_recordop(csi,
+				csi->pathstart >= 0 ? csi->pathstart : csi->opstart,
+				pos, nil);
+			if (error)
+				return fz_rethrow(error, "cannot record operator");
+		}
+		csi->pathstart = -1;
+		csi->pathclip = 0;
+		break;
+
+	case 'n':
+		csi->pathstart = -1;
+		csi->pathclip = 0;
+		break;
+
+	case OP2('D','o'): case OP2('s','h'): case OP2('B','I'):
+		error = pdf_recordop(csi, csi->opstart, pos, name);
+		if (error)
+			return fz_rethrow(error, "cannot record operator");
+		break;
+	}
+
+	csi->opstart = pos;
+	csi->opbbox = fz_emptyrect;
+
+	return fz_okay;
+}
+
 fz_error *
 pdf_runcsi(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, fz_stream *file)
 {
@@ -1243,6 +1495,18 @@ pdf_runcsi(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, fz_stream *file)
 	pdf_token_e tok;
 	int len;
 	fz_obj *obj;
+	fz_obj *name;
+	int recording;
+	int op;
+
+	recording = csi->measure && csi->measure->recordops;
+	if (recording && csi->depth == 0)
+	{
+		csi->opstart = fz_tell(file);
+		csi->pathstart = -1;
+		csi->pathclip = 0;
+		csi->opbbox = fz_emptyrect;
+	}
 
 	while (1)
 	{
@@ -1263,7 +1527,7 @@ pdf_runcsi(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, fz_stream *file)
 			}
 			else if (tok == PDF_TINT || tok == PDF_TREAL)
 			{
-				error = fz_newreal(&obj, atof(buf));
+				error = fz_newreal(&obj, pdf_atof(buf));
 				if (error) return fz_rethrow(error, "cannot create number");
 				error = fz_arraypush(csi->array, obj);
 				fz_dropobj(obj);
@@ -1312,13 +1576,13 @@ pdf_runcsi(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, fz_stream *file)
 			break;
 
 		case PDF_TINT:
-			error = fz_newint(&csi->stack[csi->top], atoi(buf));
+			error = fz_newint(&csi->stack[csi->top], pdf_atoi(buf));
 			if (error) return fz_rethrow(error, "cannot create integer");
 			csi->top ++;
 			break;
 
 		case PDF_TREAL:
-			error = fz_newreal(&csi->stack[csi->top], atof(buf));
+			error = fz_newreal(&csi->stack[csi->top], pdf_atof(buf));
 			if (error) return fz_rethrow(error, "cannot create real");
 			csi->top ++;
 			break;
@@ -1348,7 +1612,8 @@ pdf_runcsi(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, fz_stream *file)
 			break;
 
 		case PDF_TKEYWORD:
-			if (!strcmp(buf, "BI"))
+			op = opcode(buf, len);
+			if (op == OP2('B','I'))
 			{
 				fz_obj *obj;
 
@@ -1366,13 +1631,37 @@ pdf_runcsi(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, fz_stream *file)
 				fz_dropobj(obj);
 				if (error)
 					return fz_rethrow(error, "cannot parse inline image");
+
+				if (recording)
+				{
+					error = recordop(csi, file, op, nil);
+					if (error)
+						return fz_rethrow(error, "cannot record inline image");
+				}
 			}
 			else
 			{
-				error = runkeyword(csi, xref, rdb, buf);
+				name = nil;
+				if (recording && op == OP2('D','o') && csi->top == 1)
+					name = fz_keepobj(csi->stack[0]);
+
+				error = runkeyword(csi, xref, rdb, op, buf);
 				if (error)
+				{
+					if (name)
+						fz_dropobj(name);
 					return fz_rethrow(error, "cannot run '%s'", buf);
+				}
 				clearstack(csi);
+
+				if (recording)
+				{
+					error = recordop(csi, file, op, name);
+					if (name)
+						fz_dropobj(name);
+					if (error)
+						return fz_rethrow(error, "cannot record '%s'", buf);
+				}
 			}
 			break;
 
@@ -6,45 +6,64 @@
  * have to check for file errors with fz_readerror() after lexing.
  */
 
-static inline int iswhite(int ch)
-{
-	return
-		ch == '\000' ||
-		ch == '\011' ||
-		ch == '\012' ||
-		ch == '\014' ||
-		ch == '\015' ||
-		ch == '\040';
-}
+/*
+ * character classes, one table lookup instead of a chain of compares
+ */
 
-static inline int isdelim(int ch)
+enum
 {
-	return
-		ch == '(' || ch == ')' ||
-		ch == '<' || ch == '>' ||
-		ch == '[' || ch == ']' ||
-		ch == '{' || ch == '}' ||
-		ch == '/' ||
-		ch == '%';
-}
-
-static inline int isregular(int ch)
+	W = 1,	/* white space */
+	D = 2,	/* delimiter */
+	N = 4,	/* can start or continue a number */
+	H = 8,	/* hex digit */
+	R = 16	/* regular: neither white space nor delimiter */
+};
+
+static const unsigned char ctype[256] =
 {
-	return !isdelim(ch) && !iswhite(ch) && ch != EOF;
-}
-
-static inline int isnumber(int ch)
+	W,     R,     R,     R,     R,     R,     R,     R,	/* 0x00 */
+	R,     W,     W,     R,     W,     W,     R,     R,	/* 0x08 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0x10 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0x18 */
+	W,     R,     R,     R,     R,     D,     R,     R,	/* 0x20 */
+	D,     D,     R,     R|N,   R,     R|N,   R|N,   D,	/* 0x28 */
+	R|N|H, R|N|H, R|N|H, R|N|H, R|N|H, R|N|H, R|N|H, R|N|H,	/* 0x30 */
+	R|N|H, R|N|H, R,     R,     D,     R,     D,     R,	/* 0x38 */
+	R,     R|H,   R|H,   R|H,   R|H,   R|H,   R|H,   R,	/* 0x40 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0x48 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0x50 */
+	R,     R,     R,     D,     R,     D,     R,     R,	/* 0x58 */
+	R,     R|H,   R|H,   R|H,   R|H,   R|H,   R|H,   R,	/* 0x60 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0x68 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0x70 */
+	R,     R,     R,     D,     R,     D,     R,     R,	/* 0x78 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0x80 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0x88 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0x90 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0x98 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0xa0 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0xa8 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0xb0 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0xb8 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0xc0 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0xc8 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0xd0 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0xd8 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0xe0 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0xe8 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0xf0 */
+	R,     R,     R,     R,     R,     R,     R,     R,	/* 0xf8 */
+};
+
+static inline int isclass(int ch, int cls)
 {
-	return ch == '+' || ch == '-' || ch == '.' || (ch >= '0' && ch <= '9');
+	return ch != EOF && (ctype[ch] & cls);
 }
 
-static inline int ishex(int ch)
-{
-	return
-		(ch >= '0' && ch <= '9') ||
-		(ch >= 'A' && ch <= 'F') ||
-		(ch >= 'a' && ch <= 'f');
-}
+#define iswhite(ch) isclass(ch, W)
+#define isregular(ch) isclass(ch, R)
+#define isnumber(ch) isclass(ch, N)
+#define ishex(ch) isclass(ch, H)
 
 static inline int fromhex(int ch)
 {
@@ -57,25 +76,46 @@ static inline int fromhex(int ch)
 	return 0;
 }
 
+/*
+ * The scanners below work on the stream buffer directly and only go
+ * through fz_peekbyte (which refills it) when they run off its end.
+ */
+
 static inline void
 lexwhite(fz_stream *f)
 {
-	int c;
+	fz_buffer *b;
+	unsigned char *p;
+
 	while (1)
 	{
-		c = fz_peekbyte(f);
-		if (!iswhite(c))
-			break;
-		fz_readbyte(f);
+		b = f->buffer;
+		for (p = b->rp; p < b->wp && (ctype[*p] & W); p++)
+			;
+		b->rp = p;
+		if (p < b->wp || !iswhite(fz_peekbyte(f)))
+			return;
 	}
 }
 
 static inline void
 lexcomment(fz_stream *f)
 {
+	fz_buffer *b;
+	unsigned char *p;
 	int c;
+
 	while (1)
 	{
+		b = f->buffer;
+		for (p = b->rp; p < b->wp && *p != '\012' && *p != '\015'; p++)
+			;
+		b->rp = p;
+		if (p < b->wp)
+		{
+			b->rp ++;
+			return;
+		}
 		c = fz_readbyte(f);
 		if (c == '\012') break;
 		if (c == '\015') break;
@@ -83,34 +123,53 @@ lexcomment(fz_stream *f)
 	}
 }
 
-static void
-lexnumber(fz_stream *f, char *s, int n)
+/* copy bytes of class cls to s, at most n - 1, and terminate */
+static int
+lexclass(fz_stream *f, char *s, int n, int cls)
 {
+	fz_buffer *b;
+	unsigned char *p, *e;
+	char *s0 = s;
+
 	while (n > 1)
 	{
-		if (!isnumber(fz_peekbyte(f)))
+		b = f->buffer;
+		e = b->wp;
+		if (e - b->rp > n - 1)
+			e = b->rp + n - 1;
+		for (p = b->rp; p < e && (ctype[*p] & cls); p++)
+			*s++ = *p;
+		n -= p - b->rp;
+		b->rp = p;
+		if (p < b->wp || n <= 1)
+			break;
+		if (!isclass(fz_peekbyte(f), cls))
 			break;
-		*s++ = fz_readbyte(f);
-		n--;
 	}
+
 	*s = '\0';
+	return s - s0;
 }
 
-static void
+static int
+lexnumber(fz_stream *f, char *s, int n)
+{
+	return lexclass(f, s, n, N);
+}
+
+static int
 lexname(fz_stream *f, char *s, int n)
 {
-	char *p = s;
-	char *q = s;
+	char *p, *q;
+	int len;
 
-	while (n > 1)
-	{
-		if (!isregular(fz_peekbyte(f)))
-			break;
-		*s++ = fz_readbyte(f);
-		n--;
-	}
-	*s = '\0';
+	len = lexclass(f, s, n, R);
 
+	p = memchr(s, '#', len);
+	if (!p)
+		return len;
+
+	q = p;
 	while (*p)
 	{
 		if (p[0] == '#' && p[1] != 0 && p[2] != 0)
@@ -122,6 +181,8 @@ lexname(fz_stream *f, char *s, int n)
 			*q++ = *p++;
 	}
 	*q = '\0';
+
+	return strlen(s);
 }
 
 static int
@@ -135,6 +196,18 @@ lexstring(fz_stream *f, char *buf, int n)
 
 	while (s < e)
 	{
+		/* copy runs of plain bytes straight from the buffer */
+		fz_buffer *b = f->buffer;
+		unsigned char *p = b->rp;
+		unsigned char *pe = b->wp;
+		if (pe - p > e - s)
+			pe = p + (e - s);
+		while (p < pe && *p != '(' && *p != ')' && *p != '\\')
+			*s++ = *p++;
+		b->rp = p;
+		if (s == e)
+			break;
+
 		c = fz_readbyte(f);
 		if (c == '(')
 		{
@@ -235,19 +308,26 @@ lexhexstring(fz_stream *f, char *buf, int n)
 static pdf_token_e
 tokenfromkeyword(char *key)
 {
-	if (!strcmp(key, "R")) return PDF_TR;
-	if (!strcmp(key, "true")) return PDF_TTRUE;
-	if (!strcmp(key, "false")) return PDF_TFALSE;
-	if (!strcmp(key, "null")) return PDF_TNULL;
-
-	if (!strcmp(key, "obj")) return PDF_TOBJ;
-	if (!strcmp(key, "endobj")) return PDF_TENDOBJ;
-	if (!strcmp(key, "stream")) return PDF_TSTREAM;
-	if (!strcmp(key, "endstream")) return PDF_TENDSTREAM;
-
-	if (!strcmp(key, "xref")) return PDF_TXREF;
-	if (!strcmp(key, "trailer")) return PDF_TTRAILER;
-	if (!strcmp(key, "startxref")) return PDF_TSTARTXREF;
+	switch (*key)
+	{
+	case 'R': if (!strcmp(key, "R")) return PDF_TR; break;
+	case 't':
+		if (!strcmp(key, "true")) return PDF_TTRUE;
+		if (!strcmp(key, "trailer")) return PDF_TTRAILER;
+		break;
+	case 'f': if (!strcmp(key, "false")) return PDF_TFALSE; break;
+	case 'n': if (!strcmp(key, "null")) return PDF_TNULL; break;
+	case 'o': if (!strcmp(key, "obj")) return PDF_TOBJ; break;
+	case 'e':
+		if (!strcmp(key, "endobj")) return PDF_TENDOBJ;
+		if (!strcmp(key, "endstream")) return PDF_TENDSTREAM;
+		break;
+	case 's':
+		if (!strcmp(key, "stream")) return PDF_TSTREAM;
+		if (!strcmp(key, "startxref")) return PDF_TSTARTXREF;
+		break;
+	case 'x': if (!strcmp(key, "xref")) return PDF_TXREF; break;
+	}
 
 	return PDF_TKEYWORD;
 }
@@ -262,37 +342,33 @@ pdf_lex(pdf_token_e *tok, fz_stream *f, char *buf, int n, int *sl)
 	{
 		c = fz_peekbyte(f);
 
-		if (c == EOF)
+		switch (c)
 		{
+		case EOF:
 			*tok = PDF_TEOF;
 			goto cleanupokay;
-		}
 
-		else if (iswhite(c))
+		case '\000': case '\011': case '\012': case '\014': case '\015': case ' ':
 			lexwhite(f);
+			break;
 
-		else if (c == '%')
+		case '%':
 			lexcomment(f);
+			break;
 
-		else if (c == '/')
-		{
+		case '/':
 			fz_readbyte(f);
-			lexname(f, buf, n);
-			*sl = strlen(buf);
+			*sl = lexname(f, buf, n);
 			*tok = PDF_TNAME;
 			goto cleanupokay;
-		}
 
-		else if (c == '(')
-		{
+		case '(':
 			fz_readbyte(f);
 			*sl = lexstring(f, buf, n);
 			*tok = PDF_TSTRING;
 			goto cleanupokay;
-		}
 
-		else if (c == '<')
-		{
+		case '<':
 			fz_readbyte(f);
 			c = fz_peekbyte(f);
 			if (c == '<')
@@ -301,16 +377,11 @@ pdf_lex(pdf_token_e *tok, fz_stream *f, char *buf, int n, int *sl)
 				*tok = PDF_TODICT;
 				goto cleanupokay;
 			}
-			else
-			{
-				*sl = lexhexstring(f, buf, n);
-				*tok = PDF_TSTRING;
-				goto cleanupokay;
-			}
-		}
+			*sl = lexhexstring(f, buf, n);
+			*tok = PDF_TSTRING;
+			goto cleanupokay;
 
-		else if (c == '>')
-		{
+		case '>':
 			fz_readbyte(f);
 			c = fz_readbyte(f);
 			if (c == '>')
@@ -320,59 +391,46 @@ pdf_lex(pdf_token_e *tok, fz_stream *f, char *buf, int n, int *sl)
 			}
 			*tok = PDF_TERROR;
 			goto cleanuperror;
-		}
 
-		else if (c == '[')
-		{
+		case '[':
 			fz_readbyte(f);
 			*tok = PDF_TOARRAY;
 			goto cleanupokay;
-		}
 
-		else if (c == ']')
-		{
+		case ']':
 			fz_readbyte(f);
 			*tok = PDF_TCARRAY;
 			goto cleanupokay;
-		}
 
-		else if (c == '{')
-		{
+		case '{':
 			fz_readbyte(f);
 			*tok = PDF_TOBRACE;
 			goto cleanupokay;
-		}
 
-		else if (c ==  '}')
-		{
+		case '}':
 			fz_readbyte(f);
 			*tok = PDF_TCBRACE;
 			goto cleanupokay;
-		}
 
-		else if (isnumber(c))
-		{
-			lexnumber(f, buf, n);
-			*sl = strlen(buf);
-			if (strchr(buf, '.'))
+		case '+': case '-': case '.':
+		case '0': case '1': case '2': case '3': case '4':
+		case '5': case '6': case '7': case '8': case '9':
+			*sl = lexnumber(f, buf, n);
+			if (memchr(buf, '.', *sl))
 			{
 				*tok = PDF_TREAL;
 				goto cleanupokay;
 			}
 			*tok = PDF_TINT;
 			goto cleanupokay;
-		}
 
-		else if (isregular(c))
-		{
-			lexname(f, buf, n);
-			*sl = strlen(buf);
-			*tok = tokenfromkeyword(buf);
-			goto cleanupokay;
-		}
-
-		else
-		{
+		default:
+			if (isregular(c))
+			{
+				*sl = lexname(f, buf, n);
+				*tok = tokenfromkeyword(buf);
+				goto cleanupokay;
+			}
 			*tok = PDF_TERROR;
 			goto cleanuperror;
 		}
@@ -398,3 +456,68 @@ cleanuperror:
 	return fz_throw("lexical error");
 }
 
+/*
+ * Number tokens are short and simple, so convert the common forms
+ * here and leave anything unusual to the C library.
+ */
+
+int
+pdf_atoi(char *s)
+{
+	char *p = s;
+	int neg = 0;
+	int v = 0;
+	int i;
+
+	if (*p == '-' || *p == '+')
+		neg = *p++ == '-';
+
+	for (i = 0; i < 9 && *p >= '0' && *p <= '9'; i++)
+		v = v * 10 + (*p++ - '0');
+
+	if (*p >= '0' && *p <= '9')
+		return atoi(s);
+
+	return neg ? -v : v;
+}
+
+float
+pdf_atof(char *s)
+{
+	static const double pow10[] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+		1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+	};
+	char *p = s;
+	int neg = 0;
+	int digits = 0;
+	int frac = -1;
+	double v = 0;
+
+	if (*p == '-' || *p == '+')
+		neg = *p++ == '-';
+
+	/* at most 15 digits are exact in a double, so v / 10^frac
+	   rounds the same as strtod */
+	for (; *p; p++)
+	{
+		if (*p >= '0' && *p <= '9')
+		{
+			if (++digits > 15)
+				return atof(s);
+			v = v * 10 + (*p - '0');
+			if (frac >= 0)
+				frac ++;
+		}
+		else if (*p == '.' && frac < 0)
+			frac = 0;
+		else
+			return atof(s);
+	}
+
+	if (frac > 0)
+		v /= pow10[frac];
+
+	return neg ? -v : v;
+}
@@ -102,6 +102,9 @@ pdf_loadnametrees(pdf_xref *xref)
 	fz_obj *names;
 	fz_obj *dests;
 
+	if (xref->dests)
+		return fz_okay;
+
 	/* PDF 1.1 */
 	dests = fz_dictgets(xref->root, "Dests");
 	if (dests)
@@ -133,6 +136,14 @@ pdf_loadnametrees(pdf_xref *xref)
 		fz_dropobj(names);
 	}
 
+	/* an empty table tells later lookups not to look again */
+	if (!xref->dests)
+	{
+		error = fz_newdict(&xref->dests, 1);
+		if (error)
+			return fz_rethrow(error, "cannot create empty name tree");
+	}
+
 	return fz_okay;
 }
 
@@ -199,6 +199,94 @@ readtrailer(pdf_xref *xref, char *buf, int cap)
  * xref tables
  */
 
+/*
+ * Classic xref entries are fixed width records, "oooooooooo ggggg n"
+ * followed by a two byte end of line. Decode them straight out of the
+ * stream buffer, eight offset digits at a time with SWAR arithmetic.
+ * Records that are not all digits (leading blanks and the like) fall
+ * back to atoi as before.
+ */
+
+static inline unsigned long long
+loaddigits(unsigned char *s)
+{
+	return
+		(unsigned long long) s[0] | (unsigned long long) s[1] << 8 |
+		(unsigned long long) s[2] << 16 | (unsigned long long) s[3] << 24 |
+		(unsigned long long) s[4] << 32 | (unsigned long long) s[5] << 40 |
+		(unsigned long long) s[6] << 48 | (unsigned long long) s[7] << 56;
+}
+
+static inline int
+isdigits(unsigned long long v)
+{
+	return (((v - 0x3030303030303030ULL) | (v + 0x4646464646464646ULL)) &
+		0x8080808080808080ULL) == 0;
+}
+
+static inline unsigned int
+parsedigits(unsigned long long v)
+{
+	v -= 0x3030303030303030ULL;
+	v = (v * 10 + (v >> 8)) & 0x00FF00FF00FF00FFULL;
+	v = (v * 100 + (v >> 16)) & 0x0000FFFF0000FFFFULL;
+	v = (v * 10000 + (v >> 32)) & 0x00000000FFFFFFFFULL;
+	return (unsigned int) v;
+}
+
+static void
+parseoldentry(pdf_xrefentry *x, unsigned char *s)
+{
+	unsigned long long lo = loaddigits(s + 2);
+	unsigned int d0 = s[0] - '0', d1 = s[1] - '0';
+	unsigned int g0 = s[11] - '0', g1 = s[12] - '0', g2 = s[13] - '0';
+	unsigned int g3 = s[14] - '0', g4 = s[15] - '0';
+
+	if (isdigits(lo) && (d0 | d1 | g0 | g1 | g2 | g3 | g4) < 10)
+	{
+		x->ofs = (d0 * 10 + d1) * 100000000 + parsedigits(lo);
+		x->gen = (((g0 * 10 + g1) * 10 + g2) * 10 + g3) * 10 + g4;
+	}
+	else
+	{
+		x->ofs = atoi((char *) s);
+		x->gen = atoi((char *) s + 11);
+	}
+	x->type = s[17];
+}
+
+static fz_error *
+readoldxrefsection(pdf_xref *xref, int ofs, int len)
+{
+	fz_error *error;
+	fz_buffer *buf = xref->file->buffer;
+	int i, n;
+
+	i = 0;
+	while (i < len)
+	{
+		n = (buf->wp - buf->rp) / 20;
+		if (n == 0)
+		{
+			if (buf->eof)
+				return fz_throw("truncated xref table");
+			error = fz_readimp(xref->file);
+			if (error)
+				return fz_rethrow(error, "cannot read xref table");
+			continue;
+		}
+
+		n = MIN(n, len - i);
+		for (; n > 0; n--, i++, buf->rp += 20)
+		{
+			if (!xref->table[ofs + i].type)
+				parseoldentry(xref->table + ofs + i, buf->rp);
+		}
+	}
+
+	return fz_okay;
+}
+
 static fz_error *
 readoldxref(fz_obj **trailerp, pdf_xref *xref, char *buf, int cap)
 {
@@ -246,7 +334,7 @@ readoldxref(fz_obj **trailerp, pdf_xref *xref, char *buf, int cap)
 		if ((ofs + len) > xref->cap)
 		{
 			fz_warn("broken xref section, proceeding anyway.");
-			xref->cap = ofs + len;
+			xref->cap = MAX(ofs + len, xref->cap * 2);
 			xref->table = fz_realloc(xref->table, xref->cap * sizeof(pdf_xrefentry));
 			if (!xref->table)
 				return fz_throw("outofmem: xref table");
@@ -262,24 +350,15 @@ readoldxref(fz_obj **trailerp, pdf_xref *xref, char *buf, int cap)
 				xref->table[i].mark = 0;
 				xref->table[i].stmbuf = nil;
 				xref->table[i].stmofs = 0;
+				xref->table[i].stmxref = nil;
 				xref->table[i].obj = nil;
 			}
 			xref->len = ofs + len;
 		}
 
-		for (i = 0; i < len; i++)
-		{
-			error = fz_read(&n, xref->file, (unsigned char *) buf, 20);
-			if (error)
-				return fz_rethrow(error, "cannot read xref table");
-			if (!xref->table[ofs + i].type)
-			{
-				s = buf;
-				xref->table[ofs + i].ofs = atoi(s);
-				xref->table[ofs + i].gen = atoi(s + 11);
-				xref->table[ofs + i].type = s[17];
-			}
-		}
+		error = readoldxrefsection(xref, ofs, len);
+		if (error)
+			return fz_rethrow(error, "cannot read xref table");
 	}
 
 	error = pdf_lex(&tok, xref->file, buf, cap, &n);
@@ -523,116 +602,227 @@ readxrefsections(pdf_xref *xref, int ofs, char *buf, int cap)
  * compressed object streams
  */
 
-fz_error *
-pdf_loadobjstm(pdf_xref *xref, int oid, int gen, char *buf, int cap)
+static void
+dropobjstm(pdf_objstm *os)
+{
+	if (os->buf)
+		fz_dropbuffer(os->buf);
+	fz_free(os->ofs);
+	fz_free(os->oids);
+	fz_free(os);
+}
+
+void
+pdf_dropobjstms(pdf_xref *xref)
+{
+	int i;
+
+	for (i = 0; i < PDF_OBJSTMCACHE; i++)
+	{
+		if (xref->objstms[i])
+		{
+			dropobjstm(xref->objstms[i]);
+			xref->objstms[i] = nil;
+		}
+	}
+}
+
+/*
+ * decode an object stream and read the object number / offset
+ * pairs from its header.
+ */
+static fz_error *
+decodeobjstm(pdf_objstm **osp, pdf_xref *xref, int oid, char *buf, int cap)
 {
 	fz_error *error;
 	fz_stream *stm;
 	fz_obj *objstm;
-	int *oidbuf;
-	int *ofsbuf;
-
-	fz_obj *obj;
+	pdf_objstm *os;
 	int first;
-	int count;
 	int i, n;
 	pdf_token_e tok;
 
-	pdf_logxref("loadobjstm %d %d\n", oid, gen);
+	pdf_logxref("decodeobjstm %d\n", oid);
 
-	error = pdf_loadobject(&objstm, xref, oid, gen);
+	error = pdf_loadobject(&objstm, xref, oid, 0);
 	if (error)
 		return fz_rethrow(error, "cannot load object stream object");
 
-	count = fz_toint(fz_dictgets(objstm, "N"));
+	os = fz_malloc(sizeof(pdf_objstm));
+	if (!os)
+	{
+		fz_dropobj(objstm);
+		return fz_throw("outofmem: object stream struct");
+	}
+
+	os->oid = oid;
+	os->count = fz_toint(fz_dictgets(objstm, "N"));
+	os->oids = nil;
+	os->ofs = nil;
+	os->buf = nil;
 	first = fz_toint(fz_dictgets(objstm, "First"));
 
-	pdf_logxref("  count %d\n", count);
+	fz_dropobj(objstm);
+
+	pdf_logxref("  count %d\n", os->count);
 
-	oidbuf = fz_malloc(count * sizeof(int));
-	if (!oidbuf)
+	if (os->count < 0 || first < 0)
+	{
+		error = fz_throw("corrupt object stream (N=%d First=%d)", os->count, first);
+		goto cleanup;
+	}
+
+	os->oids = fz_malloc(MAX(os->count, 1) * sizeof(int));
+	if (!os->oids)
 	{
 		error = fz_throw("outofmem: object id buffer");
-		goto cleanupobj;
+		goto cleanup;
 	}
 
-	ofsbuf = fz_malloc(count * sizeof(int));
-	if (!ofsbuf)
+	os->ofs = fz_malloc(MAX(os->count, 1) * sizeof(int));
+	if (!os->ofs)
 	{
 		error = fz_throw("outofmem: offset buffer");
-		goto cleanupoid;
+		goto cleanup;
 	}
 
-	error = pdf_openstream(&stm, xref, oid, gen);
+	error = pdf_loadstream(&os->buf, xref, oid, 0);
+	if (error)
+	{
+		error = fz_rethrow(error, "cannot load object stream");
+		goto cleanup;
+	}
+
+	error = fz_openrbuffer(&stm, os->buf);
 	if (error)
 	{
 		error = fz_rethrow(error, "cannot open object stream");
-		goto cleanupofs;
+		goto cleanup;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = 0; i < os->count; i++)
 	{
 		error = pdf_lex(&tok, stm, buf, cap, &n);
 		if (error || tok != PDF_TINT)
 		{
 			error = fz_rethrow(error, "corrupt object stream");
-			goto cleanupstm;
+			fz_dropstream(stm);
+			goto cleanup;
 		}
-		oidbuf[i] = atoi(buf);
+		os->oids[i] = pdf_atoi(buf);
 
 		error = pdf_lex(&tok, stm, buf, cap, &n);
 		if (error || tok != PDF_TINT)
 		{
 			error = fz_rethrow(error, "corrupt object stream");
-			goto cleanupstm;
+			fz_dropstream(stm);
+			goto cleanup;
 		}
-		ofsbuf[i] = atoi(buf);
+		os->ofs[i] = first + pdf_atoi(buf);
 	}
 
-	error = fz_seek(stm, first, 0);
-	if (error)
+	fz_dropstream(stm);
+
+	*osp = os;
+	return fz_okay;
+
+cleanup:
+	dropobjstm(os);
+	return error; /* already rethrown */
+}
+
+/*
+ * find a decoded object stream, decoding it if it is not
+ * among the most recently used ones.
+ */
+static fz_error *
+findobjstm(pdf_objstm **osp, pdf_xref *xref, int oid, char *buf, int cap)
+{
+	fz_error *error;
+	pdf_objstm *os;
+	int i;
+
+	for (i = 0; i < PDF_OBJSTMCACHE; i++)
+		if (xref->objstms[i] && xref->objstms[i]->oid == oid)
+			break;
+
+	if (i < PDF_OBJSTMCACHE)
+	{
+		os = xref->objstms[i];
+	}
+	else
 	{
-		error = fz_rethrow(error, "cannot seek in object stream");
-		goto cleanupstm;
+		error = decodeobjstm(&os, xref, oid, buf, cap);
+		if (error)
+			return fz_rethrow(error, "cannot decode object stream %d", oid);
+
+		i = PDF_OBJSTMCACHE - 1;
+		if (xref->objstms[i])
+			dropobjstm(xref->objstms[i]);
 	}
 
-	for (i = 0; i < count; i++)
+	memmove(xref->objstms + 1, xref->objstms, i * sizeof(pdf_objstm*));
+	xref->objstms[0] = os;
+
+	*osp = os;
+	return fz_okay;
+}
+
+/*
+ * load object oid from the object stream that holds it
+ */
+fz_error *
+pdf_loadobjstm(pdf_xref *xref, int oid, char *buf, int cap)
+{
+	fz_error *error;
+	fz_stream *stm;
+	pdf_objstm *os;
+	pdf_xrefentry *x;
+	fz_obj *obj;
+	int i;
+
+	x = &xref->table[oid];
+
+	pdf_logxref("loadobjstm %d (in %d, index %d)\n", oid, x->ofs, x->gen);
+
+	error = findobjstm(&os, xref, x->ofs, buf, cap);
+	if (error)
+		return fz_rethrow(error, "cannot load object stream");
+
+	/* trust the index from the xref stream, but check it */
+	i = x->gen;
+	if (i >= os->count || os->oids[i] != oid)
 	{
-		/* FIXME: seek to first + ofsbuf[i] */
+		for (i = 0; i < os->count; i++)
+			if (os->oids[i] == oid)
+				break;
+		if (i == os->count)
+			return fz_throw("object %d not found in object stream %d", oid, os->oid);
+	}
 
-		error = pdf_parsestmobj(&obj, stm, buf, cap);
-		if (error)
-		{
-			error = fz_rethrow(error, "cannot parse object %d in stream", i);
-			goto cleanupstm;
-		}
+	if (os->ofs[i] < 0 || os->ofs[i] >= os->buf->wp - os->buf->bp)
+		return fz_throw("object %d offset (%d) out of range in object stream %d", oid, os->ofs[i], os->oid);
 
-		if (oidbuf[i] < 1 || oidbuf[i] >= xref->len)
-		{
-			error = fz_throw("object id (%d) out of range (0..%d)", oidbuf[i], xref->len - 1);
-			goto cleanupstm;
-		}
+	error = fz_openrbuffer(&stm, os->buf);
+	if (error)
+		return fz_rethrow(error, "cannot open object stream");
 
-		if (xref->table[oidbuf[i]].obj)
-			fz_dropobj(xref->table[oidbuf[i]].obj);
-		xref->table[oidbuf[i]].obj = obj;
+	error = fz_seek(stm, os->ofs[i], 0);
+	if (error)
+	{
+		fz_dropstream(stm);
+		return fz_rethrow(error, "cannot seek in object stream");
 	}
 
+	error = pdf_parsestmobj(&obj, stm, buf, cap);
 	fz_dropstream(stm);
-	fz_free(ofsbuf);
-	fz_free(oidbuf);
-	fz_dropobj(objstm);
-	return fz_okay;
+	if (error)
+		return fz_rethrow(error, "cannot parse object %d in stream", oid);
 
-cleanupstm:
-	fz_dropstream(stm);
-cleanupofs:
-	fz_free(ofsbuf);
-cleanupoid:
-	fz_free(oidbuf);
-cleanupobj:
-	fz_dropobj(objstm);
-	return error; /* already rethrown */
+	x->obj = obj;
+	pdf_countobject(xref, oid);
+
+	return fz_okay;
 }
 
 /*
@@ -697,6 +887,7 @@ pdf_loadxref2(pdf_xref *xref)
 		xref->table[i].mark = 0;
 		xref->table[i].stmbuf = nil;
 		xref->table[i].stmofs = 0;
+		xref->table[i].stmxref = nil;
 		xref->table[i].obj = nil;
 	}
 
@@ -723,7 +914,7 @@ pdf_loadxref(pdf_xref *xref, char *filename)
 	fz_error * error;    
 	pdf_logxref("loadxref '%s' %p\n", filename, xref);
 
-	error = fz_openrfile(&xref->file, filename);
+	error = fz_openrfilemmap(&xref->file, filename);
 	if (error)
 	{
 		return fz_rethrow(error, "cannot open file: '%s'", filename);
@@ -735,7 +926,7 @@ pdf_loadxref(pdf_xref *xref, char *filename)
 fz_error *
 pdf_loadxrefw(pdf_xref *xref, const wchar_t *filename)
 {
-	fz_error * error = fz_openrfilew(&xref->file, filename);
+	fz_error * error = fz_openrfilemmapw(&xref->file, filename);
 	if (error)
 	{
 		return fz_rethrow(error, "cannot open file");
@@ -107,15 +107,10 @@ cleanupbuf:
 }
 
 static fz_error *
-loadpagecontents(fz_tree **treep, pdf_xref *xref, fz_obj *rdb, fz_obj *ref)
+runpagecontents(pdf_csi *csi, pdf_xref *xref, fz_obj *rdb, fz_obj *ref)
 {
 	fz_error *error;
 	fz_obj *obj;
-	pdf_csi *csi;
-
-	error = pdf_newcsi(&csi, 0);
-	if (error)
-		return fz_rethrow(error, "cannot create interpreter");
 
 	if (fz_isindirect(ref))
 	{
@@ -136,10 +131,7 @@ loadpagecontents(fz_tree **treep, pdf_xref *xref, fz_obj *rdb, fz_obj *ref)
 		fz_dropobj(obj);
 
 		if (error)
-		{
-			pdf_dropcsi(csi);
 			return fz_rethrow(error, "cannot interpret page contents (%d)", fz_tonum(ref));
-		}
 	}
 
 	else if (fz_isarray(ref))
@@ -150,10 +142,27 @@ loadpagecontents(fz_tree **treep, pdf_xref *xref, fz_obj *rdb, fz_obj *ref)
 			error = runmany(csi, xref, rdb, ref);
 
 		if (error)
-		{
-			pdf_dropcsi(csi);
 			return fz_rethrow(error, "cannot interpret page contents (%d)", fz_tonum(ref));
-		}
+	}
+
+	return fz_okay;
+}
+
+static fz_error *
+loadpagecontents(fz_tree **treep, pdf_xref *xref, fz_obj *rdb, fz_obj *ref)
+{
+	fz_error *error;
+	pdf_csi *csi;
+
+	error = pdf_newcsi(&csi, 0);
+	if (error)
+		return fz_rethrow(error, "cannot create interpreter");
+
+	error = runpagecontents(csi, xref, rdb, ref);
+	if (error)
+	{
+		pdf_dropcsi(csi);
+		return fz_rethrow(error, "cannot run page contents");
 	}
 
 	*treep = csi->tree;
@@ -164,24 +173,12 @@ loadpagecontents(fz_tree **treep, pdf_xref *xref, fz_obj *rdb, fz_obj *ref)
 	return fz_okay;
 }
 
-fz_error *
-pdf_loadpage(pdf_page **pagep, pdf_xref *xref, fz_obj *dict)
+static fz_error *
+loadpagemedia(fz_rect *bboxp, int *rotatep, pdf_xref *xref, fz_obj *dict)
 {
 	fz_error *error;
 	fz_obj *obj;
-	pdf_page *page;
-	fz_obj *rdb;
-	pdf_comment *comments = nil;
-	pdf_link *links = nil;
-	fz_tree *tree = nil;
 	fz_rect bbox;
-	int rotate;
-
-	pdf_logpage("load page {\n");
-
-	/*
-	 * Sort out page media
-	 */
 
 	obj = fz_dictgets(dict, "CropBox");
 	if (!obj)
@@ -196,13 +193,44 @@ pdf_loadpage(pdf_page **pagep, pdf_xref *xref, fz_obj *dict)
 	pdf_logpage("bbox [%g %g %g %g]\n",
 			bbox.x0, bbox.y0, bbox.x1, bbox.y1);
 
+	bboxp->x0 = MIN(bbox.x0, bbox.x1);
+	bboxp->y0 = MIN(bbox.y0, bbox.y1);
+	bboxp->x1 = MAX(bbox.x0, bbox.x1);
+	bboxp->y1 = MAX(bbox.y0, bbox.y1);
+
 	obj = fz_dictgets(dict, "Rotate");
 	if (fz_isint(obj))
-		rotate = fz_toint(obj);
+		*rotatep = fz_toint(obj);
 	else
-		rotate = 0;
+		*rotatep = 0;
 
-	pdf_logpage("rotate %d\n", rotate);
+	pdf_logpage("rotate %d\n", *rotatep);
+
+	return fz_okay;
+}
+
+fz_error *
+pdf_loadpage(pdf_page **pagep, pdf_xref *xref, fz_obj *dict)
+{
+	fz_error *error;
+	fz_obj *obj;
+	pdf_page *page;
+	fz_obj *rdb;
+	pdf_comment *comments = nil;
+	pdf_link *links = nil;
+	fz_tree *tree = nil;
+	fz_rect bbox;
+	int rotate;
+
+	pdf_logpage("load page {\n");
+
+	/*
+	 * Sort out page media
+	 */
+
+	error = loadpagemedia(&bbox, &rotate, xref, dict);
+	if (error)
+		return fz_rethrow(error, "cannot load page media");
 
 	/*
 	 * Load annotations
@@ -273,10 +301,7 @@ pdf_loadpage(pdf_page **pagep, pdf_xref *xref, fz_obj *dict)
 		return fz_throw("outofmem: page struct");
 	}
 
-	page->mediabox.x0 = MIN(bbox.x0, bbox.x1);
-	page->mediabox.y0 = MIN(bbox.y0, bbox.y1);
-	page->mediabox.x1 = MAX(bbox.x0, bbox.x1);
-	page->mediabox.y1 = MAX(bbox.y0, bbox.y1);
+	page->mediabox = bbox;
 	page->rotate = rotate;
 	page->resources = rdb;
 	page->tree = tree;
@@ -290,6 +315,391 @@ pdf_loadpage(pdf_page **pagep, pdf_xref *xref, fz_obj *dict)
 	return fz_okay;
 }
 
+/*
+ * Load the page contents into one buffer, the way runmany joins them.
+ */
+static fz_error *
+loadcontentbuffer(fz_buffer **bufp, pdf_xref *xref, fz_obj *ref)
+{
+	fz_error *error;
+	fz_stream *file;
+	fz_buffer *big;
+	fz_buffer *one;
+	fz_obj *list = nil;
+	fz_obj *obj = nil;
+	fz_obj *stm;
+	int i;
+
+	if (fz_isindirect(ref))
+	{
+		error = pdf_loadindirect(&obj, xref, ref);
+		if (error)
+			return fz_rethrow(error, "cannot load page contents (%d)", fz_tonum(ref));
+
+		if (!fz_isarray(obj))
+		{
+			fz_dropobj(obj);
+			error = pdf_loadstream(bufp, xref, fz_tonum(ref), fz_togen(ref));
+			if (error)
+				return fz_rethrow(error, "cannot load content stream %d", fz_tonum(ref));
+			return fz_okay;
+		}
+
+		list = obj;
+	}
+	else if (fz_isarray(ref))
+		list = ref;
+
+	error = fz_newbuffer(&big, 32 * 1024);
+	if (error)
+	{
+		if (obj)
+			fz_dropobj(obj);
+		return fz_rethrow(error, "cannot create content buffer");
+	}
+
+	error = fz_openwbuffer(&file, big);
+	if (error)
+	{
+		error = fz_rethrow(error, "cannot open content buffer (write)");
+		goto cleanupbuf;
+	}
+
+	for (i = 0; list && i < fz_arraylen(list); i++)
+	{
+		stm = fz_arrayget(list, i);
+		error = pdf_loadstream(&one, xref, fz_tonum(stm), fz_togen(stm));
+		if (error)
+		{
+			error = fz_rethrow(error, "cannot load content stream");
+			goto cleanupstm;
+		}
+
+		error = fz_write(file, one->rp, one->wp - one->rp);
+		fz_dropbuffer(one);
+		if (error)
+		{
+			error = fz_rethrow(error, "cannot write to content buffer");
+			goto cleanupstm;
+		}
+
+		error = fz_printstr(file, " ");
+		if (error)
+		{
+			error = fz_rethrow(error, "cannot write to content buffer");
+			goto cleanupstm;
+		}
+	}
+
+	fz_dropstream(file);
+	if (obj)
+		fz_dropobj(obj);
+
+	*bufp = big;
+	return fz_okay;
+
+cleanupstm:
+	fz_dropstream(file);
+cleanupbuf:
+	fz_dropbuffer(big);
+	if (obj)
+		fz_dropobj(obj);
+	return error; /* already rethrown */
+}
+
+/*
+ * Run the page contents in measure mode. This gives the bounding
+ * boxes the display tree would have had, without building the tree,
+ * decoding images or loading patterns and annotations.
+ */
+static fz_error *
+measurepage(pdf_measure **measurep, pdf_xref *xref, fz_obj *dict, fz_buffer *contents)
+{
+	fz_error *error;
+	fz_obj *obj;
+	fz_obj *rdb;
+	fz_stream *file;
+	pdf_measure *measure;
+	pdf_csi *csi;
+
+	pdf_logpage("measure page {\n");
+
+	error = pdf_newmeasure(&measure);
+	if (error)
+		return fz_rethrow(error, "cannot create page measure");
+
+	measure->recordops = contents != nil;
+
+	error = loadpagemedia(&measure->mediabox, &measure->rotate, xref, dict);
+	if (error)
+	{
+		pdf_dropmeasure(measure);
+		return fz_rethrow(error, "cannot load page media");
+	}
+
+	obj = fz_dictgets(dict, "Resources");
+	if (!obj)
+	{
+		fz_warn("cannot find page resources, proceeding anyway.");
+		error = fz_newdict(&obj, 0);
+		if (error)
+		{
+			pdf_dropmeasure(measure);
+			return fz_rethrow(error, "cannot create fake page resources");
+		}
+	}
+	error = pdf_resolve(&obj, xref);
+	if (error)
+	{
+		pdf_dropmeasure(measure);
+		return fz_rethrow(error, "cannot resolve page resources");
+	}
+	error = pdf_loadmeasureresources(&rdb, xref, obj);
+	fz_dropobj(obj);
+	if (error)
+	{
+		pdf_dropmeasure(measure);
+		return fz_rethrow(error, "cannot load page resources");
+	}
+
+	error = pdf_newmeasurecsi(&csi, measure);
+	if (error)
+	{
+		fz_dropobj(rdb);
+		pdf_dropmeasure(measure);
+		return fz_rethrow(error, "cannot create interpreter");
+	}
+
+	if (contents)
+	{
+		contents->rp = contents->bp;
+		error = fz_openrbuffer(&file, contents);
+		if (!error)
+		{
+			error = pdf_runcsi(csi, xref, rdb, file);
+			fz_dropstream(file);
+		}
+	}
+	else
+	{
+		obj = fz_dictgets(dict, "Contents");
+		error = runpagecontents(csi, xref, rdb, obj);
+	}
+
+	pdf_dropcsi(csi);
+	fz_dropobj(rdb);
+	if (error)
+	{
+		pdf_dropmeasure(measure);
+		return fz_rethrow(error, "cannot measure page contents");
+	}
+
+	pdf_logpage("} %d shapes\n", measure->len);
+
+	*measurep = measure;
+	return fz_okay;
+}
+
+fz_error *
+pdf_measurepage(pdf_measure **measurep, pdf_xref *xref, fz_obj *dict)
+{
+	fz_error *error;
+	error = measurepage(measurep, xref, dict, nil);
+	if (error)
+		return fz_rethrow(error, "cannot measure page");
+	return fz_okay;
+}
+
+/*
+ * Measure the page and record its painting operators. The contents
+ * are returned joined into one buffer; the recorded byte ranges are
+ * offsets into it.
+ */
+fz_error *
+pdf_measurepageops(pdf_measure **measurep, fz_buffer **contentsp, pdf_xref *xref, fz_obj *dict)
+{
+	fz_error *error;
+	fz_buffer *contents;
+
+	error = loadcontentbuffer(&contents, xref, fz_dictgets(dict, "Contents"));
+	if (error)
+		return fz_rethrow(error, "cannot load page contents");
+
+	error = measurepage(measurep, xref, dict, contents);
+	if (error)
+	{
+		fz_dropbuffer(contents);
+		return fz_rethrow(error, "cannot measure page");
+	}
+
+	*contentsp = contents;
+	return fz_okay;
+}
+
+static int
+isprunedop(pdf_measureop *op, fz_rect rect)
+{
+	return op->start >= 0 && fz_isemptyrect(fz_intersectrects(op->bbox, rect));
+}
+
+/*
+ * Copy the contents without the painting operators that leave
+ * nothing inside rect. Gives nil if there is nothing to cut.
+ * Text objects are never cut, since the text state and position
+ * carry over from one text operator to the next.
+ */
+fz_error *
+pdf_prunecontents(fz_buffer **bufp, fz_buffer *contents, pdf_measure *measure, fz_rect rect)
+{
+	fz_error *error;
+	fz_buffer *buf;
+	pdf_measureop *op;
+	int len = contents->wp - contents->bp;
+	int pos;
+	int i;
+
+	*bufp = nil;
+
+	for (i = 0; i < measure->oplen; i++)
+		if (isprunedop(&measure->ops[i], rect))
+			break;
+	if (i == measure->oplen)
+		return fz_okay;
+
+	error = fz_newbuffer(&buf, len + 1);
+	if (error)
+		return fz_rethrow(error, "cannot create content buffer");
+
+	pos = 0;
+	for (; i < measure->oplen; i++)
+	{
+		op = &measure->ops[i];
+		if (!isprunedop(op, rect) || op->start < pos || op->end > len)
+			continue;
+		memcpy(buf->wp, contents->bp + pos, op->start - pos);
+		buf->wp += op->start - pos;
+		*buf->wp++ = ' ';
+		pos = op->end;
+	}
+	memcpy(buf->wp, contents->bp + pos, len - pos);
+	buf->wp += len - pos;
+
+	*bufp = buf;
+	return fz_okay;
+}
+
+/*
+ * Copy the page resources without the xobjects whose every use
+ * pdf_prunecontents cuts. Gives nil if there is nothing to drop.
+ */
+fz_error *
+pdf_pruneresources(fz_obj **rdbp, pdf_xref *xref, fz_obj *rdb, pdf_measure *measure, fz_rect rect)
+{
+	fz_error *error;
+	fz_obj *xobj = nil;
+	fz_obj *newxobj = nil;
+	fz_obj *newrdb = nil;
+	fz_obj *key;
+	pdf_measureop *op;
+	int used, pruned;
+	int i, k;
+
+	*rdbp = nil;
+
+	if (!rdb)
+		return fz_okay;
+
+	rdb = fz_keepobj(rdb);
+	error = pdf_resolve(&rdb, xref);
+	if (error)
+		return fz_rethrow(error, "cannot resolve page resources");
+
+	xobj = fz_dictgets(rdb, "XObject");
+	if (!xobj)
+	{
+		fz_dropobj(rdb);
+		return fz_okay;
+	}
+
+	xobj = fz_keepobj(xobj);
+	error = pdf_resolve(&xobj, xref);
+	if (error)
+	{
+		fz_dropobj(rdb);
+		return fz_rethrow(error, "cannot resolve xobject dictionary");
+	}
+
+	for (k = 0; k < fz_dictlen(xobj); k++)
+	{
+		key = fz_dictgetkey(xobj, k);
+
+		used = 0;
+		pruned = 0;
+		for (i = 0; i < measure->oplen; i++)
+		{
+			op = &measure->ops[i];
+			if (op->name && !strcmp(fz_toname(op->name), fz_toname(key)))
+			{
+				used ++;
+				if (isprunedop(op, rect))
+					pruned ++;
+			}
+		}
+
+		if (used == 0 || pruned < used)
+			continue;
+
+		if (!newxobj)
+		{
+			error = fz_copydict(&newxobj, xobj);
+			if (error)
+			{
+				error = fz_rethrow(error, "cannot copy xobject dictionary");
+				goto cleanup;
+			}
+		}
+
+		error = fz_dictdel(newxobj, key);
+		if (error)
+		{
+			error = fz_rethrow(error, "cannot remove xobject");
+			goto cleanup;
+		}
+	}
+
+	if (newxobj)
+	{
+		error = fz_copydict(&newrdb, rdb);
+		if (error)
+		{
+			error = fz_rethrow(error, "cannot copy page resources");
+			goto cleanup;
+		}
+
+		error = fz_dictputs(newrdb, "XObject", newxobj);
+		if (error)
+		{
+			fz_dropobj(newrdb);
+			error = fz_rethrow(error, "cannot set xobject dictionary");
+			goto cleanup;
+		}
+
+		fz_dropobj(newxobj);
+		*rdbp = newrdb;
+	}
+
+	fz_dropobj(xobj);
+	fz_dropobj(rdb);
+	return fz_okay;
+
+cleanup:
+	if (newxobj)
+		fz_dropobj(newxobj);
+	fz_dropobj(xobj);
+	fz_dropobj(rdb);
+	return error; /* already rethrown */
+}
+
 void
 pdf_droppage(pdf_page *page)
 {
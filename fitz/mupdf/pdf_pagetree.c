@@ -55,6 +55,14 @@ loadpagetree(pdf_xref *xref, pdf_pagetree *pages,
 			if (error) return fz_rethrow(error, "cannot inherit page tree rotate");
 		}
 
+		if (pages->cursor >= pages->count)
+			return fz_throw("page tree has more pages than its /Count");
+
+		if (pages->pref[pages->cursor])
+			fz_dropobj(pages->pref[pages->cursor]);
+		if (pages->pobj[pages->cursor])
+			fz_dropobj(pages->pobj[pages->cursor]);
+
 		pages->pref[pages->cursor] = fz_keepobj(ref);
 		pages->pobj[pages->cursor] = fz_keepobj(obj);
 		pages->cursor ++;
@@ -112,6 +120,262 @@ loadpagetree(pdf_xref *xref, pdf_pagetree *pages,
 	return fz_okay;
 }
 
+/*
+ * The kids of a page tree node, checked against its /Count the first
+ * time a lookup passes through it. Kid i holds the pages from start[i]
+ * up to start[i + 1], start[len] is the /Count of the node.
+ */
+
+struct nodekey
+{
+	int oid;
+	int gen;
+};
+
+typedef struct pagenode_s pagenode;
+
+struct pagenode_s
+{
+	int len;
+	int start[1];
+};
+
+static fz_error *
+countkids(pagenode **nodep, pdf_xref *xref, fz_obj *obj, fz_obj *kids)
+{
+	fz_error *error;
+	pagenode *node;
+	fz_obj *kref, *kobj;
+	int i, n;
+
+	node = fz_malloc(sizeof(pagenode) + sizeof(int) * fz_arraylen(kids));
+	if (!node)
+		return fz_throw("outofmem: page tree node");
+
+	node->len = fz_arraylen(kids);
+	node->start[0] = 0;
+
+	for (i = 0; i < node->len; i++)
+	{
+		kref = fz_arrayget(kids, i);
+
+		error = pdf_loadindirect(&kobj, xref, kref);
+		if (error)
+		{
+			fz_free(node);
+			return fz_rethrow(error, "cannot load kid");
+		}
+
+		if (kobj == obj)
+		{
+			/* prevent infinite recursion possible in maliciously crafted PDFs */
+			fz_dropobj(kobj);
+			fz_free(node);
+			return fz_throw("corrupted pdf file");
+		}
+
+		if (strcmp(fz_toname(fz_dictgets(kobj, "Type")), "Page") == 0)
+			n = 1;
+		else if (strcmp(fz_toname(fz_dictgets(kobj, "Type")), "Pages") == 0)
+			n = fz_toint(fz_dictgets(kobj, "Count"));
+		else
+			n = -1;
+
+		fz_dropobj(kobj);
+
+		if (n < 0 || n > INT_MAX - node->start[i])
+		{
+			fz_free(node);
+			return fz_throw("pagetree node has unexpected type or count");
+		}
+
+		node->start[i + 1] = node->start[i] + n;
+	}
+
+	if (node->start[node->len] != fz_toint(fz_dictgets(obj, "Count")))
+	{
+		fz_free(node);
+		return fz_throw("page tree /Count does not match its kids");
+	}
+
+	*nodep = node;
+	return fz_okay;
+}
+
+static void
+dropnodes(pdf_pagetree *pages)
+{
+	int i;
+
+	if (!pages->nodes)
+		return;
+
+	for (i = 0; i < fz_hashlen(pages->nodes); i++)
+		fz_free(fz_hashgetval(pages->nodes, i));
+	fz_drophash(pages->nodes);
+	pages->nodes = nil;
+}
+
+/*
+ * Find page p, the index'th page below obj, by skipping whole
+ * subtrees according to their /Count, and apply the inherited
+ * attributes to just that page. The counts of each node on the way
+ * down are checked against its kids, so a bad /Count is reported
+ * instead of silently picking the wrong page. That check loads every
+ * kid, so it is done once per node and its result kept in pages->nodes.
+ */
+static fz_error *
+findpage(pdf_xref *xref, pdf_pagetree *pages, struct stuff inherit,
+		fz_obj *obj, fz_obj *ref, int p, int index, int depth)
+{
+	fz_error *error = fz_okay;
+	fz_obj *kids;
+	fz_obj *kref, *kobj;
+	fz_obj *inh;
+	struct nodekey key;
+	pagenode *node = nil;
+	int pagenum = p + 1;
+	int lo, hi, mid;
+
+	if (depth > 64)
+		return fz_throw("page tree is too deep");
+
+	inh = fz_dictgets(obj, "Resources");
+	if (inh) inherit.resources = inh;
+
+	inh = fz_dictgets(obj, "MediaBox");
+	if (inh) inherit.mediabox = inh;
+
+	inh = fz_dictgets(obj, "CropBox");
+	if (inh) inherit.cropbox = inh;
+
+	inh = fz_dictgets(obj, "Rotate");
+	if (inh) inherit.rotate = inh;
+
+	kids = fz_dictgets(obj, "Kids");
+	error = pdf_resolve(&kids, xref);
+	if (error)
+		return fz_rethrow(error, "cannot resolve /Kids");
+
+	/* only nodes with an object number can be found again */
+	memset(&key, 0, sizeof key);
+	if (fz_isindirect(ref))
+	{
+		key.oid = fz_tonum(ref);
+		key.gen = fz_togen(ref);
+		node = fz_hashfind(pages->nodes, &key);
+	}
+
+	if (!node)
+	{
+		error = countkids(&node, xref, obj, kids);
+		if (error)
+		{
+			error = fz_rethrow(error, "cannot count page tree kids");
+			goto cleanup;
+		}
+
+		if (fz_isindirect(ref))
+		{
+			error = fz_hashinsert(pages->nodes, &key, node);
+			if (error)
+			{
+				fz_free(node);
+				node = nil;
+				error = fz_rethrow(error, "cannot remember page tree node");
+				goto cleanup;
+			}
+		}
+	}
+
+	if (index < 0 || index >= node->start[node->len])
+	{
+		error = fz_throw("page tree /Count does not match its kids");
+		goto cleanup;
+	}
+
+	/* the kid whose pages hold index, skipping empty subtrees */
+	lo = 0;
+	hi = node->len - 1;
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (node->start[mid + 1] <= index)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	kref = fz_arrayget(kids, lo);
+	error = pdf_loadindirect(&kobj, xref, kref);
+	if (error)
+	{
+		error = fz_rethrow(error, "cannot load kid");
+		goto cleanup;
+	}
+
+	if (strcmp(fz_toname(fz_dictgets(kobj, "Type")), "Page") == 0)
+	{
+		pages->cursor = p;
+		error = loadpagetree(xref, pages, inherit, kobj, kref, &pagenum);
+		pages->cursor = 0;
+	}
+	else
+	{
+		error = findpage(xref, pages, inherit, kobj, kref, p, index - node->start[lo], depth + 1);
+	}
+	fz_dropobj(kobj);
+	if (error)
+		error = fz_rethrow(error, "cannot find page in subtree");
+
+cleanup:
+	if (node && !fz_isindirect(ref))
+		fz_free(node);
+	fz_dropobj(kids);
+	return error;
+}
+
+/*
+ * Resolve page p of a lazily loaded tree. When the /Count entries do
+ * not lead to the page, fall back to walking the whole tree once.
+ */
+static fz_error *
+loadlazypage(pdf_pagetree *pages, int p)
+{
+	fz_error *error;
+	struct stuff inherit;
+	int pagenum = 1;
+
+	inherit.resources = nil;
+	inherit.mediabox = nil;
+	inherit.cropbox = nil;
+	inherit.rotate = nil;
+
+	error = findpage(pages->xref, pages, inherit, pages->root, pages->rootref, p, p, 0);
+	if (!error && pages->pobj[p])
+		return fz_okay;
+
+	if (error)
+		fz_droperror(error);
+	fz_warn("cannot find page %d by /Count, loading whole page tree", p + 1);
+
+	pages->cursor = 0;
+	error = loadpagetree(pages->xref, pages, inherit, pages->root, pages->rootref, &pagenum);
+	pages->cursor = 0;
+
+	/* the tree has been walked; later pages need no lookups */
+	dropnodes(pages);
+	fz_dropobj(pages->root);
+	fz_dropobj(pages->rootref);
+	pages->root = nil;
+	pages->rootref = nil;
+	pages->xref = nil;
+
+	if (error)
+		return fz_rethrow(error, "cannot load pagetree");
+	return fz_okay;
+}
+
 void
 pdf_debugpagetree(pdf_pagetree *pages)
 {
@@ -120,13 +384,16 @@ pdf_debugpagetree(pdf_pagetree *pages)
 	for (i = 0; i < pages->count; i++) {
 		printf("    %% page %d\n", i + 1);
 		printf("    ");
-		fz_debugobj(pages->pref[i]);
+		if (pages->pref[i])
+			fz_debugobj(pages->pref[i]);
+		else
+			printf("null\n");
 	}
 	printf("  ]\n>>\n");
 }
 
-fz_error *
-pdf_loadpagetree(pdf_pagetree **pp, pdf_xref *xref)
+static fz_error *
+openpagetree(pdf_pagetree **pp, pdf_xref *xref, int lazy)
 {
 	fz_error *error;
 	struct stuff inherit;
@@ -138,6 +405,7 @@ pdf_loadpagetree(pdf_pagetree **pp, pdf_xref *xref)
 	fz_obj *treeref;
 	int count;
 	int pagenum = 1;
+	int i;
 
 	inherit.resources = nil;
 	inherit.mediabox = nil;
@@ -156,6 +424,7 @@ pdf_loadpagetree(pdf_pagetree **pp, pdf_xref *xref)
 
 	ref = fz_dictgets(pages, "Count");
 	count = fz_toint(ref);
+	if (count < 0) { error = fz_throw("page tree has negative /Count"); goto cleanup; }
 
 	p = fz_malloc(sizeof(pdf_pagetree));
 	if (!p) { error = fz_throw("outofmem: page tree struct"); goto cleanup; }
@@ -166,6 +435,10 @@ pdf_loadpagetree(pdf_pagetree **pp, pdf_xref *xref)
 	p->pobj = nil;
 	p->count = count;
 	p->cursor = 0;
+	p->xref = nil;
+	p->root = nil;
+	p->rootref = nil;
+	p->nodes = nil;
 
 	p->pref = fz_malloc(sizeof(fz_obj*) * count);
 	if (!p->pref) { error = fz_throw("outofmem: page tree reference array"); goto cleanup; }
@@ -173,8 +446,25 @@ pdf_loadpagetree(pdf_pagetree **pp, pdf_xref *xref)
 	p->pobj = fz_malloc(sizeof(fz_obj*) * count);
 	if (!p->pobj) { error = fz_throw("outofmem: page tree object array"); goto cleanup; }
 
-	error = loadpagetree(xref, p, inherit, pages, treeref, &pagenum);
-	if (error) { error = fz_rethrow(error, "cannot load pagetree"); goto cleanup; }
+	for (i = 0; i < count; i++)
+	{
+		p->pref[i] = nil;
+		p->pobj[i] = nil;
+	}
+
+	if (lazy)
+	{
+		error = fz_newhash(&p->nodes, 64, sizeof(struct nodekey));
+		if (error) { error = fz_rethrow(error, "cannot create page tree node hash"); goto cleanup; }
+		p->xref = xref;
+		p->root = fz_keepobj(pages);
+		p->rootref = fz_keepobj(treeref);
+	}
+	else
+	{
+		error = loadpagetree(xref, p, inherit, pages, treeref, &pagenum);
+		if (error) { error = fz_rethrow(error, "cannot load pagetree"); goto cleanup; }
+	}
 
 	fz_dropobj(pages);
 	fz_dropobj(catalog);
@@ -188,6 +478,11 @@ cleanup:
 	if (pages) fz_dropobj(pages);
 	if (catalog) fz_dropobj(catalog);
 	if (p) {
+		for (i = 0; p->pobj && i < count; i++) {
+			if (p->pref[i]) fz_dropobj(p->pref[i]);
+			if (p->pobj[i]) fz_dropobj(p->pobj[i]);
+		}
+		dropnodes(p);
 		fz_free(p->pref);
 		fz_free(p->pobj);
 		fz_free(p);
@@ -195,6 +490,22 @@ cleanup:
 	return error; /* already rethrown */
 }
 
+fz_error *
+pdf_loadpagetree(pdf_pagetree **pp, pdf_xref *xref)
+{
+	return openpagetree(pp, xref, 0);
+}
+
+/*
+ * Only read the root of the page tree. Page objects are looked up the
+ * first time pdf_getpageobject asks for them.
+ */
+fz_error *
+pdf_loadpagetreelazy(pdf_pagetree **pp, pdf_xref *xref)
+{
+	return openpagetree(pp, xref, 1);
+}
+
 int
 pdf_getpagecount(pdf_pagetree *pages)
 {
@@ -204,8 +515,22 @@ pdf_getpagecount(pdf_pagetree *pages)
 fz_obj *
 pdf_getpageobject(pdf_pagetree *pages, int p)
 {
+	fz_error *error;
+
 	if (p < 0 || p >= pages->count)
 		return nil;
+
+	if (!pages->pobj[p] && pages->root)
+	{
+		error = loadlazypage(pages, p);
+		if (error)
+		{
+			error = fz_rethrow(error, "cannot load page %d", p + 1);
+			fz_printerror(error);
+			fz_droperror(error);
+		}
+	}
+
 	return pages->pobj[p];
 }
 
@@ -223,6 +548,12 @@ pdf_droppagetree(pdf_pagetree *pages)
 			fz_dropobj(pages->pobj[i]);
 	}
 
+	if (pages->root)
+		fz_dropobj(pages->root);
+	if (pages->rootref)
+		fz_dropobj(pages->rootref);
+	dropnodes(pages);
+
 	fz_free(pages->pref);
 	fz_free(pages->pobj);
 	fz_free(pages);
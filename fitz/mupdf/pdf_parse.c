@@ -174,9 +174,9 @@ pdf_parsearray(fz_obj **op, fz_stream *file, char *buf, int cap)
 			return fz_okay;
 		case PDF_TINT:
 			if (n == 0)
-				a = atoi(buf);
+				a = pdf_atoi(buf);
 			if (n == 1)
-				b = atoi(buf);
+				b = pdf_atoi(buf);
 			n ++;
 			break;
 		case PDF_TR:
@@ -189,7 +189,7 @@ pdf_parsearray(fz_obj **op, fz_stream *file, char *buf, int cap)
 		case PDF_TOARRAY:	error = pdf_parsearray(&obj, file, buf, cap); break;
 		case PDF_TODICT:	error = pdf_parsedict(&obj, file, buf, cap); break;
 		case PDF_TNAME:		error = fz_newname(&obj, buf); break;
-		case PDF_TREAL:		error = fz_newreal(&obj, atof(buf)); break;
+		case PDF_TREAL:		error = fz_newreal(&obj, pdf_atof(buf)); break;
 		case PDF_TSTRING:	error = fz_newstring(&obj, buf, len); break;
 		case PDF_TTRUE:		error = fz_newbool(&obj, 1); break;
 		case PDF_TFALSE:	error = fz_newbool(&obj, 0); break;
@@ -268,13 +268,13 @@ skip:
 		case PDF_TOARRAY:	error = pdf_parsearray(&val, file, buf, cap); break;
 		case PDF_TODICT:	error = pdf_parsedict(&val, file, buf, cap); break;
 		case PDF_TNAME:		error = fz_newname(&val, buf); break;
-		case PDF_TREAL:		error = fz_newreal(&val, atof(buf)); break;
+		case PDF_TREAL:		error = fz_newreal(&val, pdf_atof(buf)); break;
 		case PDF_TSTRING:	error = fz_newstring(&val, buf, len); break;
 		case PDF_TTRUE:		error = fz_newbool(&val, 1); break;
 		case PDF_TFALSE:	error = fz_newbool(&val, 0); break;
 		case PDF_TNULL:		error = fz_newnull(&val); break;
 		case PDF_TINT:
-			a = atoi(buf);
+			a = pdf_atoi(buf);
 			error = pdf_lex(&tok, file, buf, cap, &len);
 			if (error) goto cleanup;
 			if (tok == PDF_TCDICT || tok == PDF_TNAME ||
@@ -291,7 +291,7 @@ skip:
 			}
 			if (tok == PDF_TINT)
 			{
-				b = atoi(buf);
+				b = pdf_atoi(buf);
 				error = pdf_lex(&tok, file, buf, cap, &len);
 				if (error) goto cleanup;
 				if (tok == PDF_TR)
@@ -341,12 +341,12 @@ pdf_parsestmobj(fz_obj **op, fz_stream *file, char *buf, int cap)
 	case PDF_TOARRAY:	error = pdf_parsearray(op, file, buf, cap); break;
 	case PDF_TODICT:	error = pdf_parsedict(op, file, buf, cap); break;
 	case PDF_TNAME:	error = fz_newname(op, buf); break;
-	case PDF_TREAL:	error = fz_newreal(op, atof(buf)); break;
+	case PDF_TREAL:	error = fz_newreal(op, pdf_atof(buf)); break;
 	case PDF_TSTRING:	error = fz_newstring(op, buf, len); break;
 	case PDF_TTRUE:	error = fz_newbool(op, 1); break;
 	case PDF_TFALSE:	error = fz_newbool(op, 0); break;
 	case PDF_TNULL:	error = fz_newnull(op); break;
-	case PDF_TINT:	error = fz_newint(op, atoi(buf)); break;
+	case PDF_TINT:	error = fz_newint(op, pdf_atoi(buf)); break;
 	default: return fz_throw("unknown token in object stream");
 	}
 
@@ -369,12 +369,12 @@ pdf_parseindobj(fz_obj **op, fz_stream *file, char *buf, int cap,
 	error = pdf_lex(&tok, file, buf, cap, &len);
 	if (error || tok != PDF_TINT)
 		goto cleanup;
-	oid = atoi(buf);
+	oid = pdf_atoi(buf);
 
 	error = pdf_lex(&tok, file, buf, cap, &len);
 	if (error || tok != PDF_TINT)
 		goto cleanup;
-	gid = atoi(buf);
+	gid = pdf_atoi(buf);
 
 	error = pdf_lex(&tok, file, buf, cap, &len);
 	if (error || tok != PDF_TOBJ)
@@ -389,13 +389,13 @@ pdf_parseindobj(fz_obj **op, fz_stream *file, char *buf, int cap,
 	case PDF_TOARRAY:	error = pdf_parsearray(&obj, file, buf, cap); break;
 	case PDF_TODICT:	error = pdf_parsedict(&obj, file, buf, cap); break;
 	case PDF_TNAME:	error = fz_newname(&obj, buf); break;
-	case PDF_TREAL:	error = fz_newreal(&obj, atof(buf)); break;
+	case PDF_TREAL:	error = fz_newreal(&obj, pdf_atof(buf)); break;
 	case PDF_TSTRING:	error = fz_newstring(&obj, buf, len); break;
 	case PDF_TTRUE:	error = fz_newbool(&obj, 1); break;
 	case PDF_TFALSE:	error = fz_newbool(&obj, 0); break;
 	case PDF_TNULL:	error = fz_newnull(&obj); break;
 	case PDF_TINT:
-			a = atoi(buf);
+			a = pdf_atoi(buf);
 			error = pdf_lex(&tok, file, buf, cap, &len);
 			if (error) goto cleanup;
 			if (tok == PDF_TSTREAM || tok == PDF_TENDOBJ)
@@ -406,7 +406,7 @@ pdf_parseindobj(fz_obj **op, fz_stream *file, char *buf, int cap,
 			}
 			if (tok == PDF_TINT)
 			{
-				b = atoi(buf);
+				b = pdf_atoi(buf);
 				error = pdf_lex(&tok, file, buf, cap, &len);
 				if (error) goto cleanup;
 				if (tok == PDF_TR)
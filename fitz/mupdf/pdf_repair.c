@@ -101,17 +101,41 @@ parseobj(fz_stream *file, char *buf, int cap, int *stmofs, int *stmlen,
 				return fz_rethrow(error, "cannot seek in file");
 		}
 
-		error = fz_read(&n, file, (unsigned char *) buf, 9);
-		if (error)
-			return fz_rethrow(error, "cannot read from file");
+		if (file->kind == FZ_SMMAP)
+		{
+			/* search the mapping directly instead of a byte at a time */
+			unsigned char *p = file->buffer->bp + *stmofs;
+			unsigned char *ep = file->buffer->wp;
+
+			while (ep - p >= 9)
+			{
+				p = memchr(p, 'e', ep - p - 8);
+				if (!p || !memcmp(p, "endstream", 9))
+					break;
+				p ++;
+			}
 
-		while (memcmp(buf, "endstream", 9) != 0)
+			if (p && ep - p >= 9)
+				error = fz_seek(file, p + 9 - file->buffer->bp, 0);
+			else
+				error = fz_seek(file, 0, 2);
+			if (error)
+				return fz_rethrow(error, "cannot seek in file");
+		}
+		else
 		{
-			c = fz_readbyte(file);
-			if (c == EOF)
-				break;
-			memmove(buf, buf + 1, 8);
-			buf[8] = c;
+			error = fz_read(&n, file, (unsigned char *) buf, 9);
+			if (error)
+				return fz_rethrow(error, "cannot read from file");
+
+			while (memcmp(buf, "endstream", 9) != 0)
+			{
+				c = fz_readbyte(file);
+				if (c == EOF)
+					break;
+				memmove(buf, buf + 1, 8);
+				buf[8] = c;
+			}
 		}
 
 		error = fz_readerror(file);
@@ -134,140 +158,319 @@ atobjend:
 	return fz_okay;
 }
 
-fz_error *
-pdf_repairxref(pdf_xref *xref, char *filename)
-{
-	fz_error *error;
-	fz_stream *file;
-
-	struct entry *list = nil;
-	int listlen;
-	int listcap;
-	int maxoid = 0;
+/*
+ * objects found so far
+ */
 
-	char buf[65536];
+struct scan
+{
+	struct entry *list;
+	int len;
+	int cap;
+	int maxoid;
+	int rootoid, rootgen;
+	int infooid, infogen;
+};
 
-	int oid = 0;
-	int gen = 0;
-	int tmpofs, oidofs = 0, genofs = 0;
-	int isroot, rootoid = 0, rootgen = 0;
-	int isinfo, infooid = 0, infogen = 0;
+/*
+ * parse the object whose 'obj' keyword the file is positioned after
+ * and add it to the list.
+ */
+static fz_error *
+foundobject(struct scan *scan, fz_stream *file, char *buf, int cap,
+		int oid, int gen, int ofs)
+{
+	fz_error *error;
+	int isroot, isinfo;
 	int stmlen, stmofs = 0;
-	pdf_token_e tok;
-	int len;
-	int next;
-	int i;
 
-	error = fz_openrfile(&file, filename);
+	error = parseobj(file, buf, cap, &stmofs, &stmlen, &isroot, &isinfo);
 	if (error)
-		return fz_rethrow(error, "cannot open file '%s'", filename);
-
-	pdf_logxref("repairxref '%s' %p\n", filename, xref);
+		return fz_rethrow(error, "cannot parse object");
 
-	xref->file = file;
+	if (isroot) {
+		pdf_logxref("found catalog: %d %d\n", oid, gen);
+		scan->rootoid = oid;
+		scan->rootgen = gen;
+	}
 
-	/* TODO: extract version */
+	if (isinfo) {
+		pdf_logxref("found info: %d %d\n", oid, gen);
+		scan->infooid = oid;
+		scan->infogen = gen;
+	}
 
-	listlen = 0;
-	listcap = 1024;
-	list = fz_malloc(listcap * sizeof(struct entry));
-	if (!list)
+	if (scan->len + 1 == scan->cap)
 	{
-		error = fz_throw("outofmem: reparation object list");
-		goto cleanup;
+		struct entry *newlist;
+		newlist = fz_realloc(scan->list, scan->cap * 2 * sizeof(struct entry));
+		if (!newlist)
+			return fz_throw("outofmem: resize reparation object list");
+		scan->list = newlist;
+		scan->cap = scan->cap * 2;
 	}
 
+	scan->list[scan->len].oid = oid;
+	scan->list[scan->len].gen = gen;
+	scan->list[scan->len].ofs = ofs;
+	scan->list[scan->len].stmofs = stmofs;
+	scan->list[scan->len].stmlen = stmlen;
+	scan->len ++;
+
+	if (oid > scan->maxoid)
+		scan->maxoid = oid;
+
+	return fz_okay;
+}
+
+/*
+ * lex the whole file looking for 'N G obj'
+ */
+static fz_error *
+scanlexed(struct scan *scan, fz_stream *file, char *buf, int cap)
+{
+	fz_error *error;
+	int oid = 0;
+	int gen = 0;
+	int tmpofs, oidofs = 0, genofs = 0;
+	pdf_token_e tok;
+	int len;
+
 	while (1)
 	{
 		tmpofs = fz_tell(file);
 		if (tmpofs < 0)
-		{
-			error = fz_throw("cannot tell in file");
-			goto cleanup;
-		}
+			return fz_throw("cannot tell in file");
 
-		error = pdf_lex(&tok, file, buf, sizeof buf, &len);
+		error = pdf_lex(&tok, file, buf, cap, &len);
 		if (error)
-		{
-			error = fz_rethrow(error, "cannot scan for objects");
-			goto cleanup;
-		}
+			return fz_rethrow(error, "cannot scan for objects");
 
 		if (tok == PDF_TINT)
 		{
 			oidofs = genofs;
 			oid = gen;
 			genofs = tmpofs;
-			gen = atoi(buf);
+			gen = pdf_atoi(buf);
 		}
 
-		if (tok == PDF_TOBJ)
+		if (tok == PDF_TOBJ && oid > 0 && gen >= 0)
 		{
-			error = parseobj(file, buf, sizeof buf, &stmofs, &stmlen, &isroot, &isinfo);
+			error = foundobject(scan, file, buf, cap, oid, gen, oidofs);
 			if (error)
-			{
-				error = fz_rethrow(error, "cannot parse object");
-				goto cleanup;
-			}
+				return fz_rethrow(error, "cannot parse object %d %d", oid, gen);
+		}
 
-			if (isroot) {
-				pdf_logxref("found catalog: %d %d\n", oid, gen);
-				rootoid = oid;
-				rootgen = gen;
-			}
+		if (tok == PDF_TERROR)
+			fz_readbyte(file);
 
-			if (isinfo) {
-				pdf_logxref("found info: %d %d\n", oid, gen);
-				infooid = oid;
-				infogen = gen;
-			}
+		if (tok == PDF_TEOF)
+			return fz_okay;
+	}
+}
 
-			if (listlen + 1 == listcap)
-			{
-				struct entry *newlist;
-				listcap = listcap * 2;
-				newlist = fz_realloc(list, listcap * sizeof(struct entry));
-				if (!newlist) {
-					error = fz_throw("outofmem: resize reparation object list");
-					goto cleanup;
-				}
-				list = newlist;
-			}
+static inline int iswhite(int ch)
+{
+	return ch == '\000' || ch == '\011' || ch == '\012' ||
+		ch == '\014' || ch == '\015' || ch == '\040';
+}
 
-			list[listlen].oid = oid;
-			list[listlen].gen = gen;
-			list[listlen].ofs = oidofs;
-			list[listlen].stmofs = stmofs;
-			list[listlen].stmlen = stmlen;
-			listlen ++;
+static inline int isdelim(int ch)
+{
+	return ch == '(' || ch == ')' || ch == '<' || ch == '>' ||
+		ch == '[' || ch == ']' || ch == '{' || ch == '}' ||
+		ch == '/' || ch == '%';
+}
 
-			if (oid > maxoid)
-				maxoid = oid;
-		}
+static inline int isdecimal(int ch)
+{
+	return ch >= '0' && ch <= '9';
+}
 
-		if (tok == PDF_TERROR)
-			fz_readbyte(file);
+/*
+ * p points at 'obj'. check that it is the keyword, preceded by
+ * two integers, and return them and the offset of the first.
+ * the numbers are read backwards, not before lo, at most 5 digits
+ * of generation and 10 of object number, and must fit an int.
+ */
+static int
+ismarker(unsigned char *bp, unsigned char *lo, unsigned char *ep,
+		unsigned char *p, int *oidp, int *genp, int *ofsp)
+{
+	unsigned char *s;
+	int oid, gen, k, n, d;
 
-		if (tok == PDF_TEOF)
+	if (p + 3 < ep && !iswhite(p[3]) && !isdelim(p[3]))
+		return 0;
+
+	s = p;
+	if (s == lo || !iswhite(s[-1]))
+		return 0;
+	while (s > lo && iswhite(s[-1]))
+		s--;
+
+	for (gen = 0, k = 1, n = 0; n < 5 && s > lo && isdecimal(s[-1]); s--, n++, k *= 10)
+		gen += (s[-1] - '0') * k;
+	if (n == 0)
+		return 0;
+
+	if (s == lo || !iswhite(s[-1]))
+		return 0;
+	while (s > lo && iswhite(s[-1]))
+		s--;
+
+	for (oid = 0, k = 1, n = 0; n < 10 && s > lo && isdecimal(s[-1]); s--, n++)
+	{
+		d = s[-1] - '0';
+		if (d > (INT_MAX - oid) / k)
+			return 0;
+		oid += d * k;
+		if (n < 9)
+			k *= 10;
+	}
+	if (n == 0 || oid <= 0)
+		return 0;
+
+	if (s > lo && !iswhite(s[-1]) && !isdelim(s[-1]))
+		return 0;
+
+	*oidp = oid;
+	*genp = gen;
+	*ofsp = s - bp;
+	return 1;
+}
+
+/*
+ * the whole file is mapped: find the 'obj' keywords with memchr
+ * instead of lexing every byte, and only parse the objects behind
+ * them. comments are skipped, and so is the stream data skipped by
+ * parseobj, as with the lexer. unlike the lexer, strings in the
+ * garbage between objects are not.
+ */
+static fz_error *
+scanmapped(struct scan *scan, fz_stream *file, char *buf, int cap)
+{
+	fz_error *error;
+	unsigned char *bp = file->buffer->bp;
+	unsigned char *ep = file->buffer->wp;
+	unsigned char *p = bp;
+	unsigned char *lo = bp;	/* no comment starts before here */
+	unsigned char *sp = bp;	/* numbers are not read before here */
+	unsigned char *q;
+	int oid, gen, ofs;
+	int next;
+
+	while (ep - p >= 3)
+	{
+		p = memchr(p, 'o', ep - p - 2);
+		if (!p)
 			break;
+
+		/* skip the comments up to the candidate */
+		q = memchr(lo, '%', p - lo);
+		if (q)
+		{
+			while (q < ep && *q != '\012' && *q != '\015')
+				q ++;
+			lo = sp = q;
+			p = MAX(p, q);
+			continue;
+		}
+		lo = p;
+
+		if (p[1] != 'b' || p[2] != 'j' || !ismarker(bp, sp, ep, p, &oid, &gen, &ofs))
+		{
+			p ++;
+			continue;
+		}
+
+		error = fz_seek(file, p + 3 - bp, 0);
+		if (error)
+			return fz_rethrow(error, "cannot seek in file");
+
+		error = foundobject(scan, file, buf, cap, oid, gen, ofs);
+		if (error)
+			return fz_rethrow(error, "cannot parse object %d %d", oid, gen);
+
+		next = fz_tell(file);
+		if (next < 0)
+			return fz_throw("cannot tell in file");
+		p = MAX(p + 3, bp + next);
+		lo = sp = p;
 	}
 
-	if (rootoid == 0)
+	return fz_okay;
+}
+
+fz_error *
+pdf_repairxref(pdf_xref *xref, char *filename)
+{
+	fz_error *error;
+	fz_stream *file;
+
+	struct scan scan;
+	struct entry *list;
+	int listlen;
+
+	char buf[65536];
+
+	int next;
+	int i;
+
+	error = fz_openrfilemmap(&file, filename);
+	if (error)
+		return fz_rethrow(error, "cannot open file '%s'", filename);
+
+	pdf_logxref("repairxref '%s' %p\n", filename, xref);
+
+	xref->file = file;
+
+	/* TODO: extract version */
+
+	memset(&scan, 0, sizeof scan);
+	scan.cap = 1024;
+	scan.list = fz_malloc(scan.cap * sizeof(struct entry));
+	if (!scan.list)
+	{
+		error = fz_throw("outofmem: reparation object list");
+		goto cleanup;
+	}
+
+	if (file->kind == FZ_SMMAP)
+		error = scanmapped(&scan, file, buf, sizeof buf);
+	else
+		error = scanlexed(&scan, file, buf, sizeof buf);
+	if (error)
+	{
+		error = fz_rethrow(error, "cannot scan for objects");
+		goto cleanup;
+	}
+
+	list = scan.list;
+	listlen = scan.len;
+
+	if (scan.rootoid == 0)
 	{
 		error = fz_throw("cannot find catalog object");
 		goto cleanup;
 	}
 
+	if (scan.maxoid >= INT_MAX / (int)sizeof(pdf_xrefentry))
+	{
+		error = fz_throw("object number too large: %d", scan.maxoid);
+		goto cleanup;
+	}
+
 	error = fz_packobj(&xref->trailer,
 			"<< /Size %i /Root %r >>",
-			maxoid + 1, rootoid, rootgen);
+			scan.maxoid + 1, scan.rootoid, scan.rootgen);
 	if (error)
 	{
 		error = fz_rethrow(error, "cannot create new trailer");
 		goto cleanup;
 	}
 
-	xref->len = maxoid + 1;
+	xref->len = scan.maxoid + 1;
 	xref->cap = xref->len;
 	xref->table = fz_malloc(xref->cap * sizeof(pdf_xrefentry));
 	if (!xref->table)
@@ -282,6 +485,7 @@ pdf_repairxref(pdf_xref *xref, char *filename)
 	xref->table[0].gen = 65535;
 	xref->table[0].stmbuf = nil;
 	xref->table[0].stmofs = 0;
+	xref->table[0].stmxref = nil;
 	xref->table[0].obj = nil;
 
 	for (i = 1; i < xref->len; i++)
@@ -292,6 +496,7 @@ pdf_repairxref(pdf_xref *xref, char *filename)
 		xref->table[i].gen = 0;
 		xref->table[i].stmbuf = nil;
 		xref->table[i].stmofs = 0;
+		xref->table[i].stmxref = nil;
 		xref->table[i].obj = nil;
 	}
 
@@ -362,13 +567,13 @@ pdf_repairxref(pdf_xref *xref, char *filename)
 		}
 	}
 
-	fz_free(list);
+	fz_free(scan.list);
 	return fz_okay;
 
 cleanup:
 	fz_dropstream(file);
 	xref->file = nil; /* don't keep the stale pointer */
-	fz_free(list);
+	fz_free(scan.list);
 	return error; /* already rethrown */
 }
 
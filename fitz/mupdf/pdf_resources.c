@@ -213,7 +213,7 @@ preloadmask(pdf_xref *xref, fz_obj *ref)
 }
 
 static fz_error *
-scanfontsandmasks(pdf_xref *xref, fz_obj *rdb)
+scanfontsandmasks(pdf_xref *xref, fz_obj *rdb, int measure)
 {
 	fz_error *error;
 	fz_obj *dict;
@@ -237,7 +237,7 @@ scanfontsandmasks(pdf_xref *xref, fz_obj *rdb)
 
 			obj = fz_dictgetval(dict, i);
 			obj = fz_dictgets(obj, "SMask");
-			if (obj)
+			if (obj && !measure)
 			{
 				pdf_logrsrc("extgstate smask\n");
 				error = preloadmask(xref, obj);
@@ -310,8 +310,8 @@ copyresolved(fz_obj **outp, pdf_xref *xref, fz_obj *dict)
 	return fz_okay;
 }
 
-fz_error *
-pdf_loadresources(fz_obj **rdbp, pdf_xref *xref, fz_obj *orig)
+static fz_error *
+loadresources(fz_obj **rdbp, pdf_xref *xref, fz_obj *orig, int measure)
 {
 	fz_error *error;
 	fz_obj *copy;
@@ -384,7 +384,7 @@ pdf_loadresources(fz_obj **rdbp, pdf_xref *xref, fz_obj *orig)
 	 */
 
 	dict = fz_dictgets(copy, "Pattern");
-	if (dict)
+	if (dict && !measure)
 	{
 		for (i = 0; i < fz_dictlen(dict); i++)
 		{
@@ -418,7 +418,7 @@ pdf_loadresources(fz_obj **rdbp, pdf_xref *xref, fz_obj *orig)
 	 */
 
 	dict = fz_dictgets(copy, "XObject");
-	if (dict)
+	if (dict && !measure)
 	{
 		for (i = 0; i < fz_dictlen(dict); i++)
 		{
@@ -436,7 +436,7 @@ pdf_loadresources(fz_obj **rdbp, pdf_xref *xref, fz_obj *orig)
 	 * Load Font objects
 	 */
 
-	error = scanfontsandmasks(xref, copy);
+	error = scanfontsandmasks(xref, copy, measure);
 	if (error)
 	{
 		fz_dropobj(copy);
@@ -449,3 +449,21 @@ pdf_loadresources(fz_obj **rdbp, pdf_xref *xref, fz_obj *orig)
 	return fz_okay;
 }
 
+fz_error *
+pdf_loadresources(fz_obj **rdbp, pdf_xref *xref, fz_obj *orig)
+{
+	return loadresources(rdbp, xref, orig, 0);
+}
+
+/*
+ * Measuring a page needs fonts for the glyph metrics, colorspaces
+ * for the operand counts and shadings for their bounds. Patterns,
+ * images, forms and soft masks are left alone; the interpreter only
+ * needs their geometry and it loads forms itself as it meets them.
+ */
+
+fz_error *
+pdf_loadmeasureresources(fz_obj **rdbp, pdf_xref *xref, fz_obj *orig)
+{
+	return loadresources(rdbp, xref, orig, 1);
+}
@@ -11,7 +11,7 @@ writestream(fz_stream *out, pdf_xref *xref, pdf_crypt *encrypt, int oid, int gen
 	fz_error *error;
 	fz_stream *dststm;
 	fz_stream *srcstm;
-	unsigned char buf[4096];
+	unsigned char buf[32768];
 	fz_filter *ef;
 	int n;
 
@@ -218,105 +218,708 @@ pdf_updatexref(pdf_xref *xref, char *path)
 	return fz_okay;
 }
 
+/*
+ * Recompression. Streams that are stored raw or with one of the weak
+ * filters can be decoded and stored with flate instead. Loading and
+ * replacing the stream use the xref, the compression in between does
+ * not, so that part can be farmed out to other threads.
+ */
+
+static int
+isweakfilter(fz_obj *obj)
+{
+	char *s = fz_toname(obj);
+	return !strcmp(s, "LZWDecode") || !strcmp(s, "LZW") ||
+		!strcmp(s, "RunLengthDecode") || !strcmp(s, "RL") ||
+		!strcmp(s, "ASCIIHexDecode") || !strcmp(s, "AHx") ||
+		!strcmp(s, "ASCII85Decode") || !strcmp(s, "A85");
+}
+
+static int
+isflatefilter(fz_obj *obj)
+{
+	char *s = fz_toname(obj);
+	return !strcmp(s, "FlateDecode") || !strcmp(s, "Fl");
+}
+
+/*
+ * A stream is worth recompressing if it has no filter, or a chain of
+ * weak filters with at most one flate. Image codecs and external or
+ * crypt filtered streams are left alone.
+ */
+int
+pdf_isrecompressible(pdf_xref *xref, int oid, int gen)
+{
+	fz_obj *dict;
+	fz_obj *filters;
+	int i, weak, flate;
+
+	if (!pdf_isstream(xref, oid, gen))
+		return 0;
+
+	dict = xref->table[oid].obj;
+	if (!fz_isdict(dict))
+		return 0;
+
+	if (fz_dictgets(dict, "F") || fz_dictgets(dict, "DL"))
+		return 0;
+
+	filters = fz_dictgets(dict, "Filter");
+	if (!filters)
+		return 1;
+	if (fz_isindirect(filters))
+		return 0;
+
+	if (fz_isname(filters))
+		return isweakfilter(filters);
+
+	if (!fz_isarray(filters))
+		return 0;
+
+	weak = flate = 0;
+	for (i = 0; i < fz_arraylen(filters); i++)
+	{
+		fz_obj *f = fz_arrayget(filters, i);
+		if (isweakfilter(f))
+			weak ++;
+		else if (isflatefilter(f))
+			flate ++;
+		else
+			return 0;
+	}
+
+	return weak > 0 && flate <= 1;
+}
+
+/*
+ * Store new flate compressed data for a stream, and drop the old
+ * filters and parameters from its dictionary.
+ */
 fz_error *
-pdf_savexref(pdf_xref *xref, char *path, pdf_crypt *encrypt)
+pdf_replacestream(pdf_xref *xref, int oid, int gen, fz_buffer *buf)
 {
 	fz_error *error;
-	fz_stream *out;
-	int oid;
-	int startxref;
-	int *ofsbuf;
+	fz_obj *dict;
 	fz_obj *obj;
+
+	error = pdf_cacheobject(xref, oid, gen);
+	if (error)
+		return fz_rethrow(error, "cannot load stream object (%d)", oid);
+
+	dict = xref->table[oid].obj;
+
+	error = fz_newname(&obj, "FlateDecode");
+	if (error)
+		return fz_rethrow(error, "cannot create filter name");
+	error = fz_dictputs(dict, "Filter", obj);
+	fz_dropobj(obj);
+	if (error)
+		return fz_rethrow(error, "cannot update stream filter");
+
+	error = fz_newint(&obj, buf->wp - buf->rp);
+	if (error)
+		return fz_rethrow(error, "cannot create stream length");
+	error = fz_dictputs(dict, "Length", obj);
+	fz_dropobj(obj);
+	if (error)
+		return fz_rethrow(error, "cannot update stream length");
+
+	fz_dictdels(dict, "DecodeParms");
+	fz_dictdels(dict, "DP");
+
+	pdf_pinobject(xref, oid);
+
+	error = pdf_updatestream(xref, oid, gen, buf);
+	if (error)
+		return fz_rethrow(error, "cannot update stream data");
+
+	return fz_okay;
+}
+
+/*
+ * Streaming writer. Objects can be written out as soon as they are
+ * final and are then dropped from memory, the xref table and trailer
+ * are written when the writer is closed. Objects that have been written
+ * must not be loaded or changed again.
+ *
+ * In compress mode (PDF 1.5) the objects that are not streams are
+ * packed into flate compressed object streams, and the xref table
+ * is written as a compressed xref stream.
+ */
+
+enum { OBJSTMMAX = 100 };
+
+struct pdf_writer_s
+{
+	pdf_xref *xref;
+	pdf_crypt *encrypt;
 	int eoid, egen;
+	fz_stream *out;
+	int cap;
+	int *ofsbuf;		/* output offset or object stream, 0 if not yet written */
+	int *idxbuf;		/* index in object stream, -1 for a plain object */
+
+	int compress;
+	fz_buffer *stmbuf;	/* objects of the pending object stream */
+	fz_stream *stmout;
+	int stmlen;
+	int stmoids[OBJSTMMAX];
+	int stmofs[OBJSTMMAX];
+};
 
-	pdf_logxref("savexref '%s' %p\n", path, xref);
+static fz_error *
+growwriter(pdf_writer *writer, int len)
+{
+	int *newofsbuf;
+	int *newidxbuf;
+	int newcap;
+	int i;
+
+	if (len <= writer->cap)
+		return fz_okay;
+
+	newcap = MAX(len, writer->cap * 2);
+
+	newofsbuf = fz_realloc(writer->ofsbuf, sizeof(int) * newcap);
+	if (!newofsbuf)
+		return fz_throw("outofmem: offset buffer");
+	writer->ofsbuf = newofsbuf;
+
+	newidxbuf = fz_realloc(writer->idxbuf, sizeof(int) * newcap);
+	if (!newidxbuf)
+		return fz_throw("outofmem: index buffer");
+	writer->idxbuf = newidxbuf;
+
+	for (i = writer->cap; i < newcap; i++)
+	{
+		newofsbuf[i] = 0;
+		newidxbuf[i] = -1;
+	}
+
+	writer->cap = newcap;
+
+	return fz_okay;
+}
+
+/*
+ * Run a block of memory through an encoding filter into a new buffer.
+ * Uses no shared state, so it can run on any thread.
+ */
+fz_error *
+pdf_encodebuffer(fz_buffer **bufp, fz_filter *filter, unsigned char *data, int len)
+{
+	fz_error *error;
+	fz_stream *bufstm;
+	fz_stream *stm;
+	fz_buffer *buf;
+
+	error = fz_newbuffer(&buf, len / 2 + 64);
+	if (error)
+		return fz_rethrow(error, "cannot create encode buffer");
+
+	error = fz_openwbuffer(&bufstm, buf);
+	if (error)
+	{
+		fz_dropbuffer(buf);
+		return fz_rethrow(error, "cannot open encode buffer");
+	}
+
+	error = fz_openwfilter(&stm, filter, bufstm);
+	fz_dropstream(bufstm);
+	if (error)
+	{
+		fz_dropbuffer(buf);
+		return fz_rethrow(error, "cannot open encode stream");
+	}
+
+	error = fz_write(stm, data, len);
+	fz_dropstream(stm);
+	if (error)
+	{
+		fz_dropbuffer(buf);
+		return fz_rethrow(error, "cannot encode data");
+	}
+
+	*bufp = buf;
+	return fz_okay;
+}
+
+/*
+ * Flate compress a block of memory into a new buffer.
+ */
+fz_error *
+pdf_deflatebuffer(fz_buffer **bufp, unsigned char *data, int len)
+{
+	fz_error *error;
+	fz_filter *filter;
+
+	error = fz_newflatee(&filter, nil);
+	if (error)
+		return fz_rethrow(error, "cannot create flate filter");
+
+	error = pdf_encodebuffer(bufp, filter, data, len);
+	fz_dropfilter(filter);
+	if (error)
+		return fz_rethrow(error, "cannot deflate data");
+
+	return fz_okay;
+}
+
+/*
+ * Write the pending object stream.
+ */
+static fz_error *
+flushobjstm(pdf_writer *writer)
+{
+	fz_error *error;
+	fz_buffer *hdrbuf;
+	fz_buffer *zbuf;
+	fz_stream *hdr;
+	unsigned char *data;
+	int hdrlen, bodylen;
+	int oid, gen;
+	int i;
+
+	if (writer->stmlen == 0)
+		return fz_okay;
+
+	error = fz_newbuffer(&hdrbuf, writer->stmlen * 12);
+	if (error)
+		return fz_rethrow(error, "cannot create object stream header");
+
+	error = fz_openwbuffer(&hdr, hdrbuf);
+	if (error)
+	{
+		fz_dropbuffer(hdrbuf);
+		return fz_rethrow(error, "cannot open object stream header");
+	}
+
+	for (i = 0; i < writer->stmlen; i++)
+		fz_print(hdr, "%d %d ", writer->stmoids[i], writer->stmofs[i]);
+	fz_print(hdr, "\n");
+
+	/* the objects go right after the header */
+	hdrlen = fz_tell(hdr);
+	bodylen = fz_tell(writer->stmout);
+	fz_dropstream(hdr);
+
+	data = fz_malloc(hdrlen + bodylen);
+	if (!data)
+	{
+		fz_dropbuffer(hdrbuf);
+		return fz_throw("outofmem: object stream data");
+	}
+
+	memcpy(data, hdrbuf->bp, hdrlen);
+	memcpy(data + hdrlen, writer->stmbuf->bp, bodylen);
+	fz_dropbuffer(hdrbuf);
+
+	error = pdf_deflatebuffer(&zbuf, data, hdrlen + bodylen);
+	fz_free(data);
+	if (error)
+		return fz_rethrow(error, "cannot compress object stream");
+
+	error = pdf_allocobject(writer->xref, &oid, &gen);
+	if (error)
+	{
+		fz_dropbuffer(zbuf);
+		return fz_rethrow(error, "cannot allocate object stream");
+	}
+
+	error = growwriter(writer, writer->xref->len);
+	if (error)
+	{
+		fz_dropbuffer(zbuf);
+		return fz_rethrow(error, "cannot grow offset buffer");
+	}
+
+	pdf_logxref("objstm %d %d (%d objects)\n", oid, gen, writer->stmlen);
+
+	writer->ofsbuf[oid] = fz_tell(writer->out);
+	fz_print(writer->out, "%d %d obj\n", oid, gen);
+	fz_print(writer->out, "<</Type/ObjStm/N %d/First %d/Filter/FlateDecode/Length %d>>\n",
+			writer->stmlen, hdrlen, (int)(zbuf->wp - zbuf->bp));
+	fz_print(writer->out, "stream\n");
+	fz_write(writer->out, zbuf->bp, zbuf->wp - zbuf->bp);
+	fz_print(writer->out, "\nendstream\nendobj\n\n");
+	fz_dropbuffer(zbuf);
+
+	for (i = 0; i < writer->stmlen; i++)
+	{
+		writer->ofsbuf[writer->stmoids[i]] = oid;
+		writer->idxbuf[writer->stmoids[i]] = i;
+	}
+
+	writer->stmlen = 0;
+	writer->stmbuf->rp = writer->stmbuf->bp;
+	writer->stmbuf->wp = writer->stmbuf->bp;
+
+	return fz_okay;
+}
+
+/*
+ * Write an object, into the pending object stream if it can go there.
+ */
+static fz_error *
+putobject(pdf_writer *writer, int oid, int gen)
+{
+	pdf_xref *xref = writer->xref;
+	fz_error *error;
+
+	if (writer->compress && gen == 0 && !pdf_isstream(xref, oid, gen))
+	{
+		error = pdf_cacheobject(xref, oid, gen);
+		if (error)
+			return fz_rethrow(error, "cannot load object");
+
+		writer->stmoids[writer->stmlen] = oid;
+		writer->stmofs[writer->stmlen] = fz_tell(writer->stmout);
+		writer->stmlen ++;
+
+		/* a temporary slot until the object stream is written */
+		writer->ofsbuf[oid] = -1;
+
+		fz_printobj(writer->stmout, xref->table[oid].obj, TIGHT);
+		fz_print(writer->stmout, "\n");
+
+		if (writer->stmlen == OBJSTMMAX)
+		{
+			error = flushobjstm(writer);
+			if (error)
+				return fz_rethrow(error, "cannot write object stream");
+		}
+
+		return fz_okay;
+	}
+
+	writer->ofsbuf[oid] = fz_tell(writer->out);
+	writer->idxbuf[oid] = -1;
+	error = writeobject(writer->out, xref, writer->encrypt, oid, gen);
+	if (error)
+		return fz_rethrow(error, "cannot write object (oid=%d)", oid);
+
+	return fz_okay;
+}
+
+
+fz_error *
+pdf_openwriter(pdf_writer **writerp, pdf_xref *xref, char *path, pdf_crypt *encrypt, int compress)
+{
+	fz_error *error;
+	pdf_writer *writer;
+
+	pdf_logxref("openwriter '%s' %p\n", path, xref);
+
+	writer = fz_malloc(sizeof(pdf_writer));
+	if (!writer)
+		return fz_throw("outofmem: writer struct");
+
+	writer->xref = xref;
+	writer->encrypt = encrypt;
+	writer->eoid = 0;
+	writer->egen = 0;
+	writer->out = nil;
+	writer->cap = 0;
+	writer->ofsbuf = nil;
+	writer->idxbuf = nil;
+
+	/* objects in object streams are not encrypted on their own, keep it simple */
+	writer->compress = compress && !encrypt;
+	writer->stmbuf = nil;
+	writer->stmout = nil;
+	writer->stmlen = 0;
 
 	/* need to add encryption object for acrobat < 6 */
 	if (encrypt)
 	{
 		pdf_logxref("make encryption dict\n");
 
-		error = pdf_allocobject(xref, &eoid, &egen);
+		error = pdf_allocobject(xref, &writer->eoid, &writer->egen);
 		if (error)
+		{
+			fz_free(writer);
 			return fz_rethrow(error, "cannot allocate encryption object");
+		}
 
-		pdf_cryptobj(encrypt, encrypt->encrypt, eoid, egen);
+		pdf_cryptobj(encrypt, encrypt->encrypt, writer->eoid, writer->egen);
 
-		error = pdf_updateobject(xref, eoid, egen, encrypt->encrypt);
+		error = pdf_updateobject(xref, writer->eoid, writer->egen, encrypt->encrypt);
 		if (error)
+		{
+			pdf_cryptobj(encrypt, encrypt->encrypt, writer->eoid, writer->egen);
+			fz_free(writer);
 			return fz_rethrow(error, "cannot update encryption object");
+		}
 	}
 
-	ofsbuf = fz_malloc(sizeof(int) * xref->len);
-	if (!ofsbuf)
-		return fz_throw("outofmem: offset buffer");
+	error = growwriter(writer, xref->len);
+	if (error)
+		goto cleanup;
+
+	if (writer->compress)
+	{
+		error = fz_newbuffer(&writer->stmbuf, FZ_BUFSIZE);
+		if (error)
+		{
+			error = fz_rethrow(error, "cannot create object stream buffer");
+			goto cleanup;
+		}
+
+		error = fz_openwbuffer(&writer->stmout, writer->stmbuf);
+		if (error)
+		{
+			error = fz_rethrow(error, "cannot open object stream buffer");
+			goto cleanup;
+		}
+
+		if (xref->version < 15)
+			xref->version = 15;
+	}
 
-	error = fz_openwfile(&out, path);
+	error = fz_openwfile(&writer->out, path);
 	if (error)
 	{
-		fz_free(ofsbuf);
-		return fz_rethrow(error, "cannot open output file");
+		error = fz_rethrow(error, "cannot open output file");
+		goto cleanup;
 	}
 
-	fz_print(out, "%%PDF-%d.%df\n", xref->version / 10, xref->version % 10);
-	fz_print(out, "%%\342\343\317\323\n\n");
+	fz_print(writer->out, "%%PDF-%d.%df\n", xref->version / 10, xref->version % 10);
+	fz_print(writer->out, "%%\342\343\317\323\n\n");
+
+	*writerp = writer;
+	return fz_okay;
+
+cleanup:
+	if (encrypt)
+		pdf_cryptobj(encrypt, encrypt->encrypt, writer->eoid, writer->egen);
+	if (writer->stmout)
+		fz_dropstream(writer->stmout);
+	if (writer->stmbuf)
+		fz_dropbuffer(writer->stmbuf);
+	fz_free(writer->ofsbuf);
+	fz_free(writer->idxbuf);
+	fz_free(writer);
+	return error; /* already rethrown */
+}
+
+/*
+ * Write one object (and its stream) now and drop it from memory.
+ */
+fz_error *
+pdf_writeobject(pdf_writer *writer, int oid, int gen)
+{
+	pdf_xref *xref = writer->xref;
+	pdf_xrefentry *x;
+	fz_error *error;
+
+	if (oid <= 0 || oid >= xref->len)
+		return fz_throw("assert: object out of range: %d", oid);
+
+	error = growwriter(writer, xref->len);
+	if (error)
+		return fz_rethrow(error, "cannot grow offset buffer");
+
+	if (writer->ofsbuf[oid])
+		return fz_okay;
+
+	x = xref->table + oid;
+	if (x->type != 'n' && x->type != 'o' && x->type != 'a')
+		return fz_okay;
+
+	error = putobject(writer, oid, gen);
+	if (error)
+		return fz_rethrow(error, "cannot write object (oid=%d)", oid);
+
+	if (x->type == 'a')
+	{
+		if (x->stmbuf)
+			fz_dropbuffer(x->stmbuf);
+		x->stmbuf = nil;
+		x->stmxref = nil;
+		if (x->obj)
+			fz_dropobj(x->obj);
+		x->obj = nil;
+	}
+
+	return fz_okay;
+}
+
+static void
+putxrefentry(unsigned char *p, int type, int field2, int field3)
+{
+	p[0] = type;
+	p[1] = (field2 >> 24) & 0xff;
+	p[2] = (field2 >> 16) & 0xff;
+	p[3] = (field2 >> 8) & 0xff;
+	p[4] = field2 & 0xff;
+	p[5] = (field3 >> 8) & 0xff;
+	p[6] = field3 & 0xff;
+}
+
+/*
+ * Write the xref as a flate compressed xref stream with /W [1 4 2].
+ */
+static fz_error *
+writexrefstream(pdf_writer *writer, int *startxrefp)
+{
+	pdf_xref *xref = writer->xref;
+	fz_stream *out = writer->out;
+	fz_error *error;
+	fz_buffer *zbuf;
+	unsigned char *data;
+	fz_obj *obj;
+	int oid, gen;
+	int xoid, xgen;
+
+	/* this relinks the free list, so free entries are taken from the xref below */
+	error = pdf_allocobject(xref, &xoid, &xgen);
+	if (error)
+		return fz_rethrow(error, "cannot allocate xref stream");
+
+	error = growwriter(writer, xref->len);
+	if (error)
+		return fz_rethrow(error, "cannot grow offset buffer");
+
+	*startxrefp = fz_tell(out);
+	writer->ofsbuf[xoid] = *startxrefp;
+
+	data = fz_malloc(xref->len * 7);
+	if (!data)
+		return fz_throw("outofmem: xref stream data");
+
+	for (oid = 0; oid < xref->len; oid++)
+	{
+		int type = xref->table[oid].type;
+
+		gen = xref->table[oid].gen;
+		if (type == 'o')
+			gen = 0;
+
+		if (writer->idxbuf[oid] >= 0)
+			putxrefentry(data + oid * 7, 2, writer->ofsbuf[oid], writer->idxbuf[oid]);
+		else if (type == 'n' || type == 'o' || type == 'a')
+			putxrefentry(data + oid * 7, 1, writer->ofsbuf[oid], gen);
+		else
+			putxrefentry(data + oid * 7, 0, xref->table[oid].ofs, gen);
+	}
+
+	error = pdf_deflatebuffer(&zbuf, data, xref->len * 7);
+	fz_free(data);
+	if (error)
+		return fz_rethrow(error, "cannot compress xref stream");
+
+	fz_print(out, "%d %d obj\n", xoid, xgen);
+	fz_print(out, "<</Type/XRef/Size %d/W[1 4 2]", xref->len);
+	obj = fz_dictgets(xref->trailer, "Root");
+	fz_print(out, "/Root %d %d R", fz_tonum(obj), fz_togen(obj));
+	obj = fz_dictgets(xref->trailer, "Info");
+	if (obj)
+		fz_print(out, "/Info %d %d R", fz_tonum(obj), fz_togen(obj));
+	fz_print(out, "/Filter/FlateDecode/Length %d>>\n", (int)(zbuf->wp - zbuf->bp));
+	fz_print(out, "stream\n");
+	fz_write(out, zbuf->bp, zbuf->wp - zbuf->bp);
+	fz_print(out, "\nendstream\nendobj\n\n");
+
+	fz_dropbuffer(zbuf);
+
+	return fz_okay;
+}
+
+/*
+ * Write the objects not written yet, the xref table and the trailer,
+ * and free the writer whether this succeeds or not.
+ */
+fz_error *
+pdf_closewriter(pdf_writer *writer)
+{
+	pdf_xref *xref = writer->xref;
+	pdf_crypt *encrypt = writer->encrypt;
+	fz_stream *out = writer->out;
+	fz_error *error;
+	int oid;
+	int startxref;
+	fz_obj *obj;
+
+	error = growwriter(writer, xref->len);
+	if (error)
+	{
+		error = fz_rethrow(error, "cannot grow offset buffer");
+		goto cleanup;
+	}
 
 	for (oid = 0; oid < xref->len; oid++)
 	{
 		pdf_xrefentry *x = xref->table + oid;
+		if (writer->ofsbuf[oid])
+			continue;
 		if (x->type == 'n' || x->type == 'o' || x->type == 'a')
 		{
-			ofsbuf[oid] = fz_tell(out);
-			error = writeobject(out, xref, encrypt, oid, x->type == 'o' ? 0 : x->gen);
+			error = putobject(writer, oid, x->type == 'o' ? 0 : x->gen);
 			if (error)
 			{
-				if (ofsbuf) fz_free(ofsbuf);
-				fz_dropstream(out);
-				return fz_rethrow(error, "cannot write object (oid=%d)", oid);
+				error = fz_rethrow(error, "cannot write object (oid=%d)", oid);
+				goto cleanup;
 			}
 		}
 		else
 		{
-			ofsbuf[oid] = x->ofs;
+			writer->ofsbuf[oid] = x->ofs;
 		}
 	}
 
-	startxref = fz_tell(out);
-	fz_print(out, "xref\n");
-	fz_print(out, "0 %d\n", xref->len);
+	error = flushobjstm(writer);
+	if (error)
+	{
+		error = fz_rethrow(error, "cannot write object stream");
+		goto cleanup;
+	}
 
-	for (oid = 0; oid < xref->len; oid++)
+	if (writer->compress)
 	{
-		int gen = xref->table[oid].gen;
-		int type = xref->table[oid].type;
-		if (type == 'o')
-			gen = 0;
-		if (type == 'a' || type == 'o')
-			type = 'n';
-		if (type == 'd')
-			type = 'f';
-		fz_print(out, "%010d %05d %c \n", ofsbuf[oid], gen, type);
+		error = writexrefstream(writer, &startxref);
+		if (error)
+		{
+			error = fz_rethrow(error, "cannot write xref stream");
+			goto cleanup;
+		}
 	}
+	else
+	{
+		startxref = fz_tell(out);
+		fz_print(out, "xref\n");
+		fz_print(out, "0 %d\n", xref->len);
 
-	fz_print(out, "\n");
+		for (oid = 0; oid < xref->len; oid++)
+		{
+			int gen = xref->table[oid].gen;
+			int type = xref->table[oid].type;
+			if (type == 'o')
+				gen = 0;
+			if (type == 'a' || type == 'o')
+				type = 'n';
+			if (type == 'd')
+				type = 'f';
+			fz_print(out, "%010d %05d %c \n", writer->ofsbuf[oid], gen, type);
+		}
 
-	fz_print(out, "trailer\n<<\n  /Size %d", xref->len);
-	obj = fz_dictgets(xref->trailer, "Root");
-	fz_print(out, "\n  /Root %d %d R", fz_tonum(obj), fz_togen(obj));
-	obj = fz_dictgets(xref->trailer, "Info");
-	if (obj)
-		fz_print(out, "\n  /Info %d %d R", fz_tonum(obj), fz_togen(obj));
-	if (encrypt)
-	{
-		fz_print(out, "\n  /Encrypt %d %d R", eoid, egen);
-		fz_print(out, "\n  /ID [");
-		fz_printobj(out, encrypt->id, 1);
-		fz_printobj(out, encrypt->id, 1);
-		fz_print(out, "]");
+		fz_print(out, "\n");
 
-		pdf_cryptobj(encrypt, encrypt->encrypt, eoid, egen);
+		fz_print(out, "trailer\n<<\n  /Size %d", xref->len);
+		obj = fz_dictgets(xref->trailer, "Root");
+		fz_print(out, "\n  /Root %d %d R", fz_tonum(obj), fz_togen(obj));
+		obj = fz_dictgets(xref->trailer, "Info");
+		if (obj)
+			fz_print(out, "\n  /Info %d %d R", fz_tonum(obj), fz_togen(obj));
+		if (encrypt)
+		{
+			fz_print(out, "\n  /Encrypt %d %d R", writer->eoid, writer->egen);
+			fz_print(out, "\n  /ID [");
+			fz_printobj(out, encrypt->id, 1);
+			fz_printobj(out, encrypt->id, 1);
+			fz_print(out, "]");
+		}
+		fz_print(out, "\n>>\n\n");
 	}
-	fz_print(out, "\n>>\n\n");
 
 	fz_print(out, "startxref\n");
 	fz_print(out, "%d\n", startxref);
@@ -326,8 +929,35 @@ pdf_savexref(pdf_xref *xref, char *path, pdf_crypt *encrypt)
 
 	/* TODO: check for write errors */
 
-	if(ofsbuf) fz_free(ofsbuf);
+cleanup:
+	if (encrypt)
+		pdf_cryptobj(encrypt, encrypt->encrypt, writer->eoid, writer->egen);
+	if (writer->stmout)
+		fz_dropstream(writer->stmout);
+	if (writer->stmbuf)
+		fz_dropbuffer(writer->stmbuf);
 	fz_dropstream(out);
-	return fz_okay;
+	fz_free(writer->ofsbuf);
+	fz_free(writer->idxbuf);
+	fz_free(writer);
+	return error;
 }
 
+fz_error *
+pdf_savexref(pdf_xref *xref, char *path, pdf_crypt *encrypt)
+{
+	fz_error *error;
+	pdf_writer *writer;
+
+	pdf_logxref("savexref '%s' %p\n", path, xref);
+
+	error = pdf_openwriter(&writer, xref, path, encrypt, 0);
+	if (error)
+		return fz_rethrow(error, "cannot open writer");
+
+	error = pdf_closewriter(writer);
+	if (error)
+		return fz_rethrow(error, "cannot save xref");
+
+	return fz_okay;
+}
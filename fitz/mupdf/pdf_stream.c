@@ -20,7 +20,7 @@ pdf_isstream(pdf_xref *xref, int oid, int gen)
 		return 0;
 	}
 
-	return xref->table[oid].stmbuf || xref->table[oid].stmofs;
+	return xref->table[oid].stmbuf || xref->table[oid].stmofs || xref->table[oid].stmxref;
 }
 
 /*
@@ -378,6 +378,14 @@ pdf_openrawstream(fz_stream **stmp, pdf_xref *xref, int oid, int gen)
 		return fz_okay;
 	}
 
+	if (x->stmxref)
+	{
+		error = pdf_openrawstream(stmp, x->stmxref, x->stmoid, x->stmgen);
+		if (error)
+			return fz_rethrow(error, "cannot open linked stream (%d)", x->stmoid);
+		return fz_okay;
+	}
+
 	if (x->stmofs)
 	{
 		error = buildrawfilter(&filter, xref, x->obj, oid, gen);
@@ -447,6 +455,14 @@ pdf_openstream(fz_stream **stmp, pdf_xref *xref, int oid, int gen)
 		return fz_okay;
 	}
 
+	if (x->stmxref)
+	{
+		error = pdf_openstream(stmp, x->stmxref, x->stmoid, x->stmgen);
+		if (error)
+			return fz_rethrow(error, "cannot open linked stream (%d)", x->stmoid);
+		return fz_okay;
+	}
+
 	if (x->stmofs)
 	{
 		error = pdf_buildfilter(&filter, xref, x->obj, oid, gen);
@@ -471,6 +487,55 @@ pdf_openstream(fz_stream **stmp, pdf_xref *xref, int oid, int gen)
 	return fz_throw("object is not a stream");
 }
 
+/*
+ * Unencrypted streams in a memory mapped file need no copying;
+ * hand out a slice of the mapping. Leaves *bufp nil when the
+ * stream has to go through the ordinary path.
+ */
+static fz_error *
+loadmappedstream(fz_buffer **bufp, pdf_xref *xref, int oid, int gen)
+{
+	fz_error *error;
+	pdf_xrefentry *x;
+	fz_obj *stmlen;
+	int len;
+
+	*bufp = nil;
+
+	if (xref->crypt || !xref->file || xref->file->kind != FZ_SMMAP)
+		return fz_okay;
+	if (oid < 0 || oid >= xref->len)
+		return fz_okay;
+
+	x = xref->table + oid;
+
+	error = pdf_cacheobject(xref, oid, gen);
+	if (error)
+		return fz_rethrow(error, "cannot load stream object (%d)", oid);
+
+	if (x->stmbuf || x->stmxref || !x->stmofs)
+		return fz_okay;
+
+	stmlen = fz_dictgets(x->obj, "Length");
+	error = pdf_resolve(&stmlen, xref);
+	if (error)
+		return fz_rethrow(error, "cannot resolve stream /Length");
+	len = fz_toint(stmlen);
+	fz_dropobj(stmlen);
+
+	if (len < 0)
+		return fz_okay;
+
+	error = fz_seek(xref->file, x->stmofs, 0);
+	if (error)
+		return fz_rethrow(error, "cannot seek to stream");
+
+	error = fz_readslice(bufp, xref->file, len);
+	if (error)
+		return fz_rethrow(error, "cannot map stream");
+	return fz_okay;
+}
+
 /*
  * Load raw (compressed but decrypted) contents of a stream into buf.
  */
@@ -480,6 +545,12 @@ pdf_loadrawstream(fz_buffer **bufp, pdf_xref *xref, int oid, int gen)
 	fz_error *error;
 	fz_stream *stm;
 
+	error = loadmappedstream(bufp, xref, oid, gen);
+	if (error)
+		return fz_rethrow(error, "cannot load mapped stream (%d)", oid);
+	if (*bufp)
+		return fz_okay;
+
 	error = pdf_openrawstream(&stm, xref, oid, gen);
 	if (error)
 		return fz_rethrow(error, "cannot open raw stream (%d)", oid);
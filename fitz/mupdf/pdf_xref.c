@@ -69,6 +69,9 @@ pdf_closexref(pdf_xref *xref)
 	if (xref->crypt)
 		pdf_dropcrypt(xref->crypt);
 
+	fz_free(xref->cache.flags);
+	fz_free(xref->cache.bytes);
+
 	fz_free(xref);
 }
 
@@ -90,11 +93,188 @@ pdf_initxref(pdf_xref *xref)
 	xref->table[0].gen = 65535;
 	xref->table[0].stmbuf = nil;
 	xref->table[0].stmofs = 0;
+	xref->table[0].stmxref = nil;
 	xref->table[0].obj = nil;
 
 	return fz_okay;
 }
 
+/*
+ * object cache bookkeeping
+ */
+
+enum { CACHEUSED = 1, CACHEPINNED = 2 };
+
+static int
+growcache(pdf_objcache *cache, int oid)
+{
+	unsigned char *flags;
+	int *bytes;
+	int cap, i;
+
+	if (oid < cache->cap)
+		return 1;
+
+	cap = MAX(oid + 1, cache->cap * 2);
+
+	flags = fz_realloc(cache->flags, cap);
+	if (!flags)
+		return 0;
+	cache->flags = flags;
+
+	bytes = fz_realloc(cache->bytes, cap * sizeof(int));
+	if (!bytes)
+		return 0;
+	cache->bytes = bytes;
+
+	for (i = cache->cap; i < cap; i++)
+	{
+		cache->flags[i] = 0;
+		cache->bytes[i] = 0;
+	}
+
+	cache->cap = cap;
+	return 1;
+}
+
+/* rough heap footprint, not following indirect references */
+static int
+objsize(fz_obj *obj)
+{
+	int n = sizeof(fz_obj);
+	int i;
+
+	if (fz_isstring(obj))
+		n += fz_tostrlen(obj);
+	else if (fz_isname(obj))
+		n += strlen(fz_toname(obj));
+	else if (fz_isarray(obj))
+	{
+		n += obj->u.a.cap * sizeof(fz_obj*);
+		for (i = 0; i < fz_arraylen(obj); i++)
+			n += objsize(fz_arrayget(obj, i));
+	}
+	else if (fz_isdict(obj))
+	{
+		n += obj->u.d.cap * sizeof(fz_keyval);
+		for (i = 0; i < fz_dictlen(obj); i++)
+		{
+			n += objsize(fz_dictgetkey(obj, i));
+			n += objsize(fz_dictgetval(obj, i));
+		}
+	}
+
+	return n;
+}
+
+static void
+forgetobject(pdf_xref *xref, int oid)
+{
+	pdf_objcache *cache = &xref->cache;
+	if (oid < cache->cap && cache->bytes[oid])
+	{
+		cache->size -= cache->bytes[oid];
+		cache->bytes[oid] = 0;
+	}
+}
+
+/*
+ * Count an object that was just parsed from the file
+ * against the cache limit.
+ */
+void
+pdf_countobject(pdf_xref *xref, int oid)
+{
+	pdf_objcache *cache = &xref->cache;
+
+	cache->misses ++;
+
+	if (!cache->limit || !xref->table[oid].obj)
+		return;
+	if (!growcache(cache, oid))
+		return;
+
+	forgetobject(xref, oid);
+	cache->bytes[oid] = objsize(xref->table[oid].obj);
+	cache->size += cache->bytes[oid];
+	cache->flags[oid] |= CACHEUSED;
+}
+
+void
+pdf_setcachelimit(pdf_xref *xref, int bytes)
+{
+	xref->cache.limit = MAX(bytes, 0);
+}
+
+/*
+ * Keep an object that has been changed in place in the cache,
+ * since evicting it would lose the change.
+ */
+void
+pdf_pinobject(pdf_xref *xref, int oid)
+{
+	if (oid < 0 || oid >= xref->len)
+		return;
+	if (growcache(&xref->cache, oid))
+		xref->cache.flags[oid] |= CACHEPINNED;
+}
+
+/*
+ * Evict clean objects until the cache fits its limit. Only call this
+ * where no borrowed xref->table[].obj pointers are in use, e.g. between
+ * pages; objects are reloaded from the file when needed again.
+ */
+void
+pdf_trimcache(pdf_xref *xref)
+{
+	pdf_objcache *cache = &xref->cache;
+	pdf_xrefentry *x;
+	int len, steps, i;
+
+	if (!cache->limit)
+		return;
+
+	len = MIN(xref->len, cache->cap);
+	steps = 2 * len;
+
+	while (cache->size > cache->limit && steps-- > 0)
+	{
+		if (cache->hand >= len)
+			cache->hand = 0;
+		i = cache->hand ++;
+
+		if (!cache->bytes[i])
+			continue;
+
+		x = xref->table + i;
+
+		/* replaced or dropped behind our back */
+		if (!x->obj || (x->type != 'n' && x->type != 'o'))
+		{
+			forgetobject(xref, i);
+			continue;
+		}
+
+		if (x->obj->refs > 1 || x->stmbuf || x->stmxref)
+			continue;
+		if (cache->flags[i] & CACHEPINNED)
+			continue;
+
+		if (cache->flags[i] & CACHEUSED)
+		{
+			cache->flags[i] &= ~CACHEUSED;
+			continue;
+		}
+
+		pdf_logxref("evict %d (%d bytes)\n", i, cache->bytes[i]);
+
+		fz_dropobj(x->obj);
+		x->obj = nil;
+		forgetobject(xref, i);
+		cache->evictions ++;
+	}
+}
+
 void
 pdf_flushxref(pdf_xref *xref, int force)
 {
@@ -102,6 +282,9 @@ pdf_flushxref(pdf_xref *xref, int force)
 
 	pdf_logxref("flushxref %p (%d)\n", xref, force);
 
+	if (force)
+		pdf_dropobjstms(xref);
+
 	for (i = 0; i < xref->len; i++)
 	{
 		if (force)
@@ -115,6 +298,7 @@ pdf_flushxref(pdf_xref *xref, int force)
 			{
 				fz_dropobj(xref->table[i].obj);
 				xref->table[i].obj = nil;
+				forgetobject(xref, i);
 			}
 		}
 		else
@@ -128,6 +312,7 @@ pdf_flushxref(pdf_xref *xref, int force)
 			{
 				fz_dropobj(xref->table[i].obj);
 				xref->table[i].obj = nil;
+				forgetobject(xref, i);
 			}
 		}
 	}
@@ -273,6 +458,7 @@ pdf_allocobject(pdf_xref *xref, int *oidp, int *genp)
 	xref->table[oid].gen = 0;
 	xref->table[oid].stmbuf = nil;
 	xref->table[oid].stmofs = 0;
+	xref->table[oid].stmxref = nil;
 	xref->table[oid].obj = nil;
 
 	*oidp = oid;
@@ -308,6 +494,7 @@ pdf_deleteobject(pdf_xref *xref, int oid, int gen)
 	if (x->stmbuf)
 		fz_dropbuffer(x->stmbuf);
 	x->stmbuf = nil;
+	x->stmxref = nil;
 
 	if (x->obj)
 		fz_dropobj(x->obj);
@@ -369,6 +556,35 @@ pdf_updatestream(pdf_xref *xref, int oid, int gen, fz_buffer *stm)
 	if (x->stmbuf)
 		fz_dropbuffer(x->stmbuf);
 	x->stmbuf = fz_keepbuffer(stm);
+	x->stmxref = nil;
+
+	return fz_okay;
+}
+
+/*
+ * Make the stream of an object read from a stream in another xref,
+ * without loading it into memory. The source xref must be kept open
+ * for as long as the stream can be read or saved.
+ */
+fz_error *
+pdf_linkstream(pdf_xref *xref, int oid, int gen, pdf_xref *src, int srcoid, int srcgen)
+{
+	pdf_xrefentry *x;
+
+	if (oid < 0 || oid >= xref->len)
+		return fz_throw("assert: object out of range: %d", oid);
+
+	pdf_logxref("linkstm %d %d (%p %d %d)\n", oid, gen, src, srcoid, srcgen);
+
+	x = xref->table + oid;
+
+	if (x->stmbuf)
+		fz_dropbuffer(x->stmbuf);
+	x->stmbuf = nil;
+
+	x->stmxref = src;
+	x->stmoid = srcoid;
+	x->stmgen = srcgen;
 
 	return fz_okay;
 }
@@ -392,7 +608,12 @@ pdf_cacheobject(pdf_xref *xref, int oid, int gen)
 	x = &xref->table[oid];
 
 	if (x->obj)
+	{
+		xref->cache.hits ++;
+		if (oid < xref->cache.cap)
+			xref->cache.flags[oid] |= CACHEUSED;
 		return fz_okay;
+	}
 
 	if (x->type == 'f' || x->type == 'd')
 	{
@@ -417,18 +638,26 @@ pdf_cacheobject(pdf_xref *xref, int oid, int gen)
 
 		if (xref->crypt)
 			pdf_cryptobj(xref->crypt, x->obj, oid, gen);
+
+		pdf_countobject(xref, oid);
 	}
 
 	else if (x->type == 'o')
 	{
 		if (!x->obj)
 		{
-			error = pdf_loadobjstm(xref, x->ofs, 0, buf, sizeof buf);
+			error = pdf_loadobjstm(xref, oid, buf, sizeof buf);
 			if (error)
 				return fz_rethrow(error, "cannot load object stream containing object %d", oid);
 		}
 	}
 
+	else if (x->type == 'a')
+	{
+		/* dropped by pdf_writeobject, or allocated but never set */
+		return fz_throw("object %d is not in memory", oid);
+	}
+
 	return fz_okay;
 }
 
@@ -88,12 +88,8 @@ getargb(unsigned *s, int w, int h, int u, int v)
 
 static void img_4o4mmx(FZ_PSRC, FZ_PDST, FZ_PCTM)
 {
-	/* since mmx does not have an unsigned multiply instruction we use
-	   17.15 fixed point */
-	u0 >>= 1;	v0 >>= 1;
-	fa >>= 1;	fb >>= 1;
-	fc >>= 1;	fd >>= 1;
-
+	/* mmx only has a signed 16-bit multiply, so the 16.16 fractions
+	   are corrected for the unsigned high bit to lerp like img_4o4 */
 	while (h--)
 	{
 		unsigned *s = (unsigned *)src;
@@ -104,22 +100,27 @@ static void img_4o4mmx(FZ_PSRC, FZ_PDST, FZ_PCTM)
 
 		__m64 mzero = _mm_setzero_si64();
 		__m64 m256 = _mm_set1_pi16(256);
+		__m64 m00ff = _mm_set1_pi16(0xff);
 		__m64 malphamask = _mm_cvtsi32_si64(0xff);
 
 		while (w--)
 		{
-			int iu = u >> 15;
-			int iv = v >> 15;
+			int iu = u >> 16;
+			int iv = v >> 16;
 
-			int fu = u & 0x7fff;
-			int fv = v & 0x7fff;
+			int fu = u & 0xffff;
+			int fv = v & 0xffff;
 
 			int atedge =
 				(iu < 0) | (iu >= (srcw - 1)) |
 				(iv < 0) | (iv >= (srch - 1));
 
-			__m64 ms0s1;
-			__m64 ms2s3;
+			__m64 ms0s1, ms2s3;
+			__m64 ms0, ms1, ms2, ms3;
+			__m64 mfu, mfv, mhu, mhv;
+			__m64 t0, t1, t2, t3, t4, t5, t6, t7, t8;
+			__m64 d0, d1, d2, d3, d4, d5;
+			__m64 a0001, a0011, a1111, sna;
 
 			if (atedge)
 			{
@@ -146,59 +147,64 @@ static void img_4o4mmx(FZ_PSRC, FZ_PDST, FZ_PCTM)
 			}
 
 			/* unpack src into 4x16bit vectors */
-			__m64 ms0 = _mm_unpacklo_pi8(ms0s1, mzero);
-			__m64 ms1 = _mm_unpackhi_pi8(ms0s1, mzero);
-			__m64 ms2 = _mm_unpacklo_pi8(ms2s3, mzero);
-			__m64 ms3 = _mm_unpackhi_pi8(ms2s3, mzero);
+			ms0 = _mm_unpacklo_pi8(ms0s1, mzero);
+			ms1 = _mm_unpackhi_pi8(ms0s1, mzero);
+			ms2 = _mm_unpacklo_pi8(ms2s3, mzero);
+			ms3 = _mm_unpackhi_pi8(ms2s3, mzero);
 
 			/* lerp fu */
 
-			__m64 mfu = _mm_set1_pi16(fu);
+			/* pmulhw reads fu >= 0x8000 as fu - 0x10000, which
+			   takes one (s1 - s0) too many off the product */
+			mfu = _mm_set1_pi16((short)fu);
+			mhu = _mm_srai_pi16(mfu, 15);
 
-			/* t2 = (s1 - s0) * fu + s0 */
-			__m64 t0 = _mm_sub_pi16(ms1, ms0);
-			__m64 t1 = _mm_mulhi_pi16(t0, mfu);
-			t1 = _mm_adds_pi16(t1, t1);
-			__m64 t2 = _mm_add_pi16(t1, ms0);
+			/* t2 = ((s1 - s0) * fu >> 16) + s0 */
+			t0 = _mm_sub_pi16(ms1, ms0);
+			t1 = _mm_mulhi_pi16(t0, mfu);
+			t1 = _mm_add_pi16(t1, _mm_and_si64(t0, mhu));
+			t2 = _mm_add_pi16(t1, ms0);
 
-			/* t3 = (s3 - s2) * fu + s2 */
-			__m64 t3 = _mm_sub_pi16(ms3, ms2);
-			__m64 t4 = _mm_mulhi_pi16(t3, mfu);
-			t4 = _mm_adds_pi16(t4, t4);
-			__m64 t5 = _mm_add_pi16(t4, ms2);
+			/* t5 = ((s3 - s2) * fu >> 16) + s2 */
+			t3 = _mm_sub_pi16(ms3, ms2);
+			t4 = _mm_mulhi_pi16(t3, mfu);
+			t4 = _mm_add_pi16(t4, _mm_and_si64(t3, mhu));
+			t5 = _mm_add_pi16(t4, ms2);
 
 			/* lerp fv */
 
-			__m64 mfv = _mm_set1_pi16(fv);
+			mfv = _mm_set1_pi16((short)fv);
+			mhv = _mm_srai_pi16(mfv, 15);
 
-			/* t8 = (t5 - t2) * fv + t2 */
-			__m64 t6 = _mm_sub_pi16(t5, t2);
-			__m64 t7 = _mm_mulhi_pi16(t6, mfv);
-			t7 = _mm_adds_pi16(t7, t7);
-			__m64 t8 = _mm_add_pi16(t7, t2);
+			/* t8 = ((t5 - t2) * fv >> 16) + t2 */
+			t6 = _mm_sub_pi16(t5, t2);
+			t7 = _mm_mulhi_pi16(t6, mfv);
+			t7 = _mm_add_pi16(t7, _mm_and_si64(t6, mhv));
+			t8 = _mm_add_pi16(t7, t2);
 
 			/* load and prepare dst */
-			__m64 d0 = _mm_cvtsi32_si64(*d);
+			d0 = _mm_cvtsi32_si64(*d);
 
-			__m64 d1 = _mm_unpacklo_pi8(d0, mzero);
+			d1 = _mm_unpacklo_pi8(d0, mzero);
 
 			/* get src alpha */
 
 			/* splat alpha */
-			__m64 a0001 = _mm_and_si64(malphamask, t8);
-			__m64 a0011 = _mm_unpacklo_pi16(a0001, a0001);
-			__m64 a1111 = _mm_unpacklo_pi16(a0011, a0011);
+			a0001 = _mm_and_si64(malphamask, t8);
+			a0011 = _mm_unpacklo_pi16(a0001, a0001);
+			a1111 = _mm_unpacklo_pi16(a0011, a0011);
 
 			/* 255+1 - sa */
-			__m64 sna = _mm_sub_pi16(m256, a1111);
+			sna = _mm_sub_pi16(m256, a1111);
 
 			/* blend src with dst */
-			__m64 d2 = _mm_mullo_pi16(d1, sna);
-			__m64 d3 = _mm_srli_pi16(d2, 8);
-			__m64 d4 = _mm_add_pi16(t8, d3);
+			d2 = _mm_mullo_pi16(d1, sna);
+			d3 = _mm_srli_pi16(d2, 8);
+			d4 = _mm_add_pi16(t8, d3);
 
-			/* pack and store new dst */
-			__m64 d5 = _mm_packs_pu16(d4, mzero);
+			/* pack and store new dst, wrapping like the byte stores
+			   of img_4o4 */
+			d5 = _mm_packs_pu16(_mm_and_si64(d4, m00ff), mzero);
 
 			*d++ = _mm_cvtsi64_si32(d5);
 
@@ -216,6 +222,671 @@ static void img_4o4mmx(FZ_PSRC, FZ_PDST, FZ_PCTM)
 
 #endif /* HAVE_MMX */
 
+/*
+ * SSE4.1 and AVX2 versions of the span compositors in porterduff.c.
+ * They blend 16 or 32 bytes at a time in 16 bit lanes and give the
+ * same bytes as the C versions: fz_mul255(a, b) is (a * (b + 1)) >> 8
+ * and every product stays below 65536. Ragged ends of a span go
+ * through the C formulas.
+ *
+ * The functions carry their own target attribute under gcc so that the
+ * rest of fitz can be built for the baseline cpu; fz_accelerate only
+ * installs them after fz_cpudetect found the instructions.
+ */
+
+#if defined(HAVE_SSE41) || defined(HAVE_AVX2)
+#  ifdef __GNUC__
+#    define TARGETSSE41 __attribute__((target("sse4.1")))
+#    define TARGETAVX2 __attribute__((target("avx2")))
+#  else
+#    define TARGETSSE41
+#    define TARGETAVX2
+#  endif
+#  if defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1700)
+#    define HAVE_AVX2INTRIN
+#    include <immintrin.h>
+#  else
+#    include <smmintrin.h>
+#  endif
+#endif
+
+#ifdef HAVE_SSE41
+
+/* (a * (b + 1)) >> 8 for each byte */
+static inline TARGETSSE41 __m128i
+mul255sse41(__m128i a, __m128i b)
+{
+	__m128i z = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi16(1);
+	__m128i lo, hi;
+	lo = _mm_mullo_epi16(_mm_unpacklo_epi8(a, z), _mm_add_epi16(_mm_unpacklo_epi8(b, z), one));
+	hi = _mm_mullo_epi16(_mm_unpackhi_epi8(a, z), _mm_add_epi16(_mm_unpackhi_epi8(b, z), one));
+	return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+}
+
+/* (c * (a + 1) + d * (255 - a)) >> 8, which is fz_mul255(c - d, a) + d */
+static inline TARGETSSE41 __m128i
+lerp255sse41(__m128i c, __m128i d, __m128i a)
+{
+	__m128i z = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi16(1);
+	__m128i m255 = _mm_set1_epi16(255);
+	__m128i a0 = _mm_unpacklo_epi8(a, z);
+	__m128i a1 = _mm_unpackhi_epi8(a, z);
+	__m128i lo, hi;
+	lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(c, z), _mm_add_epi16(a0, one)),
+		_mm_mullo_epi16(_mm_unpacklo_epi8(d, z), _mm_sub_epi16(m255, a0)));
+	hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(c, z), _mm_add_epi16(a1, one)),
+		_mm_mullo_epi16(_mm_unpackhi_epi8(d, z), _mm_sub_epi16(m255, a1)));
+	return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+}
+
+/* s + fz_mul255(d, 255 - a) */
+static inline TARGETSSE41 __m128i
+oversse41(__m128i s, __m128i d, __m128i a)
+{
+	return _mm_add_epi8(s, mul255sse41(d, _mm_xor_si128(a, _mm_set1_epi8(-1))));
+}
+
+/* running sum of the bytes, plus cov */
+static inline TARGETSSE41 __m128i
+coversse41(__m128i x, byte cov)
+{
+	x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+	x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+	x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+	x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+	return _mm_add_epi8(x, _mm_set1_epi8(cov));
+}
+
+#define LOADSSE(p) _mm_loadu_si128((__m128i*)(p))
+#define STORESSE(p, x) _mm_storeu_si128((__m128i*)(p), x)
+#define ALPHASSE _mm_setr_epi8(0,0,0,0, 4,4,4,4, 8,8,8,8, 12,12,12,12)
+#define SPREADSSE(k) _mm_setr_epi8(k,k,k,k, k+1,k+1,k+1,k+1, k+2,k+2,k+2,k+2, k+3,k+3,k+3,k+3)
+
+/* 16 pixels of the colour in argb with coverage cov over dst */
+static inline TARGETSSE41 void
+w4i1o4sse41(__m128i cov, __m128i alpha, __m128i rgb, byte *dst)
+{
+	__m128i amask = _mm_setr_epi8(-1,0,0,0, -1,0,0,0, -1,0,0,0, -1,0,0,0);
+	__m128i ctl = SPREADSSE(0);
+	__m128i four = _mm_set1_epi8(4);
+	__m128i ca, a, d;
+	int i;
+
+	ca = mul255sse41(cov, alpha);
+	for (i = 0; i < 4; i++)
+	{
+		a = _mm_shuffle_epi8(ca, ctl);
+		ctl = _mm_add_epi8(ctl, four);
+		d = LOADSSE(dst);
+		d = _mm_blendv_epi8(lerp255sse41(rgb, d, a), oversse41(a, d, a), amask);
+		STORESSE(dst, d);
+		dst += 16;
+	}
+}
+
+static void TARGETSSE41
+duff_1o1sse41(byte *sp0, int sw, byte *dp0, int dw, int w0, int h)
+{
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *dp = dp0;
+		int w = w0;
+		for (; w >= 16; w -= 16, sp += 16, dp += 16)
+		{
+			__m128i s = LOADSSE(sp);
+			STORESSE(dp, oversse41(s, LOADSSE(dp), s));
+		}
+		for (; w > 0; w--, sp++, dp++)
+			dp[0] = sp[0] + fz_mul255(dp[0], 255 - sp[0]);
+		sp0 += sw;
+		dp0 += dw;
+	}
+}
+
+static void TARGETSSE41
+duff_4o4sse41(byte *sp0, int sw, byte *dp0, int dw, int w0, int h)
+{
+	__m128i ctl = ALPHASSE;
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *dp = dp0;
+		int w = w0;
+		for (; w >= 8; w -= 8, sp += 32, dp += 32)
+		{
+			__m128i s0 = LOADSSE(sp);
+			__m128i s1 = LOADSSE(sp + 16);
+			STORESSE(dp, oversse41(s0, LOADSSE(dp), _mm_shuffle_epi8(s0, ctl)));
+			STORESSE(dp + 16, oversse41(s1, LOADSSE(dp + 16), _mm_shuffle_epi8(s1, ctl)));
+		}
+		for (; w > 0; w--, sp += 4, dp += 4)
+		{
+			byte ssa = 255 - sp[0];
+			dp[0] = sp[0] + fz_mul255(dp[0], ssa);
+			dp[1] = sp[1] + fz_mul255(dp[1], ssa);
+			dp[2] = sp[2] + fz_mul255(dp[2], ssa);
+			dp[3] = sp[3] + fz_mul255(dp[3], ssa);
+		}
+		sp0 += sw;
+		dp0 += dw;
+	}
+}
+
+static void TARGETSSE41
+duff_1i1c1sse41(byte *sp0, int sw, byte *mp0, int mw, byte *dp0, int dw, int w0, int h)
+{
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *mp = mp0;
+		byte *dp = dp0;
+		int w = w0;
+		for (; w >= 16; w -= 16, sp += 16, mp += 16, dp += 16)
+			STORESSE(dp, mul255sse41(LOADSSE(sp), LOADSSE(mp)));
+		for (; w > 0; w--, sp++, mp++, dp++)
+			dp[0] = fz_mul255(sp[0], mp[0]);
+		sp0 += sw;
+		mp0 += mw;
+		dp0 += dw;
+	}
+}
+
+static void TARGETSSE41
+duff_4i1c4sse41(byte *sp0, int sw, byte *mp0, int mw, byte *dp0, int dw, int w0, int h)
+{
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *mp = mp0;
+		byte *dp = dp0;
+		int w = w0;
+		for (; w >= 8; w -= 8, sp += 32, mp += 8, dp += 32)
+		{
+			__m128i m = _mm_loadl_epi64((__m128i*)mp);
+			STORESSE(dp, mul255sse41(LOADSSE(sp), _mm_shuffle_epi8(m, SPREADSSE(0))));
+			STORESSE(dp + 16, mul255sse41(LOADSSE(sp + 16), _mm_shuffle_epi8(m, SPREADSSE(4))));
+		}
+		for (; w > 0; w--, sp += 4, mp++, dp += 4)
+		{
+			byte ma = mp[0];
+			dp[0] = fz_mul255(sp[0], ma);
+			dp[1] = fz_mul255(sp[1], ma);
+			dp[2] = fz_mul255(sp[2], ma);
+			dp[3] = fz_mul255(sp[3], ma);
+		}
+		sp0 += sw;
+		mp0 += mw;
+		dp0 += dw;
+	}
+}
+
+static void TARGETSSE41
+duff_1i1o1sse41(byte *sp0, int sw, byte *mp0, int mw, byte *dp0, int dw, int w0, int h)
+{
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *mp = mp0;
+		byte *dp = dp0;
+		int w = w0;
+		for (; w >= 16; w -= 16, sp += 16, mp += 16, dp += 16)
+		{
+			__m128i sa = mul255sse41(LOADSSE(sp), LOADSSE(mp));
+			STORESSE(dp, oversse41(sa, LOADSSE(dp), sa));
+		}
+		for (; w > 0; w--, sp++, mp++, dp++)
+		{
+			byte sa = fz_mul255(sp[0], mp[0]);
+			dp[0] = sa + fz_mul255(dp[0], 255 - sa);
+		}
+		sp0 += sw;
+		mp0 += mw;
+		dp0 += dw;
+	}
+}
+
+static void TARGETSSE41
+duff_4i1o4sse41(byte *sp0, int sw, byte *mp0, int mw, byte *dp0, int dw, int w0, int h)
+{
+	__m128i ctl = ALPHASSE;
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *mp = mp0;
+		byte *dp = dp0;
+		int w = w0;
+		for (; w >= 8; w -= 8, sp += 32, mp += 8, dp += 32)
+		{
+			__m128i m = _mm_loadl_epi64((__m128i*)mp);
+			__m128i s0 = mul255sse41(LOADSSE(sp), _mm_shuffle_epi8(m, SPREADSSE(0)));
+			__m128i s1 = mul255sse41(LOADSSE(sp + 16), _mm_shuffle_epi8(m, SPREADSSE(4)));
+			STORESSE(dp, oversse41(s0, LOADSSE(dp), _mm_shuffle_epi8(s0, ctl)));
+			STORESSE(dp + 16, oversse41(s1, LOADSSE(dp + 16), _mm_shuffle_epi8(s1, ctl)));
+		}
+		for (; w > 0; w--, sp += 4, mp++, dp += 4)
+		{
+			byte ma = mp[0];
+			byte ssa = 255 - fz_mul255(sp[0], ma);
+			dp[0] = fz_mul255(sp[0], ma) + fz_mul255(dp[0], ssa);
+			dp[1] = fz_mul255(sp[1], ma) + fz_mul255(dp[1], ssa);
+			dp[2] = fz_mul255(sp[2], ma) + fz_mul255(dp[2], ssa);
+			dp[3] = fz_mul255(sp[3], ma) + fz_mul255(dp[3], ssa);
+		}
+		sp0 += sw;
+		mp0 += mw;
+		dp0 += dw;
+	}
+}
+
+static void TARGETSSE41
+path_1c1sse41(byte *src, byte cov, int len, byte *dst)
+{
+	__m128i z = _mm_setzero_si128();
+	for (; len >= 16; len -= 16, src += 16, dst += 16)
+	{
+		__m128i c = coversse41(LOADSSE(src), cov);
+		STORESSE(src, z);
+		STORESSE(dst, c);
+		cov = _mm_extract_epi8(c, 15);
+	}
+	while (len--)
+	{
+		cov += *src; *src = 0; src++;
+		*dst++ = cov;
+	}
+}
+
+static void TARGETSSE41
+path_1o1sse41(byte *src, byte cov, int len, byte *dst)
+{
+	__m128i z = _mm_setzero_si128();
+	for (; len >= 16; len -= 16, src += 16, dst += 16)
+	{
+		__m128i c = coversse41(LOADSSE(src), cov);
+		STORESSE(src, z);
+		STORESSE(dst, oversse41(c, LOADSSE(dst), c));
+		cov = _mm_extract_epi8(c, 15);
+	}
+	while (len--)
+	{
+		cov += *src; *src = 0; src++;
+		dst[0] = cov + fz_mul255(dst[0], 255 - cov);
+		dst++;
+	}
+}
+
+static void TARGETSSE41
+path_w4i1o4sse41(byte *argb, byte *src, byte cov, int len, byte *dst)
+{
+	byte alpha = argb[0];
+	byte r = argb[4];
+	byte g = argb[5];
+	byte b = argb[6];
+	__m128i valpha = _mm_set1_epi8(alpha);
+	__m128i vrgb = _mm_setr_epi8(0,r,g,b, 0,r,g,b, 0,r,g,b, 0,r,g,b);
+	__m128i z = _mm_setzero_si128();
+	for (; len >= 16; len -= 16, src += 16, dst += 64)
+	{
+		__m128i c = coversse41(LOADSSE(src), cov);
+		STORESSE(src, z);
+		w4i1o4sse41(c, valpha, vrgb, dst);
+		cov = _mm_extract_epi8(c, 15);
+	}
+	while (len--)
+	{
+		byte ca;
+		cov += *src; *src = 0; src++;
+		ca = fz_mul255(cov, alpha);
+		dst[0] = ca + fz_mul255(dst[0], 255 - ca);
+		dst[1] = fz_mul255((short)r - dst[1], ca) + dst[1];
+		dst[2] = fz_mul255((short)g - dst[2], ca) + dst[2];
+		dst[3] = fz_mul255((short)b - dst[3], ca) + dst[3];
+		dst += 4;
+	}
+}
+
+static void
+text_1c1sse41(byte *src0, int srcw, byte *dst0, int dstw, int w0, int h)
+{
+	while (h--)
+	{
+		memcpy(dst0, src0, w0);
+		src0 += srcw;
+		dst0 += dstw;
+	}
+}
+
+static void TARGETSSE41
+text_w4i1o4sse41(byte *argb, byte *src0, int srcw, byte *dst0, int dstw, int w0, int h)
+{
+	byte alpha = argb[0];
+	byte r = argb[4];
+	byte g = argb[5];
+	byte b = argb[6];
+	__m128i valpha = _mm_set1_epi8(alpha);
+	__m128i vrgb = _mm_setr_epi8(0,r,g,b, 0,r,g,b, 0,r,g,b, 0,r,g,b);
+	while (h--)
+	{
+		byte *src = src0;
+		byte *dst = dst0;
+		int w = w0;
+		for (; w >= 16; w -= 16, src += 16, dst += 64)
+			w4i1o4sse41(LOADSSE(src), valpha, vrgb, dst);
+		for (; w > 0; w--, src++, dst += 4)
+		{
+			byte ca = fz_mul255(src[0], alpha);
+			dst[0] = ca + fz_mul255(dst[0], 255 - ca);
+			dst[1] = fz_mul255((short)r - dst[1], ca) + dst[1];
+			dst[2] = fz_mul255((short)g - dst[2], ca) + dst[2];
+			dst[3] = fz_mul255((short)b - dst[3], ca) + dst[3];
+		}
+		src0 += srcw;
+		dst0 += dstw;
+	}
+}
+
+#endif /* HAVE_SSE41 */
+
+#if defined(HAVE_AVX2) && defined(HAVE_AVX2INTRIN)
+
+/* the 32 byte versions of the helpers above; shuffles stay inside each
+   16 byte half, which holds four whole pixels */
+
+static inline TARGETAVX2 __m256i
+mul255avx2(__m256i a, __m256i b)
+{
+	__m256i z = _mm256_setzero_si256();
+	__m256i one = _mm256_set1_epi16(1);
+	__m256i lo, hi;
+	lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(a, z), _mm256_add_epi16(_mm256_unpacklo_epi8(b, z), one));
+	hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(a, z), _mm256_add_epi16(_mm256_unpackhi_epi8(b, z), one));
+	return _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8));
+}
+
+static inline TARGETAVX2 __m256i
+lerp255avx2(__m256i c, __m256i d, __m256i a)
+{
+	__m256i z = _mm256_setzero_si256();
+	__m256i one = _mm256_set1_epi16(1);
+	__m256i m255 = _mm256_set1_epi16(255);
+	__m256i a0 = _mm256_unpacklo_epi8(a, z);
+	__m256i a1 = _mm256_unpackhi_epi8(a, z);
+	__m256i lo, hi;
+	lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(c, z), _mm256_add_epi16(a0, one)),
+		_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, z), _mm256_sub_epi16(m255, a0)));
+	hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(c, z), _mm256_add_epi16(a1, one)),
+		_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, z), _mm256_sub_epi16(m255, a1)));
+	return _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8));
+}
+
+static inline TARGETAVX2 __m256i
+overavx2(__m256i s, __m256i d, __m256i a)
+{
+	return _mm256_add_epi8(s, mul255avx2(d, _mm256_xor_si256(a, _mm256_set1_epi8(-1))));
+}
+
+/* eight mask bytes, each spread over the four bytes of its pixel */
+static inline TARGETAVX2 __m256i
+spreadavx2(byte *mp)
+{
+	__m128i m = _mm_loadl_epi64((__m128i*)mp);
+	__m256i mm = _mm256_inserti128_si256(_mm256_castsi128_si256(m), m, 1);
+	return _mm256_shuffle_epi8(mm, _mm256_setr_epi8(
+		0,0,0,0, 1,1,1,1, 2,2,2,2, 3,3,3,3,
+		4,4,4,4, 5,5,5,5, 6,6,6,6, 7,7,7,7));
+}
+
+#define LOADAVX(p) _mm256_loadu_si256((__m256i*)(p))
+#define STOREAVX(p, x) _mm256_storeu_si256((__m256i*)(p), x)
+#define ALPHAAVX _mm256_setr_epi8( \
+	0,0,0,0, 4,4,4,4, 8,8,8,8, 12,12,12,12, \
+	0,0,0,0, 4,4,4,4, 8,8,8,8, 12,12,12,12)
+
+static inline TARGETAVX2 void
+w4i1o4avx2(__m128i cov, __m128i alpha, __m256i rgb, byte *dst)
+{
+	__m256i amask = _mm256_setr_epi8(
+		-1,0,0,0, -1,0,0,0, -1,0,0,0, -1,0,0,0,
+		-1,0,0,0, -1,0,0,0, -1,0,0,0, -1,0,0,0);
+	__m128i ca = mul255sse41(cov, alpha);
+	__m256i ca2 = _mm256_inserti128_si256(_mm256_castsi128_si256(ca), ca, 1);
+	__m256i a, d;
+
+	a = _mm256_shuffle_epi8(ca2, _mm256_setr_epi8(
+		0,0,0,0, 1,1,1,1, 2,2,2,2, 3,3,3,3,
+		4,4,4,4, 5,5,5,5, 6,6,6,6, 7,7,7,7));
+	d = LOADAVX(dst);
+	STOREAVX(dst, _mm256_blendv_epi8(lerp255avx2(rgb, d, a), overavx2(a, d, a), amask));
+
+	a = _mm256_shuffle_epi8(ca2, _mm256_setr_epi8(
+		8,8,8,8, 9,9,9,9, 10,10,10,10, 11,11,11,11,
+		12,12,12,12, 13,13,13,13, 14,14,14,14, 15,15,15,15));
+	d = LOADAVX(dst + 32);
+	STOREAVX(dst + 32, _mm256_blendv_epi8(lerp255avx2(rgb, d, a), overavx2(a, d, a), amask));
+}
+
+static void TARGETAVX2
+duff_1o1avx2(byte *sp0, int sw, byte *dp0, int dw, int w0, int h)
+{
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *dp = dp0;
+		int w = w0;
+		for (; w >= 32; w -= 32, sp += 32, dp += 32)
+		{
+			__m256i s = LOADAVX(sp);
+			STOREAVX(dp, overavx2(s, LOADAVX(dp), s));
+		}
+		for (; w > 0; w--, sp++, dp++)
+			dp[0] = sp[0] + fz_mul255(dp[0], 255 - sp[0]);
+		sp0 += sw;
+		dp0 += dw;
+	}
+	_mm256_zeroupper();
+}
+
+static void TARGETAVX2
+duff_4o4avx2(byte *sp0, int sw, byte *dp0, int dw, int w0, int h)
+{
+	__m256i ctl = ALPHAAVX;
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *dp = dp0;
+		int w = w0;
+		for (; w >= 8; w -= 8, sp += 32, dp += 32)
+		{
+			__m256i s = LOADAVX(sp);
+			STOREAVX(dp, overavx2(s, LOADAVX(dp), _mm256_shuffle_epi8(s, ctl)));
+		}
+		for (; w > 0; w--, sp += 4, dp += 4)
+		{
+			byte ssa = 255 - sp[0];
+			dp[0] = sp[0] + fz_mul255(dp[0], ssa);
+			dp[1] = sp[1] + fz_mul255(dp[1], ssa);
+			dp[2] = sp[2] + fz_mul255(dp[2], ssa);
+			dp[3] = sp[3] + fz_mul255(dp[3], ssa);
+		}
+		sp0 += sw;
+		dp0 += dw;
+	}
+	_mm256_zeroupper();
+}
+
+static void TARGETAVX2
+duff_1i1c1avx2(byte *sp0, int sw, byte *mp0, int mw, byte *dp0, int dw, int w0, int h)
+{
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *mp = mp0;
+		byte *dp = dp0;
+		int w = w0;
+		for (; w >= 32; w -= 32, sp += 32, mp += 32, dp += 32)
+			STOREAVX(dp, mul255avx2(LOADAVX(sp), LOADAVX(mp)));
+		for (; w > 0; w--, sp++, mp++, dp++)
+			dp[0] = fz_mul255(sp[0], mp[0]);
+		sp0 += sw;
+		mp0 += mw;
+		dp0 += dw;
+	}
+	_mm256_zeroupper();
+}
+
+static void TARGETAVX2
+duff_4i1c4avx2(byte *sp0, int sw, byte *mp0, int mw, byte *dp0, int dw, int w0, int h)
+{
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *mp = mp0;
+		byte *dp = dp0;
+		int w = w0;
+		for (; w >= 8; w -= 8, sp += 32, mp += 8, dp += 32)
+			STOREAVX(dp, mul255avx2(LOADAVX(sp), spreadavx2(mp)));
+		for (; w > 0; w--, sp += 4, mp++, dp += 4)
+		{
+			byte ma = mp[0];
+			dp[0] = fz_mul255(sp[0], ma);
+			dp[1] = fz_mul255(sp[1], ma);
+			dp[2] = fz_mul255(sp[2], ma);
+			dp[3] = fz_mul255(sp[3], ma);
+		}
+		sp0 += sw;
+		mp0 += mw;
+		dp0 += dw;
+	}
+	_mm256_zeroupper();
+}
+
+static void TARGETAVX2
+duff_1i1o1avx2(byte *sp0, int sw, byte *mp0, int mw, byte *dp0, int dw, int w0, int h)
+{
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *mp = mp0;
+		byte *dp = dp0;
+		int w = w0;
+		for (; w >= 32; w -= 32, sp += 32, mp += 32, dp += 32)
+		{
+			__m256i sa = mul255avx2(LOADAVX(sp), LOADAVX(mp));
+			STOREAVX(dp, overavx2(sa, LOADAVX(dp), sa));
+		}
+		for (; w > 0; w--, sp++, mp++, dp++)
+		{
+			byte sa = fz_mul255(sp[0], mp[0]);
+			dp[0] = sa + fz_mul255(dp[0], 255 - sa);
+		}
+		sp0 += sw;
+		mp0 += mw;
+		dp0 += dw;
+	}
+	_mm256_zeroupper();
+}
+
+static void TARGETAVX2
+duff_4i1o4avx2(byte *sp0, int sw, byte *mp0, int mw, byte *dp0, int dw, int w0, int h)
+{
+	__m256i ctl = ALPHAAVX;
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *mp = mp0;
+		byte *dp = dp0;
+		int w = w0;
+		for (; w >= 8; w -= 8, sp += 32, mp += 8, dp += 32)
+		{
+			__m256i s = mul255avx2(LOADAVX(sp), spreadavx2(mp));
+			STOREAVX(dp, overavx2(s, LOADAVX(dp), _mm256_shuffle_epi8(s, ctl)));
+		}
+		for (; w > 0; w--, sp += 4, mp++, dp += 4)
+		{
+			byte ma = mp[0];
+			byte ssa = 255 - fz_mul255(sp[0], ma);
+			dp[0] = fz_mul255(sp[0], ma) + fz_mul255(dp[0], ssa);
+			dp[1] = fz_mul255(sp[1], ma) + fz_mul255(dp[1], ssa);
+			dp[2] = fz_mul255(sp[2], ma) + fz_mul255(dp[2], ssa);
+			dp[3] = fz_mul255(sp[3], ma) + fz_mul255(dp[3], ssa);
+		}
+		sp0 += sw;
+		mp0 += mw;
+		dp0 += dw;
+	}
+	_mm256_zeroupper();
+}
+
+static void TARGETAVX2
+path_w4i1o4avx2(byte *argb, byte *src, byte cov, int len, byte *dst)
+{
+	byte alpha = argb[0];
+	byte r = argb[4];
+	byte g = argb[5];
+	byte b = argb[6];
+	__m128i valpha = _mm_set1_epi8(alpha);
+	__m256i vrgb = _mm256_setr_epi8(
+		0,r,g,b, 0,r,g,b, 0,r,g,b, 0,r,g,b,
+		0,r,g,b, 0,r,g,b, 0,r,g,b, 0,r,g,b);
+	__m128i z = _mm_setzero_si128();
+	for (; len >= 16; len -= 16, src += 16, dst += 64)
+	{
+		__m128i c = coversse41(LOADSSE(src), cov);
+		STORESSE(src, z);
+		w4i1o4avx2(c, valpha, vrgb, dst);
+		cov = _mm_extract_epi8(c, 15);
+	}
+	while (len--)
+	{
+		byte ca;
+		cov += *src; *src = 0; src++;
+		ca = fz_mul255(cov, alpha);
+		dst[0] = ca + fz_mul255(dst[0], 255 - ca);
+		dst[1] = fz_mul255((short)r - dst[1], ca) + dst[1];
+		dst[2] = fz_mul255((short)g - dst[2], ca) + dst[2];
+		dst[3] = fz_mul255((short)b - dst[3], ca) + dst[3];
+		dst += 4;
+	}
+	_mm256_zeroupper();
+}
+
+static void TARGETAVX2
+text_w4i1o4avx2(byte *argb, byte *src0, int srcw, byte *dst0, int dstw, int w0, int h)
+{
+	byte alpha = argb[0];
+	byte r = argb[4];
+	byte g = argb[5];
+	byte b = argb[6];
+	__m128i valpha = _mm_set1_epi8(alpha);
+	__m256i vrgb = _mm256_setr_epi8(
+		0,r,g,b, 0,r,g,b, 0,r,g,b, 0,r,g,b,
+		0,r,g,b, 0,r,g,b, 0,r,g,b, 0,r,g,b);
+	while (h--)
+	{
+		byte *src = src0;
+		byte *dst = dst0;
+		int w = w0;
+		for (; w >= 16; w -= 16, src += 16, dst += 64)
+			w4i1o4avx2(LOADSSE(src), valpha, vrgb, dst);
+		for (; w > 0; w--, src++, dst += 4)
+		{
+			byte ca = fz_mul255(src[0], alpha);
+			dst[0] = ca + fz_mul255(dst[0], 255 - ca);
+			dst[1] = fz_mul255((short)r - dst[1], ca) + dst[1];
+			dst[2] = fz_mul255((short)g - dst[2], ca) + dst[2];
+			dst[3] = fz_mul255((short)b - dst[3], ca) + dst[3];
+		}
+		src0 += srcw;
+		dst0 += dstw;
+	}
+	_mm256_zeroupper();
+}
+
+#endif /* HAVE_AVX2 */
+
 #if defined (ARCH_X86) || defined(ARCH_X86_64)
 void
 fz_accelerate(void)
@@ -227,6 +898,40 @@ fz_accelerate(void)
 		fz_img_4o4 = img_4o4mmx;
 	}
 #  endif
+
+#  ifdef HAVE_SSE41
+	if (fz_cpuflags & HAVE_SSE41)
+	{
+		fz_duff_1o1 = duff_1o1sse41;
+		fz_duff_4o4 = duff_4o4sse41;
+		fz_duff_1i1c1 = duff_1i1c1sse41;
+		fz_duff_4i1c4 = duff_4i1c4sse41;
+		fz_duff_1i1o1 = duff_1i1o1sse41;
+		fz_duff_4i1o4 = duff_4i1o4sse41;
+		fz_path_1c1 = path_1c1sse41;
+		fz_path_1o1 = path_1o1sse41;
+		fz_path_w4i1o4 = path_w4i1o4sse41;
+		fz_text_1c1 = text_1c1sse41;
+		fz_text_1o1 = duff_1o1sse41;
+		fz_text_w4i1o4 = text_w4i1o4sse41;
+	}
+#  endif
+
+	/* the running coverage sums of fz_path_1c1 and fz_path_1o1 are
+	   serial across the span, so those keep their SSE4.1 versions */
+#  if defined(HAVE_AVX2) && defined(HAVE_AVX2INTRIN)
+	if ((fz_cpuflags & HAVE_AVX2) && (fz_cpuflags & HAVE_SSE41))
+	{
+		fz_duff_1o1 = duff_1o1avx2;
+		fz_duff_4o4 = duff_4o4avx2;
+		fz_duff_1i1c1 = duff_1i1c1avx2;
+		fz_duff_4i1c4 = duff_4i1c4avx2;
+		fz_duff_1i1o1 = duff_1i1o1avx2;
+		fz_duff_4i1o4 = duff_4i1o4avx2;
+		fz_path_w4i1o4 = path_w4i1o4avx2;
+		fz_text_1o1 = duff_1o1avx2;
+		fz_text_w4i1o4 = text_w4i1o4avx2;
+	}
+#  endif
 }
 #endif
-
@@ -2,24 +2,55 @@
 #include "fitz-world.h"
 #include "fitz-draw.h"
 
+/*
+ * Rendered glyphs are kept in open addressed hash tables over fixed
+ * arrays of entries. The samples of each glyph come from the block pools,
+ * and the total is held under a limit in bytes. When the cache is full
+ * a clock hand sweeps the entries: a glyph that was used since the hand
+ * last passed gets a second chance, the first one that was not is
+ * evicted and removed from the hash table.
+ *
+ * The cache is split into shards by the hash of the key, each with its
+ * own lock, so renderers on several threads can share it. Glyphs are
+ * rendered outside the lock; entries handed out are pinned until they
+ * are released, and pinned entries are never evicted.
+ *
+ * Which glyphs are cached does not depend on the sharding: anything up
+ * to a sixth of the whole cache is. A glyph larger than the share of its
+ * shard evicts the rest of the shard and has it to itself.
+ */
+
+typedef struct fz_glyphshard_s fz_glyphshard;
 typedef struct fz_hash_s fz_hash;
 typedef struct fz_key_s fz_key;
 typedef struct fz_val_s fz_val;
 
-struct fz_glyphcache_s
+struct fz_glyphshard_s
 {
 	int slots;
 	int size;
 	fz_hash *hash;
-	fz_val *lru;
-	unsigned char *buffer;
+	fz_val *vals;
+	fz_val *free;
+	int maxload;
 	int load;
 	int used;
+	int hand;
+	int hits;
+	int misses;
+	int evictions;
+};
+
+struct fz_glyphcache_s
+{
+	int refs;
+	int size;
+	fz_glyphshard shards[FZ_GLYPHSHARDS];
 };
 
 struct fz_key_s
 {
-	void *fid;
+	unsigned char fid[16];
 	int a, b;
 	int c, d;
 	unsigned short cid;
@@ -34,10 +65,13 @@ struct fz_hash_s
 
 struct fz_val_s
 {
-	fz_hash *ent;
+	fz_hash *ent;	/* nil when the entry is free */
+	fz_val *next;	/* free list */
 	unsigned char *samples;
 	short w, h, x, y;
-	int uses;
+	unsigned char shard;
+	unsigned char recent;
+	short pins;
 };
 
 static unsigned int hashkey(fz_key *key)
@@ -57,73 +91,148 @@ static unsigned int hashkey(fz_key *key)
 	return hash;
 }
 
+/* the shard takes the top bits of the hash, the slot the rest */
+static inline int hashshard(unsigned int hash)
+{
+	return hash >> 24 & (FZ_GLYPHSHARDS - 1);
+}
+
+static fz_error *
+newshard(fz_glyphshard *shard, int slots, int size)
+{
+	int i;
+
+	/* keep the load of the hash table under 75% */
+	shard->slots = MAX(slots, 4);
+	shard->maxload = shard->slots * 3 / 4;
+	shard->size = size;
+
+	shard->hash = fz_malloc(sizeof(fz_hash) * shard->slots);
+	if (!shard->hash)
+		return fz_outofmem;
+
+	shard->vals = fz_malloc(sizeof(fz_val) * shard->maxload);
+	if (!shard->vals)
+	{
+		fz_free(shard->hash);
+		shard->hash = nil;
+		return fz_outofmem;
+	}
+
+	memset(shard->hash, 0, sizeof(fz_hash) * shard->slots);
+	memset(shard->vals, 0, sizeof(fz_val) * shard->maxload);
+
+	shard->free = nil;
+	for (i = shard->maxload - 1; i >= 0; i--)
+	{
+		shard->vals[i].next = shard->free;
+		shard->free = &shard->vals[i];
+	}
+
+	shard->load = 0;
+	shard->used = 0;
+	shard->hand = 0;
+	shard->hits = 0;
+	shard->misses = 0;
+	shard->evictions = 0;
+
+	return fz_okay;
+}
+
+static void
+dropshard(fz_glyphshard *shard)
+{
+	int i;
+
+	if (shard->vals)
+		for (i = 0; i < shard->maxload; i++)
+			if (shard->vals[i].ent && shard->vals[i].samples)
+				fz_poolfree(shard->vals[i].samples, shard->vals[i].w * shard->vals[i].h);
+
+	fz_free(shard->hash);
+	fz_free(shard->vals);
+}
+
 fz_error *
 fz_newglyphcache(fz_glyphcache **arenap, int slots, int size)
 {
 	fz_glyphcache *arena;
+	int i;
 
 	arena = *arenap = fz_malloc(sizeof(fz_glyphcache));
 	if (!arena)
 		return fz_outofmem;
 
-	arena->slots = slots;
+	memset(arena, 0, sizeof(fz_glyphcache));
+	arena->refs = 1;
 	arena->size = size;
 
-	arena->hash = nil;
-	arena->lru = nil;
-	arena->buffer = nil;
-
-	arena->hash = fz_malloc(sizeof(fz_hash) * slots);
-	if (!arena->hash)
-		goto cleanup;
-
-	arena->lru = fz_malloc(sizeof(fz_val) * slots);
-	if (!arena->lru)
-		goto cleanup;
-
-	arena->buffer = fz_malloc(size);
-	if (!arena->buffer)
-		goto cleanup;
-
-	memset(arena->hash, 0, sizeof(fz_hash) * slots);
-	memset(arena->lru, 0, sizeof(fz_val) * slots);
-	memset(arena->buffer, 0, size);
-	arena->load = 0;
-	arena->used = 0;
+	for (i = 0; i < FZ_GLYPHSHARDS; i++)
+	{
+		if (newshard(&arena->shards[i], slots / FZ_GLYPHSHARDS, size / FZ_GLYPHSHARDS))
+		{
+			fz_dropglyphcache(arena);
+			return fz_outofmem;
+		}
+	}
 
 	return fz_okay;
+}
 
-cleanup:
-	fz_free(arena->hash);
-	fz_free(arena->lru);
-	fz_free(arena->buffer);
-	fz_free(arena);
-	return fz_outofmem;
+fz_glyphcache *
+fz_keepglyphcache(fz_glyphcache *arena)
+{
+	fz_lock(FZ_LOCK_GLYPHCACHE);
+	arena->refs ++;
+	fz_unlock(FZ_LOCK_GLYPHCACHE);
+	return arena;
 }
 
 void
 fz_dropglyphcache(fz_glyphcache *arena)
 {
-	fz_free(arena->hash);
-	fz_free(arena->lru);
-	fz_free(arena->buffer);
-	fz_free(arena);
+	int refs;
+	int i;
+
+	fz_lock(FZ_LOCK_GLYPHCACHE);
+	refs = --arena->refs;
+	fz_unlock(FZ_LOCK_GLYPHCACHE);
+
+	if (refs == 0)
+	{
+		for (i = 0; i < FZ_GLYPHSHARDS; i++)
+			dropshard(&arena->shards[i]);
+		fz_free(arena);
+	}
 }
 
-static int hokay = 0;
-static int hcoll = 0;
-static int hdist = 0;
-static int coos = 0;
-static int covf = 0;
+void
+fz_getglyphcachestats(fz_glyphcache *arena, fz_glyphcachestats *stats)
+{
+	fz_glyphshard *shard;
+	int i;
+
+	memset(stats, 0, sizeof(fz_glyphcachestats));
 
-static int ghits = 0;
-static int gmisses = 0;
+	for (i = 0; i < FZ_GLYPHSHARDS; i++)
+	{
+		shard = &arena->shards[i];
+		fz_lock(FZ_LOCK_GLYPHSHARD + i);
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->evictions += shard->evictions;
+		stats->count += shard->load;
+		stats->used += shard->used;
+		stats->size += shard->size;
+		fz_unlock(FZ_LOCK_GLYPHSHARD + i);
+	}
+}
 
 static fz_val *
-hashfind(fz_glyphcache *arena, fz_key *key)
+hashfind(fz_glyphshard *shard, fz_key *key, unsigned int hash)
 {
-	fz_hash *tab = arena->hash;
-	int pos = hashkey(key) % arena->slots;
+	fz_hash *tab = shard->hash;
+	int pos = hash % shard->slots;
 
 	while (1)
 	{
@@ -134,17 +243,16 @@ hashfind(fz_glyphcache *arena, fz_key *key)
 			return tab[pos].val;
 
 		pos = pos + 1;
-		if (pos == arena->slots)
+		if (pos == shard->slots)
 			pos = 0;
 	}
 }
 
 static void
-hashinsert(fz_glyphcache *arena, fz_key *key, fz_val *val)
+hashinsert(fz_glyphshard *shard, fz_key *key, unsigned int hash, fz_val *val)
 {
-	fz_hash *tab = arena->hash;
-	int pos = hashkey(key) % arena->slots;
-int didcoll = 0;
+	fz_hash *tab = shard->hash;
+	int pos = hash % shard->slots;
 
 	while (1)
 	{
@@ -153,175 +261,134 @@ int didcoll = 0;
 			tab[pos].key = *key;
 			tab[pos].val = val;
 			tab[pos].val->ent = &tab[pos];
-if (didcoll) hcoll ++; else hokay ++; hdist += didcoll;
 			return;
 		}
 
 		pos = pos + 1;
-		if (pos == arena->slots)
+		if (pos == shard->slots)
 			pos = 0;
-didcoll ++;
 	}
 }
 
 /*
+ * Empty the slot and move later members of its probe run back into
+ * the hole, so that lookups never stop short at it.
+ */
 static void
-hashremove(fz_glyphcache *arena, fz_key *key)
+hashremove(fz_glyphshard *shard, fz_hash *ent)
 {
-	fz_hash *tab = arena->hash;
-	unsigned int pos = hashkey(key) % arena->slots;
-	unsigned int hole;
+	fz_hash *tab = shard->hash;
+	unsigned int hole = ent - tab;
 	unsigned int look;
 	unsigned int code;
 
-	while (1)
-	{
-		if (!tab[pos].val)
-			return; // boo hoo! tried to remove non-existant key
+	tab[hole].val = nil;
 
-		if (memcmp(key, &tab[pos].key, sizeof (fz_key)) == 0)
-		{
-			tab[pos].val = nil;
-
-			hole = pos;
-			look = hole + 1;
-			if (look == arena->slots)
-				look = 0;
-
-			while (tab[look].val)
-			{
-				code = (hashkey(&tab[look].key) % arena->slots);
-				if ((code <= hole && hole < look) ||
-					(look < code && code <= hole) ||
-					(hole < look && look < code))
-				{
-					tab[hole] = tab[look];
-					tab[hole].val->ent = &tab[hole];
-					tab[look].val = nil;
-					hole = look;
-				}
-
-				look = look + 1;
-				if (look == arena->slots)
-					look = 0;
-			}
+	look = hole + 1;
+	if (look == shard->slots)
+		look = 0;
 
-			return;
+	while (tab[look].val)
+	{
+		code = hashkey(&tab[look].key) % shard->slots;
+		if ((code <= hole && hole < look) ||
+			(look < code && code <= hole) ||
+			(hole < look && look < code))
+		{
+			tab[hole] = tab[look];
+			tab[hole].val->ent = &tab[hole];
+			tab[look].val = nil;
+			hole = look;
 		}
 
-		pos = pos + 1;
-		if (pos == arena->slots)
-			pos = 0;
+		look = look + 1;
+		if (look == shard->slots)
+			look = 0;
 	}
 }
-*/
 
 void
 fz_debugglyphcache(fz_glyphcache *arena)
 {
-	printf("cache load %d / %d (%d / %d bytes)\n",
-		arena->load, arena->slots, arena->used, arena->size);
-	printf("no-colliders: %d colliders: %d\n", hokay, hcoll);
-	printf("avg dist: %d / %d: %g\n", hdist, hcoll, (double)hdist / hcoll);
-	printf("out-of-space evicts: %d\n", coos);
-	printf("out-of-hash evicts: %d\n", covf);
-	printf("hits = %d misses = %d ratio = %g\n", ghits, gmisses, (float)ghits / (ghits + gmisses));
-/*
-	int i;
-	for (i = 0; i < arena->slots; i++)
-	{
-		if (!arena->hash[i].val)
-			printf("glyph % 4d: empty\n", i);
-		else {
-			fz_key *k = &arena->hash[i].key;
-			fz_val *b = arena->hash[i].val;
-			printf("glyph % 4d: %p %d [%g %g %g %g + %d %d] "
-					"-> [%dx%d %d,%d]\n", i,
-				k->fid, k->cid,
-				k->a / 65536.0,
-				k->b / 65536.0,
-				k->c / 65536.0,
-				k->d / 65536.0,
-				k->e, k->f,
-				b->w, b->h, b->x, b->y);
-		}
-	}
+	fz_glyphcachestats stats;
 
-	for (i = 0; i < arena->load; i++)
-		printf("lru %04d: glyph %d (%d)\n", i,
-			arena->lru[i].ent - arena->hash, arena->lru[i].uses);
-*/
+	fz_getglyphcachestats(arena, &stats);
+
+	printf("cache load %d (%d / %d bytes)\n",
+		stats.count, stats.used, stats.size);
+	printf("hits = %d misses = %d evictions = %d ratio = %g\n",
+		stats.hits, stats.misses, stats.evictions,
+		(float)stats.hits / (stats.hits + stats.misses));
 }
 
-static void
-bubble(fz_glyphcache *arena, int i)
+/* returns 0 when every entry is pinned */
+static int
+evictone(fz_glyphshard *shard)
 {
-	fz_val tmp;
-
-	if (i == 0 || arena->load < 2)
-		return;
-
-	tmp = arena->lru[i - 1];
-	arena->lru[i - 1] = arena->lru[i];
-	arena->lru[i] = tmp;
+	fz_val *val;
+	int n;
 
-	arena->lru[i - 1].ent->val = &arena->lru[i - 1];
-	arena->lru[i].ent->val = &arena->lru[i];
-}
+	for (n = 0; n < shard->maxload * 2; n++)
+	{
+		val = &shard->vals[shard->hand];
+		shard->hand = shard->hand + 1;
+		if (shard->hand == shard->maxload)
+			shard->hand = 0;
 
-/*
-static void
-evictlast(fz_glyphcache *arena)
-{
-	fz_val *lru = arena->lru;
-	unsigned char *s, *e;
-	int i, k;
-	fz_key key;
+		if (!val->ent || val->pins)
+			continue;
 
-	if (arena->load == 0)
-		return;
+		if (val->recent)
+		{
+			val->recent = 0;
+			continue;
+		}
 
-	k = arena->load - 1;
-	s = lru[k].samples;
-	e = s + lru[k].w * lru[k].h;
+		hashremove(shard, val->ent);
 
-	// pack buffer to fill hole
-	memmove(s, e, arena->buffer + arena->used - e);
-	memset(arena->buffer + arena->used - (e - s), 0, e - s);
-	arena->used -= e - s;
+		if (val->samples)
+			fz_poolfree(val->samples, val->w * val->h);
+		shard->used -= val->w * val->h;
+		shard->load --;
+		shard->evictions ++;
 
-	// update lru pointers
-	for (i = 0; i < k; i++)	// XXX this is DOG slow! XXX
-		if (lru[i].samples >= e)
-			lru[i].samples -= e - s;
+		val->ent = nil;
+		val->samples = nil;
+		val->next = shard->free;
+		shard->free = val;
 
-	// remove hash entry
-	key = lru[k].ent->key;
-	hashremove(arena, &key);
+		return 1;
+	}
 
-	arena->load --;
+	return 0;
 }
-*/
 
 static void
-evictall(fz_glyphcache *arena)
+pinglyph(fz_glyph *glyph, fz_val *val)
 {
-	memset(arena->hash, 0, sizeof(fz_hash) * arena->slots);
-	memset(arena->lru, 0, sizeof(fz_val) * arena->slots);
-	memset(arena->buffer, 0, arena->size);
-	arena->load = 0;
-	arena->used = 0;
+	val->pins ++;
+	glyph->w = val->w;
+	glyph->h = val->h;
+	glyph->x = val->x;
+	glyph->y = val->y;
+	glyph->samples = val->samples;
+	glyph->pin = val;
 }
 
 fz_error *
 fz_renderglyph(fz_glyphcache *arena, fz_glyph *glyph, fz_font *font, int cid, fz_matrix ctm)
 {
 	fz_error *error;
+	fz_glyphshard *shard;
 	fz_key key;
 	fz_val *val;
+	unsigned char *samples;
+	unsigned int hash;
+	int lock;
 	int size;
 
-	key.fid = font;
+	memset(&key, 0, sizeof key);
+	memcpy(key.fid, font->id, sizeof key.fid);
 	key.cid = cid;
 	key.a = ctm.a * 65536;
 	key.b = ctm.b * 65536;
@@ -330,25 +397,27 @@ fz_renderglyph(fz_glyphcache *arena, fz_glyph *glyph, fz_font *font, int cid, fz
 	key.e = (ctm.e - fz_floor(ctm.e)) * 256;
 	key.f = (ctm.f - fz_floor(ctm.f)) * 256;
 
-	val = hashfind(arena, &key);
-	if (val)
-	{
-		val->uses ++;
-		glyph->w = val->w;
-		glyph->h = val->h;
-		glyph->x = val->x;
-		glyph->y = val->y;
-		glyph->samples = val->samples;
+	hash = hashkey(&key);
+	lock = hashshard(hash);
+	shard = &arena->shards[lock];
+	lock += FZ_LOCK_GLYPHSHARD;
 
-		bubble(arena, val - arena->lru);
-
-		ghits++;
+	glyph->pin = nil;
 
+	fz_lock(lock);
+	val = hashfind(shard, &key, hash);
+	if (val)
+	{
+		val->recent = 1;
+		pinglyph(glyph, val);
+		shard->hits ++;
+		fz_unlock(lock);
 		return fz_okay;
 	}
+	shard->misses ++;
+	fz_unlock(lock);
 
-	gmisses++;
-
+	/* render outside the lock, type3 glyphs run a renderer of their own */
 	ctm.e = fz_floor(ctm.e) + key.e / 256.0;
 	ctm.f = fz_floor(ctm.f) + key.f / 256.0;
 
@@ -361,33 +430,80 @@ fz_renderglyph(fz_glyphcache *arena, fz_glyph *glyph, fz_font *font, int cid, fz
 	if (size > arena->size / 6)
 		return fz_okay;
 
-	while (arena->load > arena->slots * 75 / 100)
+	/* not caching the glyph is no error */
+	samples = nil;
+	if (size > 0)
 	{
-		covf ++;
-		evictall(arena);
+		samples = fz_poolalloc(size);
+		if (!samples)
+			return fz_okay;
+		memcpy(samples, glyph->samples, size);
 	}
 
-	while (arena->used + size >= arena->size)
+	fz_lock(lock);
+
+	/* another thread may have rendered it meanwhile */
+	val = hashfind(shard, &key, hash);
+	if (val)
 	{
-		coos ++;
-		evictall(arena);
+		pinglyph(glyph, val);
+		fz_unlock(lock);
+		if (samples)
+			fz_poolfree(samples, size);
+		return fz_okay;
 	}
 
-	val = &arena->lru[arena->load++];
-	val->uses = 0;
+	while (shard->load > 0 &&
+		(shard->load == shard->maxload || shard->used + size > shard->size))
+	{
+		if (!evictone(shard))
+			break;
+	}
+
+	if (!shard->free || (shard->load > 0 && shard->used + size > shard->size))
+	{
+		fz_unlock(lock);
+		if (samples)
+			fz_poolfree(samples, size);
+		return fz_okay;
+	}
+
+	val = shard->free;
+	shard->free = val->next;
+
+	val->shard = lock - FZ_LOCK_GLYPHSHARD;
+	val->recent = 0;
+	val->pins = 0;
 	val->w = glyph->w;
 	val->h = glyph->h;
 	val->x = glyph->x;
 	val->y = glyph->y;
-	val->samples = arena->buffer + arena->used;
+	val->samples = samples;
 
-	arena->used += size;
+	shard->load ++;
+	shard->used += size;
 
-	memcpy(val->samples, glyph->samples, glyph->w * glyph->h);
-	glyph->samples = val->samples;
+	hashinsert(shard, &key, hash, val);
+	pinglyph(glyph, val);
 
-	hashinsert(arena, &key, val);
+	fz_unlock(lock);
 
 	return fz_okay;
 }
 
+void
+fz_releaseglyph(fz_glyphcache *arena, fz_glyph *glyph)
+{
+	fz_val *val = glyph->pin;
+	int lock;
+
+	if (!val)
+		return;
+
+	lock = FZ_LOCK_GLYPHSHARD + val->shard;
+	fz_lock(lock);
+	val->pins --;
+	fz_unlock(lock);
+
+	glyph->pin = nil;
+}
@@ -83,6 +83,37 @@ static inline void sampleargb(byte *s, int w, int h, int u, int v, byte *abcd)
 	lerpargb(abcd, ab, cd, vd);
 }
 
+static inline void lerpag(byte *dst, byte *a, byte *b, int t)
+{
+	dst[0] = lerp(a[0], b[0], t);
+	dst[1] = lerp(a[1], b[1], t);
+}
+
+static inline byte *getag(byte *s, int w, int h, int u, int v)
+{
+	static byte zero[2] = { 0, 0 };
+	if (u < 0 || u >= w) return zero;
+	if (v < 0 || v >= h) return zero;
+	return s + ((w * v + u) << 1);
+}
+
+static inline void sampleag(byte *s, int w, int h, int u, int v, byte *abcd)
+{
+	byte ab[2];
+	byte cd[2];
+	int ui = u >> 16;
+	int vi = v >> 16;
+	int ud = u & 0xFFFF;
+	int vd = v & 0xFFFF;
+	byte *a = getag(s, w, h, ui, vi);
+	byte *b = getag(s, w, h, ui+1, vi);
+	byte *c = getag(s, w, h, ui, vi+1);
+	byte *d = getag(s, w, h, ui+1, vi+1);
+	lerpag(ab, a, b, ud);
+	lerpag(cd, c, d, ud);
+	lerpag(abcd, ab, cd, vd);
+}
+
 static void img_ncn(FZ_PSRC, int srcn, FZ_PDST, FZ_PCTM)
 {
 	int k;
@@ -129,6 +160,27 @@ static void img_1c1(FZ_PSRC, FZ_PDST, FZ_PCTM)
 	}
 }
 
+static void img_2c2(FZ_PSRC, FZ_PDST, FZ_PCTM)
+{
+	while (h--)
+	{
+		byte *dstp = dst0;
+		int u = u0;
+		int v = v0;
+		int w = w0;
+		while (w--)
+		{
+			sampleag(src, srcw, srch, u, v, dstp);
+			dstp += 2;
+			u += fa;
+			v += fb;
+		}
+		dst0 += dstw;
+		u0 += fc;
+		v0 += fd;
+	}
+}
+
 static void img_4c4(FZ_PSRC, FZ_PDST, FZ_PCTM)
 {
 	while (h--)
@@ -173,6 +225,32 @@ static void img_1o1(FZ_PSRC, FZ_PDST, FZ_PCTM)
 	}
 }
 
+static void img_2o2(FZ_PSRC, FZ_PDST, FZ_PCTM)
+{
+	byte ag[2];
+	byte ssa;
+	while (h--)
+	{
+		byte *dstp = dst0;
+		int u = u0;
+		int v = v0;
+		int w = w0;
+		while (w--)
+		{
+			sampleag(src, srcw, srch, u, v, ag);
+			ssa = 255 - ag[0];
+			dstp[0] = ag[0] + fz_mul255(dstp[0], ssa);
+			dstp[1] = ag[1] + fz_mul255(dstp[1], ssa);
+			dstp += 2;
+			u += fa;
+			v += fb;
+		}
+		dst0 += dstw;
+		u0 += fc;
+		v0 += fd;
+	}
+}
+
 static void img_4o4(FZ_PSRC, FZ_PDST, FZ_PCTM)
 {
 	byte argb[4];
@@ -201,6 +279,34 @@ static void img_4o4(FZ_PSRC, FZ_PDST, FZ_PCTM)
 	}
 }
 
+static void img_w2i1o2(byte *argb, FZ_PSRC, FZ_PDST, FZ_PCTM)
+{
+	byte alpha = argb[0];
+	byte k = argb[4];
+	byte cov;
+	byte ca;
+	while (h--)
+	{
+		byte *dstp = dst0;
+		int u = u0;
+		int v = v0;
+		int w = w0;
+		while (w--)
+		{
+			cov = samplemask(src, srcw, srch, u, v);
+			ca = fz_mul255(cov, alpha);
+			dstp[0] = ca + fz_mul255(dstp[0], 255 - ca);
+			dstp[1] = fz_mul255((short)k - dstp[1], ca) + dstp[1];
+			dstp += 2;
+			u += fa;
+			v += fb;
+		}
+		dst0 += dstw;
+		u0 += fc;
+		v0 += fd;
+	}
+}
+
 static void img_w4i1o4(byte *argb, FZ_PSRC, FZ_PDST, FZ_PCTM)
 {
 	byte alpha = argb[0];
@@ -235,8 +341,11 @@ static void img_w4i1o4(byte *argb, FZ_PSRC, FZ_PDST, FZ_PCTM)
 
 void (*fz_img_ncn)(FZ_PSRC, int sn, FZ_PDST, FZ_PCTM) = img_ncn;
 void (*fz_img_1c1)(FZ_PSRC, FZ_PDST, FZ_PCTM) = img_1c1;
+void (*fz_img_2c2)(FZ_PSRC, FZ_PDST, FZ_PCTM) = img_2c2;
 void (*fz_img_4c4)(FZ_PSRC, FZ_PDST, FZ_PCTM) = img_4c4;
 void (*fz_img_1o1)(FZ_PSRC, FZ_PDST, FZ_PCTM) = img_1o1;
+void (*fz_img_2o2)(FZ_PSRC, FZ_PDST, FZ_PCTM) = img_2o2;
 void (*fz_img_4o4)(FZ_PSRC, FZ_PDST, FZ_PCTM) = img_4o4;
+void (*fz_img_w2i1o2)(byte*,FZ_PSRC,FZ_PDST,FZ_PCTM) = img_w2i1o2;
 void (*fz_img_w4i1o4)(byte*,FZ_PSRC,FZ_PDST,FZ_PCTM) = img_w4i1o4;
 
@@ -319,12 +319,13 @@ fz_rendershade(fz_shade *shade, fz_matrix ctm, fz_colorspace *destcs, fz_pixmap
 	unsigned char *s, *d;
 	fz_error *error;
 	fz_pixmap *temp;
-	float rgb[3];
+	float rgb[FZ_MAXCOLORS];
 	float tri[3][MAXN];
 	fz_point p;
 	int i, j, k, n;
 
-	assert(dest->n == 4);
+	assert(dest->n == destcs->n + 1);
+	assert(destcs->n <= 3);
 
 	ctm = fz_concat(shade->matrix, ctm);
 
@@ -375,23 +376,35 @@ fz_rendershade(fz_shade *shade, fz_matrix ctm, fz_colorspace *destcs, fz_pixmap
 		for (i = 0; i < 256; i++)
 		{
 			fz_convertcolor(shade->cs, shade->function[i], destcs, rgb);
-			clut[i][0] = rgb[0] * 255;
-			clut[i][1] = rgb[1] * 255;
-			clut[i][2] = rgb[2] * 255;
+			for (k = 0; k < destcs->n; k++)
+				clut[i][k] = rgb[k] * 255;
 		}
 
 		n = temp->w * temp->h;
 		s = temp->samples;
 		d = dest->samples;
 
-		while (n--)
+		if (destcs->n == 1)
 		{
-			d[0] = s[0];
-			d[1] = fz_mul255(s[0], clut[s[1]][0]);
-			d[2] = fz_mul255(s[0], clut[s[1]][1]);
-			d[3] = fz_mul255(s[0], clut[s[1]][2]);
-			s += 2;
-			d += 4;
+			while (n--)
+			{
+				d[0] = s[0];
+				d[1] = fz_mul255(s[0], clut[s[1]][0]);
+				s += 2;
+				d += 2;
+			}
+		}
+		else
+		{
+			while (n--)
+			{
+				d[0] = s[0];
+				d[1] = fz_mul255(s[0], clut[s[1]][0]);
+				d[2] = fz_mul255(s[0], clut[s[1]][1]);
+				d[3] = fz_mul255(s[0], clut[s[1]][2]);
+				s += 2;
+				d += 4;
+			}
 		}
 
 		fz_droppixmap(temp);
@@ -2,14 +2,18 @@
 #include "fitz-world.h"
 #include "fitz-draw.h"
 
-enum { HSCALE = 17, VSCALE = 15, SF = 1 };
+/*
+ * Edges are kept in 24.8 fixed point. A pixel is covered by the exact
+ * area of the path inside it, which is found the way FreeType's ftgrays
+ * does: every edge leaves a signed area in the cells it crosses on a
+ * row, and a running sum along the row gives the coverage of each
+ * pixel. A full pixel is FULL.
+ */
+
+enum { FRAC = 8, ONE = 1 << FRAC, FULL = 2 * ONE * ONE };
 
 /*
  * Global Edge List -- list of straight path segments for scan conversion
- *
- * Stepping along the edges is with bresenham's line algorithm.
- *
- * See Mike Abrash -- Graphics Programming Black Book (notably chapter 40)
  */
 
 fz_error *
@@ -49,10 +53,10 @@ fz_resetgel(fz_gel *gel, fz_irect clip)
 		gel->clip.x1 = gel->clip.y1 = INT_MIN;
 	}
 	else {
-		gel->clip.x0 = clip.x0 * HSCALE;
-		gel->clip.x1 = clip.x1 * HSCALE;
-		gel->clip.y0 = clip.y0 * VSCALE;
-		gel->clip.y1 = clip.y1 * VSCALE;
+		gel->clip.x0 = clip.x0 * ONE;
+		gel->clip.x1 = clip.x1 * ONE;
+		gel->clip.y0 = clip.y0 * ONE;
+		gel->clip.y1 = clip.y1 * ONE;
 	}
 
 	gel->bbox.x0 = gel->bbox.y0 = INT_MAX;
@@ -72,10 +76,10 @@ fz_irect
 fz_boundgel(fz_gel *gel)
 {
 	fz_irect bbox;
-	bbox.x0 = fz_idiv(gel->bbox.x0, HSCALE);
-	bbox.y0 = fz_idiv(gel->bbox.y0, VSCALE);
-	bbox.x1 = fz_idiv(gel->bbox.x1, HSCALE) + 1;
-	bbox.y1 = fz_idiv(gel->bbox.y1, VSCALE) + 1;
+	bbox.x0 = fz_idiv(gel->bbox.x0, ONE);
+	bbox.y0 = fz_idiv(gel->bbox.y0, ONE);
+	bbox.x1 = fz_idiv(gel->bbox.x1, ONE) + 1;
+	bbox.y1 = fz_idiv(gel->bbox.y1, ONE) + 1;
 	return bbox;
 }
 
@@ -97,42 +101,23 @@ cliplerpx(int val, int m, int x0, int y0, int x1, int y1, int *out)
 
 	if (v1out)
 	{
-		*out = y0 + (y1 - y0) * (val - x0) / (x1 - x0);
+		*out = y0 + (int)((double)(y1 - y0) * (val - x0) / (x1 - x0));
 		return LEAVE;
 	}
 
 	else
 	{
-		*out = y1 + (y0 - y1) * (val - x1) / (x0 - x1);
+		*out = y1 + (int)((double)(y0 - y1) * (val - x1) / (x0 - x1));
 		return ENTER;
 	}
 }
 
-fz_error *
-fz_insertgel(fz_gel *gel, float fx0, float fy0, float fx1, float fy1)
+static fz_error *
+addedge(fz_gel *gel, int x0, int y0, int x1, int y1)
 {
 	fz_edge *edge;
-	int dx, dy;
 	int winding;
-	int width;
 	int tmp;
-	int v;
-	int d;
-
-	int x0 = fz_floor(fx0 * HSCALE);
-	int y0 = fz_floor(fy0 * VSCALE);
-	int x1 = fz_floor(fx1 * HSCALE);
-	int y1 = fz_floor(fy1 * VSCALE);
-
-	d = cliplerpy(gel->clip.y0, 0, x0, y0, x1, y1, &v);
-	if (d == OUTSIDE) return fz_okay;
-	if (d == LEAVE) { y1 = gel->clip.y0; x1 = v; }
-	if (d == ENTER) { y0 = gel->clip.y0; x0 = v; }
-
-	d = cliplerpy(gel->clip.y1, 1, x0, y0, x1, y1, &v);
-	if (d == OUTSIDE) return fz_okay;
-	if (d == LEAVE) { y1 = gel->clip.y1; x1 = v; }
-	if (d == ENTER) { y0 = gel->clip.y1; x0 = v; }
 
 	if (y0 == y1)
 		return fz_okay;
@@ -164,36 +149,76 @@ fz_insertgel(fz_gel *gel, float fx0, float fy0, float fx1, float fy1)
 
 	edge = &gel->edges[gel->len++];
 
-	dy = y1 - y0;
-	dx = x1 - x0;
-	width = dx < 0 ? -dx : dx;
+	edge->x0 = x0;
+	edge->y0 = y0;
+	edge->x1 = x1;
+	edge->y1 = y1;
+	edge->dir = winding;
+	edge->dxdy = (double)(x1 - x0) / (y1 - y0);
 
-	edge->xdir = dx > 0 ? 1 : -1;
-	edge->ydir = winding;
-	edge->x = x0;
-	edge->y = y0;
-	edge->h = dy;
-	edge->adjdown = dy;
+	return fz_okay;
+}
 
-	/* initial error term going l->r and r->l */
-	if (dx >= 0)
-		edge->e = 0;
-	else
-		edge->e = -dy + 1;
+/*
+ * The parts of an edge left or right of the clip are moved onto the
+ * clip boundary. They still add their winding to the pixels right of
+ * them, but no longer stretch the row buffers or overflow the fixed
+ * point arithmetic.
+ */
+static fz_error *
+addclippededge(fz_gel *gel, int x0, int y0, int x1, int y1)
+{
+	fz_error *error;
+	int cx0 = gel->clip.x0;
+	int cx1 = gel->clip.x1;
+	int v;
 
-	/* y-major edge */
-	if (dy >= width) {
-		edge->xmove = 0;
-		edge->adjup = width;
+	if ((x0 < cx0 && x1 > cx0) || (x1 < cx0 && x0 > cx0))
+	{
+		cliplerpx(cx0, 0, x0, y0, x1, y1, &v);
+		error = addclippededge(gel, x0, y0, cx0, v);
+		if (error)
+			return error;
+		return addclippededge(gel, cx0, v, x1, y1);
 	}
 
-	/* x-major edge */
-	else {
-		edge->xmove = (width / dy) * edge->xdir;
-		edge->adjup = width % dy;
+	if ((x0 < cx1 && x1 > cx1) || (x1 < cx1 && x0 > cx1))
+	{
+		cliplerpx(cx1, 1, x0, y0, x1, y1, &v);
+		error = addclippededge(gel, x0, y0, cx1, v);
+		if (error)
+			return error;
+		return addclippededge(gel, cx1, v, x1, y1);
 	}
 
-	return fz_okay;
+	return addedge(gel, CLAMP(x0, cx0, cx1), y0, CLAMP(x1, cx0, cx1), y1);
+}
+
+fz_error *
+fz_insertgel(fz_gel *gel, float fx0, float fy0, float fx1, float fy1)
+{
+	int v;
+	int d;
+
+	int x0 = fz_floor(fx0 * ONE);
+	int y0 = fz_floor(fy0 * ONE);
+	int x1 = fz_floor(fx1 * ONE);
+	int y1 = fz_floor(fy1 * ONE);
+
+	d = cliplerpy(gel->clip.y0, 0, x0, y0, x1, y1, &v);
+	if (d == OUTSIDE) return fz_okay;
+	if (d == LEAVE) { y1 = gel->clip.y0; x1 = v; }
+	if (d == ENTER) { y0 = gel->clip.y0; x0 = v; }
+
+	d = cliplerpy(gel->clip.y1, 1, x0, y0, x1, y1, &v);
+	if (d == OUTSIDE) return fz_okay;
+	if (d == LEAVE) { y1 = gel->clip.y1; x1 = v; }
+	if (d == ENTER) { y0 = gel->clip.y1; x0 = v; }
+
+	if (y0 == y1)
+		return fz_okay;
+
+	return addclippededge(gel, x0, y0, x1, y1);
 }
 
 void
@@ -221,8 +246,7 @@ fz_sortgel(fz_gel *gel)
 		for (i = 0; i < n; i++) {
 			t = a[i];
 			k = i - h;
-			/* TODO: sort on y major, x minor */
-			while (k >= 0 && a[k].y > t.y) {
+			while (k >= 0 && a[k].y0 > t.y0) {
 				a[k + h] = a[k];
 				k -= h;
 			}
@@ -286,7 +310,7 @@ sortael(fz_edge **a, int n)
 		for (i = 0; i < n; i++) {
 			t = a[i];
 			k = i - h;
-			while (k >= 0 && a[k]->x > t->x) {
+			while (k >= 0 && a[k]->lo > t->lo) {
 				a[k + h] = a[k];
 				k -= h;
 			}
@@ -300,8 +324,10 @@ sortael(fz_edge **a, int n)
 static fz_error *
 insertael(fz_ael *ael, fz_gel *gel, int y, int *e)
 {
-	/* insert edges that start here */
-	while (*e < gel->len && gel->edges[*e].y == y) {
+	fz_edge *edge;
+
+	/* insert edges that start on this row */
+	while (*e < gel->len && fz_idiv(gel->edges[*e].y0, ONE) <= y) {
 		if (ael->len + 1 == ael->cap) {
 			int newcap = ael->cap + 64;
 			fz_edge **newedges = fz_realloc(ael->edges, sizeof(fz_edge*) * newcap);
@@ -310,41 +336,26 @@ insertael(fz_ael *ael, fz_gel *gel, int y, int *e)
 			ael->edges = newedges;
 			ael->cap = newcap;
 		}
-		ael->edges[ael->len++] = &gel->edges[(*e)++];
+		edge = &gel->edges[(*e)++];
+		edge->x = edge->x0;
+		ael->edges[ael->len++] = edge;
 	}
 
-	/* shell-sort the edges by increasing x */
-	sortael(ael->edges, ael->len);
-
 	return fz_okay;
 }
 
 static void
-advanceael(fz_ael *ael)
+advanceael(fz_ael *ael, int ybot)
 {
-	fz_edge *edge;
 	int i = 0;
 
+	/* drop the edges that end on this row */
 	while (i < ael->len)
 	{
-		edge = ael->edges[i];
-
-		edge->h --;
-
-		/* terminator! */
-		if (edge->h == 0) {
+		if (ael->edges[i]->y1 <= ybot)
 			ael->edges[i] = ael->edges[--ael->len];
-		}
-
-		else {
-			edge->x += edge->xmove;
-			edge->e += edge->adjup;
-			if (edge->e > 0) {
-				edge->x += edge->xdir;
-				edge->e -= edge->adjdown;
-			}
+		else
 			i ++;
-		}
 	}
 }
 
@@ -352,99 +363,204 @@ advanceael(fz_ael *ael)
  * Scan convert
  */
 
+/* a piece of edge going from fx0 to fx1 inside cell x and dy high */
 static inline void
-addspan(unsigned char *list, int x0, int x1, int xofs)
+addcell(int *acc, int x, int fx0, int fx1, int dy)
 {
-	int x0pix, x0sub;
-	int x1pix, x1sub;
+	int area = dy * (2 * ONE - fx0 - fx1);
+	acc[x] += area;
+	acc[x + 1] += 2 * ONE * dy - area;
+}
 
-	if (x0 == x1)
-		return;
+/* split a piece of edge inside one row among the cells it crosses */
+static inline void
+addcells(int *acc, int xa, int xb, int dy)
+{
+	int ca, cb, fa, fb;
+	int dx, p, y;
+	int delta, mod, lift, rem;
 
-	/* x between 0 and width of bbox */
-	x0 -= xofs;
-	x1 -= xofs;
+	if (xb < xa) {
+		int t = xa; xa = xb; xb = t;
+	}
 
-	x0pix = x0 / HSCALE;
-	x0sub = x0 % HSCALE;
-	x1pix = x1 / HSCALE;
-	x1sub = x1 % HSCALE;
+	ca = xa >> FRAC;
+	fa = xa & (ONE - 1);
+	cb = xb >> FRAC;
+	fb = xb & (ONE - 1);
 
-	if (x0pix == x1pix)
+	if (ca == cb)
 	{
-		list[x0pix] += x1sub - x0sub;
-		list[x0pix+1] += x0sub - x1sub;
+		addcell(acc, ca, fa, fb, dy);
+		return;
 	}
 
-	else
+	/* dy is shared out in proportion to the width in each cell, with
+	   the rounding error carried along as in bresenham's algorithm */
+	dx = xb - xa;
+
+	p = (ONE - fa) * dy;
+	delta = p / dx;
+	mod = p % dx;
+	if (mod < 0) {
+		delta --;
+		mod += dx;
+	}
+
+	addcell(acc, ca, fa, ONE, delta);
+	y = delta;
+	ca ++;
+
+	if (ca != cb)
 	{
-		list[x0pix] += HSCALE - x0sub;
-		list[x0pix+1] += x0sub;
-		list[x1pix] += x1sub - HSCALE;
-		list[x1pix+1] += -x1sub;
+		p = ONE * dy;
+		lift = p / dx;
+		rem = p % dx;
+		if (rem < 0) {
+			lift --;
+			rem += dx;
+		}
+
+		mod -= dx;
+		while (ca != cb)
+		{
+			delta = lift;
+			mod += rem;
+			if (mod >= 0) {
+				mod -= dx;
+				delta ++;
+			}
+			addcell(acc, ca, 0, ONE, delta);
+			y += delta;
+			ca ++;
+		}
 	}
+
+	addcell(acc, cb, 0, fb, dy - y);
 }
 
-static inline void
-nonzerowinding(fz_ael *ael, unsigned char *list, int xofs)
+/* add the part of each active edge between ytop and ybot */
+static void
+accumulate(fz_ael *ael, int *acc, int xofs, int ytop, int ybot)
 {
-	int winding = 0;
-	int x = 0;
+	fz_edge *edge;
+	int xa, xb, ya, yb;
 	int i;
+
 	for (i = 0; i < ael->len; i++)
 	{
-		if (!winding && (winding + ael->edges[i]->ydir))
-			x = ael->edges[i]->x;
-		if (winding && !(winding + ael->edges[i]->ydir))
-			addspan(list, x, ael->edges[i]->x, xofs);
-		winding += ael->edges[i]->ydir;
+		edge = ael->edges[i];
+
+		ya = MAX(edge->y0, ytop);
+		yb = MIN(edge->y1, ybot);
+
+		xa = edge->x;
+		if (yb == edge->y1)
+			xb = edge->x1;
+		else
+			xb = edge->x0 + (int)floor((yb - edge->y0) * edge->dxdy + 0.5);
+		edge->x = xb;
+
+		xa -= xofs;
+		xb -= xofs;
+		addcells(acc, xa, xb, (yb - ya) * edge->dir);
+
+		edge->lo = MIN(xa, xb) >> FRAC;
+		edge->hi = (MAX(xa, xb) >> FRAC) + 1;
 	}
 }
 
-static inline void
-evenodd(fz_ael *ael, unsigned char *list, int xofs)
+static inline int
+coverage(int area, int eofill)
 {
-	int even = 0;
+	if (area < 0)
+		area = -area;
+	if (eofill)
+	{
+		area &= 2 * FULL - 1;
+		if (area > FULL)
+			area = 2 * FULL - area;
+	}
+	else if (area > FULL)
+		area = FULL;
+	return (area * 255 + FULL / 2) / FULL;
+}
+
+/*
+ * Turn the row of cells into the coverage deltas that the span
+ * functions sum up. Only the cells under the edges are visited; between
+ * them the running sum and so the coverage does not change, and the
+ * deltas stay zero. Pixels x0 to x1 are visible. The span that can have
+ * coverage is returned in x0 and x1, with the coverage left of it in cov.
+ */
+static void
+sweep(fz_ael *ael, int *acc, unsigned char *list, int eofill,
+	int *x0, int *x1, unsigned char *cov)
+{
+	fz_edge *edge;
+	int area = 0;
+	int last = 0;
+	int start = -1;
+	int c;
 	int x = 0;
 	int i;
+
+	sortael(ael->edges, ael->len);
+
 	for (i = 0; i < ael->len; i++)
 	{
-		if (!even)
-			x = ael->edges[i]->x;
-		else
-			addspan(list, x, ael->edges[i]->x, xofs);
-		even = !even;
+		edge = ael->edges[i];
+		if (x < edge->lo)
+			x = edge->lo;
+		for (; x <= edge->hi; x++)
+		{
+			area += acc[x];
+			acc[x] = 0;
+			c = coverage(area, eofill);
+			if (x >= *x0 && x < *x1)
+			{
+				if (start < 0) {
+					start = last ? *x0 : x;
+					*cov = last;
+				}
+				list[x] = c - last;
+			}
+			last = c;
+		}
 	}
+
+	/* everything visited was left of the visible pixels */
+	if (start < 0) {
+		start = *x0;
+		*cov = last;
+	}
+
+	/* an open path leaves coverage running on to the right */
+	if (last == 0 && x < *x1)
+		*x1 = x;
+	*x0 = MIN(start, *x1);
 }
 
-static inline void toalpha(unsigned char *list, int n)
+static void
+clearcells(fz_ael *ael, int *acc)
 {
-	int d = 0;
-	while (n--)
-	{
-		d += *list;
-		*list++ = d;
-	}
+	int i, x;
+	for (i = 0; i < ael->len; i++)
+		for (x = ael->edges[i]->lo; x <= ael->edges[i]->hi; x++)
+			acc[x] = 0;
 }
 
 static inline void blit(fz_pixmap *pix, int x, int y,
-						unsigned char *list, int skipx, int len,
+						unsigned char *list, unsigned char cov, int len,
 						unsigned char *argb, int over)
 {
 	unsigned char *dst;
-	unsigned char cov;
 
 	dst = pix->samples + ( (y - pix->y) * pix->w + (x - pix->x) ) * pix->n;
-	cov = 0;
 
-	while (skipx--)
-	{
-		cov += *list;
-		*list = 0;
-		++list;
-	}
-
-	if (argb)
+	if (argb && pix->n == 2)
+		fz_path_w2i1o2(argb, list, cov, len, dst);
+	else if (argb)
 		fz_path_w4i1o4(argb, list, cov, len, dst);
 	else if (over)
 		fz_path_1o1(list, cov, len, dst);
@@ -458,13 +574,15 @@ fz_scanconvert(fz_gel *gel, fz_ael *ael, int eofill, fz_irect clip,
 {
 	fz_error *error;
 	unsigned char *deltas;
+	int *acc;
+	unsigned char cov;
+	int x0, x1;
 	int y, e;
-	int yd, yc;
 
-	int xmin = fz_idiv(gel->bbox.x0, HSCALE);
-	int xmax = fz_idiv(gel->bbox.x1, HSCALE) + 1;
+	int xmin = fz_idiv(gel->bbox.x0, ONE);
+	int xmax = fz_idiv(gel->bbox.x1, ONE) + 1;
 
-	int xofs = xmin * HSCALE;
+	int xofs = xmin * ONE;
 
 	int skipx = clip.x0 - xmin;
 	int clipn = clip.x1 - clip.x0;
@@ -475,57 +593,53 @@ fz_scanconvert(fz_gel *gel, fz_ael *ael, int eofill, fz_irect clip,
 	if (gel->len == 0)
 		return fz_okay;
 
-	deltas = fz_malloc(xmax - xmin + 1);
+	deltas = fz_malloc(xmax - xmin + 2);
 	if (!deltas)
 		return fz_outofmem;
 
-	memset(deltas, 0, xmax - xmin + 1);
+	acc = fz_malloc((xmax - xmin + 2) * sizeof(int));
+	if (!acc) {
+		fz_free(deltas);
+		return fz_outofmem;
+	}
+
+	memset(deltas, 0, xmax - xmin + 2);
+	memset(acc, 0, (xmax - xmin + 2) * sizeof(int));
 
 	e = 0;
-	y = gel->edges[0].y;
-	yc = fz_idiv(y, VSCALE);
-	yd = yc;
+	y = fz_idiv(gel->edges[0].y0, ONE);
 
 	while (ael->len > 0 || e < gel->len)
 	{
-		yc = fz_idiv(y, VSCALE);
-		if (yc != yd)
-		{
-			if (yd >= clip.y0 && yd < clip.y1)
-			{
-				blit(pix, xmin + skipx, yd, deltas, skipx, clipn, argb, over);
-			}
-		}
-		yd = yc;
+		/* skip rows with nothing on them */
+		if (ael->len == 0)
+			y = fz_idiv(gel->edges[e].y0, ONE);
 
 		error = insertael(ael, gel, y, &e);
 		if (error) {
+			fz_free(acc);
 			fz_free(deltas);
 			return error;
 		}
 
-		if (yd >= clip.y0 && yd < clip.y1)
+		accumulate(ael, acc, xofs, y * ONE, y * ONE + ONE);
+
+		if (y >= clip.y0 && y < clip.y1)
 		{
-			if (eofill)
-				evenodd(ael, deltas, xofs);
-			else
-				nonzerowinding(ael, deltas, xofs);
+			x0 = skipx;
+			x1 = skipx + clipn;
+			sweep(ael, acc, deltas, eofill, &x0, &x1, &cov);
+			if (x0 < x1)
+				blit(pix, xmin + x0, y, deltas + x0, cov, x1 - x0, argb, over);
 		}
+		else
+			clearcells(ael, acc);
 
-		advanceael(ael);
-
-		if (ael->len > 0)
-			y ++;
-		else if (e < gel->len)
-			y = gel->edges[e].y;
-	}
-
-	if (yd >= clip.y0 && yd < clip.y1)
-	{
-		blit(pix, xmin + skipx, yd, deltas, skipx, clipn, argb, over);
+		advanceael(ael, y * ONE + ONE);
+		y ++;
 	}
 
+	fz_free(acc);
 	fz_free(deltas);
 	return fz_okay;
 }
-
@@ -234,6 +234,77 @@ static void duff_4i1o4(byte * restrict sp0, int sw, byte * restrict mp0, int mw,
 	}
 }
 
+static void duff_2o2(byte * restrict sp0, int sw, byte * restrict dp0, int dw, int w0, int h)
+{
+	/* duff_non(sp0, sw, 2, dp0, dw, w0, h); */
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *dp = dp0;
+		int w = w0;
+		while (w--)
+		{
+			byte ssa = 255 - sp[0];
+			dp[0] = sp[0] + fz_mul255(dp[0], ssa);
+			dp[1] = sp[1] + fz_mul255(dp[1], ssa);
+			sp += 2;
+			dp += 2;
+		}
+		sp0 += sw;
+		dp0 += dw;
+	}
+}
+
+static void duff_2i1c2(byte * restrict sp0, int sw, byte * restrict mp0, int mw, byte * restrict dp0, int dw, int w0, int h)
+{
+	/* duff_nimcn(sp0, sw, 2, mp0, mw, 1, dp0, dw, w0, h); */
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *mp = mp0;
+		byte *dp = dp0;
+		int w = w0;
+		while (w--)
+		{
+			byte ma = mp[0];
+			dp[0] = fz_mul255(sp[0], ma);
+			dp[1] = fz_mul255(sp[1], ma);
+			sp += 2;
+			mp += 1;
+			dp += 2;
+		}
+		sp0 += sw;
+		mp0 += mw;
+		dp0 += dw;
+	}
+}
+
+static void duff_2i1o2(byte * restrict sp0, int sw, byte * restrict mp0, int mw, byte * restrict dp0, int dw, int w0, int h)
+{
+	/* duff_nimon(sp0, sw, 2, mp0, mw, 1, dp0, dw, w0, h); */
+	while (h--)
+	{
+		byte *sp = sp0;
+		byte *mp = mp0;
+		byte *dp = dp0;
+		int w = w0;
+		while (w--)
+		{
+			byte ma = mp[0];
+			byte sa = fz_mul255(sp[0], ma);
+			byte ssa = 255 - sa;
+			dp[0] = sa + fz_mul255(dp[0], ssa);
+			dp[1] = fz_mul255(sp[1], ma) + fz_mul255(dp[1], ssa);
+			sp += 2;
+			mp += 1;
+			dp += 2;
+		}
+		sp0 += sw;
+		mp0 += mw;
+		dp0 += dw;
+	}
+}
+
 /*
  * Path and text masks
  */
@@ -277,6 +348,22 @@ static void path_w4i1o4(byte * restrict argb, byte * restrict src, byte cov, int
 	}
 }
 
+// With 2 (alpha and gray) In 1 Over 2
+static void path_w2i1o2(byte * restrict argb, byte * restrict src, byte cov, int len, byte * restrict dst)
+{
+	byte alpha = argb[0];
+	byte k = argb[4];
+	while (len--)
+	{
+		byte ca;
+		cov += *src; *src = 0; src++;
+		ca = fz_mul255(cov, alpha);
+		dst[0] = ca + fz_mul255(dst[0], 255 - ca);
+		dst[1] = fz_mul255((short)k - dst[1], ca) + dst[1];
+		dst += 2;
+	}
+}
+
 static void text_1c1(byte * restrict src0, int srcw, byte * restrict dst0, int dstw, int w0, int h)
 {
 	while (h--)
@@ -337,6 +424,28 @@ static void text_w4i1o4(byte * restrict argb, byte * restrict src0, int srcw, by
 	}
 }
 
+static void text_w2i1o2(byte * restrict argb, byte * restrict src0, int srcw, byte * restrict dst0, int dstw, int w0, int h)
+{
+	unsigned char alpha = argb[0];
+	unsigned char k = argb[4];
+	while (h--)
+	{
+		byte *src = src0;
+		byte *dst = dst0;
+		int w = w0;
+		while (w--)
+		{
+			byte ca = fz_mul255(src[0], alpha);
+			dst[0] = ca + fz_mul255(dst[0], 255 - ca);
+			dst[1] = fz_mul255((short)k - dst[1], ca) + dst[1];
+			src ++;
+			dst += 2;
+		}
+		src0 += srcw;
+		dst0 += dstw;
+	}
+}
+
 /*
  * ... and the function pointers
  */
@@ -345,17 +454,22 @@ void (*fz_duff_non)(byte*,int,int,byte*,int,int,int) = duff_non;
 void (*fz_duff_nimcn)(byte*,int,int,byte*,int,int,byte*,int,int,int) = duff_nimcn;
 void (*fz_duff_nimon)(byte*,int,int,byte*,int,int,byte*,int,int,int) = duff_nimon;
 void (*fz_duff_1o1)(byte*,int,byte*,int,int,int) = duff_1o1;
+void (*fz_duff_2o2)(byte*,int,byte*,int,int,int) = duff_2o2;
 void (*fz_duff_4o4)(byte*,int,byte*,int,int,int) = duff_4o4;
 void (*fz_duff_1i1c1)(byte*,int,byte*,int,byte*,int,int,int) = duff_1i1c1;
+void (*fz_duff_2i1c2)(byte*,int,byte*,int,byte*,int,int,int) = duff_2i1c2;
 void (*fz_duff_4i1c4)(byte*,int,byte*,int,byte*,int,int,int) = duff_4i1c4;
 void (*fz_duff_1i1o1)(byte*,int,byte*,int,byte*,int,int,int) = duff_1i1o1;
+void (*fz_duff_2i1o2)(byte*,int,byte*,int,byte*,int,int,int) = duff_2i1o2;
 void (*fz_duff_4i1o4)(byte*,int,byte*,int,byte*,int,int,int) = duff_4i1o4;
 
 void (*fz_path_1c1)(byte*,byte,int,byte*) = path_1c1;
 void (*fz_path_1o1)(byte*,byte,int,byte*) = path_1o1;
+void (*fz_path_w2i1o2)(byte*,byte*,byte,int,byte*) = path_w2i1o2;
 void (*fz_path_w4i1o4)(byte*,byte*,byte,int,byte*) = path_w4i1o4;
 
 void (*fz_text_1c1)(byte*,int,byte*,int,int,int) = text_1c1;
 void (*fz_text_1o1)(byte*,int,byte*,int,int,int) = text_1o1;
+void (*fz_text_w2i1o2)(byte*,byte*,int,byte*,int,int,int) = text_w2i1o2;
 void (*fz_text_w4i1o4)(byte*,byte*,int,byte*,int,int,int) = text_w4i1o4;
 
@@ -25,10 +25,29 @@ static fz_error *rendernode(fz_renderer *gc, fz_node *node, fz_matrix ctm);
 
 fz_error *
 fz_newrenderer(fz_renderer **gcp, fz_colorspace *pcm, int maskonly, int gcmem)
+{
+	fz_error *error;
+	fz_glyphcache *cache;
+
+	error = fz_newglyphcache(&cache, gcmem / 24, gcmem);
+	if (error)
+		return error;
+
+	error = fz_newrendererwithcache(gcp, pcm, maskonly, cache);
+	fz_dropglyphcache(cache);
+	return error;
+}
+
+fz_error *
+fz_newrendererwithcache(fz_renderer **gcp, fz_colorspace *pcm, int maskonly, fz_glyphcache *cache)
 {
 	fz_error *error;
 	fz_renderer *gc;
 
+	/* the span functions come in gray and rgb flavours */
+	if (pcm->n != 1 && pcm->n != 3)
+		return fz_throw("assert: renderer model is neither gray nor rgb");
+
 	gc = fz_malloc(sizeof(fz_renderer));
 	if (!gc)
 		return fz_outofmem;
@@ -39,9 +58,7 @@ fz_newrenderer(fz_renderer **gcp, fz_colorspace *pcm, int maskonly, int gcmem)
 	gc->gel = nil;
 	gc->ael = nil;
 
-	error = fz_newglyphcache(&gc->cache, gcmem / 24, gcmem);
-	if (error)
-		goto cleanup;
+	gc->cache = fz_keepglyphcache(cache);
 
 	error = fz_newgel(&gc->gel);
 	if (error)
@@ -110,28 +127,33 @@ DEBUG("}\n");
  * Color
  */
 
+static void
+setargb(fz_renderer *gc, fz_solidnode *solid)
+{
+	float v[FZ_MAXCOLORS];
+	int k;
+
+	fz_convertcolor(solid->cs, solid->samples, gc->model, v);
+	gc->argb[0] = solid->a * 255;
+	for (k = 0; k < gc->model->n; k++)
+	{
+		gc->argb[1 + k] = v[k] * solid->a * 255;
+		gc->argb[4 + k] = v[k] * 255;
+	}
+}
+
 static fz_error *
 rendersolid(fz_renderer *gc, fz_solidnode *solid, fz_matrix ctm)
 {
 	fz_error *error;
-	float rgb[3];
 	unsigned char a, r, g, b;
 	unsigned char *p;
 	int n;
 
 	if (gc->maskonly)
 		return fz_throw("assert: mask only renderer");
-	if (gc->model->n != 3)
-		return fz_throw("assert: non-rgb renderer");
 
-	fz_convertcolor(solid->cs, solid->samples, gc->model, rgb);
-	gc->argb[0] = solid->a * 255;
-	gc->argb[1] = rgb[0] * solid->a * 255;
-	gc->argb[2] = rgb[1] * solid->a * 255;
-	gc->argb[3] = rgb[2] * solid->a * 255;
-	gc->argb[4] = rgb[0] * 255;
-	gc->argb[5] = rgb[1] * 255;
-	gc->argb[6] = rgb[2] * 255;
+	setargb(gc, solid);
 
 DEBUG("solid %s [%d %d %d %d];\n", solid->cs->name, gc->argb[0], gc->argb[1], gc->argb[2], gc->argb[3]);
 
@@ -142,13 +164,26 @@ DEBUG("solid %s [%d %d %d %d];\n", solid->cs->name, gc->argb[0], gc->argb[1], gc
 	}
 	else
 	{
-		error = fz_newpixmapwithrect(&gc->dest, gc->clip, 4);
+		error = fz_newpixmapwithrect(&gc->dest, gc->clip, gc->model->n + 1);
 		if (error)
 			return error;
 		p = gc->dest->samples;
 		n = gc->dest->w * gc->dest->h;
 	}
-	
+
+	if (gc->model->n == 1)
+	{
+		a = gc->argb[0];
+		g = gc->argb[1];
+		while (n--)
+		{
+			p[0] = a;
+			p[1] = g;
+			p += 2;
+		}
+		return fz_okay;
+	}
+
 	a = gc->argb[0];
 	r = gc->argb[1];
 	g = gc->argb[2];
@@ -298,8 +333,13 @@ static void drawglyph(fz_renderer *gc, fz_pixmap *dst, fz_glyph *src, int xorig,
 		break;
 
 	case FOVER | FRGB:
-		assert(dst->n == 4);
-		fz_text_w4i1o4(gc->argb, sp, src->w, dp, dst->w * 4, w, h);
+		if (dst->n == 2)
+			fz_text_w2i1o2(gc->argb, sp, src->w, dp, dst->w * 2, w, h);
+		else
+		{
+			assert(dst->n == 4);
+			fz_text_w4i1o4(gc->argb, sp, src->w, dp, dst->w * 4, w, h);
+		}
 		break;
 
 	default:
@@ -356,6 +396,8 @@ text->trm.a, text->trm.b, text->trm.c, text->trm.d);
 			drawglyph(gc, gc->dest, &glyph, x, y);
 		else
 			drawglyph(gc, gc->over, &glyph, x, y);
+
+		fz_releaseglyph(gc->cache, &glyph);
 	}
 
 	return fz_okay;
@@ -526,7 +568,9 @@ DEBUG("  fnone %d x %d\n", w, h);
 			if (error)
 				goto cleanup;
 
-			if (image->cs)
+			if (image->cs && gc->model->n == 1)
+				fz_img_2c2(PSRC, PDST(gc->dest), PCTM);
+			else if (image->cs)
 				fz_img_4c4(PSRC, PDST(gc->dest), PCTM);
 			else
 				fz_img_1c1(PSRC, PDST(gc->dest), PCTM);
@@ -536,7 +580,9 @@ DEBUG("  fnone %d x %d\n", w, h);
 	case FOVER:
 		{
 DEBUG("  fover %d x %d\n", w, h);
-			if (image->cs)
+			if (image->cs && gc->model->n == 1)
+				fz_img_2o2(PSRC, PDST(gc->over), PCTM);
+			else if (image->cs)
 				fz_img_4o4(PSRC, PDST(gc->over), PCTM);
 			else
 				fz_img_1o1(PSRC, PDST(gc->over), PCTM);
@@ -545,7 +591,10 @@ DEBUG("  fover %d x %d\n", w, h);
 
 	case FOVER | FRGB:
 DEBUG("  fover+rgb %d x %d\n", w, h);
-		fz_img_w4i1o4(gc->argb, PSRC, PDST(gc->over), PCTM);
+		if (gc->model->n == 1)
+			fz_img_w2i1o2(gc->argb, PSRC, PDST(gc->over), PCTM);
+		else
+			fz_img_w4i1o4(gc->argb, PSRC, PDST(gc->over), PCTM);
 		break;
 
 	default:
@@ -620,6 +669,8 @@ blendover(fz_renderer *gc, fz_pixmap *src, fz_pixmap *dst)
 
 	if (src->n == 1 && dst->n == 1)
 		fz_duff_1o1(sp, src->w, dp, dst->w, w, h);
+	else if (src->n == 2 && dst->n == 2)
+		fz_duff_2o2(sp, src->w * 2, dp, dst->w * 2, w, h);
 	else if (src->n == 4 && dst->n == 4)
 		fz_duff_4o4(sp, src->w * 4, dp, dst->w * 4, w, h);
 	else if (src->n == dst->n)
@@ -665,6 +716,8 @@ blendmask(fz_renderer *gc, fz_pixmap *src, fz_pixmap *msk, fz_pixmap *dst, int o
 	{
 		if (src->n == 1 && msk->n == 1 && dst->n == 1)
 			fz_duff_1i1o1(sp, src->w, mp, msk->w, dp, dst->w, w, h);
+		else if (src->n == 2 && msk->n == 1 && dst->n == 2)
+			fz_duff_2i1o2(sp, src->w * 2, mp, msk->w, dp, dst->w * 2, w, h);
 		else if (src->n == 4 && msk->n == 1 && dst->n == 4)
 			fz_duff_4i1o4(sp, src->w * 4, mp, msk->w, dp, dst->w * 4, w, h);
 		else if (src->n == dst->n)
@@ -676,6 +729,8 @@ blendmask(fz_renderer *gc, fz_pixmap *src, fz_pixmap *msk, fz_pixmap *dst, int o
 	{
 		if (src->n == 1 && msk->n == 1 && dst->n == 1)
 			fz_duff_1i1c1(sp, src->w, mp, msk->w, dp, dst->w, w, h);
+		else if (src->n == 2 && msk->n == 1 && dst->n == 2)
+			fz_duff_2i1c2(sp, src->w * 2, mp, msk->w, dp, dst->w * 2, w, h);
 		else if (src->n == 4 && msk->n == 1 && dst->n == 4)
 			fz_duff_4i1c4(sp, src->w * 4, mp, msk->w, dp, dst->w * 4, w, h);
 		else if (src->n == dst->n)
@@ -694,12 +749,12 @@ renderover(fz_renderer *gc, fz_overnode *over, fz_matrix ctm)
 
 	if (!gc->over)
 	{
-DEBUG("over cluster %d\n{\n", gc->maskonly ? 1 : 4);
+DEBUG("over cluster %d\n{\n", gc->maskonly ? 1 : gc->model->n + 1);
 		cluster = 1;
 		if (gc->maskonly)
 			error = fz_newpixmapwithrect(&gc->over, gc->clip, 1);
 		else
-			error = fz_newpixmapwithrect(&gc->over, gc->clip, 4);
+			error = fz_newpixmapwithrect(&gc->over, gc->clip, gc->model->n + 1);
 		if (error)
 			return error;
 		fz_clearpixmap(gc->over);
@@ -743,7 +798,6 @@ rendermask(fz_renderer *gc, fz_masknode *mask, fz_matrix ctm)
 	fz_pixmap *colorpix = nil;
 	fz_node *shape;
 	fz_node *color;
-	float rgb[3];
 
 	shape = mask->super.first;
 	color = shape->next;
@@ -753,16 +807,7 @@ rendermask(fz_renderer *gc, fz_masknode *mask, fz_matrix ctm)
 	{
 		if (fz_issolidnode(color))
 		{
-			fz_solidnode *solid = (fz_solidnode*)color;
-
-			fz_convertcolor(solid->cs, solid->samples, gc->model, rgb);
-			gc->argb[0] = solid->a * 255;
-			gc->argb[1] = rgb[0] * solid->a * 255;
-			gc->argb[2] = rgb[1] * solid->a * 255;
-			gc->argb[3] = rgb[2] * solid->a * 255;
-			gc->argb[4] = rgb[0] * 255;
-			gc->argb[5] = rgb[1] * 255;
-			gc->argb[6] = rgb[2] * 255;
+			setargb(gc, (fz_solidnode*)color);
 			gc->flag |= FRGB;
 
 			/* we know these can handle the FRGB shortcut */
@@ -904,7 +949,7 @@ fz_rendertree(fz_pixmap **outp,
 	if (gc->maskonly)
 		error = fz_newpixmapwithrect(&gc->over, bbox, 1);
 	else
-		error = fz_newpixmapwithrect(&gc->over, bbox, 4);
+		error = fz_newpixmapwithrect(&gc->over, bbox, gc->model->n + 1);
 	if (error)
 		return error;
 
@@ -914,7 +959,7 @@ fz_rendertree(fz_pixmap **outp,
 		memset(gc->over->samples, 0x00, gc->over->w * gc->over->h * gc->over->n);
 
 DEBUG("tree %d [%d %d %d %d]\n{\n",
-gc->maskonly ? 1 : 4,
+gc->maskonly ? 1 : gc->model->n + 1,
 bbox.x0, bbox.y0, bbox.x1, bbox.y1);
 
 	error = rendernode(gc, tree->root, ctm);
@@ -942,7 +987,7 @@ fz_rendertreeover(fz_renderer *gc, fz_pixmap *dest, fz_tree *tree, fz_matrix ctm
 	fz_error *error;
 
 	assert(!gc->maskonly);
-	assert(dest->n == 4);
+	assert(dest->n == gc->model->n + 1);
 
 	gc->clip.x0 = dest->x;
 	gc->clip.y0 = dest->y;
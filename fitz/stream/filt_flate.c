@@ -163,8 +163,6 @@ fz_dropflatee(fz_filter *f)
 	err = deflateEnd(zp);
 	if (err != Z_OK)
 		fprintf(stderr, "deflateEnd: %s", zp->msg);
-
-	fz_free(f);
 }
 
 fz_error *
@@ -9,7 +9,7 @@ fz_newarray(fz_obj **op, int initialcap)
 	fz_obj *obj;
 	int i;
 
-	obj = *op = fz_malloc(sizeof (fz_obj));
+	obj = *op = fz_poolalloc(sizeof (fz_obj));
 	if (!obj)
 	    return fz_throw("outofmem: array struct");
 
@@ -19,10 +19,10 @@ fz_newarray(fz_obj **op, int initialcap)
 	obj->u.a.len = 0;
 	obj->u.a.cap = initialcap > 0 ? initialcap : 6;
 
-	obj->u.a.items = fz_malloc(sizeof (fz_obj*) * obj->u.a.cap);
+	obj->u.a.items = fz_poolalloc(sizeof (fz_obj*) * obj->u.a.cap);
 	if (!obj->u.a.items)
 	{
-	    fz_free(obj);
+	    fz_poolfree(obj, sizeof (fz_obj));
 	    return fz_throw("outofmem: array item buffer");
 	}
 
@@ -180,7 +180,8 @@ growarray(fz_obj *obj)
 	int i;
 
 	newcap = obj->u.a.cap * 2;
-	newitems = fz_realloc(obj->u.a.items, sizeof (fz_obj*) * newcap);
+	newitems = fz_poolrealloc(obj->u.a.items,
+			sizeof (fz_obj*) * obj->u.a.cap, sizeof (fz_obj*) * newcap);
 	if (!newitems)
 	    return fz_throw("outofmem: resize item buffer");
 
@@ -224,7 +225,7 @@ fz_droparray(fz_obj *obj)
 		if (obj->u.a.items[i])
 			fz_dropobj(obj->u.a.items[i]);
 
-	fz_free(obj->u.a.items);
-	fz_free(obj);
+	fz_poolfree(obj->u.a.items, sizeof (fz_obj*) * obj->u.a.cap);
+	fz_poolfree(obj, sizeof (fz_obj));
 }
 
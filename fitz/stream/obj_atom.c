@@ -0,0 +1,106 @@
+#include "fitz-base.h"
+#include "fitz-stream.h"
+
+/*
+ * Well-known names. A name object whose text is in this list points
+ * at the entry here instead of holding its own copy, so a dictionary
+ * lookup of one of these keys compares pointers, not strings.
+ *
+ * The table is never changed after it is set up, so documents on
+ * different threads can share it.
+ */
+
+static char *atomlist[] =
+{
+	"A", "AcroForm", "Alternate", "Annot", "Annots", "ArtBox", "Ascent",
+	"Author", "AvgWidth", "BBox", "BM", "BPC", "Background",
+	"BaseEncoding", "BaseFont", "BitsPerComponent", "BitsPerCoordinate",
+	"BitsPerFlag", "BitsPerSample", "BlackIs1", "BlackPoint", "BleedBox",
+	"Border", "Bounds", "C0", "C1", "CA", "CCITTFaxDecode", "CF", "CFM",
+	"CIDFontType0", "CIDFontType2", "CIDSystemInfo", "CIDToGIDMap", "CS",
+	"CalGray", "CalRGB", "CapHeight", "Catalog", "CharProcs", "CharSet",
+	"ColorSpace", "ColorTransform", "Colors", "Columns", "Contents",
+	"Coords", "Count", "CreationDate", "Creator", "CropBox", "D",
+	"DCTDecode", "DL", "DP", "DW", "DW2", "Decode", "DecodeParms",
+	"DescendantFonts", "Descent", "Dest", "Dests", "DeviceCMYK",
+	"DeviceGray", "DeviceN", "DeviceRGB", "Differences", "Domain",
+	"EarlyChange", "Effort", "Encode", "EncodedByteAlign", "Encoding",
+	"Encrypt", "EncryptMetadata", "EndOfBlock", "EndOfLine", "ExtGState",
+	"Extend", "F", "Filter", "First", "FirstChar", "Fit", "FitB", "FitH",
+	"FitR", "Flags", "FlateDecode", "Font", "FontBBox", "FontDescriptor",
+	"FontFamily", "FontFile", "FontFile2", "FontFile3", "FontMatrix",
+	"FontName", "FontStretch", "FontWeight", "Form", "Function",
+	"FunctionType", "Functions", "G", "Gamma", "GoTo", "Group", "H",
+	"HSamples", "Height", "I", "ICCBased", "ID", "IM", "Identity",
+	"Image", "ImageMask", "Index", "Indexed", "Info", "Intent",
+	"Interpolate", "ItalicAngle", "JBIG2Decode", "JBIG2Globals",
+	"JPXDecode", "K", "Kids", "LC", "LJ", "LW", "Lab", "Last",
+	"LastChar", "Leading", "Length", "Link", "ML", "MacRomanEncoding",
+	"Mask", "Matrix", "MaxWidth", "MediaBox", "Metadata", "MissingWidth",
+	"ModDate", "N", "Name", "Names", "Next", "O", "ObjStm", "Ordering",
+	"Outlines", "P", "Page", "PageLabels", "PageLayout", "PageMode",
+	"Pages", "PaintType", "Parent", "Pattern", "PatternType",
+	"Predictor", "Prev", "ProcSet", "Producer", "R", "Range", "Rect",
+	"Registry", "Resources", "Root", "Rotate", "Rows", "S", "SMask",
+	"Separation", "Shading", "ShadingType", "Size", "Standard",
+	"StandardEncoding", "StemH", "StemV", "StmF", "StrF",
+	"StructParents", "Subject", "Subtype", "Supplement", "Title",
+	"ToUnicode", "TrimBox", "TrueType", "Type", "Type0", "Type1",
+	"Type3", "U", "URI", "UseCMap", "V", "VSamples", "VerticesPerRow",
+	"W", "W2", "WMode", "WhitePoint", "Width", "Widths",
+	"WinAnsiEncoding", "XHeight", "XObject", "XRef", "XRefStm", "XStep",
+	"XYZ", "YStep", "ca",
+};
+
+#define ATOMSLOTS 1024
+
+static short atomslot[ATOMSLOTS];
+static volatile int atomsready = 0;
+
+static inline unsigned int atomhash(char *s)
+{
+	unsigned int h = 0;
+	while (*s)
+		h = h * 31 + (unsigned char) *s++;
+	return h;
+}
+
+static void initatoms(void)
+{
+	unsigned int h;
+	int i;
+
+	fz_lock(FZ_LOCK_ATOMS);
+	if (!atomsready)
+	{
+		for (i = 0; i < nelem(atomlist); i++)
+		{
+			h = atomhash(atomlist[i]) & (ATOMSLOTS - 1);
+			while (atomslot[h])
+				h = (h + 1) & (ATOMSLOTS - 1);
+			atomslot[h] = i + 1;
+		}
+		atomsready = 1;
+	}
+	fz_unlock(FZ_LOCK_ATOMS);
+}
+
+char *
+fz_findatom(char *s)
+{
+	unsigned int h;
+	int i;
+
+	if (!atomsready)
+		initatoms();
+
+	h = atomhash(s) & (ATOMSLOTS - 1);
+	while ((i = atomslot[h]) != 0)
+	{
+		if (!strcmp(atomlist[i - 1], s))
+			return atomlist[i - 1];
+		h = (h + 1) & (ATOMSLOTS - 1);
+	}
+
+	return nil;
+}
@@ -23,13 +23,21 @@ static inline int keystrcmp(fz_obj *key, char *s)
 	return -1;
 }
 
+/* names with well-known text always point at the atom (see obj_atom.c) */
+static inline char *keyatom(fz_obj *key)
+{
+	if (fz_isname(key) && key->u.n.s != key->u.n.buf)
+		return key->u.n.s;
+	return nil;
+}
+
 fz_error *
 fz_newdict(fz_obj **op, int initialcap)
 {
 	fz_obj *obj;
 	int i;
 
-	obj = *op = fz_malloc(sizeof (fz_obj));
+	obj = *op = fz_poolalloc(sizeof (fz_obj));
 	if (!obj)
 	    return fz_throw("outofmem: dict struct");
 
@@ -40,10 +48,10 @@ fz_newdict(fz_obj **op, int initialcap)
 	obj->u.d.len = 0;
 	obj->u.d.cap = initialcap > 0 ? initialcap : 10;
 
-	obj->u.d.items = fz_malloc(sizeof(fz_keyval) * obj->u.d.cap);
+	obj->u.d.items = fz_poolalloc(sizeof(fz_keyval) * obj->u.d.cap);
 	if (!obj->u.d.items)
 	{
-	    fz_free(obj);
+	    fz_poolfree(obj, sizeof (fz_obj));
 	    return fz_throw("outofmem: dict item buffer");
 	}
 
@@ -163,7 +171,8 @@ growdict(fz_obj *obj)
 
 	newcap = obj->u.d.cap * 2;
 
-	newitems = fz_realloc(obj->u.d.items, sizeof(fz_keyval) * newcap);
+	newitems = fz_poolrealloc(obj->u.d.items,
+			sizeof(fz_keyval) * obj->u.d.cap, sizeof(fz_keyval) * newcap);
 	if (!newitems)
 	    return fz_throw("outofmem: resize item buffer");
 
@@ -210,8 +219,15 @@ fz_dictgetval(fz_obj *obj, int i)
 	return obj->u.d.items[i].v;
 }
 
-static inline int dictfinds(fz_obj *obj, char *key)
+/*
+ * atom is fz_findatom(key). a name key can only match a well-known
+ * key if it points at the same atom, and can never match any other
+ * key if it points at an atom, so most compares are pointer compares.
+ */
+static inline int dictfindatom(fz_obj *obj, char *key, char *atom)
 {
+	fz_obj *k;
+
 	if (obj->u.d.sorted)
 	{
 		int l = 0;
@@ -219,7 +235,11 @@ static inline int dictfinds(fz_obj *obj, char *key)
 		while (l <= r)
 		{
 			int m = (l + r) >> 1;
-			int c = -keystrcmp(obj->u.d.items[m].k, key);
+			int c;
+			k = obj->u.d.items[m].k;
+			if (atom && keyatom(k) == atom)
+				return m;
+			c = -keystrcmp(k, key);
 			if (c < 0)
 				r = m - 1;
 			else if (c > 0)
@@ -229,17 +249,43 @@ static inline int dictfinds(fz_obj *obj, char *key)
 		}
 	}
 
+	else if (atom)
+	{
+		int i;
+		for (i = 0; i < obj->u.d.len; i++)
+		{
+			k = obj->u.d.items[i].k;
+			if (fz_isname(k) ? k->u.n.s == atom : keystrcmp(k, key) == 0)
+				return i;
+		}
+	}
+
 	else
 	{
 		int i;
 		for (i = 0; i < obj->u.d.len; i++)
-			if (keystrcmp(obj->u.d.items[i].k, key) == 0)
+		{
+			k = obj->u.d.items[i].k;
+			if (!keyatom(k) && keystrcmp(k, key) == 0)
 				return i;
+		}
 	}
 
 	return -1;
 }
 
+static inline int dictfinds(fz_obj *obj, char *key)
+{
+	return dictfindatom(obj, key, fz_findatom(key));
+}
+
+static inline int dictfind(fz_obj *obj, fz_obj *key)
+{
+	if (fz_isname(key))
+		return dictfindatom(obj, fz_toname(key), keyatom(key));
+	return dictfinds(obj, fz_tostrbuf(key));
+}
+
 fz_obj *
 fz_dictgets(fz_obj *obj, char *key)
 {
@@ -258,10 +304,17 @@ fz_dictgets(fz_obj *obj, char *key)
 fz_obj *
 fz_dictget(fz_obj *obj, fz_obj *key)
 {
-	if (fz_isname(key))
-		return fz_dictgets(obj, fz_toname(key));
-	if (fz_isstring(key))
-		return fz_dictgets(obj, fz_tostrbuf(key));
+	int i;
+
+	if (!fz_isdict(obj))
+		return nil;
+	if (!fz_isname(key) && !fz_isstring(key))
+		return nil;
+
+	i = dictfind(obj, key);
+	if (i >= 0)
+		return obj->u.d.items[i].v;
+
 	return nil;
 }
 
@@ -292,7 +345,7 @@ fz_dictput(fz_obj *obj, fz_obj *key, fz_obj *val)
 	else
 		return fz_throw("assert: key is not string or name (%s)", fz_objkindstr(obj));
 
-	i = dictfinds(obj, s);
+	i = dictfind(obj, key);
 	if (i >= 0)
 	{
 		fz_dropobj(obj->u.d.items[i].v);
@@ -381,8 +434,8 @@ fz_dropdict(fz_obj *obj)
 			fz_dropobj(obj->u.d.items[i].v);
 	}
 
-	fz_free(obj->u.d.items);
-	fz_free(obj);
+	fz_poolfree(obj->u.d.items, sizeof(fz_keyval) * obj->u.d.cap);
+	fz_poolfree(obj, sizeof (fz_obj));
 }
 
 void
@@ -6,7 +6,7 @@ extern void fz_dropdict(fz_obj *dict);
 
 #define NEWOBJ(KIND,SIZE) \
 	fz_obj *o; \
-	o = *op = fz_malloc(SIZE); \
+	o = *op = fz_poolalloc(SIZE); \
 	if (!o) return fz_throw("outofmem: dynamic object"); \
 	o->refs = 1; \
 	o->kind = KIND;
@@ -45,7 +45,14 @@ fz_newreal(fz_obj **op, float f)
 fz_error *
 fz_newstring(fz_obj **op, char *str, int len)
 {
-	NEWOBJ(FZ_STRING, offsetof(fz_obj, u.s.buf) + len + 1);
+	fz_obj *o;
+	if (len > 0xffff)
+		len = 0xffff;	/* u.s.len is only 16 bits */
+	o = *op = fz_poolalloc(offsetof(fz_obj, u.s.buf) + len + 1);
+	if (!o)
+		return fz_throw("outofmem: dynamic object");
+	o->refs = 1;
+	o->kind = FZ_STRING;
 	o->u.s.len = len;
 	memcpy(o->u.s.buf, str, len);
 	o->u.s.buf[len] = '\0';
@@ -55,9 +62,21 @@ fz_newstring(fz_obj **op, char *str, int len)
 fz_error *
 fz_newname(fz_obj **op, char *str)
 {
-	NEWOBJ(FZ_NAME, offsetof(fz_obj, u.n) + strlen(str) + 1);
-	strcpy(o->u.n, str);
-	return fz_okay;
+	char *atom = fz_findatom(str);
+	if (atom)
+	{
+		NEWOBJ(FZ_NAME, offsetof(fz_obj, u.n.buf) + 1);
+		o->u.n.buf[0] = '\0';
+		o->u.n.s = atom;
+		return fz_okay;
+	}
+	else
+	{
+		NEWOBJ(FZ_NAME, offsetof(fz_obj, u.n.buf) + strlen(str) + 1);
+		strcpy(o->u.n.buf, str);
+		o->u.n.s = o->u.n.buf;
+		return fz_okay;
+	}
 }
 
 fz_error *
@@ -77,6 +96,17 @@ fz_newpointer(fz_obj **op, void *p)
 	return fz_okay;
 }
 
+/* the size the object was allocated with */
+static int
+objbytes(fz_obj *o)
+{
+	if (o->kind == FZ_STRING)
+		return offsetof(fz_obj, u.s.buf) + o->u.s.len + 1;
+	if (o->kind == FZ_NAME)
+		return offsetof(fz_obj, u.n.buf) + strlen(o->u.n.buf) + 1;
+	return sizeof (fz_obj);
+}
+
 fz_obj *
 fz_keepobj(fz_obj *o)
 {
@@ -96,7 +126,7 @@ fz_dropobj(fz_obj *o)
 		else if (o->kind == FZ_DICT)
 			fz_dropdict(o);
 		else
-			fz_free(o);
+			fz_poolfree(o, objbytes(o));
 	}
 }
 
@@ -192,7 +222,7 @@ char *
 fz_toname(fz_obj *obj)
 {
 	if (fz_isname(obj))
-		return obj->u.n;
+		return obj->u.n.s;
 	return "";
 }
 
@@ -239,9 +269,19 @@ fz_topointer(fz_obj *obj)
 fz_error *
 fz_newnamefromstring(fz_obj **op, fz_obj *str)
 {
-	NEWOBJ(FZ_NAME, offsetof(fz_obj, u.n) + fz_tostrlen(str) + 1);
-	memcpy(o->u.n, fz_tostrbuf(str), fz_tostrlen(str));
-	o->u.n[fz_tostrlen(str)] = '\0';
+	fz_error *error;
+	char *s;
+
+	s = fz_malloc(fz_tostrlen(str) + 1);
+	if (!s)
+		return fz_throw("outofmem: name text");
+	memcpy(s, fz_tostrbuf(str), fz_tostrlen(str));
+	s[fz_tostrlen(str)] = '\0';
+
+	error = fz_newname(op, s);
+	fz_free(s);
+	if (error)
+		return fz_rethrow(error, "cannot create name");
 	return fz_okay;
 }
 
@@ -268,7 +308,9 @@ fz_objcmp(fz_obj *a, fz_obj *b)
 		return memcmp(a->u.s.buf, b->u.s.buf, a->u.s.len);
 
 	case FZ_NAME:
-		return strcmp(a->u.n, b->u.n);
+		if (a->u.n.s == b->u.n.s)
+			return 0;
+		return strcmp(a->u.n.s, b->u.n.s);
 
 	case FZ_INDIRECT:
 		if (a->u.r.oid == b->u.r.oid)
@@ -23,6 +23,7 @@ fz_newbuffer(fz_buffer **bp, int size)
 	b->wp = b->bp;
 	b->ep = b->bp + size;
 	b->eof = 0;
+	b->pin = nil;
 
 	return fz_okay;
 }
@@ -44,6 +45,7 @@ fz_newbufferwithmemory(fz_buffer **bp, unsigned char *data, int size)
 	b->wp = b->bp + size;
 	b->ep = b->bp + size;
 	b->eof = 0;
+	b->pin = nil;
 
 	return fz_okay;
 }
@@ -62,6 +64,8 @@ fz_dropbuffer(fz_buffer *buf)
 	{
 		if (buf->ownsdata)
 			fz_free(buf->bp);
+		if (buf->pin)
+			fz_dropstream(buf->pin);
 		fz_free(buf);
 	}
 }
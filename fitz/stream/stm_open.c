@@ -5,6 +5,12 @@
 #include "fitz-base.h"
 #include "fitz-stream.h"
 
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
 static fz_stream *
 newstm(int kind, int mode)
 {
@@ -24,10 +30,84 @@ newstm(int kind, int mode)
 	stm->chain = nil;
 	stm->filter = nil;
 	stm->file = -1;
+	stm->mapping = nil;
 
 	return stm;
 }
 
+/*
+ * Swap the read buffer of a freshly opened file stream for a view of
+ * the whole file. Seeking then only moves the read pointer. Files that
+ * cannot be mapped (empty, too large for an int offset, pipes) are left
+ * as ordinary file streams.
+ */
+
+static void
+mapfile(fz_stream *stm)
+{
+	fz_error *error;
+	fz_buffer *buf;
+	unsigned char *data;
+	long len;
+#ifdef WIN32
+	HANDLE mapping;
+#endif
+
+	len = _lseek(stm->file, 0, 2);
+	if (_lseek(stm->file, 0, 0) < 0 || len <= 0 || len > INT_MAX)
+		return;
+
+#ifdef WIN32
+	mapping = CreateFileMapping((HANDLE)_get_osfhandle(stm->file),
+			nil, PAGE_READONLY, 0, 0, nil);
+	if (!mapping)
+		return;
+	data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, len);
+	if (!data)
+	{
+		CloseHandle(mapping);
+		return;
+	}
+	stm->mapping = mapping;
+#else
+	data = mmap(nil, len, PROT_READ, MAP_SHARED, stm->file, 0);
+	if (data == MAP_FAILED)
+		return;
+#endif
+
+	error = fz_newbufferwithmemory(&buf, data, len);
+	if (error)
+	{
+		fz_droperror(error);
+#ifdef WIN32
+		UnmapViewOfFile(data);
+		CloseHandle(mapping);
+		stm->mapping = nil;
+#else
+		munmap(data, len);
+#endif
+		return;
+	}
+
+	buf->eof = 1;
+
+	fz_dropbuffer(stm->buffer);
+	stm->buffer = buf;
+	stm->kind = FZ_SMMAP;
+}
+
+static void
+unmapfile(fz_stream *stm)
+{
+	fz_buffer *buf = stm->buffer;
+#ifdef WIN32
+	UnmapViewOfFile(buf->bp);
+	CloseHandle(stm->mapping);
+#else
+	munmap(buf->bp, buf->ep - buf->bp);
+#endif
+}
+
 fz_stream *
 fz_keepstream(fz_stream *stm)
 {
@@ -61,6 +141,10 @@ fz_dropstream(fz_stream *stm)
 		case FZ_SFILE:
 			_close(stm->file);
 			break;
+		case FZ_SMMAP:
+			unmapfile(stm);
+			_close(stm->file);
+			break;
 		case FZ_SFILTER:
 			fz_dropfilter(stm->filter);
 			fz_dropstream(stm->chain);
@@ -185,6 +269,16 @@ fz_error * fz_openrfilew(fz_stream **stmp, const wchar_t *path)
 		return fz_rethrow(error, "cannot open file for reading: '%s'", path);
 	return fz_okay;
 }
+
+fz_error * fz_openrfilemmapw(fz_stream **stmp, const wchar_t *path)
+{
+	fz_error *error;
+	error = openfilew(stmp, path, FZ_SREAD, O_BINARY | O_RDONLY);
+	if (error)
+		return fz_rethrow(error, "cannot open file for reading");
+	mapfile(*stmp);
+	return fz_okay;
+}
 #endif
 
 fz_error * fz_openrfile(fz_stream **stmp, char *path)
@@ -196,6 +290,16 @@ fz_error * fz_openrfile(fz_stream **stmp, char *path)
 	return fz_okay;
 }
 
+fz_error * fz_openrfilemmap(fz_stream **stmp, char *path)
+{
+	fz_error *error;
+	error = openfile(stmp, path, FZ_SREAD, O_BINARY | O_RDONLY);
+	if (error)
+		return fz_rethrow(error, "cannot open file for reading: '%s'", path);
+	mapfile(*stmp);
+	return fz_okay;
+}
+
 fz_error * fz_openwfile(fz_stream **stmp, char *path)
 {
 	fz_error *error;
@@ -149,6 +149,7 @@ fz_rtell(fz_stream *stm)
 		return stm->filter->count - (buf->wp - buf->rp);
 
 	case FZ_SBUFFER:
+	case FZ_SMMAP:
 		return buf->rp - buf->bp;
 
 	default:
@@ -227,6 +228,15 @@ fz_rseek(fz_stream *stm, int offset, int whence)
 			buf->rp = CLAMP(buf->ep + offset, buf->bp, buf->ep);
 		return fz_okay;
 
+	case FZ_SMMAP:
+		/* the whole file is in the buffer, so it never needs refilling */
+		if (whence == 0)
+			buf->rp = CLAMP(buf->bp + offset, buf->bp, buf->ep);
+		else
+			buf->rp = CLAMP(buf->ep + offset, buf->bp, buf->ep);
+		buf->eof = 1;
+		return fz_okay;
+
 	default:
 		return fz_throw("unknown stream type");
 	}
@@ -262,6 +272,38 @@ fz_read(int *np, fz_stream *stm, unsigned char *mem, int n)
 	return fz_okay;
 }
 
+/*
+ * Borrow the next len bytes of a mapped file stream without copying
+ * them. The returned buffer pins the stream, so it stays valid after
+ * the caller drops its own reference. Other kinds of stream return nil
+ * and the caller reads the data the ordinary way.
+ */
+fz_error *
+fz_readslice(fz_buffer **bufp, fz_stream *stm, int len)
+{
+	fz_error *error;
+	fz_buffer *buf = stm->buffer;
+
+	*bufp = nil;
+
+	if (stm->kind != FZ_SMMAP || stm->dead)
+		return fz_okay;
+
+	if (len < 0)
+		return fz_throw("assert: negative slice length");
+
+	len = MIN(len, buf->wp - buf->rp);
+
+	error = fz_newbufferwithmemory(bufp, buf->rp, len);
+	if (error)
+		return fz_rethrow(error, "cannot create slice buffer");
+
+	(*bufp)->pin = fz_keepstream(stm);
+
+	buf->rp += len;
+	return fz_okay;
+}
+
 fz_error *
 fz_readerror(fz_stream *stm)
 {
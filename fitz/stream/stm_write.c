@@ -183,7 +183,8 @@ fz_flush(fz_stream *stm)
 		return fz_okay;
 
 	case FZ_SBUFFER:
-		if (!buf->eof && buf->wp == buf->ep)
+		/* filters ask for room before the buffer is quite full */
+		if (!buf->eof)
 		{
 			error = fz_growbuffer(buf);
 			if (error)
@@ -1,12 +1,23 @@
 #include "fitz-base.h"
 #include "fitz-world.h"
 
+static int fontserial = 0;
+
 void
 fz_initfont(fz_font *font, char *name)
 {
+	int serial;
+
 	font->refs = 1;
 	strlcpy(font->name, name, sizeof font->name);
 
+	/* never reused, unlike the address of the font */
+	fz_lock(FZ_LOCK_GLYPHCACHE);
+	serial = ++fontserial;
+	fz_unlock(FZ_LOCK_GLYPHCACHE);
+	memset(font->id, 0, sizeof font->id);
+	memcpy(font->id, &serial, sizeof serial);
+
 	font->wmode = 0;
 
 	font->bbox.x0 = 0;
@@ -6,6 +6,42 @@
 int g_errorCount = 0;
 fz_error *g_errorList[MAX_ERRORS_BEFORE_STOP];
 
+// Guards the error list when pages are analysed on several threads
+CRITICAL_SECTION g_errorLock;
+
+
+//
+// fitz lock context. Fitz shares the freetype library, the object pools
+// and the glyph cache between all the documents, so the worker threads
+// have to take turns with them
+//
+typedef struct _soPdfLocks
+{
+    fz_lockcontext      super;
+    CRITICAL_SECTION    cs[FZ_LOCK_MAX];
+
+} soPdfLocks;
+
+static void
+soPdfLock(
+    fz_lockcontext *ctx,
+    int lock
+    )
+{
+    EnterCriticalSection(&((soPdfLocks*)ctx)->cs[lock]);
+}
+
+static void
+soPdfUnlock(
+    fz_lockcontext *ctx,
+    int lock
+    )
+{
+    LeaveCriticalSection(&((soPdfLocks*)ctx)->cs[lock]);
+}
+
+soPdfLocks g_locks = { { soPdfLock, soPdfUnlock } };
+
 void
 displayPageNumber(
     int pageNo,
@@ -59,12 +95,11 @@ initSoPdfFile(
 
 
 int
-openPdfFile(
+loadPdfFile(
     soPdfFile* pdfFile
     )
 {
     fz_error    *error;
-    fz_obj      *obj;
 
     //
     // open pdf and load xref table
@@ -76,6 +111,10 @@ openPdfFile(
     if (error)
         return soPdfError(error);
 
+    // Objects parsed from the input are dropped again between pages
+    // once they take up more than the cache limit
+    pdf_setcachelimit(pdfFile->xref, p_cacheLimit * 1024 * 1024);
+
     //
     // Handle encrypted file
     error = pdf_decryptxref(pdfFile->xref);
@@ -91,11 +130,30 @@ openPdfFile(
     }
 
     //
-    // load the page tree and other objects
-    error = pdf_loadpagetree(&pdfFile->pageTree, pdfFile->xref);
+    // open the page tree, the pages themselves are looked up as they
+    // are processed
+    error = pdf_loadpagetreelazy(&pdfFile->pageTree, pdfFile->xref);
     if (error)
         return soPdfError(error);
 
+    return 0;
+}
+
+int
+openPdfFile(
+    soPdfFile* pdfFile
+    )
+{
+    fz_error    *error;
+    fz_obj      *obj;
+    int         retCode;
+
+    //
+    // open the file and the page tree
+    retCode = loadPdfFile(pdfFile);
+    if (retCode != 0)
+        return retCode;
+
     //
     // load meta information
     obj = fz_dictgets(pdfFile->xref->trailer, "Root");
@@ -115,14 +173,7 @@ openPdfFile(
             return soPdfError(error);
     }
 
-    error = pdf_loadnametrees(pdfFile->xref);
-    if (error)
-        return soPdfError(error);
-
-    error = pdf_loadoutline(&pdfFile->outline, pdfFile->xref);
-    if (error)
-        return soPdfError(error);
-
+    // The name trees are loaded by the first link that needs them
     return 0;
 }
 
@@ -360,30 +411,28 @@ isInsideRect(
 
 fz_rect
 getContainingRect(
-    fz_node *node, 
+    pdf_measure *measure, 
     fz_rect maxRect
     )
 {
     fz_rect rect = fz_emptyrect;
 
-    if (node)
+    for (int ctr = 0; ctr < measure->len; ctr++)
     {
-        switch(node->kind)
+        pdf_measureitem *item = &measure->items[ctr];
+
+        switch(item->kind)
         {
         case FZ_NTEXT:
         case FZ_NIMAGE:
         case FZ_NPATH:
-            if (isInsideRect(maxRect, node->bbox))
-                rect = fz_mergerects(rect, node->bbox);
+            if (isInsideRect(maxRect, item->bbox))
+                rect = fz_mergerects(rect, item->bbox);
             break;
 
         default:
             break;
         }
-
-        // Recurse
-        for (fz_node *child = node->first; child; child = child->next)
-            rect = fz_mergerects(rect, getContainingRect(child, maxRect));
     }
 
     return rect;
@@ -407,10 +456,16 @@ processErrorPage(
             return error;
 
     // Save the error in the list
+    EnterCriticalSection(&g_errorLock);
     if (g_errorCount >= MAX_ERRORS_BEFORE_STOP)
-        return soPdfErrorList(error);
+    {
+        error = soPdfErrorList(error);
+        LeaveCriticalSection(&g_errorLock);
+        return error;
+    }
                 
     g_errorList[g_errorCount++] = error;
+    LeaveCriticalSection(&g_errorLock);
 
 
     // Get the box for the page
@@ -474,7 +529,7 @@ processPage(
 {
     fz_error    *error;
     fz_obj      *pageRef;
-    pdf_page    *pdfPage;
+    pdf_measure *measure;
     fz_rect     contentBox;
     fz_rect     mediaBox;
 
@@ -483,22 +538,27 @@ processPage(
     for (int ctr = 0; ctr < rectCount; ctr++)
         bbRect[ctr] = fz_emptyrect;
 
-    // Get the page reference and load the page contents
+    // Get the page reference and measure the page contents. We only
+    // need the bounding boxes, so there is no need to build the
+    // display tree or decode any images
     pageRef = pdf_getpageobject(inFile->pageTree, pageNo);
-    error = pdf_loadpage(&pdfPage, inFile->xref, pageRef);
+    if (pageRef == NULL)
+        error = fz_throw("cannot find page object %d", pageNo + 1);
+    else
+        error = pdf_measurepage(&measure, inFile->xref, pageRef);
     if (error != NULL)
     {
-        // Ideally pdf_loadpage should render all the pages
+        // Ideally pdf_measurepage should handle all the pages
         // and this should never happen
         return processErrorPage(inFile, pageRef, pageNo, bbRect, error);
     }
 
     // Get the bounding box for the page
-    mediaBox = pdfPage->mediabox;
+    mediaBox = measure->mediabox;
     float mbHeight = mediaBox.y1 - mediaBox.y0;
     
     // calculate the bounding box for all the elements in the page
-    contentBox = fz_boundnode(pdfPage->tree->root, fz_identity());
+    contentBox = measure->bbox;
     float cbHeight = contentBox.y1 - contentBox.y0;
 
     // If there is nothing on the page we return nothing.
@@ -513,14 +573,17 @@ processPage(
     {
         // Calculate the new content box based on the content that is 
         // inside the the media box and recalculate cbHeight
-        contentBox = getContainingRect(pdfPage->tree->root, mediaBox);
+        contentBox = getContainingRect(measure, mediaBox);
         cbHeight = contentBox.y1 - contentBox.y0;
     }
 
 
 #ifdef _blahblah
     printf("-->Page %d\n", pageNo);
-    bbdump(pdfPage->tree->root, 1);
+    for (int ctr = 0; ctr < measure->len; ctr++)
+        printf("  %d [%g %g %g %g]\n", measure->items[ctr].kind,
+            measure->items[ctr].bbox.x0, measure->items[ctr].bbox.y0,
+            measure->items[ctr].bbox.x1, measure->items[ctr].bbox.y1);
 #endif
 
     // The rotation takes place when we insert the page into destination
@@ -557,7 +620,7 @@ processPage(
     // top 55% (bottom + 45) of the contents
     bbRect[0] = contentBox;
     bbRect[0].y0 = bbRect[0].y0 + (float)(0.45 * cbHeight);
-    bbRect[0] = getContainingRect(pdfPage->tree->root, bbRect[0]);
+    bbRect[0] = getContainingRect(measure, bbRect[0]);
 
     // Check if the contents we got in first split is more than 40%
     // of the total contents
@@ -586,233 +649,1616 @@ processPage(
 
 Cleanup:
 
-    // This function can overflow the stack when the pdf page
-    // to be rendered is very complex. I had to increase the 
-    // stack size reserved for exe using compiler option
-    pdf_droppage(pdfPage);
+    pdf_dropmeasure(measure);
 
     return error;
 }
 
+// Each page can be split into up-to 3 pages
+#define MAX_SPLIT_RECTS     3
+
+//
+// State shared by the page analysis threads. Pages are handed out
+// through nextPage and the split rects of page N always land in
+// pageRects[N * MAX_SPLIT_RECTS], so the output does not depend on
+// which thread analysed which page.
+//
+typedef struct _soPdfAnalysis
+{
+    soPdfFile       *inFile;
+    fz_rect         *pageRects;
+    int             pageCount;
+
+    volatile LONG   nextPage;
+    volatile LONG   donePages;
+    volatile LONG   failed;
+
+} soPdfAnalysis;
+
+typedef struct _soPdfWorker
+{
+    soPdfAnalysis   *analysis;
+    HANDLE          hThread;
+
+    // the first page that failed and why
+    int             errorPage;
+    fz_error        *error;
+    int             retCode;
+
+} soPdfWorker;
+
+
+unsigned __stdcall
+analyzePagesThread(
+    void *arg
+    )
+{
+    soPdfWorker     *worker = (soPdfWorker*)arg;
+    soPdfAnalysis   *analysis = worker->analysis;
+    soPdfFile       file;
+
+    //
+    // Every thread opens its own copy of the input file. This gives it
+    // its own xref, object cache and resource store and none of them
+    // are safe to share
+    initSoPdfFile(&file);
+    memcpy(file.fileName, analysis->inFile->fileName, sizeof(file.fileName));
+    memcpy(file.password, analysis->inFile->password, sizeof(file.password));
+
+    worker->retCode = loadPdfFile(&file);
+    if (worker->retCode != 0)
+    {
+        InterlockedExchange(&analysis->failed, 1);
+        closePdfFile(&file);
+        fz_flushpool();
+        return 1;
+    }
+
+    while (! analysis->failed)
+    {
+        int pageNo = InterlockedIncrement(&analysis->nextPage) - 1;
+        if (pageNo >= analysis->pageCount)
+            break;
+
+        fz_error *error = processPage(&file, pageNo, 
+            analysis->pageRects + pageNo * MAX_SPLIT_RECTS, MAX_SPLIT_RECTS);
+        if (error)
+        {
+            worker->errorPage = pageNo;
+            worker->error = error;
+            InterlockedExchange(&analysis->failed, 1);
+            break;
+        }
+
+        pdf_trimcache(file.xref);
+
+        InterlockedIncrement(&analysis->donePages);
+    }
+
+    closePdfFile(&file);
+
+    // hand the objects this thread freed back to the shared pools
+    fz_flushpool();
+    return 0;
+}
+
 int
-copyPdfFile(
+analyzePdfFile(
     soPdfFile* inFile,
-    soPdfFile* outFile
+    fz_rect *pageRects
     )
 {
-    fz_error    *error;
-    int         pageTreeNum, pageTreeGen;
+    fz_error        *error;
+    soPdfAnalysis   analysis;
+    soPdfWorker     workers[MAXIMUM_WAIT_OBJECTS];
+    HANDLE          hThreads[MAXIMUM_WAIT_OBJECTS];
+    int             threadCount, ctr;
+    int             retCode = 0;
 
-    assert(inFile != NULL);
-    assert(outFile != NULL);
+    memset(&analysis, 0, sizeof(analysis));
+    analysis.inFile = inFile;
+    analysis.pageRects = pageRects;
+    analysis.pageCount = pdf_getpagecount(inFile->pageTree);
+
+    printf("\nProcessing input page : ");
 
     //
-    // Process every page in the source file
-    //
+    // Single threaded, analyse the pages of the file we already have open
+    if ((p_threads <= 1) || (analysis.pageCount <= 1))
     {
-        printf("\nProcessing input page : ");
-        for (int pageNo = 0; pageNo < pdf_getpagecount(inFile->pageTree); pageNo++)
+        for (int pageNo = 0; pageNo < analysis.pageCount; pageNo++)
         {
             displayPageNumber(pageNo + 1, !pageNo);
 
-            // Get the page object from the source
-            fz_obj  *pageRef = inFile->pageTree->pref[pageNo];
-            fz_obj  *pageObj = pdf_getpageobject(inFile->pageTree, pageNo);
-
-            //
-            // Process the page. Each page can be split into up-to 3 pages
-            //
-            fz_rect    bbRect[3];
-            error = processPage(inFile, pageNo, bbRect, 3);
+            error = processPage(inFile, pageNo, 
+                pageRects + pageNo * MAX_SPLIT_RECTS, MAX_SPLIT_RECTS);
             if (error)
                 return soPdfError(error);
+        }
 
+        return 0;
+    }
 
-            for (int ctr = 0; ctr < 3; ctr++)
-            {
-                // Check if this was a blank page
-                if (fz_isemptyrect(bbRect[ctr]))
-                    break;
+    threadCount = MIN(p_threads, analysis.pageCount);
 
-                //
-                // copy the source page dictionary entry. The way this is done is basically
-                // by making a copy of the page dict object in the source file, and adding
-                // the copy in the source file. Then the copied page dict object is 
-                // referenced and added to the destination file.
-                //
-                // This convoluted procedure is done because the copy is done by pdf_transplant
-                // function that accepts a source and destination. Whatever is referenced by
-                // destination object is deep copied
-                //
-                
+    // The threads get the default stack reserve of the exe, which is
+    // raised to 8MB in soPdf.vcproj for deeply nested content streams
+    memset(workers, 0, sizeof(workers));
+    for (ctr = 0; ctr < threadCount; ctr++)
+    {
+        workers[ctr].analysis = &analysis;
+        workers[ctr].errorPage = -1;
+        workers[ctr].hThread = (HANDLE)_beginthreadex(NULL, 0, 
+            analyzePagesThread, &workers[ctr], 0, NULL);
+        if (workers[ctr].hThread == 0)
+        {
+            InterlockedExchange(&analysis.failed, 1);
+            retCode = soPdfError(fz_throw("cannot create analysis thread %d", ctr));
+            break;
+        }
+        hThreads[ctr] = workers[ctr].hThread;
+    }
+    threadCount = ctr;
 
-                // allocate an object id and generation id in source file
-                //
-                // There is a bug in mupdf where the object allocation returns
-                // 0 oid and 0 gid when the input pdf file has iref stream
-                // so to work around the issue, we wrap the pdf_allocojbect
-                // in a for loop 10 times to get the number
-                //
-                int sNum, sGen, tries;
+    //
+    // Wait for the threads to finish, showing the progress meanwhile
+    displayPageNumber(0, true);
+    while (WaitForMultipleObjects(threadCount, hThreads, TRUE, 250) == WAIT_TIMEOUT)
+        displayPageNumber(analysis.donePages, false);
+    displayPageNumber(analysis.donePages, false);
 
-                for (tries = 0; tries < 10; tries++)
-                {
-                    error = pdf_allocobject(inFile->xref, &sNum, &sGen);
-                    if (error)
-                        return soPdfError(error);
+    for (ctr = 0; ctr < threadCount; ctr++)
+        CloseHandle(hThreads[ctr]);
 
-                    // If sNum is non zero then the allocation was successful
-                    if (sNum != 0)
-                        break;  
-                    pdf_updateobject(inFile->xref, sNum, sGen, pageObj);
-                }
+    //
+    // Report the failure on the lowest page number, which is the one a
+    // single thread would have stopped on. The rest are dropped
+    soPdfWorker *failed = NULL;
+    for (ctr = 0; ctr < threadCount; ctr++)
+    {
+        if (workers[ctr].retCode != 0)
+            retCode = workers[ctr].retCode;
 
-                // If we didn't succeed even after 10 tries then this file 
-                // is not going to work.
-                if (tries >= 10)
-                    return soPdfError(fz_throw("cannot allocate object because of mupdf bug"));
+        if (workers[ctr].error == NULL)
+            continue;
 
-                // make a deep copy of the original page dict
-                fz_obj  *pageObj2;
-                error = fz_deepcopydict(&pageObj2, pageObj);
-                if (error)
-                    return soPdfError(error);
+        if ((failed == NULL) || (workers[ctr].errorPage < failed->errorPage))
+        {
+            if (failed)
+                fz_droperror(failed->error);
+            failed = &workers[ctr];
+        }
+        else
+            fz_droperror(workers[ctr].error);
+    }
 
-                // update the source file with the duplicate page object
-                pdf_updateobject(inFile->xref, sNum, sGen, pageObj2);
+    if (failed)
+        return soPdfError(failed->error);
 
-                fz_dropobj(pageObj2);
+    return retCode;
+}
 
-                // create an indirect reference to the page object
-                fz_obj  *pageRef2;
-                error = fz_newindirect(&pageRef2, sNum, sGen);
-                if (error)
-                    return soPdfError(error);
 
-                // delete the parent dictionary entry
-                // Do we need to delete any other dictionary entry 
-                // like annot, tabs, metadata, etc
-                fz_dictdels(pageObj2, "Parent");
+//
+// Streams of one output page that are re-encoded with flate before
+// the page is written. The data is loaded and the results are stored
+// on the calling thread, the worker threads only run the deflate.
+//
+typedef struct _soPdfRecompressJob
+{
+    int             oid, gen;
+    int             rawLength;
+    fz_buffer       *data;
+    fz_buffer       *result;
+    fz_error        *error;
 
-                // Set the media box
-                setPageMediaBox(inFile->xref, pageObj2, bbRect[ctr]);
+} soPdfRecompressJob;
 
-                // Set the rotation based on input
-                switch(p_mode)
-                {
-                    // no rotation if fit height
-                case FitHeight:
-                case Fit2xHeight:
-                    break;
+typedef struct _soPdfRecompress
+{
+    soPdfRecompressJob  *jobs;
+    int                 jobCount;
 
-                    // rotate -90 deg if fit width
-                case Fit2xWidth:
-                case FitWidth:
-                    setPageRotate(pageObj2, p_reverseLandscape ? 90 : -90);
-                    break;
+    volatile LONG       nextJob;
 
-                case SmartFitHeight:
-                case SmartFitWidth:
-                default:
-                    return soPdfError(fz_throw("Mode(%d) not yet implemented.", p_mode));
-                    break;
-                }
+} soPdfRecompress;
 
 
-                // push the indirect reference to the destination list for copy by pdf_transplant
-                error = fz_arraypush(outFile->editobjs, pageRef2);
-                if (error)
-                    return soPdfError(error);
-            }
-        }
+unsigned __stdcall
+recompressThread(
+    void *arg
+    )
+{
+    soPdfRecompress *recompress = (soPdfRecompress*)arg;
+
+    while (true)
+    {
+        int jobNo = InterlockedIncrement(&recompress->nextJob) - 1;
+        if (jobNo >= recompress->jobCount)
+            break;
+
+        soPdfRecompressJob *job = &recompress->jobs[jobNo];
+        job->error = pdf_deflatebuffer(&job->result, 
+            job->data->rp, job->data->wp - job->data->rp);
     }
 
-    // flush the objects into destination from source
+    // hand the objects this thread freed back to the shared pools
+    fz_flushpool();
+    return 0;
+}
+
+fz_error*
+recompressStreams(
+    pdf_xref* xref,
+    int firstObj,
+    int lastObj
+    )
+{
+    fz_error        *error = NULL;
+    soPdfRecompress recompress;
+    HANDLE          hThreads[MAXIMUM_WAIT_OBJECTS];
+    int             threadCount, ctr;
+
+    memset(&recompress, 0, sizeof(recompress));
+    recompress.jobs = (soPdfRecompressJob*)fz_malloc(
+        MAX(lastObj - firstObj, 1) * sizeof(soPdfRecompressJob));
+    if (! recompress.jobs)
+        return fz_throw("cannot allocate recompression jobs");
+
+    //
+    // Load the decoded data of every stream worth recompressing
+    for (int oid = firstObj; oid < lastObj; oid++)
     {
-        fz_obj      *results;
-        int         outPages;
+        int gen = xref->table[oid].gen;
+        if (! pdf_isrecompressible(xref, oid, gen))
+            continue;
 
-        printf("\nCopying output page : ");
-        error = pdf_transplant(outFile->xref, inFile->xref, &results, outFile->editobjs);
+        soPdfRecompressJob *job = &recompress.jobs[recompress.jobCount];
+        memset(job, 0, sizeof(soPdfRecompressJob));
+        job->oid = oid;
+        job->gen = gen;
+
+        fz_obj *length = fz_dictgets(xref->table[oid].obj, "Length");
+        error = pdf_resolve(&length, xref);
         if (error)
-            return soPdfError(error);
+            goto Cleanup;
+        job->rawLength = fz_toint(length);
+        fz_dropobj(length);
 
-        outPages = fz_arraylen(results);
-        for (int ctr = 0; ctr < outPages; ctr++)
+        // A stream we cannot decode is written out as it is
+        error = pdf_loadstream(&job->data, xref, oid, gen);
+        if (error)
         {
-            displayPageNumber(ctr + 1, !ctr);
-            error = fz_arraypush(outFile->pagelist, fz_arrayget(results, 
-                p_reverseLandscape ? outPages - 1 - ctr : ctr));
-            if (error)
-                return soPdfError(error);
+            fz_droperror(error);
+            error = NULL;
+            continue;
         }
 
-        fz_dropobj(results);
+        recompress.jobCount++;
     }
 
-    // flush page tree
-
-    // Create page tree and add back-links
+    //
+    // Deflate on the worker threads and on this one
+    threadCount = MIN(p_threads, recompress.jobCount) - 1;
+    for (ctr = 0; ctr < threadCount; ctr++)
     {
-        fz_obj  *pageTreeObj;
-        fz_obj  *pageTreeRef;
+        hThreads[ctr] = (HANDLE)_beginthreadex(NULL, 0, 
+            recompressThread, &recompress, 0, NULL);
+        if (hThreads[ctr] == 0)
+            break;
+    }
+    threadCount = ctr;
 
-        // allocate a new object in out file for pageTree object
-        error = pdf_allocobject(outFile->xref, &pageTreeNum, &pageTreeGen);
-        if (error)
-            return soPdfError(error);
+    recompressThread(&recompress);
 
-        // Create a page tree object
-        error = fz_packobj(&pageTreeObj, "<</Type/Pages/Count %i/Kids %o>>",
-            fz_arraylen(outFile->pagelist), outFile->pagelist);
-        if (error)
-            return soPdfError(error);
+    if (threadCount > 0)
+    {
+        WaitForMultipleObjects(threadCount, hThreads, TRUE, INFINITE);
+        for (ctr = 0; ctr < threadCount; ctr++)
+            CloseHandle(hThreads[ctr]);
+    }
 
-        // Update the xref entry with the pageTree object
-        pdf_updateobject(outFile->xref, pageTreeNum, pageTreeGen, pageTreeObj);
+    //
+    // Keep the results that are smaller than what we had
+    for (ctr = 0; ctr < recompress.jobCount; ctr++)
+    {
+        soPdfRecompressJob *job = &recompress.jobs[ctr];
 
-        fz_dropobj(pageTreeObj);
+        if (job->error)
+        {
+            error = job->error;
+            job->error = NULL;
+            goto Cleanup;
+        }
+
+        if ((job->result->wp - job->result->rp) >= job->rawLength)
+            continue;
 
-        // Create a reference to the pageTree object
-        error = fz_newindirect(&pageTreeRef, pageTreeNum, pageTreeGen);
+        error = pdf_replacestream(xref, job->oid, job->gen, job->result);
         if (error)
-            return soPdfError(error);
+            goto Cleanup;
+    }
 
-        //
-        // For every page in the output file, update the parent entry
-        //
-        for (int ctr = 0; ctr < fz_arraylen(outFile->pagelist); ctr++)
-        {
-            fz_obj  *pageObj;
+Cleanup:
+    for (ctr = 0; ctr < recompress.jobCount; ctr++)
+    {
+        soPdfRecompressJob *job = &recompress.jobs[ctr];
+        if (job->data)
+            fz_dropbuffer(job->data);
+        if (job->result)
+            fz_dropbuffer(job->result);
+        if (job->error)
+            fz_droperror(job->error);
+    }
 
-            int num = fz_tonum(fz_arrayget(outFile->pagelist, ctr));
-            int gen = fz_togen(fz_arrayget(outFile->pagelist, ctr));
+    fz_free(recompress.jobs);
 
-            // Get the page object from xreft
-            error = pdf_loadobject(&pageObj, outFile->xref, num, gen);
-            if (error)
-                return soPdfError(error);
+    return error;
+}
 
-            // Update the parent entry in the page dictionary
-            error = fz_dictputs(pageObj, "Parent", pageTreeRef);
-            if (error)
-                return soPdfError(error);
 
-            // Update the entry with the updated page object
-            pdf_updateobject(outFile->xref, num, gen, pageObj);
+//
+// Images of one source page that are larger than the reader screen can
+// show them. The images are loaded and the results are stored on the
+// calling thread, the worker threads scale, convert and encode them.
+//
+typedef struct _soPdfDownsampleJob
+{
+    fz_obj          *ref;
+    int             oid, gen;
+    int             rawLength;
+    int             dct;
 
-            fz_dropobj(pageObj);
-        }
-    }
+    // the largest the image is shown on the screen, in pixels
+    float           width, height;
 
-    // Create catalog and root entries
-    {
-        fz_obj  *catObj, *infoObj;
-        int     rootNum, rootGen;
-        int     infoNum, infoGen;
+    pdf_image       *image;
+    int             xDenom, yDenom;
+    fz_buffer       *result;
+    int             resultWidth, resultHeight;
+    fz_error        *error;
 
-        //
-        // Copy the info catalog to the destination
+} soPdfDownsampleJob;
+
+typedef struct _soPdfDownsample
+{
+    soPdfDownsampleJob  *jobs;
+    int                 jobCount;
+
+    volatile LONG       nextJob;
+
+} soPdfDownsample;
+
+
+unsigned __stdcall
+downsampleThread(
+    void *arg
+    )
+{
+    soPdfDownsample *downsample = (soPdfDownsample*)arg;
+
+    while (true)
+    {
+        int jobNo = InterlockedIncrement(&downsample->nextJob) - 1;
+        if (jobNo >= downsample->jobCount)
+            break;
+
+        soPdfDownsampleJob *job = &downsample->jobs[jobNo];
+        job->error = pdf_downsampleimage(&job->result, 
+            &job->resultWidth, &job->resultHeight, job->image, 
+            job->xDenom, job->yDenom, job->dct);
+    }
+
+    // hand the objects this thread freed back to the shared pools
+    fz_flushpool();
+    return 0;
+}
+
+//
+// Check that an image can be replaced by a gray one without changing
+// what it looks like, other than the colour, and find out how it is
+// encoded. Stencil masks and colour key masks are left alone.
+//
+bool
+isDownsampleable(
+    fz_obj  *dict,
+    int     *dct
+    )
+{
+    fz_obj  *obj;
+
+    obj = fz_dictgets(dict, "Subtype");
+    if (! fz_isname(obj) || strcmp(fz_toname(obj), "Image"))
+        return false;
+
+    if (fz_tobool(fz_dictgets(dict, "ImageMask")))
+        return false;
+
+    if (fz_dictgets(dict, "Mask"))
+        return false;
+
+    obj = fz_dictgets(dict, "Filter");
+    if (fz_isarray(obj) && (fz_arraylen(obj) > 0))
+        obj = fz_arrayget(obj, fz_arraylen(obj) - 1);
+    *dct = fz_isname(obj) && 
+        (!strcmp(fz_toname(obj), "DCTDecode") || !strcmp(fz_toname(obj), "DCT"));
+
+    return true;
+}
+
+//
+// Drop a loaded image and take it out of the resource store, so that
+// its decoded samples are not kept around until the file is closed
+//
+void
+releaseImage(
+    pdf_xref*           xref,
+    soPdfDownsampleJob* job
+    )
+{
+    fz_error    *error;
+
+    fz_dropimage(&job->image->super);
+    job->image = NULL;
+
+    error = pdf_removeitem(xref->store, PDF_KIMAGE, job->ref);
+    if (error)
+        fz_droperror(error);
+}
+
+//
+// Downsample the images drawn on a source page to the resolution the
+// page splits show them at on the reader screen. The source objects
+// are replaced so the transplant copies the small images. An image is
+// sized by the first page it is drawn on, later pages share it as it is.
+//
+fz_error*
+downsampleImages(
+    pdf_xref*       xref,
+    pdf_measure*    measure,
+    fz_rect*        bbRect,
+    int             rectCount,
+    bool            rotated,
+    char*           doneImages,
+    int             doneCount
+    )
+{
+    fz_error        *error = NULL;
+    soPdfDownsample downsample;
+    HANDLE          hThreads[MAXIMUM_WAIT_OBJECTS];
+    int             threadCount, ctr;
+
+    memset(&downsample, 0, sizeof(downsample));
+    downsample.jobs = (soPdfDownsampleJob*)fz_malloc(
+        MAX(measure->imagelen, 1) * sizeof(soPdfDownsampleJob));
+    if (! downsample.jobs)
+        return fz_throw("cannot allocate downsample jobs");
+
+    //
+    // Work out the largest size every image is shown at
+    for (int use = 0; use < measure->imagelen; use++)
+    {
+        pdf_imageuse *image = &measure->images[use];
+        int oid = fz_tonum(image->ref);
+
+        if ((oid >= doneCount) || doneImages[oid])
+            continue;
+
+        for (int rect = 0; rect < rectCount; rect++)
+        {
+            if (fz_isemptyrect(bbRect[rect]))
+                break;
+            if (fz_isemptyrect(fz_intersectrects(image->bbox, bbRect[rect])))
+                continue;
+
+            // The split page is scaled to fit the screen
+            float pageWidth = bbRect[rect].x1 - bbRect[rect].x0;
+            float pageHeight = bbRect[rect].y1 - bbRect[rect].y0;
+            if (rotated)
+            {
+                float temp = pageWidth;
+                pageWidth = pageHeight;
+                pageHeight = temp;
+            }
+            if ((pageWidth <= 0) || (pageHeight <= 0))
+                continue;
+            float scale = MIN(SCREEN_WIDTH / pageWidth, SCREEN_HEIGHT / pageHeight);
+
+            float width = sqrt(image->ctm.a * image->ctm.a + image->ctm.b * image->ctm.b) * scale;
+            float height = sqrt(image->ctm.c * image->ctm.c + image->ctm.d * image->ctm.d) * scale;
+
+            for (ctr = 0; ctr < downsample.jobCount; ctr++)
+                if (downsample.jobs[ctr].oid == oid)
+                    break;
+
+            soPdfDownsampleJob *job = &downsample.jobs[ctr];
+            if (ctr == downsample.jobCount)
+            {
+                memset(job, 0, sizeof(soPdfDownsampleJob));
+                job->ref = image->ref;
+                job->oid = oid;
+                job->gen = fz_togen(image->ref);
+                downsample.jobCount++;
+            }
+
+            job->width = MAX(job->width, width);
+            job->height = MAX(job->height, height);
+        }
+    }
+
+    //
+    // Load the images that are worth shrinking
+    for (ctr = 0; ctr < downsample.jobCount; ctr++)
+    {
+        soPdfDownsampleJob *job = &downsample.jobs[ctr];
+        fz_obj *dict;
+
+        doneImages[job->oid] = 1;
+
+        error = pdf_loadindirect(&dict, xref, job->ref);
+        if (error)
+            goto Cleanup;
+
+        if (! isDownsampleable(dict, &job->dct))
+        {
+            fz_dropobj(dict);
+            continue;
+        }
+
+        fz_obj *length = fz_dictgets(dict, "Length");
+        error = pdf_resolve(&length, xref);
+        if (error)
+        {
+            fz_dropobj(dict);
+            goto Cleanup;
+        }
+        job->rawLength = fz_toint(length);
+        fz_dropobj(length);
+
+        // An image we cannot decode is written out as it is
+        error = pdf_loadimage(&job->image, xref, dict, job->ref);
+        fz_dropobj(dict);
+        if (error)
+        {
+            fz_droperror(error);
+            error = NULL;
+            job->image = NULL;
+            continue;
+        }
+
+        job->xDenom = (int)(job->image->super.w / ceil(MAX(job->width, 1)));
+        job->yDenom = (int)(job->image->super.h / ceil(MAX(job->height, 1)));
+        job->xDenom = MAX(job->xDenom, 1);
+        job->yDenom = MAX(job->yDenom, 1);
+    }
+
+    //
+    // Drop the jobs that have nothing to do, the rest go to the threads
+    {
+        int jobCount = 0;
+        for (ctr = 0; ctr < downsample.jobCount; ctr++)
+        {
+            soPdfDownsampleJob *job = &downsample.jobs[ctr];
+
+            if (job->image && 
+                (! job->image->super.cs || job->image->super.a ||
+                 ((job->xDenom < 2) && (job->yDenom < 2))))
+                releaseImage(xref, job);
+
+            if (job->image)
+                downsample.jobs[jobCount++] = *job;
+        }
+        downsample.jobCount = jobCount;
+    }
+
+    //
+    // Shrink on the worker threads and on this one
+    threadCount = MIN(p_threads, downsample.jobCount) - 1;
+    for (ctr = 0; ctr < threadCount; ctr++)
+    {
+        hThreads[ctr] = (HANDLE)_beginthreadex(NULL, 0, 
+            downsampleThread, &downsample, 0, NULL);
+        if (hThreads[ctr] == 0)
+            break;
+    }
+    threadCount = ctr;
+
+    downsampleThread(&downsample);
+
+    if (threadCount > 0)
+    {
+        WaitForMultipleObjects(threadCount, hThreads, TRUE, INFINITE);
+        for (ctr = 0; ctr < threadCount; ctr++)
+            CloseHandle(hThreads[ctr]);
+    }
+
+    //
+    // Keep the results that are smaller than what we had
+    for (ctr = 0; ctr < downsample.jobCount; ctr++)
+    {
+        soPdfDownsampleJob *job = &downsample.jobs[ctr];
+
+        if (job->error)
+        {
+            error = job->error;
+            job->error = NULL;
+            goto Cleanup;
+        }
+
+        if ((job->result->wp - job->result->rp) >= job->rawLength)
+            continue;
+
+        error = pdf_replaceimage(xref, job->oid, job->gen, job->result, 
+            job->resultWidth, job->resultHeight, job->dct);
+        if (error)
+            goto Cleanup;
+    }
+
+Cleanup:
+    for (ctr = 0; ctr < downsample.jobCount; ctr++)
+    {
+        soPdfDownsampleJob *job = &downsample.jobs[ctr];
+        if (job->image)
+            releaseImage(xref, job);
+        if (job->result)
+            fz_dropbuffer(job->result);
+        if (job->error)
+            fz_droperror(job->error);
+    }
+
+    fz_free(downsample.jobs);
+
+    return error;
+}
+
+
+//
+// Cut the drawing that falls outside the new media box out of a split
+// page. The pruned contents go into a new stream of the source file so
+// that the transplant picks them up like any other page stream. The
+// page is left alone if nothing can be cut.
+//
+fz_error*
+prunePage(
+    pdf_xref*       xref,
+    fz_obj*         pageObj,
+    pdf_measure*    measure,
+    fz_buffer*      contents,
+    fz_rect         rect
+    )
+{
+    fz_error    *error;
+    fz_buffer   *pruned, *packed;
+    fz_obj      *stmDict, *stmRef, *rdb;
+    int         sNum, sGen, tries;
+
+    error = pdf_prunecontents(&pruned, contents, measure, rect);
+    if (error)
+        return fz_rethrow(error, "cannot prune page contents");
+    if (pruned == NULL)
+        return NULL;
+
+    error = pdf_deflatebuffer(&packed, pruned->rp, pruned->wp - pruned->rp);
+    fz_dropbuffer(pruned);
+    if (error)
+        return fz_rethrow(error, "cannot compress page contents");
+
+    // Same object allocation workaround as for the page copies
+    for (tries = 0; tries < 10; tries++)
+    {
+        error = pdf_allocobject(xref, &sNum, &sGen);
+        if (error)
+        {
+            fz_dropbuffer(packed);
+            return fz_rethrow(error, "cannot allocate content stream");
+        }
+        if (sNum != 0)
+            break;
+    }
+    if (tries >= 10)
+    {
+        fz_dropbuffer(packed);
+        return fz_throw("cannot allocate object because of mupdf bug");
+    }
+
+    error = fz_newdict(&stmDict, 2);
+    if (! error)
+    {
+        error = pdf_updateobject(xref, sNum, sGen, stmDict);
+        fz_dropobj(stmDict);
+    }
+    if (! error)
+        error = pdf_replacestream(xref, sNum, sGen, packed);
+    fz_dropbuffer(packed);
+    if (error)
+        return fz_rethrow(error, "cannot store page contents");
+
+    error = fz_newindirect(&stmRef, sNum, sGen);
+    if (error)
+        return fz_rethrow(error, "cannot create content stream reference");
+    error = fz_dictputs(pageObj, "Contents", stmRef);
+    fz_dropobj(stmRef);
+    if (error)
+        return fz_rethrow(error, "cannot set page contents");
+
+    // Leave out the xobjects that are no longer drawn
+    error = pdf_pruneresources(&rdb, xref, 
+        fz_dictgets(pageObj, "Resources"), measure, rect);
+    if (error)
+        return fz_rethrow(error, "cannot prune page resources");
+    if (rdb)
+    {
+        error = fz_dictputs(pageObj, "Resources", rdb);
+        fz_dropobj(rdb);
+        if (error)
+            return fz_rethrow(error, "cannot set page resources");
+    }
+
+    return NULL;
+}
+
+
+//
+// Raster output. The split rects of every page are rendered to gray
+// bitmaps on the worker threads, each with its own copy of the input
+// file like the page analysis. The workers may run ahead of the writer
+// by a window of pages, the main thread writes the pages out in order.
+//
+typedef struct _soPdfBitmap
+{
+    fz_buffer       *data;      // encoded samples
+    int             width, height;
+
+} soPdfBitmap;
+
+typedef struct _soPdfRasterPage
+{
+    soPdfBitmap     bitmaps[MAX_SPLIT_RECTS];
+    int             bitmapCount;
+    fz_error        *error;
+    volatile LONG   done;
+
+} soPdfRasterPage;
+
+typedef struct _soPdfRaster
+{
+    soPdfFile       *inFile;
+    fz_rect         *pageRects;
+    int             pageCount;
+    soPdfRasterPage *pages;
+    fz_glyphcache   *glyphCache;    // shared by the raster threads
+
+    HANDLE          hWindow;        // semaphore, pages rendered ahead
+    HANDLE          hPageDone;      // event, a page has been rendered
+    volatile LONG   nextPage;
+    volatile LONG   failed;
+    fz_error * volatile startError; // why a thread could not start
+
+} soPdfRaster;
+
+
+//
+// Encode the gray samples of a rendered rect. One bit bitmaps are
+// thresholded at half gray and CCITT G3 1-D encoded, the rest is deflated
+//
+fz_error*
+encodeBitmap(
+    soPdfBitmap*    bitmap,
+    unsigned char*  gray,
+    int             width,
+    int             height
+    )
+{
+    fz_error        *error;
+    fz_filter       *filter;
+    fz_obj          *params;
+    int             stride;
+
+    bitmap->width = width;
+    bitmap->height = height;
+
+    if (p_rasterBits != 1)
+    {
+        error = pdf_deflatebuffer(&bitmap->data, gray, width * height);
+        if (error)
+            return fz_rethrow(error, "cannot deflate bitmap");
+        return NULL;
+    }
+
+    // Pack the samples in place, set bits are white
+    stride = (width + 7) / 8;
+    for (int y = 0; y < height; y++)
+    {
+        unsigned char *src = gray + y * width;
+        unsigned char *dst = gray + y * stride;
+
+        for (int i = 0; i < stride; i++)
+        {
+            unsigned char bits = 0;
+            for (int x = i * 8; x < i * 8 + 8 && x < width; x++)
+                if (src[x] >= 128)
+                    bits |= 0x80 >> (x & 7);
+            dst[i] = bits;
+        }
+    }
+
+    error = fz_packobj(&params, "<</K 0 /Columns %i /Rows %i>>", width, height);
+    if (error)
+        return fz_rethrow(error, "cannot create fax parameters");
+
+    error = fz_newfaxe(&filter, params);
+    fz_dropobj(params);
+    if (error)
+        return fz_rethrow(error, "cannot create fax encoder");
+
+    error = pdf_encodebuffer(&bitmap->data, filter, gray, stride * height);
+    fz_dropfilter(filter);
+    if (error)
+        return fz_rethrow(error, "cannot encode bitmap");
+
+    return NULL;
+}
+
+//
+// Render the split rects of one page at the size the screen shows them
+//
+fz_error*
+renderPage(
+    soPdfFile*          file,
+    fz_renderer*        gc,
+    int                 pageNo,
+    fz_rect*            bbRect,
+    soPdfRasterPage*    rasterPage
+    )
+{
+    fz_error    *error;
+    pdf_page    *page;
+    int         rotate;
+
+    fz_obj *pageObj = pdf_getpageobject(file->pageTree, pageNo);
+    if (pageObj == NULL)
+        return fz_throw("cannot find page object %d", pageNo + 1);
+
+    error = pdf_loadpage(&page, file->xref, pageObj);
+    if (error)
+        return fz_rethrow(error, "cannot load page %d", pageNo + 1);
+
+    // The landscape modes turn the page on its side
+    if ((p_mode == FitWidth) || (p_mode == Fit2xWidth))
+        rotate = p_reverseLandscape ? 90 : -90;
+    else
+        rotate = page->rotate;
+
+    for (int ctr = 0; ctr < MAX_SPLIT_RECTS; ctr++)
+    {
+        fz_rect     rect = bbRect[ctr];
+        fz_matrix   ctm;
+        fz_irect    bbox;
+        fz_pixmap   *pix;
+
+        if (fz_isemptyrect(rect))
+            break;
+
+        // Scale the rect to fit the screen
+        float width = rect.x1 - rect.x0;
+        float height = rect.y1 - rect.y0;
+        if ((rotate % 180) != 0)
+        {
+            float temp = width;
+            width = height;
+            height = temp;
+        }
+        float scale = MIN(SCREEN_WIDTH / width, SCREEN_HEIGHT / height);
+
+        ctm = fz_translate(-rect.x0, -rect.y1);
+        ctm = fz_concat(ctm, fz_scale(scale, -scale));
+        ctm = fz_concat(ctm, fz_rotate((float)rotate));
+
+        bbox = fz_roundrect(fz_transformaabb(ctm, rect));
+
+        error = fz_newpixmap(&pix, bbox.x0, bbox.y0, 
+            bbox.x1 - bbox.x0, bbox.y1 - bbox.y0, 2);
+        if (error)
+            break;
+
+        memset(pix->samples, 0xff, pix->w * pix->h * pix->n);
+
+        error = fz_rendertreeover(gc, pix, page->tree, ctm);
+        if (error)
+        {
+            fz_droppixmap(pix);
+            break;
+        }
+
+        // The renderer works in gray, only the alpha has to go
+        unsigned char *gray = pix->samples;
+        for (int i = 0; i < pix->w * pix->h; i++)
+            gray[i] = pix->samples[i * 2 + 1];
+
+        error = encodeBitmap(&rasterPage->bitmaps[ctr], gray, pix->w, pix->h);
+        fz_droppixmap(pix);
+        if (error)
+            break;
+
+        rasterPage->bitmapCount++;
+    }
+
+    pdf_droppage(page);
+
+    if (error)
+        return fz_rethrow(error, "cannot render page %d", pageNo + 1);
+
+    return NULL;
+}
+
+unsigned __stdcall
+rasterPagesThread(
+    void *arg
+    )
+{
+    soPdfRaster     *raster = (soPdfRaster*)arg;
+    soPdfFile       file;
+    fz_renderer     *gc = NULL;
+    fz_error        *error;
+
+    initSoPdfFile(&file);
+    memcpy(file.fileName, raster->inFile->fileName, sizeof(file.fileName));
+    memcpy(file.password, raster->inFile->password, sizeof(file.password));
+
+    if (loadPdfFile(&file) != 0)
+    {
+        InterlockedExchange(&raster->failed, 1);
+        SetEvent(raster->hPageDone);
+        closePdfFile(&file);
+        fz_flushpool();
+        return 1;
+    }
+
+    error = fz_newrendererwithcache(&gc, pdf_devicegray, 0, raster->glyphCache);
+    if (error)
+    {
+        // The main thread reports the first of these, before failed is set
+        if (InterlockedCompareExchangePointer(
+            (PVOID volatile*)&raster->startError, error, NULL) != NULL)
+            fz_droperror(error);
+        InterlockedExchange(&raster->failed, 1);
+        SetEvent(raster->hPageDone);
+        closePdfFile(&file);
+        fz_flushpool();
+        return 1;
+    }
+
+    while (true)
+    {
+        WaitForSingleObject(raster->hWindow, INFINITE);
+        if (raster->failed)
+            break;
+
+        int pageNo = InterlockedIncrement(&raster->nextPage) - 1;
+        if (pageNo >= raster->pageCount)
+            break;
+
+        soPdfRasterPage *rasterPage = &raster->pages[pageNo];
+        rasterPage->error = renderPage(&file, gc, pageNo, 
+            raster->pageRects + pageNo * MAX_SPLIT_RECTS, rasterPage);
+        pdf_trimcache(file.xref);
+
+        InterlockedExchange(&rasterPage->done, 1);
+        SetEvent(raster->hPageDone);
+    }
+
+    // Let the next thread see the end too
+    ReleaseSemaphore(raster->hWindow, 1, NULL);
+
+    fz_droprenderer(gc);
+    closePdfFile(&file);
+
+    // hand the objects this thread freed back to the shared pools
+    fz_flushpool();
+    return 0;
+}
+
+//
+// Add a rendered rect to the output as a page with a single image
+//
+fz_error*
+writeBitmapPage(
+    pdf_xref*       xref,
+    pdf_writer*     writer,
+    soPdfBitmap*    bitmap,
+    fz_obj*         pageTreeRef,
+    fz_obj**        pageRefp
+    )
+{
+    fz_error    *error;
+    fz_obj      *obj;
+    fz_buffer   *contents;
+    char        buf[128];
+    int         imgNum, imgGen, stmNum, stmGen, pageNum, pageGen;
+
+    //
+    // The image
+    error = pdf_allocobject(xref, &imgNum, &imgGen);
+    if (error)
+        return fz_rethrow(error, "cannot allocate bitmap");
+
+    if (p_rasterBits == 1)
+        error = fz_packobj(&obj, "<</Type/XObject/Subtype/Image/Width %i/Height %i"
+            "/ColorSpace/DeviceGray/BitsPerComponent 1/Filter/CCITTFaxDecode"
+            "/DecodeParms<</K 0/Columns %i/Rows %i>>/Length %i>>",
+            bitmap->width, bitmap->height, bitmap->width, bitmap->height,
+            (int)(bitmap->data->wp - bitmap->data->rp));
+    else
+        error = fz_packobj(&obj, "<</Type/XObject/Subtype/Image/Width %i/Height %i"
+            "/ColorSpace/DeviceGray/BitsPerComponent 8/Filter/FlateDecode/Length %i>>",
+            bitmap->width, bitmap->height, (int)(bitmap->data->wp - bitmap->data->rp));
+    if (error)
+        return fz_rethrow(error, "cannot create bitmap dictionary");
+
+    error = pdf_updateobject(xref, imgNum, imgGen, obj);
+    fz_dropobj(obj);
+    if (! error)
+        error = pdf_updatestream(xref, imgNum, imgGen, bitmap->data);
+    if (error)
+        return fz_rethrow(error, "cannot store bitmap");
+
+    //
+    // The contents that draw it over the whole page
+    error = pdf_allocobject(xref, &stmNum, &stmGen);
+    if (error)
+        return fz_rethrow(error, "cannot allocate page contents");
+
+    sprintf(buf, "q %d 0 0 %d 0 0 cm /Im0 Do Q", bitmap->width, bitmap->height);
+    error = fz_newbuffer(&contents, strlen(buf));
+    if (error)
+        return fz_rethrow(error, "cannot create page contents");
+    memcpy(contents->wp, buf, strlen(buf));
+    contents->wp += strlen(buf);
+
+    error = fz_packobj(&obj, "<</Length %i>>", (int)strlen(buf));
+    if (! error)
+    {
+        error = pdf_updateobject(xref, stmNum, stmGen, obj);
+        fz_dropobj(obj);
+    }
+    if (! error)
+        error = pdf_updatestream(xref, stmNum, stmGen, contents);
+    fz_dropbuffer(contents);
+    if (error)
+        return fz_rethrow(error, "cannot store page contents");
+
+    //
+    // And the page
+    error = pdf_allocobject(xref, &pageNum, &pageGen);
+    if (error)
+        return fz_rethrow(error, "cannot allocate page");
+
+    error = fz_packobj(&obj, "<</Type/Page/Parent %o/MediaBox[0 0 %i %i]"
+        "/Resources<</XObject<</Im0 %r>>>>/Contents %r>>",
+        pageTreeRef, bitmap->width, bitmap->height, 
+        imgNum, imgGen, stmNum, stmGen);
+    if (error)
+        return fz_rethrow(error, "cannot create page");
+
+    error = pdf_updateobject(xref, pageNum, pageGen, obj);
+    fz_dropobj(obj);
+    if (error)
+        return fz_rethrow(error, "cannot store page");
+
+    error = pdf_writeobject(writer, imgNum, imgGen);
+    if (! error)
+        error = pdf_writeobject(writer, stmNum, stmGen);
+    if (! error)
+        error = pdf_writeobject(writer, pageNum, pageGen);
+    if (error)
+        return fz_rethrow(error, "cannot write page");
+
+    error = fz_newindirect(pageRefp, pageNum, pageGen);
+    if (error)
+        return fz_rethrow(error, "cannot create page reference");
+
+    return NULL;
+}
+
+//
+// Render all the split pages and write them to the output
+//
+fz_error*
+rasterPdfFile(
+    soPdfFile*      inFile,
+    soPdfFile*      outFile,
+    pdf_writer*     writer,
+    fz_rect*        pageRects,
+    fz_obj*         pageTreeRef,
+    fz_obj*         results
+    )
+{
+    fz_error        *error = NULL;
+    soPdfRaster     raster;
+    HANDLE          hThreads[MAXIMUM_WAIT_OBJECTS];
+    int             threadCount, ctr;
+
+    memset(&raster, 0, sizeof(raster));
+    raster.inFile = inFile;
+    raster.pageRects = pageRects;
+    raster.pageCount = pdf_getpagecount(inFile->pageTree);
+    raster.pages = (soPdfRasterPage*)fz_malloc(
+        MAX(raster.pageCount, 1) * sizeof(soPdfRasterPage));
+    if (! raster.pages)
+        return fz_throw("cannot allocate raster pages");
+    memset(raster.pages, 0, MAX(raster.pageCount, 1) * sizeof(soPdfRasterPage));
+
+    threadCount = MAX(MIN(p_threads, raster.pageCount), 1);
+
+    //
+    // One glyph cache for all threads, as big as their own caches were
+    error = fz_newglyphcache(&raster.glyphCache, 
+        threadCount * 1024 * 512 / 24, threadCount * 1024 * 512);
+    if (error)
+        goto Cleanup;
+
+    raster.hWindow = CreateSemaphore(NULL, threadCount * 2, threadCount * 2, NULL);
+    raster.hPageDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if ((raster.hWindow == NULL) || (raster.hPageDone == NULL))
+    {
+        error = fz_throw("cannot create raster events");
+        goto Cleanup;
+    }
+
+    for (ctr = 0; ctr < threadCount; ctr++)
+    {
+        hThreads[ctr] = (HANDLE)_beginthreadex(NULL, 0, 
+            rasterPagesThread, &raster, 0, NULL);
+        if (hThreads[ctr] == 0)
+            break;
+    }
+    threadCount = ctr;
+    if (threadCount == 0)
+        error = fz_throw("cannot create raster thread");
+
+    printf("\nRendering output page : ");
+
+    //
+    // Write the pages out in order as they are rendered
+    for (int pageNo = 0; (error == NULL) && (pageNo < raster.pageCount); pageNo++)
+    {
+        soPdfRasterPage *rasterPage = &raster.pages[pageNo];
+
+        displayPageNumber(pageNo + 1, !pageNo);
+
+        while (! rasterPage->done && ! raster.failed)
+            WaitForSingleObject(raster.hPageDone, 250);
+
+        if (! rasterPage->done)
+        {
+            if (raster.startError)
+            {
+                error = fz_rethrow(raster.startError, "cannot render page %d", pageNo + 1);
+                raster.startError = NULL;
+            }
+            else
+                error = fz_throw("cannot render page %d", pageNo + 1);
+            break;
+        }
+
+        if (rasterPage->error)
+        {
+            error = rasterPage->error;
+            rasterPage->error = NULL;
+            break;
+        }
+
+        for (ctr = 0; ctr < rasterPage->bitmapCount; ctr++)
+        {
+            fz_obj *pageRef;
+
+            error = writeBitmapPage(outFile->xref, writer, 
+                &rasterPage->bitmaps[ctr], pageTreeRef, &pageRef);
+            if (error)
+                break;
+
+            error = fz_arraypush(results, pageRef);
+            fz_dropobj(pageRef);
+            if (error)
+                break;
+
+            fz_dropbuffer(rasterPage->bitmaps[ctr].data);
+            rasterPage->bitmaps[ctr].data = NULL;
+        }
+
+        ReleaseSemaphore(raster.hWindow, 1, NULL);
+    }
+
+    //
+    // Stop the threads that are still going
+    InterlockedExchange(&raster.failed, 1);
+    ReleaseSemaphore(raster.hWindow, threadCount, NULL);
+    if (threadCount > 0)
+    {
+        WaitForMultipleObjects(threadCount, hThreads, TRUE, INFINITE);
+        for (ctr = 0; ctr < threadCount; ctr++)
+            CloseHandle(hThreads[ctr]);
+    }
+
+Cleanup:
+    for (int pageNo = 0; pageNo < raster.pageCount; pageNo++)
+    {
+        soPdfRasterPage *rasterPage = &raster.pages[pageNo];
+        for (ctr = 0; ctr < rasterPage->bitmapCount; ctr++)
+            if (rasterPage->bitmaps[ctr].data)
+                fz_dropbuffer(rasterPage->bitmaps[ctr].data);
+        if (rasterPage->error)
+            fz_droperror(rasterPage->error);
+    }
+    if (raster.startError)
+        fz_droperror(raster.startError);
+
+    if (raster.hWindow)
+        CloseHandle(raster.hWindow);
+    if (raster.hPageDone)
+        CloseHandle(raster.hPageDone);
+    if (raster.glyphCache)
+        fz_dropglyphcache(raster.glyphCache);
+    fz_free(raster.pages);
+
+    return error;
+}
+
+
+int
+copyPdfFile(
+    soPdfFile* inFile,
+    soPdfFile* outFile
+    )
+{
+    fz_error    *error;
+    int         pageTreeNum, pageTreeGen;
+    int         pageCount, retCode;
+    fz_rect     *pageRects;
+    fz_obj      *results;
+    fz_obj      *pageTreeRef;
+    pdf_remap   *remap;
+    pdf_writer  *writer;
+    char        *doneImages;
+    int         doneCount;
+
+    assert(inFile != NULL);
+    assert(outFile != NULL);
+
+    //
+    // Work out how every page in the source file is split
+    //
+    pageCount = pdf_getpagecount(inFile->pageTree);
+    pageRects = (fz_rect*)fz_malloc(MAX(pageCount, 1) * MAX_SPLIT_RECTS * sizeof(fz_rect));
+    if (! pageRects)
+        return soPdfError(fz_throw("cannot allocate page split rects"));
+
+    retCode = analyzePdfFile(inFile, pageRects);
+    if (retCode != 0)
+    {
+        fz_free(pageRects);
+        return retCode;
+    }
+
+    //
+    // The split pages are transplanted into the destination one source
+    // page at a time. The remap table is kept across the calls so the
+    // resources shared between pages are only copied once. The streams
+    // are linked rather than loaded, they are read from the input file
+    // when the output is saved, so the input must stay open until then.
+    //
+    error = pdf_newremap(&remap, 1);
+    if (error)
+        return soPdfError(error);
+
+    // The source images that have been downsampled, or left alone
+    doneCount = inFile->xref->len;
+    doneImages = (char*)fz_malloc(MAX(doneCount, 1));
+    if (! doneImages)
+        return soPdfError(fz_throw("cannot allocate image table"));
+    memset(doneImages, 0, MAX(doneCount, 1));
+
+    error = fz_newarray(&results, MAX(pageCount, 1));
+    if (error)
+        return soPdfError(error);
+
+    //
+    // The output is written while the pages are copied. Every page is
+    // written out as soon as it has been transplanted, so the page tree
+    // object is allocated up front for the back-links of the pages.
+    //
+    error = pdf_allocobject(outFile->xref, &pageTreeNum, &pageTreeGen);
+    if (error)
+        return soPdfError(error);
+
+    error = fz_newindirect(&pageTreeRef, pageTreeNum, pageTreeGen);
+    if (error)
+        return soPdfError(error);
+
+    error = pdf_openwriter(&writer, outFile->xref, outFile->fileName, NULL, p_compressObjects);
+    if (error)
+        return soPdfError(error);
+
+    //
+    // Process every page in the source file, or render them all
+    //
+    if (p_rasterBits)
+    {
+        error = rasterPdfFile(inFile, outFile, writer, pageRects, pageTreeRef, results);
+        if (error)
+            return soPdfError(error);
+
+        fz_free(pageRects);
+        fz_free(doneImages);
+        pdf_dropremap(remap);
+    }
+    else
+    {
+        printf("\nCopying output page : ");
+
+        for (int pageNo = 0; pageNo < pageCount; pageNo++)
+        {
+            // Get the page object from the source
+            fz_obj  *pageObj = pdf_getpageobject(inFile->pageTree, pageNo);
+            fz_rect *bbRect = pageRects + pageNo * MAX_SPLIT_RECTS;
+            int     firstObj = fz_arraylen(outFile->editobjs);
+            int     firstOutObj = outFile->xref->len;
+            fz_obj  *chunk, *chunkResults;
+            pdf_measure *pageMeasure = NULL;
+            fz_buffer   *pageContents = NULL;
+
+            displayPageNumber(pageNo + 1, !pageNo);
+
+            if (pageObj == NULL)
+                return soPdfError(fz_throw("cannot find page object %d", pageNo + 1));
+
+            // Record where everything on the page is drawn, a page
+            // that cannot be measured is copied whole
+            if (p_pruneContent || p_downsampleImages)
+            {
+                if (p_pruneContent)
+                    error = pdf_measurepageops(&pageMeasure, &pageContents, 
+                        inFile->xref, pageObj);
+                else
+                    error = pdf_measurepage(&pageMeasure, inFile->xref, pageObj);
+                if (error)
+                {
+                    fz_droperror(error);
+                    pageMeasure = NULL;
+                    pageContents = NULL;
+                }
+            }
+
+            // Shrink the images to what the screen can show of them.
+            // The landscape modes turn the page on its side
+            if (pageMeasure && p_downsampleImages)
+            {
+                bool rotated = (p_mode == FitWidth) || (p_mode == Fit2xWidth) ||
+                    ((pageMeasure->rotate % 180) != 0);
+
+                error = downsampleImages(inFile->xref, pageMeasure, bbRect, 
+                    MAX_SPLIT_RECTS, rotated, doneImages, doneCount);
+                if (error)
+                    return soPdfError(error);
+            }
+
+            for (int ctr = 0; ctr < MAX_SPLIT_RECTS; ctr++)
+            {
+                // Check if this was a blank page
+                if (fz_isemptyrect(bbRect[ctr]))
+                    break;
+
+                //
+                // copy the source page dictionary entry. The way this is done is basically
+                // by making a copy of the page dict object in the source file, and adding
+                // the copy in the source file. Then the copied page dict object is 
+                // referenced and added to the destination file.
+                //
+                // This convoluted procedure is done because the copy is done by pdf_transplant
+                // function that accepts a source and destination. Whatever is referenced by
+                // destination object is deep copied
+                //
+                
+
+                // allocate an object id and generation id in source file
+                //
+                // There is a bug in mupdf where the object allocation returns
+                // 0 oid and 0 gid when the input pdf file has iref stream
+                // so to work around the issue, we wrap the pdf_allocojbect
+                // in a for loop 10 times to get the number
+                //
+                int sNum, sGen, tries;
+
+                for (tries = 0; tries < 10; tries++)
+                {
+                    error = pdf_allocobject(inFile->xref, &sNum, &sGen);
+                    if (error)
+                        return soPdfError(error);
+
+                    // If sNum is non zero then the allocation was successful
+                    if (sNum != 0)
+                        break;  
+                    pdf_updateobject(inFile->xref, sNum, sGen, pageObj);
+                }
+
+                // If we didn't succeed even after 10 tries then this file 
+                // is not going to work.
+                if (tries >= 10)
+                    return soPdfError(fz_throw("cannot allocate object because of mupdf bug"));
+
+                // make a deep copy of the original page dict
+                fz_obj  *pageObj2;
+                error = fz_deepcopydict(&pageObj2, pageObj);
+                if (error)
+                    return soPdfError(error);
+
+                // update the source file with the duplicate page object
+                pdf_updateobject(inFile->xref, sNum, sGen, pageObj2);
+
+                fz_dropobj(pageObj2);
+
+                // create an indirect reference to the page object
+                fz_obj  *pageRef2;
+                error = fz_newindirect(&pageRef2, sNum, sGen);
+                if (error)
+                    return soPdfError(error);
+
+                // delete the parent dictionary entry
+                // Do we need to delete any other dictionary entry 
+                // like annot, tabs, metadata, etc
+                fz_dictdels(pageObj2, "Parent");
+
+                // Set the media box
+                setPageMediaBox(inFile->xref, pageObj2, bbRect[ctr]);
+
+                // Set the rotation based on input
+                switch(p_mode)
+                {
+                    // no rotation if fit height
+                case FitHeight:
+                case Fit2xHeight:
+                    break;
+
+                    // rotate -90 deg if fit width
+                case Fit2xWidth:
+                case FitWidth:
+                    setPageRotate(pageObj2, p_reverseLandscape ? 90 : -90);
+                    break;
+
+                case SmartFitHeight:
+                case SmartFitWidth:
+                default:
+                    return soPdfError(fz_throw("Mode(%d) not yet implemented.", p_mode));
+                    break;
+                }
+
+                // Drop what is drawn outside the new media box
+                if (pageContents)
+                {
+                    error = prunePage(inFile->xref, pageObj2, 
+                        pageMeasure, pageContents, bbRect[ctr]);
+                    if (error)
+                        return soPdfError(error);
+                }
+
+                // push the indirect reference to the destination list for copy by pdf_transplant
+                error = fz_arraypush(outFile->editobjs, pageRef2);
+                if (error)
+                    return soPdfError(error);
+            }
+
+            if (pageMeasure)
+                pdf_dropmeasure(pageMeasure);
+            if (pageContents)
+                fz_dropbuffer(pageContents);
+
+            // flush the split pages of this source page into destination
+            error = fz_newarray(&chunk, MAX_SPLIT_RECTS);
+            if (error)
+                return soPdfError(error);
+
+            for (int ctr = firstObj; ctr < fz_arraylen(outFile->editobjs); ctr++)
+            {
+                error = fz_arraypush(chunk, fz_arrayget(outFile->editobjs, ctr));
+                if (error)
+                    return soPdfError(error);
+            }
+
+            error = pdf_transplantmap(outFile->xref, inFile->xref, remap, &chunkResults, chunk);
+            fz_dropobj(chunk);
+            if (error)
+                return soPdfError(error);
+
+            for (int ctr = 0; ctr < fz_arraylen(chunkResults); ctr++)
+            {
+                fz_obj  *pageRef = fz_arrayget(chunkResults, ctr);
+                fz_obj  *outPageObj;
+
+                // Update the parent entry in the page dictionary
+                error = pdf_loadindirect(&outPageObj, outFile->xref, pageRef);
+                if (error)
+                    return soPdfError(error);
+
+                error = fz_dictputs(outPageObj, "Parent", pageTreeRef);
+                fz_dropobj(outPageObj);
+                if (error)
+                    return soPdfError(error);
+
+                error = fz_arraypush(results, pageRef);
+                if (error)
+                    return soPdfError(error);
+            }
+
+            fz_dropobj(chunkResults);
+
+            // re-encode the weakly compressed streams this page added
+            if (p_recompressStreams)
+            {
+                error = recompressStreams(outFile->xref, firstOutObj, outFile->xref->len);
+                if (error)
+                    return soPdfError(error);
+            }
+
+            // write out and drop everything this page added to the output
+            for (int oid = firstOutObj; oid < outFile->xref->len; oid++)
+            {
+                error = pdf_writeobject(writer, oid, outFile->xref->table[oid].gen);
+                if (error)
+                    return soPdfError(error);
+            }
+
+            // nothing from the input is borrowed between pages
+            pdf_trimcache(inFile->xref);
+        }
+
+        fz_free(pageRects);
+        fz_free(doneImages);
+        pdf_dropremap(remap);
+    }
+
+    // add the copied pages to the destination page list
+    {
+        int         outPages;
+
+        outPages = fz_arraylen(results);
+        for (int ctr = 0; ctr < outPages; ctr++)
+        {
+            error = fz_arraypush(outFile->pagelist, fz_arrayget(results, 
+                p_reverseLandscape ? outPages - 1 - ctr : ctr));
+            if (error)
+                return soPdfError(error);
+        }
+
+        fz_dropobj(results);
+    }
+
+    // flush page tree
+
+    // Create page tree, the pages already link back to it
+    {
+        fz_obj  *pageTreeObj;
+
+        // Create a page tree object
+        error = fz_packobj(&pageTreeObj, "<</Type/Pages/Count %i/Kids %o>>",
+            fz_arraylen(outFile->pagelist), outFile->pagelist);
+        if (error)
+            return soPdfError(error);
+
+        // Update the xref entry with the pageTree object
+        pdf_updateobject(outFile->xref, pageTreeNum, pageTreeGen, pageTreeObj);
+
+        fz_dropobj(pageTreeObj);
+        fz_dropobj(pageTreeRef);
+    }
+
+    // Create catalog and root entries
+    {
+        fz_obj  *catObj, *infoObj;
+        int     rootNum, rootGen;
+        int     infoNum, infoGen;
+
+        //
+        // Copy the info catalog to the destination
 
         // alloc an object id and gen id in destination file
         error = pdf_allocobject(outFile->xref, &infoNum, &infoGen);
@@ -858,7 +2304,7 @@ copyPdfFile(
     if (error)
         return soPdfError(error);
 
-    error = pdf_savexref(outFile->xref, outFile->fileName, NULL);
+    error = pdf_closewriter(writer);
     if (error)
         return soPdfError(error);
 
@@ -868,6 +2314,12 @@ copyPdfFile(
         for (int ctr = g_errorCount - 1; ctr >= 0; ctr--)
             soPdfError(g_errorList[ctr]);
     }
+    if (p_cacheLimit)
+    {
+        pdf_objcache *cache = &inFile->xref->cache;
+        printf("\nObject cache : %d hits, %d misses, %d evictions\n",
+            cache->hits, cache->misses, cache->evictions);
+    }
     printf("\nSaved.\n");
 
     return 0;
@@ -885,6 +2337,14 @@ processPdfFile(
     assert(inFile != NULL);
     assert(outFile != NULL);
 
+    InitializeCriticalSection(&g_errorLock);
+
+    // The worker threads of every stage share the freetype library and
+    // the object pools, so the locks are in place for the whole run
+    for (int ctr = 0; ctr < FZ_LOCK_MAX; ctr++)
+        InitializeCriticalSection(&g_locks.cs[ctr]);
+    fz_setlockcontext(&g_locks.super);
+
     // Open the input file
     retCode = openPdfFile(inFile);
     if (retCode != 0)
@@ -905,5 +2365,11 @@ Cleanup:
     closePdfFile(inFile);
     closePdfFile(outFile);
 
+    fz_setlockcontext(NULL);
+    for (int ctr = 0; ctr < FZ_LOCK_MAX; ctr++)
+        DeleteCriticalSection(&g_locks.cs[ctr]);
+
+    DeleteCriticalSection(&g_errorLock);
+
     return retCode;
 }
\ No newline at end of file
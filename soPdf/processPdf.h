@@ -15,7 +15,6 @@ typedef struct _soPdfFile
     pdf_xref        *xref;
     pdf_pagetree    *pageTree;
     pdf_page        *page;
-    pdf_outline     *outline;
 
     // for editing
     fz_obj          *pagelist;
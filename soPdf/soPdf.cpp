@@ -13,6 +13,13 @@ bool    p_reverseLandscape = false;
 bool    p_cropWhiteSpace = true;
 double  p_overlap = 2;
 EMode   p_mode = Fit2xWidth;
+int     p_threads = 1;
+bool    p_compressObjects = false;
+bool    p_recompressStreams = false;
+bool    p_pruneContent = false;
+bool    p_downsampleImages = false;
+int     p_rasterBits = 0;
+int     p_cacheLimit = 0;
 
 // Pdf files
 soPdfFile   inPdfFile;
@@ -145,6 +152,16 @@ soPdfUsage(void)
         "   -s subject      set the subject\n"
         "   -e              proceed with errors\n"
         "   -r              reverse landscape\n"
+        "   -j nn           number of threads analysing pages\n"
+        "                       nn = 1 thread *\n"
+        "   -z              compress objects (needs pdf 1.5 reader)\n"
+        "   -f              re-encode weakly compressed streams with flate\n"
+        "   -x              drop drawing outside of each output page\n"
+        "   -d              shrink images to the screen size and make them gray\n"
+        "   -g nn           render the output pages to gray images\n"
+        "                       nn = 8 bits per pixel, 1 = black and white\n"
+        "   -k nn           megabytes of parsed input objects to keep\n"
+        "                       nn = 0 keep everything *\n"
         "\n"
         "   * = default values\n");
 
@@ -164,7 +181,7 @@ _tmain(int argc, _TCHAR* argv[])
 
 
     // parse the command line arguments
-    while ((c = getopt(argc, argv, "i:p:o:t:a:b:c:s:ewm:v:r")) != -1)
+    while ((c = getopt(argc, argv, "i:p:o:t:a:b:c:s:ewm:v:rj:zfxdg:k:")) != -1)
     {
         switch(c)
         {
@@ -183,6 +200,13 @@ _tmain(int argc, _TCHAR* argv[])
         case 'm':   p_mode = (EMode)atoi(optarg);           break;
         case 'v':   p_overlap = atof(optarg);               break;
         case 'r':   p_reverseLandscape = true;              break;
+        case 'j':   p_threads = atoi(optarg);               break;
+        case 'z':   p_compressObjects = true;               break;
+        case 'f':   p_recompressStreams = true;             break;
+        case 'x':   p_pruneContent = true;                  break;
+        case 'd':   p_downsampleImages = true;              break;
+        case 'g':   p_rasterBits = atoi(optarg);            break;
+        case 'k':   p_cacheLimit = atoi(optarg);            break;
         default:    return soPdfUsage();                    break;
         }
     }
@@ -204,11 +228,32 @@ _tmain(int argc, _TCHAR* argv[])
            (p_mode == SmartFitWidth)))
         p_reverseLandscape = false;
 
+    // Keep the thread count sane. The waits are limited to
+    // MAXIMUM_WAIT_OBJECTS handles
+    if (p_threads < 1)
+        p_threads = 1;
+    if (p_threads > MAXIMUM_WAIT_OBJECTS)
+        p_threads = MAXIMUM_WAIT_OBJECTS;
+
+    // Only black and white or 8 bit gray images are written
+    if ((p_rasterBits != 0) && (p_rasterBits != 1))
+        p_rasterBits = 8;
+
+    // The cache limit is kept in bytes in an int
+    if (p_cacheLimit < 0)
+        p_cacheLimit = 0;
+    else if (p_cacheLimit > 2047)
+        p_cacheLimit = 2047;
+
     printf("\nsoPdf ver " SO_PDF_VER "\n");
     printf("\tA program to reformat pdf file for sony reader\n");
     printf("\nInput : %s\n", inPdfFile.fileName);
     printf("Output: %s\n\n", outPdfFile.fileName);
 
+    // Pick the compositing routines for this cpu before any rendering
+    fz_cpudetect();
+    fz_accelerate();
+
     return processPdfFile(&inPdfFile, &outPdfFile);
 }
 
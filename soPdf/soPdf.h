@@ -18,6 +18,17 @@ extern bool     p_cropWhiteSpace;
 extern double   p_overlap;
 extern EMode    p_mode;
 extern bool     p_proceedWithErrors;
+extern int      p_threads;
+extern bool     p_compressObjects;
+extern bool     p_recompressStreams;
+extern bool     p_pruneContent;
+extern bool     p_downsampleImages;
+extern int      p_rasterBits;
+extern int      p_cacheLimit;
+
+// The reader screen, images are not kept any larger than it can show
+#define SCREEN_WIDTH    600
+#define SCREEN_HEIGHT   800
 
 #define SO_PDF_VER  "0.1 alpha Rev 12"
 
@@ -12,6 +12,7 @@
 #include <assert.h>
 #include <string.h>
 #include <time.h>
+#include <process.h>
 
 
 #include <fitz.h>